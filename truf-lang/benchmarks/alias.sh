@@ -0,0 +1,38 @@
+#!/bin/bash
+# What the loop vectorizer did with each kernel, with and without the alias
+# information code gen gives LLVM (`-fno-alias-info`), and how long the kernels
+# take. Without `!tbaa` a store to a `float[]` parameter may change an `int[]`
+# parameter, so vectorized loops first check at run time that the arrays
+# don't overlap.
+#
+# Usage: ./benchmarks/alias.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/alias
+REMARKS="-Rpass=loop-vectorize -Rpass-missed=loop-vectorize -Rpass-analysis=loop-vectorize"
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/alias/*.tr "$BENCH_DIR"/arrays/*.tr "$BENCH_DIR"/narrow/*.tr; do
+    name=$(basename "$src" .tr)
+
+    for mode in alias-info no-alias-info; do
+        flags=""
+        if [ "$mode" = no-alias-info ]; then
+            flags="-fno-alias-info"
+        fi
+        echo "== $name ($mode)"
+        "$COMPILER" "$OPT_LEVEL" $flags $REMARKS "$src" "$OUT_DIR/${name}_$mode.o" 2>&1 > /dev/null | grep "remark:" || true
+        $CC "$OUT_DIR/${name}_$mode.o" "$RUNTIME" -o "$OUT_DIR/${name}_$mode" -pie -lpthread
+    done
+
+    for mode in alias-info no-alias-info; do
+        echo "== $name ($mode): $("$OUT_DIR/${name}_$mode")"
+        time "$OUT_DIR/${name}_$mode" > /dev/null
+    done
+done
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Heap use of allocation heavy programs with buffers freed at their last use
+# (AutoFree), with reference counting, and never freed at all. Every program
+# is also run once with -fcheck-memory, which fails on a leak or double free.
+#
+# Usage: ./benchmarks/autofree.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/autofree
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/alloc/*.tr; do
+    name=$(basename "$src" .tr)
+
+    "$COMPILER" "$OPT_LEVEL" "$src" "$OUT_DIR/${name}_autofree.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -frefcount "$src" "$OUT_DIR/${name}_refcount.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -fno-autofree "$src" "$OUT_DIR/${name}_leak.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -fcheck-memory "$src" "$OUT_DIR/${name}_check.o" > /dev/null
+
+    for variant in autofree refcount leak check; do
+        $CC "$OUT_DIR/${name}_$variant.o" "$RUNTIME" -o "$OUT_DIR/${name}_$variant" -pie -lpthread
+    done
+
+    # All of them have to print exactly the same thing
+    "$OUT_DIR/${name}_check" > "$OUT_DIR/${name}.expected"
+    for variant in autofree refcount leak; do
+        cmp "$OUT_DIR/${name}.expected" <("$OUT_DIR/${name}_$variant")
+    done
+
+    for variant in autofree refcount leak; do
+        echo "== $name ($variant)"
+        time TRUFFLE_ALLOC_STATS=1 "$OUT_DIR/${name}_$variant" > /dev/null
+    done
+done
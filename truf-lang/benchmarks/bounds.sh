@@ -0,0 +1,35 @@
+#!/bin/bash
+# Run time of numeric loops over arrays with the bounds checks that range
+# analysis proves redundant left out, against a check on every index
+# (-fno-bounds-check-elimination).
+#
+# Usage: ./benchmarks/bounds.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/bounds
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/arrays/*.tr; do
+    name=$(basename "$src" .tr)
+
+    "$COMPILER" "$OPT_LEVEL" "$src" "$OUT_DIR/${name}_eliminated.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -fno-bounds-check-elimination "$src" "$OUT_DIR/${name}_checked.o" > /dev/null
+
+    for variant in checked eliminated; do
+        $CC "$OUT_DIR/${name}_$variant.o" "$RUNTIME" -o "$OUT_DIR/${name}_$variant" -pie -lpthread
+    done
+
+    # Both have to print exactly the same thing
+    cmp <("$OUT_DIR/${name}_checked") <("$OUT_DIR/${name}_eliminated")
+
+    for variant in checked eliminated; do
+        echo "== $name ($variant)"
+        time "$OUT_DIR/${name}_$variant" > /dev/null
+    done
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Heap allocations and run time of allocation heavy programs with chains of
+# concatenations like `a + b + c` built in one buffer, and `s = s + ...`
+# appending in place, against one new buffer per `+` (-fno-concat-fusion).
+#
+# Usage: ./benchmarks/concat.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/concat
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/alloc/*.tr; do
+    name=$(basename "$src" .tr)
+
+    "$COMPILER" "$OPT_LEVEL" "$src" "$OUT_DIR/${name}_fused.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -fno-concat-fusion "$src" "$OUT_DIR/${name}_unfused.o" > /dev/null
+
+    for variant in unfused fused; do
+        $CC "$OUT_DIR/${name}_$variant.o" "$RUNTIME" -o "$OUT_DIR/${name}_$variant" -pie -lpthread
+    done
+
+    # Both have to print exactly the same thing
+    cmp <("$OUT_DIR/${name}_unfused") <("$OUT_DIR/${name}_fused")
+
+    for variant in unfused fused; do
+        echo "== $name ($variant)"
+        time TRUFFLE_ALLOC_STATS=1 "$OUT_DIR/${name}_$variant" > /dev/null
+    done
+done
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Heap allocations and run time of allocation heavy programs, built with
+# escape analysis (non-escaping buffers on the stack) and with every buffer on
+# the heap. The compiler's escape report is printed for each program.
+#
+# Usage: ./benchmarks/escape.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/alloc
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/alloc/*.tr; do
+    name=$(basename "$src" .tr)
+
+    echo "== $name (escape report)"
+    "$COMPILER" "$OPT_LEVEL" -fescape-report "$src" "$OUT_DIR/${name}_escape.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -fno-escape-analysis "$src" "$OUT_DIR/${name}_heap.o" > /dev/null
+
+    for variant in heap escape; do
+        $CC "$OUT_DIR/${name}_$variant.o" "$RUNTIME" -o "$OUT_DIR/${name}_$variant" -pie -lpthread
+    done
+
+    # Both have to print exactly the same thing
+    cmp <("$OUT_DIR/${name}_heap") <("$OUT_DIR/${name}_escape")
+
+    for variant in heap escape; do
+        echo "== $name ($variant)"
+        time TRUFFLE_ALLOC_STATS=1 "$OUT_DIR/${name}_$variant" > /dev/null
+    done
+done
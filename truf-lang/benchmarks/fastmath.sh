@@ -0,0 +1,33 @@
+#!/bin/bash
+# Run time of float reductions with strict IEEE math and with -ffast-math. A
+# strict sum has to add its elements one after another; with -ffast-math the
+# additions are reordered into vector lanes, and `a * b + s` becomes one FMA.
+# Both print the same sums here, since the elements are small multiples of 1/4.
+#
+# Usage: ./benchmarks/fastmath.sh [compiler] [opt-level] [-mcpu=...]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CPU=${3:--mcpu=native}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/fastmath
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/fastmath/*.tr; do
+    name=$(basename "$src" .tr)
+
+    "$COMPILER" "$OPT_LEVEL" "$CPU" "$src" "$OUT_DIR/${name}_strict.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" "$CPU" -ffast-math "$src" "$OUT_DIR/${name}_fast.o" > /dev/null
+    for kind in strict fast; do
+        $CC "$OUT_DIR/${name}_$kind.o" "$RUNTIME" -o "$OUT_DIR/${name}_$kind" -pie -lpthread
+    done
+
+    for kind in strict fast; do
+        echo "== $name ($kind): $("$OUT_DIR/${name}_$kind")"
+        time "$OUT_DIR/${name}_$kind" > /dev/null
+    done
+done
@@ -0,0 +1,50 @@
+"""
+Generates a large truffle program whose hot functions are scattered between
+thousands of functions that never run. Without a profile the hot code is spread
+over hundreds of pages, which is what `layout.sh` measures.
+
+Usage: python3 benchmarks/gen_large_program.py [output.tr] [num-functions] [num-hot]
+"""
+
+import random
+import sys
+
+
+def gen_function(name: str, rng: random.Random) -> str:
+    lines = [f"fn {name}(int x) int {{", f"    int a = x * {rng.randint(3, 97)} + {rng.randint(1, 1000)}"]
+    for _ in range(rng.randint(10, 16)):
+        m = rng.randint(3, 31)
+        c = rng.randint(1, 1000)
+        op = rng.choice(["+", "-", "*"])
+        lines.append(f"    if a % {m} == {rng.randint(0, m - 1)} {{")
+        lines.append(f"        a = (a {op} {c}) % 1000003")
+        lines.append("    } else {")
+        lines.append(f"        a = (a + x * {rng.randint(2, 50)}) % 1000003")
+        lines.append("    }")
+    lines.append("    return a")
+    lines.append("}")
+    return "\n".join(lines)
+
+
+def main():
+    out_path = sys.argv[1] if len(sys.argv) > 1 else "large_program.tr"
+    num_functions = int(sys.argv[2]) if len(sys.argv) > 2 else 3000
+    num_hot = int(sys.argv[3]) if len(sys.argv) > 3 else 64
+
+    rng = random.Random(1234)
+    hot = sorted(rng.sample(range(num_functions), num_hot))
+
+    parts = [gen_function(f"f_{i}", rng) for i in range(num_functions)]
+
+    main_lines = ["fn main() {", "    int acc = 1", "    int i = 0", "    while i < 300000 {"]
+    for i in hot:
+        main_lines.append(f"        acc = f_{i}(acc + i)")
+    main_lines += ["        i = i + 1", "    }", "    print(acc)", "}"]
+    parts.append("\n".join(main_lines))
+
+    with open(out_path, "w") as f:
+        f.write("\n\n".join(parts) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Run time of the same kernels without and with hints. `gather` reads a large
+# array at random indices; the hinted version prefetches the element it reads
+# 32 iterations later, so the cache miss overlaps with the work in between.
+#
+# Usage: ./benchmarks/hints.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/hints
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/hints/*_plain.tr; do
+    name=$(basename "$src" _plain.tr)
+
+    for kind in plain hinted; do
+        "$COMPILER" "$OPT_LEVEL" "$BENCH_DIR/hints/${name}_$kind.tr" "$OUT_DIR/${name}_$kind.o" > /dev/null
+        $CC "$OUT_DIR/${name}_$kind.o" "$RUNTIME" -o "$OUT_DIR/${name}_$kind" -pie -lpthread
+    done
+
+    for kind in plain hinted; do
+        echo "== $name ($kind): $("$OUT_DIR/${name}_$kind")"
+        time "$OUT_DIR/${name}_$kind" > /dev/null
+    done
+done
@@ -0,0 +1,58 @@
+#!/bin/bash
+# Measures how profile guided code layout (hot/cold sections, call-graph
+# ordering and hot/cold splitting) changes i-cache and iTLB misses on a large
+# generated program.
+#
+# Usage: ./benchmarks/layout.sh [compiler] [num-functions] [num-hot]
+#
+# The training run uses instrumentation (`$CC -fprofile-generate` links the LLVM
+# profile runtime, so CC has to be clang). With LAYOUT_PROFILE=sample it samples
+# the plain binary with `perf record` and converts that with `llvm-profgen`
+# instead. Miss counts need `perf`; without it only the run time is reported.
+set -e
+
+COMPILER=${1:-./main}
+NUM_FUNCTIONS=${2:-3000}
+NUM_HOT=${3:-64}
+CC=${CC:-clang}
+LAYOUT_PROFILE=${LAYOUT_PROFILE:-instr}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/layout
+SRC=$OUT_DIR/large_program.tr
+
+mkdir -p "$OUT_DIR"
+python3 "$BENCH_DIR/gen_large_program.py" "$SRC" "$NUM_FUNCTIONS" "$NUM_HOT"
+
+# build <name> <extra compiler flags...>
+build() {
+    local name=$1
+    shift
+    "$COMPILER" -O3 "$@" "$SRC" "$OUT_DIR/$name.o" > /dev/null
+}
+
+build base -gline-tables-only
+$CC "$OUT_DIR/base.o" "$RUNTIME" -o "$OUT_DIR/base" -pie -lpthread
+
+if [ "$LAYOUT_PROFILE" = "sample" ]; then
+    perf record -q -b -o "$OUT_DIR/perf.data" -- "$OUT_DIR/base" > /dev/null
+    llvm-profgen --binary="$OUT_DIR/base" --perfdata="$OUT_DIR/perf.data" --output="$OUT_DIR/large_program.prof"
+    build layout --profile-sample-use="$OUT_DIR/large_program.prof"
+else
+    build instr --profile-generate="$OUT_DIR/large_program-%p.profraw"
+    $CC -fprofile-generate "$OUT_DIR/instr.o" "$RUNTIME" -o "$OUT_DIR/instr" -pie -lpthread
+    rm -f "$OUT_DIR"/*.profraw
+    "$OUT_DIR/instr" > /dev/null
+    llvm-profdata merge "$OUT_DIR"/*.profraw -o "$OUT_DIR/large_program.profdata"
+    build layout --profile-use="$OUT_DIR/large_program.profdata"
+fi
+$CC "$OUT_DIR/layout.o" "$RUNTIME" -o "$OUT_DIR/layout" -pie -lpthread
+
+for name in base layout; do
+    echo "== large_program ($name)"
+    if command -v perf > /dev/null; then
+        perf stat -e iTLB-load-misses,L1-icache-load-misses,instructions -- "$OUT_DIR/$name" > /dev/null
+    else
+        time "$OUT_DIR/$name" > /dev/null
+    fi
+done
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Run time of the same kernels on `f32` and on `float` (f64) arrays. Twice
+# as many `f32`s fit in a vector register and in the cache, so the vectorized
+# loops should be up to twice as fast.
+#
+# Usage: ./benchmarks/narrow.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/narrow
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/narrow/*_float.tr; do
+    name=$(basename "$src" _float.tr)
+
+    for dtype in float f32; do
+        "$COMPILER" "$OPT_LEVEL" "$BENCH_DIR/narrow/${name}_$dtype.tr" "$OUT_DIR/${name}_$dtype.o" > /dev/null
+        $CC "$OUT_DIR/${name}_$dtype.o" "$RUNTIME" -o "$OUT_DIR/${name}_$dtype" -pie -lpthread
+    done
+
+    for dtype in float f32; do
+        echo "== $name ($dtype): $("$OUT_DIR/${name}_$dtype")"
+        time "$OUT_DIR/${name}_$dtype" > /dev/null
+    done
+done
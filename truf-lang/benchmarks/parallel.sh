@@ -0,0 +1,39 @@
+#!/bin/bash
+# Speedup of `parallel for` loops with the number of worker threads: a map
+# with uneven iterations (collatz_map) and a float sum (basel_reduce), and
+# plain loops that -fauto-parallel runs in parallel: a sum of calls
+# (collatz_auto), and short rows that it keeps on one thread because they
+# are too little work each (small_rows). Each program is run with
+# TRUFFLE_NUM_THREADS set to 1, 2, 4, ... up to the number of CPUs.
+#
+# Usage: ./benchmarks/parallel.sh [compiler] [opt-level] [max-threads]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+MAX_THREADS=${3:-$(nproc)}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/parallel
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/parallel/*.tr; do
+    name=$(basename "$src" .tr)
+    "$COMPILER" "$OPT_LEVEL" -fauto-parallel "$src" "$OUT_DIR/$name.o" > /dev/null
+    $CC "$OUT_DIR/$name.o" "$RUNTIME" -o "$OUT_DIR/$name" -pie -lpthread
+
+    echo "== $name: $(TRUFFLE_NUM_THREADS=1 "$OUT_DIR/$name")"
+    threads=1
+    while [ "$threads" -le "$MAX_THREADS" ]; do
+        start=$(date +%s%N)
+        TRUFFLE_NUM_THREADS=$threads "$OUT_DIR/$name" > /dev/null
+        elapsed=$(($(date +%s%N) - start))
+        if [ "$threads" -eq 1 ]; then
+            serial=$elapsed
+        fi
+        awk -v t="$threads" -v e="$elapsed" -v s="$serial" 'BEGIN { printf "%3d threads: %6.3fs  speedup %.2fx\n", t, e / 1e9, s / e }'
+        threads=$((threads * 2))
+    done
+done
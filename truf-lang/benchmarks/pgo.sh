@@ -0,0 +1,46 @@
+#!/bin/bash
+# Times a benchmark built without a profile against the same benchmark built
+# with the profile of a training run (instrumentation based PGO).
+#
+# Usage: ./benchmarks/pgo.sh [compiler] [benchmark] [opt-level]
+#
+# The instrumented binary is linked with `$CC -fprofile-generate`, which pulls in
+# the LLVM profile runtime (compiler-rt), so CC has to be clang.
+set -e
+
+COMPILER=${1:-./main}
+BENCH=${2:-skewed_dispatch}
+OPT_LEVEL=${3:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/pgo
+
+mkdir -p "$OUT_DIR"
+
+# build <name> <extra compiler flags...>
+build() {
+    local name=$1
+    shift
+    "$COMPILER" "$@" "$BENCH_DIR/$BENCH.tr" "$OUT_DIR/$name.ll" > /dev/null
+    opt "$OPT_LEVEL" "$OUT_DIR/$name.ll" -o "$OUT_DIR/$name.bc"
+    llc "$OPT_LEVEL" -filetype=obj -relocation-model=pic "$OUT_DIR/$name.bc" -o "$OUT_DIR/$name.o"
+}
+
+build base
+$CC "$OUT_DIR/base.o" "$RUNTIME" -o "$OUT_DIR/base" -pie -lpthread
+
+build instr --profile-generate="$OUT_DIR/$BENCH-%p.profraw"
+$CC -fprofile-generate "$OUT_DIR/instr.o" "$RUNTIME" -o "$OUT_DIR/instr" -pie -lpthread
+
+rm -f "$OUT_DIR"/*.profraw
+"$OUT_DIR/instr" > /dev/null
+llvm-profdata merge "$OUT_DIR"/*.profraw -o "$OUT_DIR/$BENCH.profdata"
+
+build pgo --profile-use="$OUT_DIR/$BENCH.profdata"
+$CC "$OUT_DIR/pgo.o" "$RUNTIME" -o "$OUT_DIR/pgo" -pie -lpthread
+
+echo "== $BENCH (no profile)"
+time "$OUT_DIR/base"
+echo "== $BENCH (profile guided)"
+time "$OUT_DIR/pgo"
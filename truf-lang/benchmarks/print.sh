@@ -0,0 +1,40 @@
+#!/bin/bash
+# Output throughput of the buffered print runtime against the printf based one,
+# and of fused prints (one write per run of consecutive prints) against one
+# runtime call per print. The runtime is linked in as an object file here, so
+# the compiler must not link its bitcode into the module.
+#
+# Usage: ./benchmarks/print.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+OUT_DIR=$BENCH_DIR/out/print
+
+mkdir -p "$OUT_DIR"
+
+cc -O2 -c "$BENCH_DIR/../runtime/truffle_rt.c" -o "$OUT_DIR/rt_buffered.o"
+cc -O2 -DTRUFFLE_RT_PRINTF -c "$BENCH_DIR/../runtime/truffle_rt.c" -o "$OUT_DIR/rt_printf.o"
+
+"$COMPILER" "$OPT_LEVEL" -fno-link-runtime -fno-print-fusion "$BENCH_DIR/print/print_throughput.tr" "$OUT_DIR/print_throughput.o" > /dev/null
+"$COMPILER" "$OPT_LEVEL" -fno-link-runtime "$BENCH_DIR/print/print_throughput.tr" "$OUT_DIR/print_throughput_fused.o" > /dev/null
+
+$CC "$OUT_DIR/print_throughput.o" "$OUT_DIR/rt_printf.o" -o "$OUT_DIR/print_printf" -pie -lpthread
+$CC "$OUT_DIR/print_throughput.o" "$OUT_DIR/rt_buffered.o" -o "$OUT_DIR/print_buffered" -pie -lpthread
+$CC "$OUT_DIR/print_throughput_fused.o" "$OUT_DIR/rt_buffered.o" -o "$OUT_DIR/print_fused" -pie -lpthread
+
+# All of them have to print exactly the same thing
+"$OUT_DIR/print_printf" > "$OUT_DIR/printf.txt"
+for variant in buffered fused; do
+    "$OUT_DIR/print_$variant" > "$OUT_DIR/$variant.txt"
+    cmp "$OUT_DIR/printf.txt" "$OUT_DIR/$variant.txt"
+done
+
+for variant in printf buffered fused; do
+    echo "== print_throughput ($variant, to /dev/null)"
+    time "$OUT_DIR/print_$variant" > /dev/null
+    echo "== print_throughput ($variant, to a pipe)"
+    time "$OUT_DIR/print_$variant" | cat > /dev/null
+done
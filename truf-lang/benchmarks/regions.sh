@@ -0,0 +1,35 @@
+#!/bin/bash
+# Heap allocations and run time of allocation heavy programs, built with
+# regions (loop temporaries are freed all at once at the end of each
+# iteration) and with every escaping buffer on the heap (-fno-regions).
+#
+# Usage: ./benchmarks/regions.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/regions
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/alloc/*.tr; do
+    name=$(basename "$src" .tr)
+
+    "$COMPILER" "$OPT_LEVEL" "$src" "$OUT_DIR/${name}_regions.o" > /dev/null
+    "$COMPILER" "$OPT_LEVEL" -fno-regions "$src" "$OUT_DIR/${name}_heap.o" > /dev/null
+
+    for variant in heap regions; do
+        $CC "$OUT_DIR/${name}_$variant.o" "$RUNTIME" -o "$OUT_DIR/${name}_$variant" -pie -lpthread
+    done
+
+    # Both have to print exactly the same thing
+    cmp <("$OUT_DIR/${name}_heap") <("$OUT_DIR/${name}_regions")
+
+    for variant in heap regions; do
+        echo "== $name ($variant)"
+        time TRUFFLE_ALLOC_STATS=1 "$OUT_DIR/${name}_$variant" > /dev/null
+    done
+done
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compiles every benchmark in this directory with the truffle compiler and times it.
+#
+# Usage: ./benchmarks/run.sh [compiler] [opt-level]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/*.tr; do
+    name=$(basename "$src" .tr)
+
+    "$COMPILER" "$src" "$OUT_DIR/$name.ll" > /dev/null
+    opt "$OPT_LEVEL" "$OUT_DIR/$name.ll" -o "$OUT_DIR/$name.bc"
+    llc "$OPT_LEVEL" -filetype=obj -relocation-model=pic "$OUT_DIR/$name.bc" -o "$OUT_DIR/$name.o"
+    $CC "$OUT_DIR/$name.o" "$RUNTIME" -o "$OUT_DIR/$name" -pie -lpthread
+
+    echo "== $name"
+    time "$OUT_DIR/$name"
+done
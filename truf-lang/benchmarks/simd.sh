@@ -0,0 +1,33 @@
+#!/bin/bash
+# Run time of the same kernels written with scalars and with explicit vectors.
+# The scalar `dot` can't be vectorized without reordering its float additions,
+# so it stays a scalar loop; the vector version adds up 8 lanes at a time.
+# `saxpy` has no such dependency, so LLVM vectorizes the scalar loop too and
+# the two should be close: explicit vectors pay off where it can't.
+#
+# Usage: ./benchmarks/simd.sh [compiler] [opt-level] [-mcpu=...]
+set -e
+
+COMPILER=${1:-./main}
+OPT_LEVEL=${2:--O3}
+CPU=${3:--mcpu=native}
+CC=${CC:-clang}
+BENCH_DIR=$(dirname "$0")
+RUNTIME=${RUNTIME:-$BENCH_DIR/../runtime/libtruffle_rt.a}
+OUT_DIR=$BENCH_DIR/out/simd
+
+mkdir -p "$OUT_DIR"
+
+for src in "$BENCH_DIR"/simd/*_scalar.tr; do
+    name=$(basename "$src" _scalar.tr)
+
+    for kind in scalar simd; do
+        "$COMPILER" "$OPT_LEVEL" "$CPU" "$BENCH_DIR/simd/${name}_$kind.tr" "$OUT_DIR/${name}_$kind.o" > /dev/null
+        $CC "$OUT_DIR/${name}_$kind.o" "$RUNTIME" -o "$OUT_DIR/${name}_$kind" -pie -lpthread
+    done
+
+    for kind in scalar simd; do
+        echo "== $name ($kind): $("$OUT_DIR/${name}_$kind")"
+        time "$OUT_DIR/${name}_$kind" > /dev/null
+    done
+done
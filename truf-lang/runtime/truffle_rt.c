@@ -0,0 +1,909 @@
+// Runtime support for compiled truffle programs.
+//
+// `print` writes into a thread-local buffer which is handed to the OS with a
+// single `write(2)` when it fills up, when `flush()` is called, when the thread
+// exits and when the process exits. Numbers are formatted by hand, so printing
+// never goes through stdio (no format string parsing and no stream locks).
+//
+// Runs of consecutive prints are fused by the compiler: it reserves space for
+// all of them at once with `__compiler_reserved_out_reserve`, copies the parts
+// it knows at compile time and formats the rest in place with the
+// `__compiler_reserved_format_*` functions, then calls
+// `__compiler_reserved_out_commit` once.
+//
+// The compiler links this file's bitcode (`make runtime/truffle_rt.bc`) into
+// every module it emits, so the runtime can be inlined into user code. Only
+// the functions a module actually calls are kept. `runtime/libtruffle_rt.a`
+// is the same code for modules compiled with `-fno-link-runtime`.
+//
+// Strings that may outlive the function that builds them are allocated with
+// `__compiler_reserved_alloc`, and the compiler frees each of them with
+// `__compiler_reserved_free` right after its last use (AutoFree). Run a
+// program with TRUFFLE_ALLOC_STATS set to get its heap allocations, peak
+// memory use and time spent in the allocator on stderr.
+//
+// Strings that die by the end of a loop iteration, or by the time the function
+// (or its caller) returns, are built in a region instead (see
+// `__compiler_reserved_region_alloc`), which is reset at the end of every
+// iteration and released when the function returns.
+//
+// Arrays are allocated with `__compiler_reserved_array_alloc`, which aligns
+// them to a cache line (`ARRAY_ALIGNMENT`), and freed like strings. Indexing
+// out of bounds calls `__compiler_reserved_bounds_fail`, which aborts.
+//
+// `parallel for` loops run on a pool of worker threads that steal ranges of
+// iterations from each other (see `__compiler_reserved_parallel_for`). Set
+// TRUFFLE_NUM_THREADS to change the number of workers, which defaults to the
+// number of CPUs.
+//
+// Build with -DTRUFFLE_RT_PRINTF to get the old printf based `print` instead
+// (used as the baseline of benchmarks/print.sh).
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+void __compiler_reserved_flush(void);
+
+static pthread_once_t alloc_stats_once = PTHREAD_ONCE_INIT;
+static bool alloc_stats_enabled;
+static uint64_t alloc_count;
+static uint64_t alloc_bytes;
+static uint64_t free_count;
+static uint64_t live_bytes;
+static uint64_t peak_live_bytes;
+static uint64_t alloc_nanos;
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static void print_alloc_stats(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "heap allocations: %lu (%lu bytes)\n",
+            __atomic_load_n(&alloc_count, __ATOMIC_RELAXED),
+            __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED));
+    fprintf(stderr, "heap frees: %lu, peak live heap: %lu bytes, peak RSS: %ld KiB\n",
+            __atomic_load_n(&free_count, __ATOMIC_RELAXED),
+            __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED),
+            usage.ru_maxrss);
+    fprintf(stderr, "allocator time: %.3f ms\n",
+            (double) __atomic_load_n(&alloc_nanos, __ATOMIC_RELAXED) / 1e6);
+}
+
+static void init_alloc_stats(void) {
+    alloc_stats_enabled = getenv("TRUFFLE_ALLOC_STATS") != NULL;
+    if (alloc_stats_enabled) {
+        atexit(print_alloc_stats);
+    }
+}
+
+static void count_alloc(size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+
+    uint64_t live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&peak_live_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void count_free(size_t size) {
+    __atomic_fetch_add(&free_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&live_bytes, size, __ATOMIC_RELAXED);
+}
+
+// Has to match `ARRAY_ALIGNMENT` in the compiler (src-cpp/code_gen.cpp)
+#define ARRAY_ALIGNMENT 64
+
+// `alignment` is a power of two, or 0 for whatever malloc gives
+static void* alloc_raw_aligned(size_t size, size_t alignment) {
+    pthread_once(&alloc_stats_once, init_alloc_stats);
+    uint64_t start = alloc_stats_enabled ? now_nanos() : 0;
+
+    void* ptr = alignment
+        ? aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1))
+        : malloc(size > 0 ? size : 1);
+    if (!ptr) {
+        fprintf(stderr, "out of memory (allocating %zu bytes)\n", size);
+        abort();
+    }
+
+    if (alloc_stats_enabled) {
+        __atomic_fetch_add(&alloc_nanos, now_nanos() - start, __ATOMIC_RELAXED);
+        count_alloc(size);
+    }
+    return ptr;
+}
+
+static void* alloc_raw(size_t size) {
+    return alloc_raw_aligned(size, 0);
+}
+
+static void free_raw(void* ptr, size_t size) {
+    if (!alloc_stats_enabled) {
+        free(ptr);
+        return;
+    }
+
+    uint64_t start = now_nanos();
+    free(ptr);
+    __atomic_fetch_add(&alloc_nanos, now_nanos() - start, __ATOMIC_RELAXED);
+    count_free(size);
+}
+
+void* __compiler_reserved_alloc(size_t size) {
+    return alloc_raw(size);
+}
+
+// Called by the compiler once the last owner of the buffer is dead (AutoFree).
+// `size` is the size it was allocated with.
+void __compiler_reserved_free(char* ptr, size_t size) {
+    free_raw(ptr, size);
+}
+
+// -fcheck-memory: every buffer is recorded with the line that allocated it. A
+// freed buffer is poisoned and kept, so its address can't be handed out again
+// and a second free of it is always caught. Buffers that are still live when
+// the program exits are reported as leaks and fail the program.
+
+struct CheckedBuffer {
+    char* ptr;
+    size_t size;
+    uint32_t alloc_line;
+    // 0 while the buffer is live
+    uint32_t free_line;
+};
+
+static pthread_mutex_t checked_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct CheckedBuffer* checked_buffers;
+static size_t checked_capacity;
+static size_t checked_count;
+
+static size_t checked_slot(struct CheckedBuffer* table, size_t capacity, char* ptr) {
+    size_t slot = (((uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15u) & (capacity - 1);
+    while (table[slot].ptr && table[slot].ptr != ptr) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+static void check_leaks(void) {
+    size_t leaked = 0;
+    size_t leaked_bytes = 0;
+    for (size_t i = 0; i < checked_capacity; i++) {
+        if (checked_buffers[i].ptr && checked_buffers[i].free_line == 0) {
+            leaked++;
+            leaked_bytes += checked_buffers[i].size;
+        }
+    }
+    if (leaked == 0) {
+        return;
+    }
+
+    __compiler_reserved_flush();
+    fprintf(stderr, "memory check: %zu buffers (%zu bytes) leaked\n", leaked, leaked_bytes);
+    size_t reported = 0;
+    for (size_t i = 0; i < checked_capacity && reported < 10; i++) {
+        if (checked_buffers[i].ptr && checked_buffers[i].free_line == 0) {
+            fprintf(stderr, "  %zu bytes allocated at line %u\n", checked_buffers[i].size, checked_buffers[i].alloc_line);
+            reported++;
+        }
+    }
+    _exit(1);
+}
+
+static void checked_error(const char* message, struct CheckedBuffer* buffer, uint32_t line) {
+    __compiler_reserved_flush();
+    fprintf(stderr, "memory check: %s at line %u", message, line);
+    if (buffer) {
+        fprintf(stderr, " (allocated at line %u, freed at line %u)", buffer->alloc_line, buffer->free_line);
+    }
+    fprintf(stderr, "\n");
+    abort();
+}
+
+static void* checked_record(char* ptr, size_t size, uint32_t line) {
+    pthread_mutex_lock(&checked_lock);
+    if (checked_buffers == NULL) {
+        atexit(check_leaks);
+    }
+    if (2 * (checked_count + 1) > checked_capacity) {
+        size_t capacity = checked_capacity ? 2 * checked_capacity : 1024;
+        struct CheckedBuffer* table = calloc(capacity, sizeof(struct CheckedBuffer));
+        if (!table) {
+            fprintf(stderr, "out of memory (memory check)\n");
+            abort();
+        }
+        for (size_t i = 0; i < checked_capacity; i++) {
+            if (checked_buffers[i].ptr) {
+                table[checked_slot(table, capacity, checked_buffers[i].ptr)] = checked_buffers[i];
+            }
+        }
+        free(checked_buffers);
+        checked_buffers = table;
+        checked_capacity = capacity;
+    }
+    checked_buffers[checked_slot(checked_buffers, checked_capacity, ptr)] = (struct CheckedBuffer) { ptr, size, line, 0 };
+    checked_count++;
+    pthread_mutex_unlock(&checked_lock);
+    return ptr;
+}
+
+void* __compiler_reserved_checked_alloc(size_t size, uint32_t line) {
+    return checked_record(alloc_raw(size), size, line);
+}
+
+void* __compiler_reserved_checked_array_alloc(size_t size, uint32_t line) {
+    return checked_record(alloc_raw_aligned(size, ARRAY_ALIGNMENT), size, line);
+}
+
+void __compiler_reserved_checked_free(char* ptr, size_t size, uint32_t line) {
+    pthread_mutex_lock(&checked_lock);
+    struct CheckedBuffer* buffer = NULL;
+    if (checked_capacity > 0) {
+        buffer = &checked_buffers[checked_slot(checked_buffers, checked_capacity, ptr)];
+    }
+
+    if (!buffer || buffer->ptr != ptr) {
+        checked_error("free of a buffer that was never allocated", NULL, line);
+    }
+    if (buffer->free_line != 0) {
+        checked_error("double free", buffer, line);
+    }
+    if (buffer->size != size) {
+        checked_error("free with the wrong size", buffer, line);
+    }
+    buffer->free_line = line > 0 ? line : UINT32_MAX;
+    pthread_mutex_unlock(&checked_lock);
+
+    memset(ptr, 0xdd, size);
+    if (alloc_stats_enabled) {
+        count_free(size);
+    }
+}
+
+// `size` > 0. Freed with `__compiler_reserved_free`.
+void* __compiler_reserved_array_alloc(size_t size) {
+    return alloc_raw_aligned(size, ARRAY_ALIGNMENT);
+}
+
+void __compiler_reserved_bounds_fail(int64_t index, int64_t length, uint32_t line) {
+    __compiler_reserved_flush();
+    fprintf(stderr, "index %lld out of bounds for length %lld at line %u\n", (long long) index, (long long) length, line);
+    abort();
+}
+
+void __compiler_reserved_array_length_fail(int64_t length, uint32_t line) {
+    __compiler_reserved_flush();
+    fprintf(stderr, "invalid array length %lld at line %u\n", (long long) length, line);
+    abort();
+}
+
+// Reference counted buffers (-frefcount), the baseline benchmarks/autofree.sh
+// compares AutoFree against. The count lives in a header in front of the data,
+// so their data (arrays too) is only aligned to 16 bytes.
+
+struct RcHeader {
+    uint64_t count;
+    uint64_t size;
+};
+
+void* __compiler_reserved_rc_alloc(size_t size) {
+    struct RcHeader* header = alloc_raw(sizeof(struct RcHeader) + size);
+    header->count = 1;
+    header->size = size;
+    return header + 1;
+}
+
+void __compiler_reserved_rc_retain(char* ptr) {
+    struct RcHeader* header = (struct RcHeader*) ptr - 1;
+    __atomic_fetch_add(&header->count, 1, __ATOMIC_RELAXED);
+}
+
+void __compiler_reserved_rc_release(char* ptr) {
+    struct RcHeader* header = (struct RcHeader*) ptr - 1;
+    if (__atomic_sub_fetch(&header->count, 1, __ATOMIC_ACQ_REL) == 0) {
+        free_raw(header, sizeof(struct RcHeader) + header->size);
+    }
+}
+
+// Regions hold buffers whose lifetime the compiler has bounded by a loop
+// iteration or a function call. Allocating is a pointer bump, and everything
+// is freed at once. The compiler keeps a region in a zeroed stack slot of the
+// same size as `struct Region`.
+#define REGION_MIN_CHUNK_SIZE (4 * 1024)
+
+struct RegionChunk {
+    struct RegionChunk* next;
+    size_t size;
+    char data[];
+};
+
+struct Region {
+    char* cur;
+    char* end;
+    struct RegionChunk* chunks;
+};
+
+static void* region_grow(struct Region* region, size_t size) {
+    size_t chunk_size = REGION_MIN_CHUNK_SIZE;
+    if (region->chunks && region->chunks->size * 2 > chunk_size) {
+        chunk_size = region->chunks->size * 2;
+    }
+    if (size > chunk_size) {
+        chunk_size = size;
+    }
+
+    struct RegionChunk* chunk = alloc_raw(sizeof(struct RegionChunk) + chunk_size);
+    chunk->next = region->chunks;
+    chunk->size = chunk_size;
+    region->chunks = chunk;
+    region->cur = chunk->data + size;
+    region->end = chunk->data + chunk_size;
+    return chunk->data;
+}
+
+static void region_free_chunks(struct Region* region) {
+    struct RegionChunk* chunk = region->chunks;
+    while (chunk) {
+        struct RegionChunk* next = chunk->next;
+        free_raw(chunk, sizeof(struct RegionChunk) + chunk->size);
+        chunk = next;
+    }
+    region->chunks = NULL;
+}
+
+void* __compiler_reserved_region_alloc(void* r, size_t size) {
+    struct Region* region = r;
+    size = (size + 7) & ~(size_t) 7;
+    if ((size_t) (region->end - region->cur) >= size) {
+        char* ptr = region->cur;
+        region->cur += size;
+        return ptr;
+    }
+    return region_grow(region, size);
+}
+
+// Called at the end of every loop iteration. If the iteration needed more than
+// one chunk they are replaced by a single one that is large enough for all of
+// them, so a loop stops allocating after its first few iterations.
+void __compiler_reserved_region_reset(void* r) {
+    struct Region* region = r;
+    struct RegionChunk* chunk = region->chunks;
+    if (!chunk) {
+        return;
+    }
+
+    if (chunk->next) {
+        size_t total = 0;
+        for (struct RegionChunk* c = chunk; c; c = c->next) {
+            total += c->size;
+        }
+        region_free_chunks(region);
+        chunk = alloc_raw(sizeof(struct RegionChunk) + total);
+        chunk->next = NULL;
+        chunk->size = total;
+        region->chunks = chunk;
+    }
+    region->cur = chunk->data;
+    region->end = chunk->data + chunk->size;
+}
+
+void __compiler_reserved_region_release(void* r) {
+    struct Region* region = r;
+    region_free_chunks(region);
+    region->cur = NULL;
+    region->end = NULL;
+}
+
+// Parallel loops. The compiler outlines the body of a `parallel for` into a
+// function that runs the iterations [lo, hi) of the loop on worker `worker`
+// (0 is the thread that started the loop), see `processParallelForLoop`.
+//
+// Every worker starts out with an equal share of the iterations, which it runs
+// in chunks of `grain` iterations from the front. A worker that runs out steals
+// the back half of what another one has left, so uneven iterations still keep
+// every worker busy. Chunks of one worker run one after another, so the body
+// can accumulate reductions per worker without synchronization.
+//
+// A `parallel for` inside of another one runs on the worker it's on.
+
+typedef void (*ParallelBody)(void* ctx, uint64_t lo, uint64_t hi, uint64_t worker);
+
+// Chunks per worker when the iterations are split evenly
+#define PARALLEL_CHUNKS_PER_WORKER 8
+
+struct WorkerRange {
+    pthread_mutex_t lock;
+    // The iterations [next, end) are left
+    uint64_t next;
+    uint64_t end;
+} __attribute__((aligned(64)));
+
+struct Pool {
+    size_t workers;
+    struct WorkerRange* ranges;
+
+    // The loop that is running, guarded by `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    size_t pending;
+    ParallelBody body;
+    void* ctx;
+    uint64_t grain;
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static struct Pool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .start = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+static _Thread_local bool in_parallel_loop;
+
+static bool take_chunk(size_t self, uint64_t* lo, uint64_t* hi) {
+    struct WorkerRange* range = &pool.ranges[self];
+    pthread_mutex_lock(&range->lock);
+    bool found = range->next < range->end;
+    if (found) {
+        *lo = range->next;
+        *hi = range->end - range->next > pool.grain ? range->next + pool.grain : range->end;
+        range->next = *hi;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+// Moves the back half of the iterations another worker has left to `self`,
+// or all of them if they're at most a chunk
+static bool steal(size_t self) {
+    for (size_t i = 1; i < pool.workers; i++) {
+        struct WorkerRange* victim = &pool.ranges[(self + i) % pool.workers];
+        pthread_mutex_lock(&victim->lock);
+        uint64_t left = victim->end - victim->next;
+        uint64_t mid = left > pool.grain ? victim->next + left / 2 : victim->next;
+        uint64_t end = victim->end;
+        victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (mid < end) {
+            struct WorkerRange* range = &pool.ranges[self];
+            pthread_mutex_lock(&range->lock);
+            range->next = mid;
+            range->end = end;
+            pthread_mutex_unlock(&range->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_chunks(size_t self) {
+    uint64_t lo, hi;
+    while (take_chunk(self, &lo, &hi) || (steal(self) && take_chunk(self, &lo, &hi))) {
+        pool.body(pool.ctx, lo, hi, self);
+    }
+
+    // The thread keeps running after the loop, so its output is written now
+    __compiler_reserved_flush();
+}
+
+static void* worker_main(void* arg) {
+    size_t self = (size_t) arg;
+    in_parallel_loop = true;
+
+    uint64_t seen = 0;
+    while (true) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.start, &pool.lock);
+        }
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_chunks(self);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static void init_pool(void) {
+    long workers = 0;
+    const char* env = getenv("TRUFFLE_NUM_THREADS");
+    if (env) {
+        workers = strtol(env, NULL, 10);
+    }
+    if (workers <= 0) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (workers <= 0) {
+        workers = 1;
+    }
+
+    pool.ranges = aligned_alloc(_Alignof(struct WorkerRange), workers * sizeof(struct WorkerRange));
+    if (!pool.ranges) {
+        fprintf(stderr, "out of memory (thread pool)\n");
+        abort();
+    }
+    for (long i = 0; i < workers; i++) {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].next = pool.ranges[i].end = 0;
+    }
+
+    // Workers that fail to start are left out
+    pool.workers = 1;
+    for (long i = 1; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, (void*) (size_t) i) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        pool.workers++;
+    }
+}
+
+// The number of workers, and so the highest `worker` a loop body gets plus one
+uint64_t __compiler_reserved_parallel_workers(void) {
+    pthread_once(&pool_once, init_pool);
+    return pool.workers;
+}
+
+// Runs `body` on the iterations [0, count) and returns once all of them ran
+void __compiler_reserved_parallel_for(uint64_t count, ParallelBody body, void* ctx) {
+    pthread_once(&pool_once, init_pool);
+    if (count == 0) {
+        return;
+    }
+    if (in_parallel_loop || pool.workers == 1 || count == 1) {
+        body(ctx, 0, count, 0);
+        return;
+    }
+
+    // Whatever was printed before the loop comes first
+    __compiler_reserved_flush();
+
+    pthread_mutex_lock(&pool.lock);
+    pool.body = body;
+    pool.ctx = ctx;
+    uint64_t grain = count / (pool.workers * PARALLEL_CHUNKS_PER_WORKER);
+    pool.grain = grain > 0 ? grain : 1;
+    for (size_t i = 0; i < pool.workers; i++) {
+        pool.ranges[i].next = count / pool.workers * i + (i < count % pool.workers ? i : count % pool.workers);
+        pool.ranges[i].end = pool.ranges[i].next + count / pool.workers + (i < count % pool.workers);
+    }
+    pool.pending = pool.workers - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_parallel_loop = true;
+    run_chunks(0);
+    in_parallel_loop = false;
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+#ifndef TRUFFLE_RT_PRINTF
+
+#define OUT_BUF_SIZE (16 * 1024)
+
+// Longest single `print`: "-9223372036854775808.000000\n", or a float's
+// integer part of up to 309 digits when it's too large for the fast path
+#define MAX_ITEM_SIZE 352
+
+struct OutBuf {
+    size_t len;
+    bool registered;
+    char data[OUT_BUF_SIZE];
+};
+
+static _Thread_local struct OutBuf out_buf;
+
+static pthread_once_t flush_init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t flush_key;
+
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void write_all(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+}
+
+static void flush_buf(struct OutBuf* buf) {
+    write_all(buf->data, buf->len);
+    buf->len = 0;
+}
+
+static void flush_at_thread_exit(void* buf) {
+    flush_buf((struct OutBuf*) buf);
+}
+
+// Thread-specific destructors don't run for the thread that calls `exit`
+static void flush_at_exit(void) {
+    flush_buf(&out_buf);
+}
+
+static void init_flush(void) {
+    pthread_key_create(&flush_key, flush_at_thread_exit);
+    atexit(flush_at_exit);
+}
+
+// Returns space for at least `size` (<= OUT_BUF_SIZE) bytes at the end of the buffer
+static char* reserve(size_t size) {
+    struct OutBuf* buf = &out_buf;
+    if (!buf->registered) {
+        pthread_once(&flush_init_once, init_flush);
+        pthread_setspecific(flush_key, buf);
+        buf->registered = true;
+    }
+    if (buf->len + size > OUT_BUF_SIZE) {
+        flush_buf(buf);
+    }
+    return buf->data + buf->len;
+}
+
+static void commit(char* end) {
+    out_buf.len = (size_t) (end - out_buf.data);
+}
+
+// Writes the digits of `v` to `dst` and returns the end
+static char* format_u64(char* dst, uint64_t v) {
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        unsigned int pair = (unsigned int) (v % 100) * 2;
+        v /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if (v >= 10) {
+        unsigned int pair = (unsigned int) v * 2;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    } else {
+        *--p = (char) ('0' + v);
+    }
+
+    size_t len = (size_t) (tmp + sizeof(tmp) - p);
+    memcpy(dst, p, len);
+    return dst + len;
+}
+
+static char* format_i64(char* dst, int64_t v) {
+    if (v < 0) {
+        *dst++ = '-';
+        return format_u64(dst, (uint64_t) 0 - (uint64_t) v);
+    }
+    return format_u64(dst, (uint64_t) v);
+}
+
+// Rounds `m / 2^k * 10^6` to the nearest integer (ties to even), exactly
+static uint64_t scale_fraction(uint64_t m, int k) {
+    // m < 2^53, so the product is below 2^73 and anything past 2^-75 is < 0.5
+    if (k >= 75) {
+        return 0;
+    }
+
+    unsigned __int128 n = (unsigned __int128) m * 1000000;
+    unsigned __int128 half = (unsigned __int128) 1 << (k - 1);
+    uint64_t q = (uint64_t) (n >> k);
+    unsigned __int128 rem = n & ((half << 1) - 1);
+    if (rem > half || (rem == half && (q & 1))) {
+        q++;
+    }
+    return q;
+}
+
+// Same output as printf's "%f": the value correctly rounded to 6 decimals
+static char* format_f64(char* dst, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+
+    bool negative = bits >> 63;
+    int exponent = (int) ((bits >> 52) & 0x7ff);
+    uint64_t mantissa = bits & ((UINT64_C(1) << 52) - 1);
+
+    if (negative) {
+        *dst++ = '-';
+    }
+    if (exponent == 0x7ff) {
+        memcpy(dst, mantissa ? "nan" : "inf", 3);
+        return dst + 3;
+    }
+
+    double magnitude = negative ? -v : v;
+    if (magnitude >= 9223372036854775808.0) {
+        // Printing the integer part exactly needs arbitrary precision
+        int len = snprintf(dst, MAX_ITEM_SIZE - 2, "%f", magnitude);
+        return dst + len;
+    }
+
+    uint64_t int_part = (uint64_t) magnitude;
+    double frac = magnitude - (double) int_part;   // exact
+
+    uint64_t frac_digits = 0;
+    if (frac != 0.0) {
+        uint64_t frac_bits;
+        memcpy(&frac_bits, &frac, sizeof(frac_bits));
+        int frac_exponent = (int) (frac_bits >> 52);
+        uint64_t m = frac_bits & ((UINT64_C(1) << 52) - 1);
+        int k = 1074;
+        if (frac_exponent != 0) {
+            m |= UINT64_C(1) << 52;
+            k = 1075 - frac_exponent;
+        }
+        frac_digits = scale_fraction(m, k);
+    }
+    if (frac_digits == 1000000) {
+        int_part++;
+        frac_digits = 0;
+    }
+
+    dst = format_u64(dst, int_part);
+    *dst++ = '.';
+    for (int i = 5; i >= 0; i--) {
+        dst[i] = (char) ('0' + frac_digits % 10);
+        frac_digits /= 10;
+    }
+    return dst + 6;
+}
+
+void __compiler_reserved_print_int(int64_t v) {
+    char* p = format_i64(reserve(MAX_ITEM_SIZE), v);
+    *p++ = '\n';
+    commit(p);
+}
+
+void __compiler_reserved_print_uint(uint64_t v) {
+    char* p = format_u64(reserve(MAX_ITEM_SIZE), v);
+    *p++ = '\n';
+    commit(p);
+}
+
+void __compiler_reserved_print_bool(bool v) {
+    char* p = reserve(MAX_ITEM_SIZE);
+    if (v) {
+        memcpy(p, "true\n", 5);
+        p += 5;
+    } else {
+        memcpy(p, "false\n", 6);
+        p += 6;
+    }
+    commit(p);
+}
+
+void __compiler_reserved_print_float(double v) {
+    char* p = format_f64(reserve(MAX_ITEM_SIZE), v);
+    *p++ = '\n';
+    commit(p);
+}
+
+void __compiler_reserved_print_str(const char* data, int64_t len) {
+    size_t remaining = (size_t) len;
+    while (remaining > 0) {
+        size_t chunk = remaining < OUT_BUF_SIZE ? remaining : OUT_BUF_SIZE;
+        char* p = reserve(chunk);
+        memcpy(p, data, chunk);
+        commit(p + chunk);
+        data += chunk;
+        remaining -= chunk;
+    }
+
+    char* p = reserve(1);
+    *p++ = '\n';
+    commit(p);
+}
+
+void __compiler_reserved_flush(void) {
+    flush_buf(&out_buf);
+}
+
+char* __compiler_reserved_out_reserve(size_t size) {
+    return reserve(size);
+}
+
+void __compiler_reserved_out_commit(char* end) {
+    commit(end);
+}
+
+char* __compiler_reserved_format_int(char* dst, int64_t v) {
+    return format_i64(dst, v);
+}
+
+char* __compiler_reserved_format_uint(char* dst, uint64_t v) {
+    return format_u64(dst, v);
+}
+
+char* __compiler_reserved_format_float(char* dst, double v) {
+    return format_f64(dst, v);
+}
+
+#else
+
+static char fused_buf[16 * 1024];
+
+void __compiler_reserved_print_int(int64_t v) {
+    printf("%ld\n", v);
+}
+
+void __compiler_reserved_print_uint(uint64_t v) {
+    printf("%lu\n", v);
+}
+
+void __compiler_reserved_print_bool(bool v) {
+    printf(v ? "true\n" : "false\n");
+}
+
+void __compiler_reserved_print_float(double v) {
+    printf("%f\n", v);
+}
+
+void __compiler_reserved_print_str(const char* data, int64_t len) {
+    printf("%.*s\n", (int) len, data);
+}
+
+void __compiler_reserved_flush(void) {
+    fflush(stdout);
+}
+
+char* __compiler_reserved_out_reserve(size_t size) {
+    (void) size;
+    return fused_buf;
+}
+
+void __compiler_reserved_out_commit(char* end) {
+    fwrite(fused_buf, 1, (size_t) (end - fused_buf), stdout);
+}
+
+char* __compiler_reserved_format_int(char* dst, int64_t v) {
+    return dst + sprintf(dst, "%ld", v);
+}
+
+char* __compiler_reserved_format_uint(char* dst, uint64_t v) {
+    return dst + sprintf(dst, "%lu", v);
+}
+
+char* __compiler_reserved_format_float(char* dst, double v) {
+    return dst + sprintf(dst, "%f", v);
+}
+
+#endif
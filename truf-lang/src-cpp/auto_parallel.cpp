@@ -0,0 +1,553 @@
+#include "auto_parallel.h"
+#include "dtype_utils.h"
+#include "parser.h"
+
+#include <cmath>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using Names = std::set<std::string>;
+
+/// The least work (in estimated operations, see `estimate_work`) a loop has
+/// to do for running it in parallel to pay off: handing out the iterations
+/// and waiting for the workers costs a few microseconds.
+static const double MIN_PARALLEL_WORK = 50000;
+
+/// Iterations assumed for loops whose trip count isn't a constant
+static const double UNKNOWN_TRIP_COUNT = 16;
+
+/// Operations assumed for a call to a function that is being estimated
+/// already (a recursive call)
+static const double RECURSIVE_CALL_WORK = 100;
+
+struct AutoParallel {
+    std::map<std::string, const nlohmann::json*> functions;
+
+    /// Functions that print, or assign to a variable they don't declare
+    /// (directly, or through a function they call)
+    Names with_effects;
+
+    /// Estimated operations per call
+    std::map<std::string, double> work;
+    Names estimating;
+};
+
+/// The loop being checked, see `find_dependence`
+struct LoopAccesses {
+    std::string variable;
+
+    /// Variables declared inside of the loop, which every iteration has its own of
+    std::unordered_set<std::string> declared;
+
+    /// Arrays of the function that no other variable can refer to
+    Names const& unaliased;
+
+    /// Arrays from outside of the loop it writes elements of
+    Names written;
+};
+
+bool is_user_function(const nlohmann::json &call, AutoParallel const& analysis) {
+    return analysis.functions.count(call["function-name"].get<std::string>()) > 0;
+}
+
+bool is_array_variable(const nlohmann::json &expr) {
+    return expr.value("type", "") == "Variable" && dtype_is_array(dtype_from_str(expr["dtype"]));
+}
+
+/// Whether `node` prints, calls C, or assigns to a variable (or an element of
+/// an array) that isn't in `locals`. Adds the user functions it calls to `callees`.
+bool has_local_effects(
+    const nlohmann::json &node,
+    std::unordered_set<std::string> const& locals,
+    AutoParallel const& analysis,
+    Names &callees
+) {
+    if (node.is_array()) {
+        bool effects = false;
+        for (const auto& child : node) {
+            effects |= has_local_effects(child, locals, analysis, callees);
+        }
+        return effects;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return false;
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "FunctionCall") {
+        std::string name = node["function-name"];
+        if (name == "print" || name == "flush" || name == "store" || name == "__some_c_func") {
+            return true;
+        }
+        if (is_user_function(node, analysis)) {
+            callees.insert(name);
+        }
+    }
+    else if ((type == "AssignmentStatement" || type == "ElementAssignmentStatement") && !locals.count(node["dst"].get<std::string>())) {
+        return true;
+    }
+
+    bool effects = false;
+    for (const auto& [key, child] : node.items()) {
+        effects |= has_local_effects(child, locals, analysis, callees);
+    }
+    return effects;
+}
+
+/// Fills `with_effects`, iterating until it doesn't change so that effects
+/// are found through any chain of calls
+void find_functions_with_effects(AutoParallel &analysis) {
+    std::map<std::string, Names> callees;
+    for (const auto& [name, func] : analysis.functions) {
+        std::unordered_set<std::string> locals = {};
+        collect_declared_names((*func)["code-block"], locals);
+        for (const auto& param : (*func)["parameters"]) {
+            locals.insert(param["name"].get<std::string>());
+        }
+        if (has_local_effects((*func)["code-block"], locals, analysis, callees[name])) {
+            analysis.with_effects.insert(name);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& [name, called] : callees) {
+            if (analysis.with_effects.count(name)) {
+                continue;
+            }
+            for (const std::string& callee : called) {
+                if (analysis.with_effects.count(callee)) {
+                    analysis.with_effects.insert(name);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/// The trip count of a range whose ends are integer literals
+std::optional<double> constant_trip_count(const nlohmann::json &loop) {
+    if (loop.contains("array")) {
+        return std::nullopt;
+    }
+    const nlohmann::json& start = loop["start"];
+    const nlohmann::json& end = loop["end"];
+    if (start["type"] != "Literal" || end["type"] != "Literal"
+        || !dtype_is_integer(dtype_from_str(start["dtype"])) || !dtype_is_integer(dtype_from_str(end["dtype"]))) {
+        return std::nullopt;
+    }
+    double count = std::stod(end["value"].get<std::string>()) - std::stod(start["value"].get<std::string>());
+    count += loop.value("inclusive", false);
+    return std::max(count, 0.0);
+}
+
+double estimate_function_work(const std::string &name, AutoParallel &analysis);
+
+/// Roughly how many operations running `node` takes: one per arithmetic
+/// operation (a division costs more), two per element access, and for a call
+/// the operations of the callee. The body of an inner loop counts once per
+/// iteration, `UNKNOWN_TRIP_COUNT` times if that isn't a constant.
+double estimate_work(const nlohmann::json &node, AutoParallel &analysis) {
+    if (node.is_array()) {
+        double work = 0;
+        for (const auto& child : node) {
+            work += estimate_work(child, analysis);
+        }
+        return work;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return 0;
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "ForLoop") {
+        double iteration = 1 + estimate_work(node["code-block"], analysis);
+        double setup = node.contains("array") ? 0 : estimate_work(node["start"], analysis) + estimate_work(node["end"], analysis);
+        return setup + constant_trip_count(node).value_or(UNKNOWN_TRIP_COUNT) * iteration;
+    }
+    if (type == "Loop") {
+        return UNKNOWN_TRIP_COUNT * (1 + estimate_work(node["condition"], analysis) + estimate_work(node["code-block"], analysis));
+    }
+    if (type == "IfBlock") {
+        // The conditions, and the most expensive branch
+        double conditions = 0;
+        double branch = node.contains("default") ? estimate_work(node["default"], analysis) : 0;
+        for (const auto& stmt : node["statements"]) {
+            conditions += estimate_work(stmt["condition"], analysis);
+            branch = std::max(branch, estimate_work(stmt["code-block"], analysis));
+        }
+        return conditions + branch;
+    }
+
+    double work = 0;
+    if (type == "Expression") {
+        std::string op = node["operator"];
+        work = op == "/" || op == "%" ? 20 : 1;
+    }
+    else if (type == "Index" || type == "VectorLoad" || type == "ElementAssignmentStatement") {
+        work = 2;
+    }
+    else if (type == "FunctionCall") {
+        work = is_user_function(node, analysis) ? 10 + estimate_function_work(node["function-name"], analysis) : 1;
+    }
+    for (const auto& [key, child] : node.items()) {
+        work += estimate_work(child, analysis);
+    }
+    return work;
+}
+
+double estimate_function_work(const std::string &name, AutoParallel &analysis) {
+    auto known = analysis.work.find(name);
+    if (known != analysis.work.end()) {
+        return known->second;
+    }
+    if (analysis.estimating.count(name)) {
+        return RECURSIVE_CALL_WORK;
+    }
+
+    analysis.estimating.insert(name);
+    double work = estimate_work((*analysis.functions.at(name))["code-block"], analysis);
+    analysis.estimating.erase(name);
+    analysis.work[name] = work;
+    return work;
+}
+
+/// The array variables `expr` uses
+void collect_array_variables(const nlohmann::json &expr, Names &names) {
+    if (expr.is_array()) {
+        for (const auto& child : expr) {
+            collect_array_variables(child, names);
+        }
+        return;
+    }
+    if (!expr.is_object()) {
+        return;
+    }
+
+    if (is_array_variable(expr)) {
+        names.insert(expr["name"].get<std::string>());
+    }
+    for (const auto& [key, child] : expr.items()) {
+        collect_array_variables(child, names);
+    }
+}
+
+/// Adds every array variable `node` assigns to `declared`. The ones that are
+/// assigned anything but a new array go in `aliased`, and so do the arrays
+/// that value is computed from (`b = a`, `b = f(a)`).
+void collect_aliased_arrays(const nlohmann::json &node, Names &declared, Names &aliased) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            collect_aliased_arrays(child, declared, aliased);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    std::string type = node.value("type", "");
+    if ((type == "DeclarationStatement" || type == "AssignmentStatement") && dtype_is_array(dtype_from_str(node["src"]["dtype"]))) {
+        std::string name = node["dst"];
+        declared.insert(name);
+        if (node["src"]["type"] != "NewArray") {
+            aliased.insert(name);
+            collect_array_variables(node["src"], aliased);
+        }
+    }
+    for (const auto& [key, child] : node.items()) {
+        collect_aliased_arrays(child, declared, aliased);
+    }
+}
+
+/// The arrays of `func` that no other variable can refer to: they are only
+/// ever assigned new arrays, which are never assigned to another variable.
+/// Parameters can refer to anything the caller passes, so they never are.
+Names find_unaliased_arrays(const nlohmann::json &func) {
+    Names declared;
+    Names aliased;
+    collect_aliased_arrays(func["code-block"], declared, aliased);
+
+    Names unaliased;
+    for (const std::string& name : declared) {
+        if (!aliased.count(name)) {
+            unaliased.insert(name);
+        }
+    }
+    return unaliased;
+}
+
+bool is_loop_variable(const nlohmann::json &index, const std::string &variable) {
+    return index["type"] == "Variable" && index["name"] == variable;
+}
+
+/// Whether an iteration can have an array of its own called `name`
+bool is_private_array(const std::string &name, LoopAccesses const& accesses) {
+    return accesses.declared.count(name) && accesses.unaliased.count(name);
+}
+
+/// Why the iterations of the loop can't run in any order because of what
+/// `node` calls, or what elements it writes (which are added to `written`).
+/// Empty if nothing.
+std::string find_effects(const nlohmann::json &node, LoopAccesses &accesses, AutoParallel const& analysis) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            std::string reason = find_effects(child, accesses, analysis);
+            if (!reason.empty()) {
+                return reason;
+            }
+        }
+        return "";
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return "";
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "ElementAssignmentStatement" && !is_private_array(node["dst"], accesses)) {
+        std::string array = node["dst"];
+        if (!is_loop_variable(node["index"], accesses.variable)) {
+            return "writes to `" + array + "` at an index other than `" + accesses.variable + "`";
+        }
+        accesses.written.insert(array);
+    }
+    else if (type == "FunctionCall") {
+        std::string name = node["function-name"];
+        if (name == "print" || name == "flush") {
+            return "prints, which has to happen in order";
+        }
+        if (name == "__some_c_func") {
+            return "calls C";
+        }
+        if (name == "store" && !is_user_function(node, analysis)) {
+            return "stores a vector to an array";
+        }
+        if (is_user_function(node, analysis)) {
+            if (analysis.with_effects.count(name)) {
+                return "calls `" + name + "`, which prints or assigns to a variable outside of it";
+            }
+            for (const auto& param : node["parameters"]) {
+                if (dtype_is_array(dtype_from_str(param["dtype"]))
+                    && !(param["type"] == "Variable" && is_private_array(param["name"], accesses))) {
+                    return "passes an array to `" + name + "`, which could write to it";
+                }
+            }
+        }
+    }
+
+    for (const auto& [key, child] : node.items()) {
+        std::string reason = find_effects(child, accesses, analysis);
+        if (!reason.empty()) {
+            return reason;
+        }
+    }
+    return "";
+}
+
+/// Whether elements of the array `name` can be written by another iteration
+bool may_be_written(const std::string &name, LoopAccesses const& accesses) {
+    if (accesses.written.count(name)) {
+        return true;
+    }
+    if (is_private_array(name, accesses) || accesses.unaliased.count(name)) {
+        return false;
+    }
+    for (const std::string& written : accesses.written) {
+        if (!accesses.unaliased.count(written)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Why `node` can read an element that another iteration writes, or "" if it can't
+std::string find_conflicting_read(const nlohmann::json &node, LoopAccesses const& accesses) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            std::string reason = find_conflicting_read(child, accesses);
+            if (!reason.empty()) {
+                return reason;
+            }
+        }
+        return "";
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return "";
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "Index" && is_array_variable(node["array"])) {
+        std::string array = node["array"]["name"];
+        if (may_be_written(array, accesses) && !is_loop_variable(node["index"], accesses.variable)) {
+            return "reads `" + array + "` at an index other than `" + accesses.variable + "`, which another iteration may write to";
+        }
+        return find_conflicting_read(node["index"], accesses);
+    }
+    if (type == "VectorLoad" && is_array_variable(node["array"]) && may_be_written(node["array"]["name"], accesses)) {
+        return "loads a vector from `" + node["array"]["name"].get<std::string>() + "`, which the iterations write to";
+    }
+    if (type == "FunctionCall" && node["function-name"] == "len") {
+        return "";
+    }
+    if (is_array_variable(node) && may_be_written(node["name"], accesses)) {
+        return "reads all of `" + node["name"].get<std::string>() + "`, which the iterations write to";
+    }
+
+    for (const auto& [key, child] : node.items()) {
+        std::string reason = find_conflicting_read(child, accesses);
+        if (!reason.empty()) {
+            return reason;
+        }
+    }
+    return "";
+}
+
+/// Why the iterations of the range loop `loop` can't run in any order (and
+/// at once), or "" if they can. Finds its reductions too.
+std::string find_dependence(
+    const nlohmann::json &loop,
+    Names const& unaliased,
+    AutoParallel const& analysis,
+    nlohmann::json &reductions
+) {
+    std::string variable = loop["variable"];
+    if (loop.value("mutable", false)) {
+        return "assigns to `" + variable + "`";
+    }
+    if (contains_return(loop["code-block"])) {
+        return "returns from inside of the loop";
+    }
+
+    std::string reason = find_reductions(loop, reductions);
+    if (!reason.empty()) {
+        return reason;
+    }
+    for (const auto& reduction : reductions) {
+        if (dtype_is_float(dtype_element(dtype_from_str(reduction["dtype"])))) {
+            return "adds up the float `" + reduction["name"].get<std::string>() + "`, which gives a different result in another order";
+        }
+    }
+
+    LoopAccesses accesses{ variable, {}, unaliased, {} };
+    collect_declared_names(loop["code-block"], accesses.declared);
+    reason = find_effects(loop["code-block"], accesses, analysis);
+    if (!reason.empty()) {
+        return reason;
+    }
+    return find_conflicting_read(loop["code-block"], accesses);
+}
+
+/// Checks every loop of `node`, and marks the ones that can run in parallel.
+/// `parallel_line` is the line of the parallel loop around `node`, 0 if there is none.
+void annotate_loops(
+    nlohmann::json &node,
+    const std::string &function,
+    Names const& unaliased,
+    AutoParallel &analysis,
+    unsigned int parallel_line,
+    std::vector<ParallelLoop> &loops
+) {
+    if (node.is_array()) {
+        for (auto& child : node) {
+            annotate_loops(child, function, unaliased, analysis, parallel_line, loops);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    std::string type = node.value("type", "");
+    if (type != "Loop" && type != "ForLoop") {
+        for (auto& [key, child] : node.items()) {
+            annotate_loops(child, function, unaliased, analysis, parallel_line, loops);
+        }
+        return;
+    }
+
+    unsigned int line = node.value("line", 0u);
+    ParallelLoop loop{ function, line, false, "", 0, 0 };
+    if (parallel_line != 0) {
+        loop.reason = "inside of the parallel loop at line " + std::to_string(parallel_line);
+    }
+    else if (node.value("parallel", false)) {
+        // A `parallel for` already
+        annotate_loops(node["code-block"], function, unaliased, analysis, line, loops);
+        return;
+    }
+    else if (type == "Loop") {
+        loop.reason = "the trip count isn't known when the loop starts";
+    }
+    else if (node.contains("array")) {
+        loop.reason = "loops over an array (a loop over `0..len(...)` can run in parallel)";
+    }
+    else {
+        nlohmann::json reductions = nlohmann::json::array();
+        loop.reason = find_dependence(node, unaliased, analysis, reductions);
+        if (loop.reason.empty()) {
+            loop.work = 1 + estimate_work(node["code-block"], analysis);
+            std::optional<double> trip_count = constant_trip_count(node);
+            if (trip_count.has_value() && *trip_count * loop.work < MIN_PARALLEL_WORK) {
+                loop.reason = "too little work to split up (" + std::to_string((uint64_t) *trip_count)
+                    + " iterations of about " + std::to_string((uint64_t) loop.work) + " operations)";
+            }
+        }
+        if (loop.reason.empty()) {
+            loop.parallel = true;
+            loop.min_iterations = (uint64_t) std::ceil(MIN_PARALLEL_WORK / loop.work);
+            node["parallel"] = true;
+            node["reductions"] = reductions;
+            node["auto-parallel"] = true;
+            node["min-parallel-iterations"] = loop.min_iterations;
+        }
+    }
+    loops.push_back(loop);
+
+    annotate_loops(node["code-block"], function, unaliased, analysis, loop.parallel ? line : parallel_line, loops);
+}
+
+std::vector<ParallelLoop> annotate_auto_parallel(nlohmann::json &module) {
+    AutoParallel analysis;
+    std::vector<nlohmann::json*> functions;
+    if (module["type"] == "Module") {
+        for (auto& stmt : module["statements"]) {
+            if (stmt["type"] == "Function") {
+                functions.push_back(&stmt);
+            }
+        }
+    } else if (module["type"] == "Function") {
+        functions.push_back(&module);
+    }
+    for (nlohmann::json* func : functions) {
+        analysis.functions[(*func)["name"]] = func;
+    }
+    find_functions_with_effects(analysis);
+
+    std::vector<ParallelLoop> loops;
+    for (nlohmann::json* func : functions) {
+        Names unaliased = find_unaliased_arrays(*func);
+        annotate_loops((*func)["code-block"], (*func)["name"], unaliased, analysis, 0, loops);
+    }
+    return loops;
+}
+
+void print_parallel_report(std::vector<ParallelLoop> const& loops, llvm::raw_ostream &os) {
+    size_t num_parallel = 0;
+    for (auto const& loop : loops) {
+        os << "auto-parallel: " << loop.function << ":" << loop.line << ": ";
+        if (loop.parallel) {
+            os << "parallel, about " << (uint64_t) loop.work << " operations per iteration, from "
+               << loop.min_iterations << " iterations on\n";
+            num_parallel++;
+        } else {
+            os << "serial, " << loop.reason << "\n";
+        }
+    }
+    os << "auto-parallel: " << num_parallel << " of " << loops.size() << " loops in parallel\n";
+}
@@ -0,0 +1,57 @@
+#ifndef AUTO_PARALLEL_H
+#define AUTO_PARALLEL_H
+
+#include "json.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+
+/// A loop that `annotate_auto_parallel` looked at
+struct ParallelLoop {
+    std::string function;
+    unsigned int line;
+    bool parallel;
+
+    /// Why the loop stays serial, empty if it runs in parallel
+    std::string reason;
+
+    /// Estimated operations per iteration (0 if the loop wasn't a candidate)
+    double work;
+
+    /// The fewest iterations the loop runs in parallel with
+    uint64_t min_iterations;
+};
+
+/// `-fauto-parallel`: turns `for i in start..end` loops whose iterations are
+/// independent into `parallel for` loops (see `parse_parallel_for`), with
+/// `"auto-parallel": true`.
+///
+/// Iterations are independent when the body
+///
+/// - doesn't assign to `i`, `return`, print, or call a function that does
+///   (or that assigns to a variable outside of itself), or pass it an array
+/// - only assigns to variables from outside of the loop like a reduction,
+///   and not to a float (combining per thread partial sums changes the result)
+/// - only writes elements `a[i]` of arrays from outside of the loop, and only
+///   reads elements of those arrays at `i` too. Arrays that may be the same
+///   (parameters, or variables not only ever assigned a new array) count as
+///   one array.
+///
+/// Loops that pass are also weighed by the operations an iteration does
+/// (calls count the operations of the callee): if a constant trip count is
+/// too small to pay for waking up the worker threads, the loop stays serial.
+/// Otherwise it gets `"min-parallel-iterations"`, the trip count below which
+/// code gen runs it on the calling thread anyway.
+///
+/// Loops nested in a loop that runs in parallel are left alone. This has to
+/// run before the other passes, which treat the loops it marks as any other
+/// `parallel for`.
+std::vector<ParallelLoop> annotate_auto_parallel(nlohmann::json &module);
+
+/// `-fparallel-report`: every loop, and why it stays serial
+void print_parallel_report(std::vector<ParallelLoop> const& loops, llvm::raw_ostream &os);
+
+#endif
@@ -0,0 +1,616 @@
+#include "autofree.h"
+#include "dtype_utils.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using VarSet = std::set<size_t>;
+
+/// Marks a declaration in scope whose type doesn't own a buffer
+const size_t NOT_TRACKED = SIZE_MAX;
+
+struct DropAnalysis {
+    bool params_owned;
+
+    /// Innermost scope last, like `ValueTable`
+    std::vector<std::map<std::string, size_t>> scopes;
+
+    /// Per variable id
+    std::vector<bool> droppable;
+    std::vector<bool> borrowed;
+    std::vector<std::vector<size_t>> copied_from;
+    std::vector<size_t> depth;
+    std::vector<bool> assigned;
+
+    /// The variables whose buffers the value of a variable may point into,
+    /// because it is a view made by `slice`. They stay alive as long as it does.
+    std::vector<VarSet> views_of;
+
+    /// `x = slice(y, ...)`, which is only a view if `y` outlives `x` (decided
+    /// once the whole function has been resolved)
+    struct BoundSlice {
+        nlohmann::json* call;
+        size_t src;
+        size_t dst;
+    };
+    std::vector<BoundSlice> bound_slices;
+
+    size_t declare(const std::string& name, const std::string& dtype, bool is_param, bool is_mutable) {
+        if (!dtype_has_buffer(dtype_from_str(dtype))) {
+            scopes.back()[name] = NOT_TRACKED;
+            return NOT_TRACKED;
+        }
+
+        size_t id = droppable.size();
+        scopes.back()[name] = id;
+
+        // A borrowed parameter that is never assigned to never owns anything
+        droppable.push_back(!is_param || params_owned || is_mutable);
+        borrowed.push_back(is_param && !params_owned);
+        copied_from.emplace_back();
+        depth.push_back(scopes.size() - 1);
+        assigned.push_back(false);
+        views_of.emplace_back();
+        return id;
+    }
+
+    size_t lookup(const std::string& name) const {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            auto var = it->find(name);
+            if (var != it->end()) {
+                return var->second;
+            }
+        }
+        return NOT_TRACKED;
+    }
+};
+
+/// The variable `expr` is, if it's just a tracked variable
+size_t variable_id(const nlohmann::json &expr) {
+    if (expr["type"] != "Variable") {
+        return NOT_TRACKED;
+    }
+    return expr.value("var-id", NOT_TRACKED);
+}
+
+bool is_slice(const nlohmann::json &expr) {
+    return expr["type"] == "FunctionCall" && expr["function-name"] == "slice" && !expr["parameters"].empty();
+}
+
+void resolve_expression(nlohmann::json &expr, DropAnalysis &analysis) {
+    std::string type = expr["type"];
+
+    if (type == "Variable") {
+        size_t id = analysis.lookup(expr["name"]);
+        if (id != NOT_TRACKED) {
+            expr["var-id"] = id;
+        }
+    }
+    else if (type == "Expression") {
+        resolve_expression(expr["left-operand"], analysis);
+        resolve_expression(expr["right-operand"], analysis);
+    }
+    else if (type == "FunctionCall") {
+        for (auto& param : expr["parameters"]) {
+            resolve_expression(param, analysis);
+        }
+
+        // A slice of a temporary has to be copied, since the temporary dies
+        // with the call. Variables and literals are still there after it.
+        if (is_slice(expr)) {
+            const nlohmann::json &src = expr["parameters"][0];
+            if (src["type"] == "Literal" || variable_id(src) != NOT_TRACKED) {
+                expr["view"] = true;
+            } else {
+                expr.erase("view");
+            }
+        }
+    }
+    else if (type == "Index") {
+        resolve_expression(expr["array"], analysis);
+        resolve_expression(expr["index"], analysis);
+    }
+    else if (type == "NewArray") {
+        resolve_expression(expr["length"], analysis);
+    }
+    else if (type == "Cast") {
+        resolve_expression(expr["value"], analysis);
+    }
+    else if (type == "Vector") {
+        for (auto& element : expr["elements"]) {
+            resolve_expression(element, analysis);
+        }
+    }
+    else if (type == "VectorLoad") {
+        resolve_expression(expr["array"], analysis);
+        resolve_expression(expr["index"], analysis);
+        if (expr.contains("mask")) {
+            resolve_expression(expr["mask"], analysis);
+        }
+    }
+}
+
+void resolve_code_block(nlohmann::json &code_block, DropAnalysis &analysis);
+
+/// Gives every declaration an id and points every use at its declaration
+void resolve_statement(nlohmann::json &stmt, DropAnalysis &analysis) {
+    std::string type = stmt["type"];
+
+    if (type == "DeclarationStatement" || type == "AssignmentStatement") {
+        // Evaluated before the binding exists, like in code gen
+        resolve_expression(stmt["src"], analysis);
+
+        size_t id = NOT_TRACKED;
+        if (type == "DeclarationStatement") {
+            id = analysis.declare(stmt["dst"], stmt["dtype"], false, stmt.value("mutable", true));
+            if (id != NOT_TRACKED) {
+                stmt["var-id"] = id;
+            }
+        } else {
+            id = analysis.lookup(stmt["dst"]);
+            if (id != NOT_TRACKED) {
+                stmt["dst-id"] = id;
+                analysis.assigned[id] = true;
+            }
+        }
+
+        // Arrays are copied element by element (see `emitArrayTransfer`), so
+        // a copy never borrows from its source
+        size_t src = variable_id(stmt["src"]);
+        bool is_array = dtype_is_array(dtype_from_str(stmt["src"].value("dtype", "Null")));
+        if (id != NOT_TRACKED && src != NOT_TRACKED && !is_array) {
+            analysis.copied_from[id].push_back(src);
+        }
+
+        if (id != NOT_TRACKED && is_slice(stmt["src"]) && stmt["src"].contains("view")) {
+            size_t sliced = variable_id(stmt["src"]["parameters"][0]);
+            if (sliced != NOT_TRACKED) {
+                analysis.bound_slices.push_back(DropAnalysis::BoundSlice{ &stmt["src"], sliced, id });
+            }
+        }
+    }
+    else if (type == "ReturnStatement") {
+        if (stmt.contains("value")) {
+            resolve_expression(stmt["value"], analysis);
+
+            // The variable a returned slice points into is dropped before the caller gets it
+            nlohmann::json &value = stmt["value"];
+            if (is_slice(value) && value["parameters"][0]["type"] != "Literal") {
+                value.erase("view");
+            }
+        }
+    }
+    else if (type == "ElementAssignmentStatement") {
+        // Writes into the buffer of the array, the variable keeps its value
+        resolve_expression(stmt["index"], analysis);
+        resolve_expression(stmt["src"], analysis);
+        size_t id = analysis.lookup(stmt["dst"]);
+        if (id != NOT_TRACKED) {
+            stmt["dst-id"] = id;
+        }
+    }
+    else if (type == "FunctionCall") {
+        resolve_expression(stmt, analysis);
+    }
+    else if (type == "IfBlock") {
+        for (auto& branch : stmt["statements"]) {
+            resolve_expression(branch["condition"], analysis);
+            resolve_code_block(branch["code-block"], analysis);
+        }
+        if (stmt.contains("default")) {
+            resolve_code_block(stmt["default"], analysis);
+        }
+    }
+    else if (type == "Loop") {
+        resolve_expression(stmt["condition"], analysis);
+        resolve_code_block(stmt["code-block"], analysis);
+    }
+    else if (type == "ForLoop") {
+        for (auto key : {"start", "end", "array"}) {
+            if (stmt.contains(key)) {
+                resolve_expression(stmt[key], analysis);
+            }
+        }
+
+        // The loop variable shadows any outer variable of the same name
+        analysis.scopes.emplace_back();
+        analysis.declare(stmt["variable"], stmt["dtype"], false, stmt.value("mutable", true));
+        resolve_code_block(stmt["code-block"], analysis);
+        analysis.scopes.pop_back();
+    }
+}
+
+void resolve_code_block(nlohmann::json &code_block, DropAnalysis &analysis) {
+    analysis.scopes.emplace_back();
+    for (auto& stmt : code_block["statements"]) {
+        resolve_statement(stmt, analysis);
+    }
+    analysis.scopes.pop_back();
+}
+
+/// Using a view also uses the variables it points into
+void collect_uses(const nlohmann::json &expr, VarSet &uses, DropAnalysis const& analysis) {
+    std::string type = expr["type"];
+
+    if (type == "Variable") {
+        if (expr.contains("var-id")) {
+            size_t id = expr["var-id"].get<size_t>();
+            uses.insert(id);
+            uses.insert(analysis.views_of[id].begin(), analysis.views_of[id].end());
+        }
+    }
+    else if (type == "Expression") {
+        collect_uses(expr["left-operand"], uses, analysis);
+        collect_uses(expr["right-operand"], uses, analysis);
+    }
+    else if (type == "FunctionCall") {
+        for (auto const& param : expr["parameters"]) {
+            collect_uses(param, uses, analysis);
+        }
+    }
+    else if (type == "Index") {
+        collect_uses(expr["array"], uses, analysis);
+        collect_uses(expr["index"], uses, analysis);
+    }
+    else if (type == "NewArray") {
+        collect_uses(expr["length"], uses, analysis);
+    }
+    else if (type == "Cast") {
+        collect_uses(expr["value"], uses, analysis);
+    }
+    else if (type == "Vector") {
+        for (auto const& element : expr["elements"]) {
+            collect_uses(element, uses, analysis);
+        }
+    }
+    else if (type == "VectorLoad") {
+        collect_uses(expr["array"], uses, analysis);
+        collect_uses(expr["index"], uses, analysis);
+        if (expr.contains("mask")) {
+            collect_uses(expr["mask"], uses, analysis);
+        }
+    }
+}
+
+VarSet uses_of(const nlohmann::json &expr, DropAnalysis const& analysis) {
+    VarSet uses;
+    collect_uses(expr, uses, analysis);
+    return uses;
+}
+
+VarSet difference(VarSet const& a, VarSet const& b) {
+    VarSet result;
+    for (size_t id : a) {
+        if (!b.count(id)) {
+            result.insert(id);
+        }
+    }
+    return result;
+}
+
+/// Sets (or clears, if nothing is dropped) a drop list. Loop bodies are
+/// analyzed more than once, so stale annotations have to be removed.
+void set_drops(nlohmann::json &node, const std::string& key, VarSet const& ids, DropAnalysis const& analysis) {
+    std::vector<size_t> dropped;
+    for (size_t id : ids) {
+        if (analysis.droppable[id]) {
+            dropped.push_back(id);
+        }
+    }
+
+    if (dropped.empty()) {
+        node.erase(key);
+    } else {
+        node[key] = dropped;
+    }
+}
+
+void set_flag(nlohmann::json &node, const std::string& key, bool value) {
+    if (value) {
+        node[key] = true;
+    } else {
+        node.erase(key);
+    }
+}
+
+bool always_returns(const nlohmann::json &stmt) {
+    if (stmt["type"] == "ReturnStatement") {
+        return true;
+    }
+    if (stmt["type"] != "IfBlock" || !stmt.contains("default")) {
+        return false;
+    }
+
+    auto block_returns = [](const nlohmann::json &code_block) {
+        for (auto const& inner : code_block["statements"]) {
+            if (always_returns(inner)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (auto const& branch : stmt["statements"]) {
+        if (!block_returns(branch["code-block"])) {
+            return false;
+        }
+    }
+    return block_returns(stmt["default"]);
+}
+
+VarSet analyze_block(nlohmann::json &code_block, VarSet const& live_out, DropAnalysis &analysis);
+
+/// Annotates `stmt` given the variables that are live after it, and returns
+/// the variables that are live before it
+VarSet analyze_statement(nlohmann::json &stmt, VarSet const& live_out, DropAnalysis &analysis) {
+    std::string type = stmt["type"];
+
+    if (type == "DeclarationStatement" || type == "AssignmentStatement") {
+        size_t id = stmt.value(type == "DeclarationStatement" ? "var-id" : "dst-id", NOT_TRACKED);
+        VarSet uses = uses_of(stmt["src"], analysis);
+        size_t src = variable_id(stmt["src"]);
+
+        // `s = s` keeps the value where it is
+        bool self_assignment = src != NOT_TRACKED && src == id;
+        bool moved = src != NOT_TRACKED && !self_assignment && !live_out.count(src);
+        set_flag(stmt, "move", moved);
+        set_flag(stmt, "copy", src != NOT_TRACKED && !self_assignment && !moved);
+
+        // The old value of `s = s + t` dies once the new one is computed
+        bool drop_old = id != NOT_TRACKED && uses.count(id) && !self_assignment && type == "AssignmentStatement";
+        set_flag(stmt, "drop-old", drop_old && analysis.droppable[id]);
+
+        VarSet dropped;
+        for (size_t use : uses) {
+            if (!live_out.count(use) && !(moved && use == src) && !(use == id && !self_assignment)) {
+                dropped.insert(use);
+            }
+        }
+        // A value that is never read dies right away
+        if (id != NOT_TRACKED && !live_out.count(id)) {
+            dropped.insert(id);
+        }
+        set_drops(stmt, "drop", dropped, analysis);
+
+        VarSet live_in = live_out;
+        if (id != NOT_TRACKED) {
+            live_in.erase(id);
+        }
+        live_in.insert(uses.begin(), uses.end());
+        return live_in;
+    }
+    else if (type == "ReturnStatement") {
+        if (!stmt.contains("value")) {
+            return {};
+        }
+
+        // Returning a variable hands its value to the caller, unless it may be
+        // borrowed, in which case the caller gets its own copy
+        VarSet uses = uses_of(stmt["value"], analysis);
+        size_t src = variable_id(stmt["value"]);
+        bool clone = src != NOT_TRACKED && analysis.borrowed[src];
+        set_flag(stmt, "clone", clone);
+        if (src != NOT_TRACKED && !clone) {
+            uses.erase(src);
+        }
+        set_drops(stmt, "drop", uses, analysis);
+        return uses_of(stmt["value"], analysis);
+    }
+    else if (type == "FunctionCall" || type == "ElementAssignmentStatement") {
+        VarSet uses;
+        if (type == "FunctionCall") {
+            uses = uses_of(stmt, analysis);
+        } else {
+            uses = uses_of(stmt["index"], analysis);
+            collect_uses(stmt["src"], uses, analysis);
+            if (stmt.contains("dst-id")) {
+                uses.insert(stmt["dst-id"].get<size_t>());
+            }
+        }
+        set_drops(stmt, "drop", difference(uses, live_out), analysis);
+
+        VarSet live_in = live_out;
+        live_in.insert(uses.begin(), uses.end());
+        return live_in;
+    }
+    else if (type == "IfBlock") {
+        // Every condition is evaluated before any branch is entered
+        VarSet live_in;
+        std::vector<VarSet> branch_live_in;
+        for (auto& branch : stmt["statements"]) {
+            VarSet cond_uses = uses_of(branch["condition"], analysis);
+            live_in.insert(cond_uses.begin(), cond_uses.end());
+
+            branch_live_in.push_back(analyze_block(branch["code-block"], live_out, analysis));
+            live_in.insert(branch_live_in.back().begin(), branch_live_in.back().end());
+        }
+
+        VarSet default_live_in = live_out;
+        if (stmt.contains("default")) {
+            default_live_in = analyze_block(stmt["default"], live_out, analysis);
+        }
+        live_in.insert(default_live_in.begin(), default_live_in.end());
+
+        // A value that is only used on some paths dies where the others start
+        for (size_t i = 0; i < branch_live_in.size(); i++) {
+            set_drops(stmt["statements"][i]["code-block"], "drop-on-entry", difference(live_in, branch_live_in[i]), analysis);
+        }
+        if (stmt.contains("default")) {
+            set_drops(stmt["default"], "drop-on-entry", difference(live_in, default_live_in), analysis);
+        } else {
+            set_drops(stmt, "else-drop", difference(live_in, live_out), analysis);
+        }
+        return live_in;
+    }
+    else if (type == "Loop") {
+        // Everything live at the header is live throughout the loop
+        VarSet header_live = live_out;
+        VarSet cond_uses = uses_of(stmt["condition"], analysis);
+        header_live.insert(cond_uses.begin(), cond_uses.end());
+
+        VarSet body_live_in;
+        while (true) {
+            body_live_in = analyze_block(stmt["code-block"], header_live, analysis);
+            size_t size = header_live.size();
+            header_live.insert(body_live_in.begin(), body_live_in.end());
+            if (header_live.size() == size) {
+                break;
+            }
+        }
+
+        set_drops(stmt["code-block"], "drop-on-entry", difference(header_live, body_live_in), analysis);
+        set_drops(stmt, "drop-on-exit", difference(header_live, live_out), analysis);
+        return header_live;
+    }
+    else if (type == "ForLoop") {
+        // The array is read in every iteration, the bounds of a range only
+        // before the first one (what only they use dies after the loop)
+        VarSet header_live = live_out;
+        if (stmt.contains("array")) {
+            VarSet array_uses = uses_of(stmt["array"], analysis);
+            header_live.insert(array_uses.begin(), array_uses.end());
+        }
+
+        VarSet body_live_in;
+        while (true) {
+            body_live_in = analyze_block(stmt["code-block"], header_live, analysis);
+            size_t size = header_live.size();
+            header_live.insert(body_live_in.begin(), body_live_in.end());
+            if (header_live.size() == size) {
+                break;
+            }
+        }
+
+        VarSet live_in = header_live;
+        if (stmt.contains("start")) {
+            VarSet bound_uses = uses_of(stmt["start"], analysis);
+            collect_uses(stmt["end"], bound_uses, analysis);
+            live_in.insert(bound_uses.begin(), bound_uses.end());
+        }
+
+        set_drops(stmt["code-block"], "drop-on-entry", difference(header_live, body_live_in), analysis);
+        set_drops(stmt, "drop-on-exit", difference(live_in, live_out), analysis);
+        return live_in;
+    }
+
+    return live_out;
+}
+
+VarSet analyze_block(nlohmann::json &code_block, VarSet const& live_out, DropAnalysis &analysis) {
+    nlohmann::json &statements = code_block["statements"];
+
+    // Anything after a return is unreachable (and never generated)
+    size_t end = statements.size();
+    for (size_t i = 0; i < statements.size(); i++) {
+        if (always_returns(statements[i])) {
+            end = i + 1;
+            break;
+        }
+    }
+
+    VarSet live = live_out;
+    for (size_t i = end; i-- > 0;) {
+        live = analyze_statement(statements[i], live, analysis);
+    }
+    return live;
+}
+
+void annotate_function(nlohmann::json &func, bool params_owned) {
+    DropAnalysis analysis;
+    analysis.params_owned = params_owned;
+
+    analysis.scopes.emplace_back();
+    VarSet params;
+    for (auto& param : func["parameters"]) {
+        size_t id = analysis.declare(param["name"], param["dtype"], true, param.value("mutable", true));
+        if (id != NOT_TRACKED) {
+            param["var-id"] = id;
+            params.insert(id);
+        }
+    }
+    resolve_code_block(func["code-block"], analysis);
+
+    // Where the value of each variable can end up: the variables it is copied
+    // into, and those that slice it
+    std::vector<VarSet> passed_to(analysis.copied_from.size());
+    for (size_t id = 0; id < analysis.copied_from.size(); id++) {
+        for (size_t src : analysis.copied_from[id]) {
+            passed_to[src].insert(id);
+        }
+    }
+    for (auto const& slice : analysis.bound_slices) {
+        passed_to[slice.src].insert(slice.dst);
+    }
+
+    // A slice can share the bytes of a variable that keeps its value for at
+    // least as long as the slice: one that is never assigned to, and declared
+    // in the same scope as or around every variable the slice ends up in
+    for (auto const& slice : analysis.bound_slices) {
+        bool outlives = !analysis.assigned[slice.src];
+        VarSet reached = { slice.dst };
+        std::vector<size_t> pending = { slice.dst };
+        while (outlives && !pending.empty()) {
+            size_t id = pending.back();
+            pending.pop_back();
+            outlives = analysis.depth[slice.src] <= analysis.depth[id];
+            for (size_t next : passed_to[id]) {
+                if (reached.insert(next).second) {
+                    pending.push_back(next);
+                }
+            }
+        }
+        if (!outlives) {
+            slice.call->erase("view");
+            continue;
+        }
+        analysis.views_of[slice.dst].insert(slice.src);
+        analysis.borrowed[slice.dst] = true;
+    }
+
+    // Copies of views and views of views point into the same variables
+    bool views_changed = true;
+    while (views_changed) {
+        views_changed = false;
+        for (size_t id = 0; id < analysis.views_of.size(); id++) {
+            VarSet sources = analysis.views_of[id];
+            sources.insert(analysis.copied_from[id].begin(), analysis.copied_from[id].end());
+            for (size_t src : sources) {
+                for (size_t viewed : analysis.views_of[src]) {
+                    views_changed |= analysis.views_of[id].insert(viewed).second;
+                }
+            }
+        }
+    }
+
+    // Whatever is copied out of a borrowed variable is borrowed too
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t id = 0; id < analysis.borrowed.size(); id++) {
+            for (size_t src : analysis.copied_from[id]) {
+                if (analysis.borrowed[src] && !analysis.borrowed[id]) {
+                    analysis.borrowed[id] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    VarSet live_in = analyze_block(func["code-block"], {}, analysis);
+
+    // Owned parameters that are never used die on entry
+    set_drops(func["code-block"], "drop-on-entry", difference(params, live_in), analysis);
+}
+
+void annotate_drops(nlohmann::json &module, bool params_owned) {
+    if (module["type"] == "Function") {
+        annotate_function(module, params_owned);
+        return;
+    }
+    for (auto& stmt : module["statements"]) {
+        if (stmt["type"] == "Function") {
+            annotate_function(stmt, params_owned);
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef AUTOFREE_H
+#define AUTOFREE_H
+
+#include "json.hpp"
+
+/// AutoFree: works out, at compile time, where every buffer-owning value
+/// (see `dtype_has_buffer`) is used for the last time along each path, and
+/// annotates the AST with where code gen has to free it:
+///
+/// - every declaration and parameter gets a `"var-id"` that is unique in its
+///   function, and Variable nodes get the id of the declaration they refer to
+/// - `"drop": [ids]` on a statement: values that are dead once it has run
+///   (for a ReturnStatement, before the function returns)
+/// - `"drop-on-entry": [ids]` on a CodeBlock: values that are live before an
+///   if branch or a loop body but never used in it
+/// - `"else-drop": [ids]` on an IfBlock without a default block, for the path
+///   that takes none of the branches
+/// - `"drop-on-exit": [ids]` on a Loop or ForLoop: values only used inside of
+///   the loop (or by the range of a ForLoop)
+/// - `"drop-old": true` on an assignment that reads the variable it assigns,
+///   whose old value dies once the new one has been computed
+/// - `"move": true` / `"copy": true` on a declaration, assignment or return
+///   whose value is just a variable: the value is moved if the variable dies
+///   there, otherwise it has to be copied. `"clone": true` on a return of a
+///   value that might be borrowed from a parameter.
+///
+/// Variables are tracked per declaration, so shadowing works as expected.
+///
+/// If `params_owned` is false, parameters are borrowed from the caller and are
+/// never dropped by the callee (AutoFree). Otherwise the callee owns them and
+/// drops them like any other value (reference counting).
+void annotate_drops(nlohmann::json &module, bool params_owned);
+
+#endif
@@ -0,0 +1,419 @@
+#include "backend.h"
+#include "code_gen.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/Optional.h>
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/IPO/HotColdSplitting.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/IPO/SampleProfile.h>
+#include <llvm/Transforms/Utils/AddDiscriminators.h>
+
+/// Functions that call each other are only packed together up to this size,
+/// so that a cluster stays within a page (one iTLB entry).
+const uint64_t MAX_CLUSTER_SIZE = 4096;
+
+/// Rough number of bytes of machine code per IR instruction
+const uint64_t BYTES_PER_INSTRUCTION = 4;
+
+std::unique_ptr<llvm::TargetMachine> create_target_machine(unsigned int opt_level, std::string cpu) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    std::string triple = llvm::sys::getDefaultTargetTriple();
+    std::string error;
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        llvm::errs() << "Error: " << error << "\n";
+        return nullptr;
+    }
+
+    llvm::CodeGenOpt::Level level = llvm::CodeGenOpt::None;
+    if (opt_level == 1) {
+        level = llvm::CodeGenOpt::Less;
+    } else if (opt_level == 2) {
+        level = llvm::CodeGenOpt::Default;
+    } else if (opt_level >= 3) {
+        level = llvm::CodeGenOpt::Aggressive;
+    }
+
+    // `native` also turns on the features of this CPU that its name doesn't imply
+    std::string features = "";
+    if (cpu == "native") {
+        cpu = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> host_features;
+        if (llvm::sys::getHostCPUFeatures(host_features)) {
+            llvm::SubtargetFeatures subtarget_features;
+            for (auto const& feature : host_features) {
+                subtarget_features.AddFeature(feature.first(), feature.second);
+            }
+            features = subtarget_features.getString();
+        }
+    }
+
+    llvm::TargetOptions target_options;
+    return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+        triple, cpu, features, target_options, llvm::Reloc::PIC_, llvm::None, level
+    ));
+}
+
+/// Registers all of the analyses the new pass manager needs with `PB`
+void register_analyses(
+    llvm::PassBuilder &PB,
+    llvm::LoopAnalysisManager &LAM,
+    llvm::FunctionAnalysisManager &FAM,
+    llvm::CGSCCAnalysisManager &CGAM,
+    llvm::ModuleAnalysisManager &MAM
+) {
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+}
+
+bool link_runtime(llvm::Module* module, std::string const& path) {
+    llvm::SMDiagnostic error;
+    std::unique_ptr<llvm::Module> runtime = llvm::parseIRFile(path, error, module->getContext());
+    if (!runtime) {
+        error.print("truffle", llvm::errs());
+        return false;
+    }
+
+    // The library is built once for the host, the module may target something more specific
+    runtime->setTargetTriple(module->getTargetTriple());
+    runtime->setDataLayout(module->getDataLayout());
+
+    bool failed = llvm::Linker::linkModules(
+        *module, std::move(runtime), llvm::Linker::Flags::LinkOnlyNeeded,
+        [](llvm::Module& linked, llvm::StringSet<> const& imported) {
+            for (llvm::Function& function : linked) {
+                if (!function.isDeclaration() && imported.count(function.getName())) {
+                    // Compile the runtime for the same CPU as the rest of the
+                    // module, otherwise the inliner refuses to mix the two
+                    function.removeFnAttr("target-cpu");
+                    function.removeFnAttr("target-features");
+                    function.removeFnAttr("tune-cpu");
+                }
+            }
+            llvm::internalizeModule(linked, [&imported](llvm::GlobalValue const& value) {
+                return !value.hasName() || !imported.count(value.getName());
+            });
+        }
+    );
+    if (failed) {
+        llvm::errs() << "Error: could not link the runtime library " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+/// This runs on the IR exactly as code gen produced it, before any other pass.
+/// Both modes therefore see the same CFG, so the profile's per-function CFG
+/// hashes match as long as the source didn't change. Branch weights and entry
+/// counts are plain metadata, so a later `opt` run picks them up.
+void run_profile_passes(llvm::Module* module, CodeGenOptions const& options) {
+    llvm::Optional<llvm::PGOOptions> pgo_options;
+    if (options.profile_generate) {
+        pgo_options = llvm::PGOOptions(options.profile_generate_path, "", "", llvm::PGOOptions::IRInstr);
+    } else if (!options.profile_use_path.empty()) {
+        pgo_options = llvm::PGOOptions(options.profile_use_path, "", "", llvm::PGOOptions::IRUse);
+    } else if (options.profile_sample_use_path.empty()) {
+        return;
+    }
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassBuilder PB(nullptr, llvm::PipelineTuningOptions(), pgo_options);
+    register_analyses(PB, LAM, FAM, CGAM, MAM);
+
+    if (pgo_options.hasValue()) {
+        // The O0 pipeline does nothing but the PGO instrumentation (or annotation)
+        llvm::ModulePassManager MPM = PB.buildO0DefaultPipeline(llvm::OptimizationLevel::O0);
+        MPM.run(*module, MAM);
+        return;
+    }
+
+    // A sample profile (e.g. from `llvm-profgen`) is matched to the code through
+    // its line table, and only applies to functions that opt into it.
+    for (llvm::Function& function : *module) {
+        if (!function.isDeclaration()) {
+            function.addFnAttr("use-sample-profile");
+        }
+    }
+
+    llvm::ModulePassManager MPM;
+    MPM.addPass(llvm::createModuleToFunctionPassAdaptor(llvm::AddDiscriminatorsPass()));
+    MPM.addPass(llvm::SampleProfileLoaderPass(options.profile_sample_use_path));
+    MPM.run(*module, MAM);
+}
+
+/// Prints the optimization remarks asked for with `-Rpass=<regex>` and co.,
+/// in the format clang uses. An empty pattern matches no pass.
+struct RemarkPrinter : llvm::DiagnosticHandler {
+    std::string passed;
+    std::string missed;
+    std::string analysis;
+
+    RemarkPrinter(CodeGenOptions const& options)
+        : passed(options.remarks_passed), missed(options.remarks_missed), analysis(options.remarks_analysis) {}
+
+    static bool matches(std::string const& pattern, llvm::StringRef pass_name) {
+        return !pattern.empty() && llvm::Regex(pattern).match(pass_name);
+    }
+
+    bool isPassedOptRemarkEnabled(llvm::StringRef pass_name) const override {
+        return matches(passed, pass_name);
+    }
+
+    bool isMissedOptRemarkEnabled(llvm::StringRef pass_name) const override {
+        return matches(missed, pass_name);
+    }
+
+    bool isAnalysisRemarkEnabled(llvm::StringRef pass_name) const override {
+        return matches(analysis, pass_name);
+    }
+
+    bool isAnyRemarkEnabled() const override {
+        return !passed.empty() || !missed.empty() || !analysis.empty();
+    }
+
+    bool handleDiagnostics(llvm::DiagnosticInfo const& info) override {
+        const auto* remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+        if (!remark) {
+            return false;
+        }
+
+        // The analysis remarks come in a few kinds (e.g. about reordering floats)
+        std::string flag = "-Rpass-analysis";
+        if (llvm::isa<llvm::OptimizationRemark>(remark)) {
+            flag = "-Rpass";
+        } else if (llvm::isa<llvm::OptimizationRemarkMissed>(remark)) {
+            flag = "-Rpass-missed";
+        }
+
+        if (remark->isLocationAvailable()) {
+            llvm::errs() << remark->getLocationStr() << ": ";
+        } else {
+            llvm::errs() << remark->getFunction().getName() << ": ";
+        }
+
+        // A loop hint (e.g. `@vectorize`) that couldn't be followed is a
+        // warning, and the analysis that explains why is printed without a flag
+        if (info.getSeverity() == llvm::DS_Warning) {
+            llvm::errs() << "warning: " << remark->getMsg() << "\n";
+            return true;
+        }
+        llvm::errs() << "remark: " << remark->getMsg() << " [" << flag;
+        if (!remark->getPassName().empty()) {
+            llvm::errs() << "=" << remark->getPassName();
+        }
+        llvm::errs() << "]\n";
+        return true;
+    }
+};
+
+void optimize_module(llvm::Module* module, llvm::TargetMachine* target_machine, CodeGenOptions const& options) {
+    if (options.opt_level == 0) {
+        return;
+    }
+
+    // Respecting the filters keeps remarks of passes that weren't asked for from the printer
+    module->getContext().setDiagnosticHandler(std::make_unique<RemarkPrinter>(options), true);
+
+    llvm::PipelineTuningOptions tuning_options;
+    tuning_options.LoopVectorization = options.opt_level >= 2;
+    tuning_options.SLPVectorization = options.opt_level >= 2;
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassBuilder PB(target_machine, tuning_options);
+    register_analyses(PB, LAM, FAM, CGAM, MAM);
+
+    // Without a profile the splitter only sees `cold` calls, which truffle can't express
+    if (module->getProfileSummary(false)) {
+        PB.registerOptimizerLastEPCallback([](llvm::ModulePassManager &MPM, llvm::OptimizationLevel) {
+            MPM.addPass(llvm::HotColdSplittingPass());
+        });
+    }
+
+    llvm::OptimizationLevel level = llvm::OptimizationLevel::O1;
+    if (options.opt_level == 2) {
+        level = llvm::OptimizationLevel::O2;
+    } else if (options.opt_level >= 3) {
+        level = llvm::OptimizationLevel::O3;
+    }
+
+    llvm::ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(level);
+    MPM.run(*module, MAM);
+}
+
+struct FunctionCluster {
+    std::vector<llvm::Function*> functions;
+    uint64_t size;
+    uint64_t count;
+};
+
+uint64_t estimate_function_size(llvm::Function const& function) {
+    return function.getInstructionCount() * BYTES_PER_INSTRUCTION;
+}
+
+/// The layout follows Pettis and Hansen: every function starts in its own
+/// cluster, then call edges are visited from the heaviest down, and the
+/// callee's cluster is appended to the caller's while the result fits in
+/// `MAX_CLUSTER_SIZE`. Clusters are finally sorted by how often their code
+/// runs per byte, so the hottest code shares the fewest pages.
+void apply_profile_layout(llvm::Module* module) {
+    llvm::ProfileSummaryInfo PSI(*module);
+    if (!PSI.hasProfileSummary()) {
+        return;
+    }
+
+    std::vector<llvm::Function*> functions;
+    std::map<std::pair<llvm::Function*, llvm::Function*>, uint64_t> call_counts;
+
+    for (llvm::Function& function : *module) {
+        if (function.isDeclaration()) {
+            continue;
+        }
+        functions.push_back(&function);
+
+        if (PSI.isFunctionEntryHot(&function) || function.hasFnAttribute(llvm::Attribute::Hot)) {
+            function.setSectionPrefix("hot");
+        } else if (PSI.isFunctionEntryCold(&function) || function.hasFnAttribute(llvm::Attribute::Cold)) {
+            function.setSectionPrefix("unlikely");
+        }
+
+        llvm::DominatorTree DT(function);
+        llvm::LoopInfo LI(DT);
+        llvm::BranchProbabilityInfo BPI(function, LI);
+        llvm::BlockFrequencyInfo BFI(function, BPI, LI);
+
+        for (llvm::BasicBlock& block : function) {
+            for (llvm::Instruction& inst : block) {
+                auto* call = llvm::dyn_cast<llvm::CallBase>(&inst);
+                if (!call) {
+                    continue;
+                }
+                llvm::Function* callee = call->getCalledFunction();
+                if (!callee || callee->isDeclaration() || callee == &function) {
+                    continue;
+                }
+
+                llvm::Optional<uint64_t> count = BFI.getBlockProfileCount(&block);
+                if (count.hasValue() && count.getValue() > 0) {
+                    call_counts[{&function, callee}] += count.getValue();
+                }
+            }
+        }
+    }
+
+    std::vector<FunctionCluster> clusters;
+    std::map<llvm::Function*, size_t> cluster_of;
+    for (llvm::Function* function : functions) {
+        uint64_t count = 0;
+        if (auto entry_count = function->getEntryCount()) {
+            count = entry_count->getCount();
+        }
+        cluster_of[function] = clusters.size();
+        clusters.push_back(FunctionCluster{ {function}, estimate_function_size(*function), count });
+    }
+
+    std::vector<std::pair<std::pair<llvm::Function*, llvm::Function*>, uint64_t>> edges(call_counts.begin(), call_counts.end());
+    std::stable_sort(edges.begin(), edges.end(), [](auto const& a, auto const& b) {
+        return a.second > b.second;
+    });
+
+    for (auto const& [edge, count] : edges) {
+        size_t caller_idx = cluster_of[edge.first];
+        size_t callee_idx = cluster_of[edge.second];
+        FunctionCluster& caller = clusters[caller_idx];
+        FunctionCluster& callee = clusters[callee_idx];
+
+        // Functions in different sections end up far apart no matter the order
+        if (caller_idx == callee_idx || edge.first->getSectionPrefix() != edge.second->getSectionPrefix()) {
+            continue;
+        }
+        if (caller.size + callee.size > MAX_CLUSTER_SIZE) {
+            continue;
+        }
+
+        for (llvm::Function* function : callee.functions) {
+            cluster_of[function] = caller_idx;
+            caller.functions.push_back(function);
+        }
+        caller.size += callee.size;
+        caller.count += callee.count;
+        callee.functions.clear();
+    }
+
+    std::vector<FunctionCluster*> order;
+    for (FunctionCluster& cluster : clusters) {
+        if (!cluster.functions.empty()) {
+            order.push_back(&cluster);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [](FunctionCluster const* a, FunctionCluster const* b) {
+        return (double) a->count / std::max<uint64_t>(a->size, 1) > (double) b->count / std::max<uint64_t>(b->size, 1);
+    });
+
+    // Code is emitted in the order of the module's function list
+    for (FunctionCluster* cluster : order) {
+        for (llvm::Function* function : cluster->functions) {
+            function->removeFromParent();
+            module->getFunctionList().push_back(function);
+        }
+    }
+}
+
+bool emit_object_file(llvm::Module* module, llvm::TargetMachine* target_machine, std::string const& filepath) {
+    std::error_code ec;
+    llvm::raw_fd_ostream dest(filepath, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+        llvm::errs() << "Could not open file: " << ec.message() << "\n";
+        return false;
+    }
+
+    llvm::legacy::PassManager pass;
+    if (target_machine->addPassesToEmitFile(pass, dest, nullptr, llvm::CGFT_ObjectFile)) {
+        llvm::errs() << "Error: the target can't emit object files.\n";
+        return false;
+    }
+
+    pass.run(*module);
+    dest.flush();
+    return true;
+}
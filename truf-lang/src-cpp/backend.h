@@ -0,0 +1,38 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "code_gen.h"
+
+#include <memory>
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+/// Target machine for the host triple and `cpu` (`native` for the host CPU,
+/// with all of its features), or nullptr if the native target isn't available.
+std::unique_ptr<llvm::TargetMachine> create_target_machine(unsigned int opt_level, std::string cpu = "generic");
+
+/// Links the runtime bitcode library at `path` into the module. Only the
+/// functions the module calls are pulled in (`LinkOnlyNeeded`), and they are
+/// internalized so the optimizer can inline them and drop what's left over.
+/// Returns false if the library can't be read or linked.
+bool link_runtime(llvm::Module* module, std::string const& path);
+
+/// Instruments the module for `--profile-generate`, or annotates it with the
+/// profile given to `--profile-use` / `--profile-sample-use`.
+void run_profile_passes(llvm::Module* module, CodeGenOptions const& options);
+
+/// Runs the default `-O<n>` pipeline. If the module carries a profile, cold
+/// code is also split out of hot functions.
+void optimize_module(llvm::Module* module, llvm::TargetMachine* target_machine, CodeGenOptions const& options);
+
+/// Puts hot functions in `.text.hot` (and cold ones in `.text.unlikely`) and
+/// orders them so that functions that call each other a lot are adjacent.
+/// Does nothing if the module has no profile.
+void apply_profile_layout(llvm::Module* module);
+
+/// Writes the module to `filepath` as an object file
+bool emit_object_file(llvm::Module* module, llvm::TargetMachine* target_machine, std::string const& filepath);
+
+#endif
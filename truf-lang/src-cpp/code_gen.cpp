@@ -1,15 +1,33 @@
 #include "json.hpp"
+#include "code_gen.h"
+#include "auto_parallel.h"
+#include "autofree.h"
+#include "backend.h"
+#include "dtype_utils.h"
+#include "escape_analysis.h"
+#include "memory_effects.h"
+#include "parser.h"
+#include "range_analysis.h"
+#include "value_table.h"
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <map>
+#include <set>
+#include <algorithm>
+#include <functional>
 
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
 
 // Forward declarations
 llvm::Type* getLLVMType(const std::string& dtype, llvm::LLVMContext &Context);
@@ -17,7 +35,7 @@ llvm::Type* getLLVMType(const std::string& dtype, llvm::LLVMContext &Context);
 void processCodeBlock(
     const nlohmann::json& codeBlock,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
@@ -25,7 +43,7 @@ void processCodeBlock(
 void processStatement(
     const nlohmann::json& stmt,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
@@ -33,7 +51,7 @@ void processStatement(
 void processDeclarationStatement(
     const nlohmann::json& stmt,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
@@ -41,23 +59,65 @@ void processDeclarationStatement(
 void processAssignmentStatement(
     const nlohmann::json& stmt,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
 
-void processFunctionCall(
+llvm::Value* processFunctionCall(
     const nlohmann::json& functionCall, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues, 
+    ValueTable &NamedValues, 
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 );
 
+void processIfBlock(
+    const nlohmann::json& ifBlock,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+void processLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+void processForLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+void processParallelForLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+bool isVectorizableBody(const nlohmann::json& codeBlock, const std::string& varName);
+
+llvm::Value* processCondition(
+    const nlohmann::json& cond,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
 void processReturn(
     const nlohmann::json& returnStmt, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues, 
+    ValueTable &NamedValues, 
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 );
@@ -65,17 +125,23 @@ void processReturn(
 void processFunction(
     const nlohmann::json& funcAst,
     llvm::IRBuilder<> &BuilderObj,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &ContextObj,
     llvm::Module *ModuleObj
 );
 
+void addFunctionAttributes(llvm::Function* function, const nlohmann::json& attributes);
+void internSymbols(nlohmann::json& node, ValueTable& NamedValues);
+SymbolId symbolOf(const nlohmann::json& node, ValueTable& NamedValues);
+llvm::FastMathFlags getFastMathFlags(const nlohmann::json& attributes);
+void flattenCalls(llvm::Function* function);
+
 llvm::Value* processExpression(
     const nlohmann::json& expr,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
-    llvm::Module *Module = nullptr
+    llvm::Module *Module
 );
 
 llvm::Value* processLiteral(const nlohmann::json& literal, llvm::LLVMContext &Context);
@@ -83,125 +149,415 @@ llvm::Value* processLiteral(const nlohmann::json& literal, llvm::LLVMContext &Co
 llvm::Value* processVariable(
     const nlohmann::json& var, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues
+    ValueTable &NamedValues
 );
 
 llvm::Value* processBinaryExpression(
     const nlohmann::json& expr,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+llvm::Value* createComparison(
+    const std::string& op,
+    llvm::Value* L,
+    llvm::Value* R,
+    bool isUnsigned,
+    llvm::IRBuilder<> &Builder
+);
+
+llvm::Value* emitConversion(
+    llvm::Value* value,
+    BeDataType from,
+    BeDataType to,
+    llvm::IRBuilder<> &Builder
+);
+
+llvm::Value* processLogicalExpression(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+bool emitConditionalBranch(
+    const nlohmann::json& cond,
+    llvm::BasicBlock* trueBB,
+    llvm::BasicBlock* falseBB,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+bool tryIfConversion(
+    const nlohmann::json& ifBlock,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+bool hasSideEffects(const nlohmann::json& expr);
+
+bool isFusablePrint(const nlohmann::json& stmt);
+
+size_t processPrintSequence(
+    const nlohmann::json& statements,
+    size_t begin,
+    size_t end,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+llvm::StructType* getStringType(llvm::LLVMContext &Context);
+
+std::string decodeStringLiteral(const std::string& token);
+
+llvm::Value* createStringConstant(const std::string& text, llvm::LLVMContext &Context, llvm::Module *Module);
+
+/// Where the bytes of a string are, and how many there are
+struct StringParts {
+    llvm::Value* data;
+    llvm::Value* len;
+};
+
+StringParts emitStringParts(llvm::Value* str, llvm::IRBuilder<> &Builder);
+
+llvm::Value* emitStringLength(llvm::Value* str, llvm::IRBuilder<> &Builder);
+
+llvm::Value* emitSmallString(std::vector<StringParts> const& pieces, llvm::Value* len, llvm::IRBuilder<> &Builder);
+
+llvm::Value* emitBySize(
+    llvm::Value* len,
+    std::function<llvm::Value*()> const& small,
+    std::function<llvm::Value*()> const& large,
+    llvm::IRBuilder<> &Builder
+);
+
+llvm::Value* processStringConcat(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module,
+    llvm::Value* reuse = nullptr
+);
+
+bool isStringConcat(const nlohmann::json& expr);
+
+llvm::Value* allocateBuffer(
+    const nlohmann::json& site,
+    llvm::Value* size,
+    llvm::Value*& capacity,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module,
+    bool isArray = false
+);
+
+bool isTemporary(const nlohmann::json& expr);
+
+llvm::Value* emitHeapAlloc(llvm::Value* size, llvm::IRBuilder<> &Builder, llvm::Module *Module, bool isArray = false);
+
+void emitDrop(llvm::Value* str, llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+void emitDrops(const nlohmann::json& node, const std::string& key, llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+llvm::Value* emitCopy(llvm::Value* str, llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+llvm::Value* emitClone(llvm::Value* str, llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+llvm::StructType* getArrayType(const std::string& dtype, llvm::LLVMContext &Context);
+
+llvm::Type* getArrayElementType(llvm::Type* arrayType);
+
+bool isArrayType(llvm::Type* type);
+
+bool isBufferType(llvm::Type* type, llvm::LLVMContext &Context);
+
+llvm::Value* processNewArray(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+llvm::Value* processIndex(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+void processElementAssignment(
+    const nlohmann::json& stmt,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+llvm::Value* processVector(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+llvm::Value* processVectorLoad(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
 
+llvm::Value* processVectorBuiltin(
+    const nlohmann::json& functionCall,
+    std::vector<llvm::Value*> const& args,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+);
+
+bool isVectorBuiltin(const nlohmann::json& functionCall);
+
+llvm::Value* emitElementPointer(
+    llvm::Value* array,
+    llvm::Value* index,
+    const nlohmann::json& node,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+);
+
+void emitRuntimeCheck(
+    llvm::Value* ok,
+    const std::string& failFunc,
+    std::vector<llvm::Value*> args,
+    const std::string& name,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+);
+
+llvm::Value* emitArrayClone(llvm::Value* array, llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+llvm::Value* emitArrayTransfer(const nlohmann::json& stmt, llvm::Value* value, llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+llvm::Value* createRegion(llvm::Function* function, const std::string& name);
+
+llvm::Value* getRegion(const nlohmann::json& node);
+
+void emitRegionReleases(llvm::IRBuilder<> &Builder, llvm::Module *Module);
+
+llvm::Value* createIntegerDivision(
+    const std::string& op,
+    llvm::Value* L,
+    llvm::Value* R,
+    bool isUnsigned,
+    llvm::IRBuilder<> &Builder
+);
+
 void declareExternalFunction(
     const std::string& functionName,
     llvm::FunctionType* funcType,
     llvm::Module* Module
 );
 
+llvm::AllocaInst* createEntryBlockAlloca(
+    llvm::Function* function,
+    llvm::Type* type,
+    const std::string& varName
+);
 
-void createPrintFunctions(llvm::LLVMContext& Context, llvm::Module* Module) {
-    llvm::IRBuilder<> Builder(Context);
+llvm::MDNode* createLoopMetadata(
+    llvm::LLVMContext& Context,
+    const llvm::DebugLoc& startLoc,
+    bool vectorize = false,
+    const nlohmann::json& attributes = nlohmann::json::object()
+);
 
-    // Declare printf
-    llvm::FunctionType* printfType = llvm::FunctionType::get(
-        llvm::IntegerType::getInt32Ty(Context),
-        llvm::PointerType::get(llvm::Type::getInt8Ty(Context), 0),
-        true
-    );
-    llvm::Function* printfFunc = llvm::Function::Create(
-        printfType,
-        llvm::Function::ExternalLinkage,
-        "printf",
-        Module
-    );
+void emitLocation(llvm::IRBuilder<> &Builder, const nlohmann::json& node);
 
-    // Create the `__compiler_reserved_print_int` function
-    llvm::FunctionType* printIntType = llvm::FunctionType::get(
-        llvm::Type::getVoidTy(Context),
-        { llvm::Type::getInt64Ty(Context) },
-        false
-    );
-    llvm::Function* printIntFunc = llvm::Function::Create(
-        printIntType,
-        llvm::Function::ExternalLinkage,
-        "__compiler_reserved_print_int",
-        Module
-    );
-    {
-        llvm::BasicBlock* entry = llvm::BasicBlock::Create(Context, "entry", printIntFunc);
-        Builder.SetInsertPoint(entry);
+llvm::DIType* getDebugType(const std::string& dtype);
 
-        // Create format string for `printf` ("%ld\n")
-        llvm::Value* formatStr = Builder.CreateGlobalStringPtr("%ld\n");
+void emitDebugVariable(
+    const std::string& name,
+    const std::string& dtype,
+    llvm::Value* value,
+    bool isMutable,
+    unsigned int argNo,
+    llvm::IRBuilder<> &Builder
+);
 
-        // Call `printf` with the format string and the argument from `printInt`
-        llvm::Value* intArg = printIntFunc->arg_begin();
-        Builder.CreateCall(printfFunc, { formatStr, intArg });
-        Builder.CreateRetVoid();
-    }
 
-    // Create the `__compiler_reserved_print_bool` function
-    llvm::FunctionType* printBoolType = llvm::FunctionType::get(
-        llvm::Type::getVoidTy(Context),
-        { llvm::Type::getInt1Ty(Context) },
-        false
-    );
-    llvm::Function* printBoolFunc = llvm::Function::Create(
-        printBoolType,
-        llvm::Function::ExternalLinkage,
-        "__compiler_reserved_print_bool",
-        Module
-    );
-    {
-        llvm::BasicBlock* entry = llvm::BasicBlock::Create(Context, "entry", printBoolFunc);
-        Builder.SetInsertPoint(entry);
+/// Debug info state for the module being generated. `DbgInfo` is only set
+/// while `gen_llvm_ir` runs with debug info enabled.
+struct DebugInfo {
+    std::unique_ptr<llvm::DIBuilder> DBuilder;
+    llvm::DICompileUnit* CompileUnit;
+    llvm::DIFile* File;
+    bool emitVariables;
+
+    /// The subprogram of the current function followed by its open lexical blocks
+    std::vector<llvm::DIScope*> LexicalBlocks;
+    std::map<std::string, llvm::DIType*> Types;
+};
+
+static std::unique_ptr<DebugInfo> DbgInfo;
 
-        llvm::Value* boolArg = printBoolFunc->arg_begin();
+/// Set from `CodeGenOptions::fuse_prints` while `gen_llvm_ir` runs
+static bool FusePrints = true;
+static bool FuseConcats = true;
 
-        // Convert the boolean value to an integer (0 or 1)
-        llvm::Value* boolAsInt = Builder.CreateZExt(boolArg, llvm::Type::getInt32Ty(Context));
+/// Set from `CodeGenOptions::alias_info` while `gen_llvm_ir` runs
+static bool AliasInfo = true;
 
-        // Create strings for "true" and "false"
-        llvm::Value* trueStr = Builder.CreateGlobalStringPtr("true\n");
-        llvm::Value* falseStr = Builder.CreateGlobalStringPtr("false\n");
+/// Set from `CodeGenOptions::fast_math` while `gen_llvm_ir` runs
+static bool FastMath = false;
 
-        // Select the appropriate string based on the boolean value
-        llvm::Value* cmp = Builder.CreateICmpEQ(boolArg, llvm::ConstantInt::get(llvm::Type::getInt1Ty(Context), 1));
-        llvm::Value* selectedStr = Builder.CreateSelect(cmp, trueStr, falseStr);
+/// Whether functions can be marked as not writing memory at all, which they
+/// do with reference counting (the callee releases its array parameters) and
+/// with `--profile-generate` (counters)
+static bool MemoryEffects = true;
 
-        // Call printf with the selected string
-        Builder.CreateCall(printfFunc, { selectedStr });
+/// Set from `CodeGenOptions::memory_model` and `check_memory` while `gen_llvm_ir` runs
+static MemoryModel Memory = MemoryModel::AutoFree;
+static bool CheckMemory = false;
 
-        Builder.CreateRetVoid();
+/// Source line of the statement being generated, for `-fcheck-memory` reports
+static unsigned int CurrentLine = 0;
+
+/// Buffer-owning variables of the current function by their `"var-id"` (see
+/// `annotate_drops`), so drops find the right variable even when it's shadowed
+static std::map<size_t, ValueBinding> BufferVariables;
+
+/// Regions of the current function (see `analyze_escapes`): the one its caller
+/// passed in (null if the caller didn't), its own, and one per enclosing loop
+/// (null for loops without one)
+static llvm::Value* CallerRegion = nullptr;
+static llvm::Value* FunctionRegion = nullptr;
+static std::vector<llvm::Value*> LoopRegions;
+
+/// Where the bytes of the strings that the current function builds are, so a
+/// small string that is used right away doesn't have to be spilled again
+static std::map<llvm::Value*, StringParts> KnownParts;
+
+/// `"var-id"`s of the array parameters of the current function, whose buffer
+/// belongs to the caller (see `emitArrayTransfer`)
+static std::set<size_t> ArrayParameters;
+
+/// Alignment of the elements of an array: a cache line, so that a vector load
+/// in a loop over an array never straddles two of them
+const uint64_t ARRAY_ALIGNMENT = 64;
+
+/// Tags a load or store of array elements of type `elementType` (or of a
+/// vector of them) with `!tbaa`. Every buffer only ever holds elements of one
+/// type, so elements of different types are never in the same place, which
+/// LLVM can't tell by itself: e.g. a store to a `float[]` doesn't change an
+/// `int[]` that the loop reads.
+void tagElementAccess(llvm::Instruction* access, llvm::Type* elementType) {
+    if (!AliasInfo) {
+        return;
     }
+    std::string name;
+    llvm::raw_string_ostream os(name);
+    elementType->print(os);
 
-    // Create the `__compiler_reserved_print_float` function
-    llvm::FunctionType* printFloatType = llvm::FunctionType::get(
-        llvm::Type::getVoidTy(Context),
-        { llvm::Type::getDoubleTy(Context) }, // Use double for both float and double types
-        false
-    );
-    llvm::Function* printFloatFunc = llvm::Function::Create(
-        printFloatType,
-        llvm::Function::ExternalLinkage,
-        "__compiler_reserved_print_float",
-        Module
-    );
-    {
-        llvm::BasicBlock* entry = llvm::BasicBlock::Create(Context, "entry", printFloatFunc);
-        Builder.SetInsertPoint(entry);
+    llvm::MDBuilder builder(access->getContext());
+    llvm::MDNode* root = builder.createTBAARoot("truffle array elements");
+    llvm::MDNode* type = builder.createTBAAScalarTypeNode(os.str(), root);
+    access->setMetadata(llvm::LLVMContext::MD_tbaa, builder.createTBAAStructTagNode(type, type, 0));
+}
+
+
+/// Declares the print functions of the runtime (runtime/truffle_rt.c). Their
+/// bodies come from the runtime bitcode library (see `link_runtime`), or from
+/// the runtime archive when the executable is linked.
+void createPrintFunctions(llvm::LLVMContext& Context, llvm::Module* Module) {
+    llvm::Type* voidTy = llvm::Type::getVoidTy(Context);
+
+    declareExternalFunction("__compiler_reserved_print_int", llvm::FunctionType::get(voidTy, { llvm::Type::getInt64Ty(Context) }, false), Module);
+    declareExternalFunction("__compiler_reserved_print_uint", llvm::FunctionType::get(voidTy, { llvm::Type::getInt64Ty(Context) }, false), Module);
+    declareExternalFunction("__compiler_reserved_print_bool", llvm::FunctionType::get(voidTy, { llvm::Type::getInt1Ty(Context) }, false), Module);
+    // A C `bool` is passed zero-extended to a whole register
+    Module->getFunction("__compiler_reserved_print_bool")->addParamAttr(0, llvm::Attribute::ZExt);
+    declareExternalFunction("__compiler_reserved_print_float", llvm::FunctionType::get(voidTy, { llvm::Type::getDoubleTy(Context) }, false), Module);
+    declareExternalFunction("__compiler_reserved_flush", llvm::FunctionType::get(voidTy, {}, false), Module);
+    declareExternalFunction("__compiler_reserved_print_str", llvm::FunctionType::get(voidTy, { llvm::Type::getInt8PtrTy(Context), llvm::Type::getInt64Ty(Context) }, false), Module);
 
-        // Create format string for `printf` ("%f\n")
-        llvm::Value* formatStr = Builder.CreateGlobalStringPtr("%f\n");
+    // Used by fused prints (see `processPrintSequence`)
+    llvm::Type* charPtrTy = llvm::Type::getInt8PtrTy(Context);
+    llvm::Type* i64Ty = llvm::Type::getInt64Ty(Context);
+    declareExternalFunction("__compiler_reserved_out_reserve", llvm::FunctionType::get(charPtrTy, { i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_out_commit", llvm::FunctionType::get(voidTy, { charPtrTy }, false), Module);
+    declareExternalFunction("__compiler_reserved_format_int", llvm::FunctionType::get(charPtrTy, { charPtrTy, i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_format_uint", llvm::FunctionType::get(charPtrTy, { charPtrTy, i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_format_float", llvm::FunctionType::get(charPtrTy, { charPtrTy, llvm::Type::getDoubleTy(Context) }, false), Module);
+
+    // Heap buffers of strings (see `emitHeapAlloc` and `emitDrop`)
+    llvm::Type* i32Ty = llvm::Type::getInt32Ty(Context);
+    declareExternalFunction("__compiler_reserved_alloc", llvm::FunctionType::get(charPtrTy, { i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_free", llvm::FunctionType::get(voidTy, { charPtrTy, i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_checked_alloc", llvm::FunctionType::get(charPtrTy, { i64Ty, i32Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_checked_free", llvm::FunctionType::get(voidTy, { charPtrTy, i64Ty, i32Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_rc_alloc", llvm::FunctionType::get(charPtrTy, { i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_rc_retain", llvm::FunctionType::get(voidTy, { charPtrTy }, false), Module);
+    declareExternalFunction("__compiler_reserved_rc_release", llvm::FunctionType::get(voidTy, { charPtrTy }, false), Module);
+
+    // Regions, for buffers that all die at the same point (see `createRegion`)
+    declareExternalFunction("__compiler_reserved_region_alloc", llvm::FunctionType::get(charPtrTy, { charPtrTy, i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_region_reset", llvm::FunctionType::get(voidTy, { charPtrTy }, false), Module);
+    declareExternalFunction("__compiler_reserved_region_release", llvm::FunctionType::get(voidTy, { charPtrTy }, false), Module);
+
+    // Arrays (see `processNewArray` and `emitElementPointer`)
+    declareExternalFunction("__compiler_reserved_array_alloc", llvm::FunctionType::get(charPtrTy, { i64Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_checked_array_alloc", llvm::FunctionType::get(charPtrTy, { i64Ty, i32Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_bounds_fail", llvm::FunctionType::get(voidTy, { i64Ty, i64Ty, i32Ty }, false), Module);
+    declareExternalFunction("__compiler_reserved_array_length_fail", llvm::FunctionType::get(voidTy, { i64Ty, i32Ty }, false), Module);
+
+    // Parallel loops (see `processParallelForLoop`)
+    declareExternalFunction("__compiler_reserved_parallel_workers", llvm::FunctionType::get(i64Ty, {}, false), Module);
+    declareExternalFunction("__compiler_reserved_parallel_for", llvm::FunctionType::get(voidTy, { i64Ty, charPtrTy, charPtrTy }, false), Module);
+
+    for (const char* allocFunc : { "__compiler_reserved_alloc", "__compiler_reserved_checked_alloc", "__compiler_reserved_rc_alloc", "__compiler_reserved_region_alloc", "__compiler_reserved_array_alloc", "__compiler_reserved_checked_array_alloc" }) {
+        Module->getFunction(allocFunc)->addRetAttr(llvm::Attribute::NoAlias);
+    }
+    for (const char* allocFunc : { "__compiler_reserved_array_alloc", "__compiler_reserved_checked_array_alloc" }) {
+        Module->getFunction(allocFunc)->addRetAttr(llvm::Attribute::getWithAlignment(Context, llvm::Align(ARRAY_ALIGNMENT)));
+    }
+    for (const char* failFunc : { "__compiler_reserved_bounds_fail", "__compiler_reserved_array_length_fail" }) {
+        Module->getFunction(failFunc)->addFnAttr(llvm::Attribute::NoReturn);
+        Module->getFunction(failFunc)->addFnAttr(llvm::Attribute::Cold);
+    }
 
-        // Get the argument (double type)
-        llvm::Value* floatArg = printFloatFunc->arg_begin();
+    // Buffers passed to the runtime only for the call
+    if (AliasInfo) {
+        Module->getFunction("__compiler_reserved_print_str")->addParamAttr(0, llvm::Attribute::NoCapture);
+        Module->getFunction("__compiler_reserved_print_str")->addParamAttr(0, llvm::Attribute::ReadOnly);
+        const char* borrowing[] = {
+            "__compiler_reserved_out_commit",
+            "__compiler_reserved_free",
+            "__compiler_reserved_checked_free",
+            "__compiler_reserved_rc_retain",
+            "__compiler_reserved_rc_release",
+            "__compiler_reserved_region_alloc",
+            "__compiler_reserved_region_reset",
+            "__compiler_reserved_region_release",
+        };
+        for (const char* func : borrowing) {
+            Module->getFunction(func)->addParamAttr(0, llvm::Attribute::NoCapture);
+        }
+    }
 
-        // Call `printf` with the format string and the argument from `printFloat`
-        Builder.CreateCall(printfFunc, { formatStr, floatArg });
-        Builder.CreateRetVoid();
+    for (llvm::Function& function : *Module) {
+        function.addFnAttr(llvm::Attribute::NoUnwind);
     }
 }
 
@@ -220,17 +576,279 @@ void declareExternalFunction(
 }
 
 
-void gen_llvm_ir(std::string filepath, nlohmann::json ast) {
+/// Allocas are always placed at the top of the entry block, even for variables
+/// declared inside of loops, so that mem2reg can promote them to SSA registers.
+llvm::AllocaInst* createEntryBlockAlloca(
+    llvm::Function* function,
+    llvm::Type* type,
+    const std::string& varName
+) {
+    llvm::BasicBlock& entry = function->getEntryBlock();
+    llvm::IRBuilder<> TmpBuilder(&entry, entry.begin());
+    return TmpBuilder.CreateAlloca(type, nullptr, varName);
+}
+
+/// Creates the self-referential `!llvm.loop` node attached to a loop's latch.
+/// Truffle loops are required to make forward progress, which lets LLVM delete
+/// or vectorize side-effect free loops without proving that they terminate.
+/// `vectorize` asks the loop vectorizer to vectorize it even where its cost
+/// model is unsure (see `isVectorizableBody`). The loop's `@unroll`,
+/// `@vectorize` and `@interleave` (see `check_loop_attributes`) come on top,
+/// and take precedence.
+llvm::MDNode* createLoopMetadata(
+    llvm::LLVMContext& Context,
+    const llvm::DebugLoc& startLoc,
+    bool vectorize,
+    const nlohmann::json& attributes
+) {
+    llvm::SmallVector<llvm::Metadata*, 4> loopProps;
+    auto addProp = [&](const char* name, llvm::Constant* value) {
+        llvm::SmallVector<llvm::Metadata*, 2> prop = { llvm::MDString::get(Context, name) };
+        if (value) {
+            prop.push_back(llvm::ConstantAsMetadata::get(value));
+        }
+        loopProps.push_back(llvm::MDNode::get(Context, prop));
+    };
+    auto getCount = [&](const char* name) {
+        return llvm::ConstantInt::get(llvm::Type::getInt32Ty(Context), attributes[name].get<int64_t>());
+    };
+
+    // Reserve the first operand for the self reference
+    llvm::TempMDTuple tmp = llvm::MDNode::getTemporary(Context, {});
+    loopProps.push_back(tmp.get());
+
+    // Lets optimization remarks point at the loop's source line
+    if (startLoc) {
+        loopProps.push_back(startLoc.get());
+    }
+    loopProps.push_back(llvm::MDNode::get(Context, llvm::MDString::get(Context, "llvm.loop.mustprogress")));
+
+    if (attributes.contains("vectorize")) {
+        // `@vectorize(1)` only gets the width, which turns vectorization off
+        if (attributes["vectorize"].is_number()) {
+            addProp("llvm.loop.vectorize.width", getCount("vectorize"));
+        }
+        vectorize = attributes["vectorize"] != 1;
+    }
+    if (vectorize) {
+        addProp("llvm.loop.vectorize.enable", llvm::ConstantInt::getTrue(Context));
+    }
+    if (attributes.contains("interleave")) {
+        addProp("llvm.loop.interleave.count", getCount("interleave"));
+    }
+
+    if (attributes.contains("unroll")) {
+        if (attributes["unroll"] == true) {
+            addProp("llvm.loop.unroll.enable", nullptr);
+        } else if (attributes["unroll"] == 1) {
+            addProp("llvm.loop.unroll.disable", nullptr);
+        } else {
+            addProp("llvm.loop.unroll.count", getCount("unroll"));
+        }
+    }
+
+    llvm::MDNode* loopID = llvm::MDNode::getDistinct(Context, loopProps);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
+/// Attributes the instructions generated next to the source position of `node`
+void emitLocation(llvm::IRBuilder<> &Builder, const nlohmann::json& node) {
+    if (!DbgInfo || DbgInfo->LexicalBlocks.empty() || !node.contains("line")) {
+        return;
+    }
+
+    Builder.SetCurrentDebugLocation(llvm::DILocation::get(
+        Builder.getContext(), node["line"], node.value("col", 0u), DbgInfo->LexicalBlocks.back()
+    ));
+}
+
+llvm::DIType* getDebugType(const std::string& dtype) {
+    auto it = DbgInfo->Types.find(dtype);
+    if (it != DbgInfo->Types.end()) {
+        return it->second;
+    }
+
+    llvm::DIType* type = nullptr;
+    llvm::DIBuilder& DBuilder = *DbgInfo->DBuilder;
+    if (dtype == "I64") {
+        type = DBuilder.createBasicType("int", 64, llvm::dwarf::DW_ATE_signed);
+    } else if (dtype == "U64") {
+        type = DBuilder.createBasicType("uint", 64, llvm::dwarf::DW_ATE_unsigned);
+    } else if (dtype == "I32") {
+        type = DBuilder.createBasicType("i32", 32, llvm::dwarf::DW_ATE_signed);
+    } else if (dtype == "U32") {
+        type = DBuilder.createBasicType("u32", 32, llvm::dwarf::DW_ATE_unsigned);
+    } else if (dtype == "I16") {
+        type = DBuilder.createBasicType("i16", 16, llvm::dwarf::DW_ATE_signed);
+    } else if (dtype == "I8") {
+        type = DBuilder.createBasicType("i8", 8, llvm::dwarf::DW_ATE_signed);
+    } else if (dtype == "U8") {
+        type = DBuilder.createBasicType("byte", 8, llvm::dwarf::DW_ATE_unsigned);
+    } else if (dtype == "F64") {
+        type = DBuilder.createBasicType("float", 64, llvm::dwarf::DW_ATE_float);
+    } else if (dtype == "F32") {
+        type = DBuilder.createBasicType("f32", 32, llvm::dwarf::DW_ATE_float);
+    } else if (dtype == "Bool") {
+        type = DBuilder.createBasicType("bool", 8, llvm::dwarf::DW_ATE_boolean);
+    } else if (dtype == "String") {
+        llvm::DIType* charType = DBuilder.createBasicType("char", 8, llvm::dwarf::DW_ATE_unsigned_char);
+        llvm::Metadata* members[] = {
+            DBuilder.createMemberType(
+                DbgInfo->CompileUnit, "data", DbgInfo->File, 0, 64, 64, 0,
+                llvm::DINode::FlagZero, DBuilder.createPointerType(charType, 64)
+            ),
+            DBuilder.createMemberType(
+                DbgInfo->CompileUnit, "len", DbgInfo->File, 0, 64, 64, 64,
+                llvm::DINode::FlagZero, getDebugType("I64")
+            ),
+            DBuilder.createMemberType(
+                DbgInfo->CompileUnit, "cap", DbgInfo->File, 0, 64, 64, 128,
+                llvm::DINode::FlagZero, getDebugType("I64")
+            ),
+        };
+        type = DBuilder.createStructType(
+            DbgInfo->CompileUnit, "string", DbgInfo->File, 0, 192, 64,
+            llvm::DINode::FlagZero, nullptr, DBuilder.getOrCreateArray(members)
+        );
+    } else if (dtype_is_array(dtype_from_str(dtype))) {
+        llvm::DIType* elementType = getDebugType(dtype.substr(0, dtype.size() - 2));
+        llvm::Metadata* members[] = {
+            DBuilder.createMemberType(
+                DbgInfo->CompileUnit, "data", DbgInfo->File, 0, 64, 64, 0,
+                llvm::DINode::FlagZero, DBuilder.createPointerType(elementType, 64)
+            ),
+            DBuilder.createMemberType(
+                DbgInfo->CompileUnit, "len", DbgInfo->File, 0, 64, 64, 64,
+                llvm::DINode::FlagZero, getDebugType("I64")
+            ),
+            DBuilder.createMemberType(
+                DbgInfo->CompileUnit, "cap", DbgInfo->File, 0, 64, 64, 128,
+                llvm::DINode::FlagZero, getDebugType("I64")
+            ),
+        };
+        type = DBuilder.createStructType(
+            DbgInfo->CompileUnit, elementType->getName().str() + "[]", DbgInfo->File, 0, 192, 64,
+            llvm::DINode::FlagZero, nullptr, DBuilder.getOrCreateArray(members)
+        );
+    } else if (dtype_is_vector(dtype_from_str(dtype))) {
+        BeDataType vector = dtype_from_str(dtype);
+        llvm::DIType* elementType = getDebugType(dtype_to_str(dtype_element(vector)));
+        uint64_t size = dtype_lanes(vector) * elementType->getSizeInBits();
+        llvm::Metadata* subscripts[] = { DBuilder.getOrCreateSubrange(0, dtype_lanes(vector)) };
+        type = DBuilder.createVectorType(size, 0, elementType, DBuilder.getOrCreateArray(subscripts));
+    }
+
+    DbgInfo->Types[dtype] = type;
+    return type;
+}
+
+/// Describes a variable (or a parameter if `argNo` isn't 0) to the debugger. A
+/// mutable variable lives in its alloca, an immutable one is just an SSA value.
+void emitDebugVariable(
+    const std::string& name,
+    const std::string& dtype,
+    llvm::Value* value,
+    bool isMutable,
+    unsigned int argNo,
+    llvm::IRBuilder<> &Builder
+) {
+    if (!DbgInfo || !DbgInfo->emitVariables || DbgInfo->LexicalBlocks.empty()) {
+        return;
+    }
+
+    llvm::DIBuilder& DBuilder = *DbgInfo->DBuilder;
+    llvm::DIScope* scope = DbgInfo->LexicalBlocks.back();
+    llvm::DebugLoc loc = Builder.getCurrentDebugLocation();
+
+    llvm::DILocalVariable* var;
+    if (argNo != 0) {
+        var = DBuilder.createParameterVariable(scope, name, argNo, DbgInfo->File, loc.getLine(), getDebugType(dtype), true);
+    } else {
+        var = DBuilder.createAutoVariable(scope, name, DbgInfo->File, loc.getLine(), getDebugType(dtype));
+    }
+
+    llvm::DILocation* varLoc = llvm::DILocation::get(Builder.getContext(), loc.getLine(), loc.getCol(), scope);
+    if (isMutable) {
+        DBuilder.insertDeclare(value, var, DBuilder.createExpression(), varLoc, Builder.GetInsertBlock());
+    } else {
+        DBuilder.insertDbgValueIntrinsic(value, var, DBuilder.createExpression(), varLoc, Builder.GetInsertBlock());
+    }
+}
+
+
+bool gen_llvm_ir(std::string filepath, nlohmann::json ast, CodeGenOptions const& options) {
     // Initialize the LLVM context and module
     llvm::LLVMContext ContextObj;
     llvm::IRBuilder<> BuilderObj(ContextObj);
     std::unique_ptr<llvm::Module> ModuleObj = std::make_unique<llvm::Module>("truffle_main", ContextObj);
 
+    // Some passes (e.g. profile instrumentation) lower differently per platform
+    std::unique_ptr<llvm::TargetMachine> TargetMachineObj = create_target_machine(options.opt_level, options.cpu);
+    ModuleObj->setTargetTriple(llvm::sys::getDefaultTargetTriple());
+    if (TargetMachineObj) {
+        ModuleObj->setDataLayout(TargetMachineObj->createDataLayout());
+    }
+
     // Create all intrinsic functions
+    AliasInfo = options.alias_info;
     createPrintFunctions(ContextObj, ModuleObj.get());
+    FusePrints = options.fuse_prints;
+    FuseConcats = options.fuse_concats;
+    FastMath = options.fast_math;
+
+    if (options.debug_info != DebugInfoLevel::None) {
+        ModuleObj->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+        ModuleObj->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+
+        llvm::SmallString<128> sourcePath(options.source_path);
+        llvm::sys::fs::make_absolute(sourcePath);
+
+        DbgInfo = std::make_unique<DebugInfo>();
+        DbgInfo->DBuilder = std::make_unique<llvm::DIBuilder>(*ModuleObj);
+        DbgInfo->File = DbgInfo->DBuilder->createFile(
+            llvm::sys::path::filename(sourcePath), llvm::sys::path::parent_path(sourcePath)
+        );
+        DbgInfo->emitVariables = options.debug_info == DebugInfoLevel::Full;
+        DbgInfo->CompileUnit = DbgInfo->DBuilder->createCompileUnit(
+            llvm::dwarf::DW_LANG_C, DbgInfo->File, "truffle compiler", false, "", 0, "",
+            DbgInfo->emitVariables ? llvm::DICompileUnit::FullDebug : llvm::DICompileUnit::LineTablesOnly
+        );
+    }
+
+    if (options.auto_parallel) {
+        std::vector<ParallelLoop> loops = annotate_auto_parallel(ast);
+        if (options.parallel_report) {
+            print_parallel_report(loops, llvm::errs());
+        }
+    }
+
+    if (options.escape_analysis) {
+        std::vector<AllocationSite> sites = analyze_escapes(ast, options.regions, options.fuse_concats);
+        if (options.escape_report) {
+            print_escape_report(sites, llvm::errs());
+        }
+    }
+
+    if (options.bounds_check_elimination) {
+        annotate_bounds_checks(ast);
+    }
+
+    Memory = options.memory_model;
+    CheckMemory = options.check_memory;
+    if (Memory != MemoryModel::Leak) {
+        annotate_drops(ast, Memory == MemoryModel::RefCount);
+    }
+
+    // `-fno-alias-info` leaves out the effects it finds, but `@pure` is still checked
+    MemoryEffects = Memory != MemoryModel::RefCount && !options.profile_generate;
+    if (MemoryEffects) {
+        annotate_memory_effects(ast);
+    }
 
     // Create a symbol table
-    std::map<std::string, llvm::Value*> NamedValues;
+    ValueTable NamedValues;
+    internSymbols(ast, NamedValues);
 
     // Process the AST
     if (ast["type"] == "Module") {
@@ -247,91 +865,399 @@ void gen_llvm_ir(std::string filepath, nlohmann::json ast) {
         std::cout << "Unhandled AST root type: " << ast["type"] << "\n";
     }
 
-    // Output the generated LLVM IR to the specified file
-    std::error_code ECObj;
-    llvm::raw_fd_ostream DestObj(filepath, ECObj, llvm::sys::fs::OF_None);
+    if (DbgInfo) {
+        DbgInfo->DBuilder->finalize();
+        DbgInfo.reset();
+    }
 
-    if (ECObj) {
-        llvm::errs() << "Could not open file: " << ECObj.message() << "\n";
-        return;
+    // Each function was verified on its own, and the errors printed then
+    if (llvm::verifyModule(*ModuleObj)) {
+        llvm::errs() << "Error: not writing invalid IR.\n";
+        return false;
     }
 
-    // Print the module to the file
-    ModuleObj->print(DestObj, nullptr);
+    if (!options.runtime_path.empty() && !link_runtime(ModuleObj.get(), options.runtime_path)) {
+        return false;
+    }
 
-    // Close the file
+    // Keep the CPU in the IR, for when it is compiled by something else
+    if (TargetMachineObj && options.cpu != "generic") {
+        for (llvm::Function& function : *ModuleObj) {
+            if (!function.isDeclaration()) {
+                // Features of `@target` come last, so they win
+                std::string features = TargetMachineObj->getTargetFeatureString().str();
+                if (function.hasFnAttribute("target-features")) {
+                    features += "," + function.getFnAttribute("target-features").getValueAsString().str();
+                }
+                function.addFnAttr("target-cpu", TargetMachineObj->getTargetCPU());
+                function.addFnAttr("target-features", features);
+            }
+        }
+    }
+
+    run_profile_passes(ModuleObj.get(), options);
+    optimize_module(ModuleObj.get(), TargetMachineObj.get(), options);
+    apply_profile_layout(ModuleObj.get());
+
+    if (options.emit_object) {
+        if (!TargetMachineObj) {
+            llvm::errs() << "Error: no target to emit an object file for.\n";
+            return false;
+        }
+        return emit_object_file(ModuleObj.get(), TargetMachineObj.get(), filepath);
+    }
+
+    // Output the generated LLVM IR to the specified file
+    std::error_code ECObj;
+    llvm::raw_fd_ostream DestObj(filepath, ECObj, llvm::sys::fs::OF_None);
+
+    if (ECObj) {
+        llvm::errs() << "Could not open file: " << ECObj.message() << "\n";
+        return false;
+    }
+
+    // Print the module to the file
+    ModuleObj->print(DestObj, nullptr);
+
+    // Close the file
     DestObj.flush();  // Ensure the file is written to disk
+    return true;
 }
 
 // New helper function to process functions
 void processFunction(
     const nlohmann::json& funcAst,
     llvm::IRBuilder<> &BuilderObj,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &ContextObj,
     llvm::Module *ModuleObj
 ) {
-    // Create a new symbol table
-    // std::map<std::string, llvm::Value*> NamedValues;
-
-
     // Extract function name, parameters, return type, and code block
     std::string funcName = funcAst["name"];
-    std::vector<std::string> parameters = funcAst["parameters"];
+    nlohmann::json parameters = funcAst["parameters"];
     std::string retTypeStr = funcAst["ret-type"];
     nlohmann::json codeBlock = funcAst["code-block"];
 
     // Create the function type
     llvm::Type* retType = getLLVMType(retTypeStr, ContextObj);
 
+    // `fn main()` is the process entry point, so it has to give the OS an exit code
+    if (funcName == "main" && retType->isVoidTy()) {
+        retType = llvm::Type::getInt32Ty(ContextObj);
+    }
+
     std::vector<llvm::Type*> paramTypes;
     for (auto& param : parameters) {
-        llvm::Type* paramType = getLLVMType(param, ContextObj);
+        llvm::Type* paramType = getLLVMType(param["dtype"], ContextObj);
         paramTypes.push_back(paramType);
     }
+
+    // A returned buffer is built in the region the caller passes last (or on
+    // the heap if that's null)
+    bool hasCallerRegion = isBufferType(retType, ContextObj);
+    if (hasCallerRegion) {
+        paramTypes.push_back(llvm::Type::getInt8PtrTy(ContextObj));
+    }
     llvm::FunctionType *funcType = llvm::FunctionType::get(retType, paramTypes, false);
     llvm::Function *function = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, funcName, ModuleObj);
 
-    // Set names for all arguments (if any).
-    unsigned idx = 0;
-    for (llvm::Function::arg_iterator AI = function->arg_begin(); idx != parameters.size(); ++AI, ++idx) {
-        AI->setName("arg" + std::to_string(idx));
+    // See `annotate_memory_effects`
+    nlohmann::json attributes = funcAst.value("attributes", nlohmann::json::object());
+    if (funcAst.contains("memory") && AliasInfo) {
+        function->addFnAttr(funcAst["memory"] == "none" ? llvm::Attribute::ReadNone : llvm::Attribute::ReadOnly);
+        function->addFnAttr(llvm::Attribute::NoFree);
+        function->addFnAttr(llvm::Attribute::NoSync);
+        if (funcAst.value("will-return", false)) {
+            function->addFnAttr(llvm::Attribute::WillReturn);
+        }
+    }
+    else if (attributes.contains("pure") && MemoryEffects) {
+        // Taken at its word (see `parse_function`; `annotate_memory_effects`
+        // dropped it if a callee breaks it), but it may still allocate and
+        // free buffers of its own
+        bool readsArrays = std::any_of(paramTypes.begin(), paramTypes.end(), isArrayType);
+        function->addFnAttr(readsArrays ? llvm::Attribute::ReadOnly : llvm::Attribute::ReadNone);
     }
+    addFunctionAttributes(function, attributes);
+
+    // Every float operation of the function gets its fast-math flags
+    BuilderObj.setFastMathFlags(getFastMathFlags(attributes));
 
     // Create a new basic block to start insertion into
     llvm::BasicBlock *BB = llvm::BasicBlock::Create(ContextObj, "entry", function);
     BuilderObj.SetInsertPoint(BB);
 
+    llvm::DISubprogram *subprogram = nullptr;
+    if (DbgInfo) {
+        unsigned int line = funcAst.value("line", 0u);
+
+        llvm::SmallVector<llvm::Metadata*, 8> debugTypes;
+        debugTypes.push_back(retTypeStr == "Null" ? nullptr : getDebugType(retTypeStr));
+        for (auto& param : parameters) {
+            debugTypes.push_back(getDebugType(param["dtype"]));
+        }
+
+        subprogram = DbgInfo->DBuilder->createFunction(
+            DbgInfo->File, funcName, funcName, DbgInfo->File, line,
+            DbgInfo->DBuilder->createSubroutineType(DbgInfo->DBuilder->getOrCreateTypeArray(debugTypes)),
+            line, llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition
+        );
+        function->setSubprogram(subprogram);
+
+        DbgInfo->LexicalBlocks.push_back(subprogram);
+        BuilderObj.SetCurrentDebugLocation(llvm::DILocation::get(ContextObj, line, funcAst.value("col", 0u), subprogram));
+    }
+
+    // Parameters live in their own scope, so nothing leaks into the next function
+    NamedValues.push_scope();
+    BufferVariables.clear();
+
+    CallerRegion = nullptr;
+    if (hasCallerRegion) {
+        CallerRegion = function->getArg(parameters.size());
+        CallerRegion->setName("caller.region");
+    }
+    FunctionRegion = funcAst.value("function-region", false) ? createRegion(function, "fn.region") : nullptr;
+    LoopRegions.clear();
+    KnownParts.clear();
+    ArrayParameters.clear();
+
+    // Immutable arguments are used directly, the others are spilled into allocas
+    unsigned idx = 0;
+    for (llvm::Function::arg_iterator AI = function->arg_begin(); idx != parameters.size(); ++AI, ++idx) {
+        std::string paramName = parameters[idx]["name"];
+        bool isMutable = parameters[idx].value("mutable", true);
+        AI->setName(paramName);
+
+        ValueBinding binding{ &*AI, false };
+        if (isMutable) {
+            llvm::AllocaInst *alloca = createEntryBlockAlloca(function, AI->getType(), paramName);
+            BuilderObj.CreateStore(&*AI, alloca);
+            binding = ValueBinding{ alloca, true };
+        }
+
+        NamedValues.bind(symbolOf(parameters[idx], NamedValues), binding);
+        if (parameters[idx].contains("var-id")) {
+            BufferVariables.emplace(parameters[idx]["var-id"].get<size_t>(), binding);
+            if (isArrayType(AI->getType())) {
+                ArrayParameters.insert(parameters[idx]["var-id"].get<size_t>());
+            }
+        }
+        emitDebugVariable(paramName, parameters[idx]["dtype"], binding.value, isMutable, idx + 1, BuilderObj);
+    }
+
     // Process the code block
     processCodeBlock(codeBlock, BuilderObj, NamedValues, ContextObj, ModuleObj);
+    NamedValues.pop_scope();
 
-    // For now, create a default return instruction
-    if (retType->isVoidTy()) {
-        BuilderObj.CreateRetVoid();
-    } else {
-        // You might want to modify this to return the actual return value
-        llvm::Value *retValue = llvm::ConstantInt::get(retType, 0);
-        BuilderObj.CreateRet(retValue);
+    // Fall off the end of the function with a default return
+    if (!BuilderObj.GetInsertBlock()->getTerminator()) {
+        if (subprogram && codeBlock.contains("end-line")) {
+            BuilderObj.SetCurrentDebugLocation(llvm::DILocation::get(ContextObj, codeBlock["end-line"], 1, subprogram));
+        }
+        emitRegionReleases(BuilderObj, ModuleObj);
+
+        if (retType->isVoidTy()) {
+            BuilderObj.CreateRetVoid();
+        } else {
+            BuilderObj.CreateRet(llvm::Constant::getNullValue(retType));
+        }
+    }
+
+    if (subprogram) {
+        DbgInfo->LexicalBlocks.clear();
+        DbgInfo->DBuilder->finalizeSubprogram(subprogram);
+        BuilderObj.SetCurrentDebugLocation(llvm::DebugLoc());
+    }
+
+    if (attributes.contains("flatten")) {
+        flattenCalls(function);
     }
 
     // Verify the function
-    llvm::verifyFunction(*function);
+    if (llvm::verifyFunction(*function, &llvm::errs())) {
+        llvm::errs() << "Error: generated invalid IR for function '" << funcName << "'.\n";
+    }
+}
+
+/// `@target("avx2,no-fma")` as LLVM's `"+avx2,-fma"`
+std::string getTargetFeatures(const std::string& attribute) {
+    std::string features;
+    llvm::SmallVector<llvm::StringRef, 4> names;
+    llvm::StringRef(attribute).split(names, ',', -1, false);
+    for (llvm::StringRef name : names) {
+        name = name.trim();
+        if (!features.empty()) {
+            features += ",";
+        }
+        if (name.consume_front("no-")) {
+            features += "-" + name.str();
+        } else if (name.startswith("+") || name.startswith("-")) {
+            features += name.str();
+        } else {
+            features += "+" + name.str();
+        }
+    }
+    return features;
+}
+
+/// Maps the attributes of a function (see `parse_function`) other than
+/// `@pure` and `@flatten` to LLVM's
+void addFunctionAttributes(llvm::Function* function, const nlohmann::json& attributes) {
+    if (attributes.contains("inline")) {
+        function->addFnAttr(llvm::Attribute::AlwaysInline);
+    }
+    if (attributes.contains("noinline")) {
+        function->addFnAttr(llvm::Attribute::NoInline);
+    }
+    // The same sections `apply_profile_layout` puts functions a profile found hot or cold in
+    if (attributes.contains("hot")) {
+        function->addFnAttr(llvm::Attribute::Hot);
+        function->setSectionPrefix("hot");
+    }
+    if (attributes.contains("cold")) {
+        function->addFnAttr(llvm::Attribute::Cold);
+        function->addFnAttr(llvm::Attribute::OptimizeForSize);
+        function->setSectionPrefix("unlikely");
+    }
+    if (attributes.contains("target")) {
+        function->addFnAttr("target-features", getTargetFeatures(attributes["target"]));
+    }
+
+    // The flags are on the instructions, but the backend only looks at these
+    llvm::FastMathFlags fastMath = getFastMathFlags(attributes);
+    if (fastMath.isFast()) {
+        function->addFnAttr("unsafe-fp-math", "true");
+    }
+    if (fastMath.noNaNs()) {
+        function->addFnAttr("no-nans-fp-math", "true");
+    }
+    if (fastMath.noInfs()) {
+        function->addFnAttr("no-infs-fp-math", "true");
+    }
+    if (fastMath.noSignedZeros()) {
+        function->addFnAttr("no-signed-zeros-fp-math", "true");
+    }
+}
+
+/// What LLVM may assume about the float math of a function: what its
+/// `@fastmath` names (see `parse_function`), everything for a bare
+/// `@fastmath`, or with `-ffast-math` for functions without the attribute
+llvm::FastMathFlags getFastMathFlags(const nlohmann::json& attributes) {
+    llvm::FastMathFlags flags;
+    nlohmann::json fastMath = attributes.value("fastmath", nlohmann::json(FastMath));
+    if (fastMath.is_boolean()) {
+        flags.setFast(fastMath.get<bool>());
+        return flags;
+    }
+    for (const auto& name : fastMath) {
+        if (name == "reassoc") flags.setAllowReassoc();
+        if (name == "contract") flags.setAllowContract();
+        if (name == "nnan") flags.setNoNaNs();
+        if (name == "ninf") flags.setNoInfs();
+        if (name == "nsz") flags.setNoSignedZeros();
+        if (name == "arcp") flags.setAllowReciprocal();
+    }
+    return flags;
+}
+
+/// `@flatten`: asks the inliner to inline every function `function` calls,
+/// but not the runtime (which is linked in later) or `function` itself
+void flattenCalls(llvm::Function* function) {
+    for (llvm::BasicBlock& block : *function) {
+        for (llvm::Instruction& inst : block) {
+            llvm::CallInst* call = llvm::dyn_cast<llvm::CallInst>(&inst);
+            llvm::Function* callee = call ? call->getCalledFunction() : nullptr;
+            if (!callee || callee == function || callee->isIntrinsic() || callee->getName().startswith("__compiler_reserved")) {
+                continue;
+            }
+            call->addFnAttr(llvm::Attribute::AlwaysInline);
+        }
+    }
+}
+
+/// Interns every variable name in `node` (see `ValueTable`) and keeps its id
+/// on the node that names it as `"symbol-id"`: `Variable`s, parameters,
+/// declarations and assignments (of `"dst"`), the variable of a `ForLoop` and
+/// reduction variables. Code gen then looks variables up by id, without
+/// hashing their names again.
+void internSymbols(nlohmann::json& node, ValueTable& NamedValues) {
+    if (node.is_array()) {
+        for (auto& child : node) {
+            internSymbols(child, NamedValues);
+        }
+        return;
+    }
+    if (!node.is_object()) {
+        return;
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "Variable" && node.contains("name")) {
+        node["symbol-id"] = NamedValues.intern(node["name"]);
+    }
+    else if (type == "DeclarationStatement" || type == "AssignmentStatement" || type == "ElementAssignmentStatement") {
+        node["symbol-id"] = NamedValues.intern(node["dst"]);
+    }
+    else if (type == "ForLoop") {
+        node["symbol-id"] = NamedValues.intern(node["variable"]);
+        if (node.contains("reductions")) {
+            for (auto& reduction : node["reductions"]) {
+                reduction["symbol-id"] = NamedValues.intern(reduction["name"]);
+            }
+        }
+    }
+    else if (type == "Function") {
+        for (auto& param : node["parameters"]) {
+            param["symbol-id"] = NamedValues.intern(param["name"]);
+        }
+    }
+
+    for (auto& [key, child] : node.items()) {
+        internSymbols(child, NamedValues);
+    }
 }
 
+/// The id of the variable `node` names (see `internSymbols`). The few nodes
+/// code gen makes up itself don't have one yet, so their name is interned.
+SymbolId symbolOf(const nlohmann::json& node, ValueTable& NamedValues) {
+    auto id = node.find("symbol-id");
+    if (id != node.end()) {
+        return id->get<SymbolId>();
+    }
+    for (const char* key : { "dst", "variable", "name" }) {
+        if (node.contains(key)) {
+            return NamedValues.intern(node[key]);
+        }
+    }
+    return NamedValues.intern("");
+}
 
 llvm::Type* getLLVMType(const std::string& dtype, llvm::LLVMContext &Context) {
-    if (dtype == "I64") {
+    if (dtype == "I64" || dtype == "U64") {
         return llvm::Type::getInt64Ty(Context);
-    } else if (dtype == "I32") {
+    } else if (dtype == "I32" || dtype == "U32") {
         return llvm::Type::getInt32Ty(Context);
+    } else if (dtype == "I16") {
+        return llvm::Type::getInt16Ty(Context);
+    } else if (dtype == "I8" || dtype == "U8") {
+        return llvm::Type::getInt8Ty(Context);
     } else if (dtype == "F64") {
         return llvm::Type::getDoubleTy(Context);
     } else if (dtype == "F32") {
         return llvm::Type::getFloatTy(Context);
     } else if (dtype == "Bool") {
         return llvm::Type::getInt1Ty(Context);
+    } else if (dtype == "String") {
+        return getStringType(Context);
     } else if (dtype == "Null") {
         return llvm::Type::getVoidTy(Context);
+    } else if (dtype.size() > 2 && dtype.compare(dtype.size() - 2, 2, "[]") == 0) {
+        return getArrayType(dtype, Context);
+    } else if (dtype_is_vector(dtype_from_str(dtype))) {
+        // Vectors wider than the target's registers are split up by instruction selection
+        BeDataType vector = dtype_from_str(dtype);
+        return llvm::FixedVectorType::get(getLLVMType(dtype_to_str(dtype_element(vector)), Context), dtype_lanes(vector));
     } else {
         llvm::errs() << "Error: Unsupported data type '" << dtype << "'.\n";
         return nullptr;
@@ -342,32 +1268,91 @@ llvm::Type* getLLVMType(const std::string& dtype, llvm::LLVMContext &Context) {
 void processCodeBlock(
     const nlohmann::json& codeBlock, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 ) {
-    for (const auto& stmtJson : codeBlock["statements"]) {
-        processStatement(stmtJson, Builder, NamedValues, Context, Module);
+    NamedValues.push_scope();
+
+    // Variables declared in the block are only visible to the debugger inside of it
+    bool hasLexicalBlock = DbgInfo && DbgInfo->emitVariables && Builder.getCurrentDebugLocation();
+    if (hasLexicalBlock) {
+        llvm::DebugLoc loc = Builder.getCurrentDebugLocation();
+        DbgInfo->LexicalBlocks.push_back(DbgInfo->DBuilder->createLexicalBlock(
+            DbgInfo->LexicalBlocks.back(), DbgInfo->File, loc.getLine(), loc.getCol()
+        ));
+    }
+
+    emitDrops(codeBlock, "drop-on-entry", Builder, Module);
+
+    const nlohmann::json& statements = codeBlock["statements"];
+    for (size_t i = 0; i < statements.size(); i++) {
+        // Anything after a return is unreachable
+        if (Builder.GetInsertBlock()->getTerminator()) {
+            break;
+        }
+
+        size_t runEnd = i;
+        while (FusePrints && runEnd < statements.size() && isFusablePrint(statements[runEnd])) {
+            runEnd++;
+        }
+        if (runEnd - i >= 2) {
+            runEnd = processPrintSequence(statements, i, runEnd, Builder, NamedValues, Context, Module);
+            i = runEnd - 1;
+            continue;
+        }
+
+        processStatement(statements[i], Builder, NamedValues, Context, Module);
+    }
+
+    if (hasLexicalBlock) {
+        DbgInfo->LexicalBlocks.pop_back();
     }
+    NamedValues.pop_scope();
 }
 
 void processStatement(const nlohmann::json& stmt, llvm::IRBuilder<> &Builder,
-                      std::map<std::string, llvm::Value*> &NamedValues,
+                      ValueTable &NamedValues,
                       llvm::LLVMContext &Context, llvm::Module *Module) {
     std::string stmtType = stmt["type"];
+    emitLocation(Builder, stmt);
+    CurrentLine = stmt.value("line", CurrentLine);
 
     if (stmtType == "DeclarationStatement") {
         processDeclarationStatement(stmt, Builder, NamedValues, Context, Module);
+        emitDrops(stmt, "drop", Builder, Module);
     } 
     else if (stmtType == "AssignmentStatement") {
         processAssignmentStatement(stmt, Builder, NamedValues, Context, Module);
+        emitDrops(stmt, "drop", Builder, Module);
+    }
+    else if (stmtType == "ElementAssignmentStatement") {
+        processElementAssignment(stmt, Builder, NamedValues, Context, Module);
+        emitDrops(stmt, "drop", Builder, Module);
     }
     else if (stmtType == "FunctionCall") {
-        processFunctionCall(stmt, Builder, NamedValues, Context, Module);
+        // Nothing else is going to free a buffer that is returned and ignored
+        llvm::Value* result = processFunctionCall(stmt, Builder, NamedValues, Context, Module);
+        if (result && isBufferType(result->getType(), Context)) {
+            emitDrop(result, Builder, Module);
+        }
+        emitDrops(stmt, "drop", Builder, Module);
     }
     else if (stmtType == "ReturnStatement") {
         processReturn(stmt, Builder, NamedValues, Context, Module);
     }
+    else if (stmtType == "IfBlock") {
+        processIfBlock(stmt, Builder, NamedValues, Context, Module);
+    }
+    else if (stmtType == "Loop") {
+        processLoop(stmt, Builder, NamedValues, Context, Module);
+    }
+    else if (stmtType == "ForLoop" && stmt.value("parallel", false)) {
+        processParallelForLoop(stmt, Builder, NamedValues, Context, Module);
+    }
+    else if (stmtType == "ForLoop") {
+        processForLoop(stmt, Builder, NamedValues, Context, Module);
+    }
     else {
         std::cout << "Warning, unhandled statement type: " << stmtType << "\n\n";
     }
@@ -376,7 +1361,7 @@ void processStatement(const nlohmann::json& stmt, llvm::IRBuilder<> &Builder,
 void processDeclarationStatement(
     const nlohmann::json& stmt, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 ) {
@@ -384,21 +1369,54 @@ void processDeclarationStatement(
     std::string dtypeStr = stmt["dtype"];
     nlohmann::json src = stmt["src"];
 
+    // Evaluated before the binding exists, so `int x = x + 1` refers to an outer `x`
+    llvm::Value *initValue = processExpression(src, Builder, NamedValues, Context, Module);
+    if (!initValue) {
+        llvm::errs() << "Error processing initial value of '" << varName << "'.\n";
+        return;
+    }
+    if (isArrayType(initValue->getType())) {
+        initValue = emitArrayTransfer(stmt, initValue, Builder, Module);
+    } else if (stmt.value("copy", false)) {
+        initValue = emitCopy(initValue, Builder, Module);
+    }
+
+    // An immutable variable is just a name for its initial value, so it never touches memory
+    if (!stmt.value("mutable", true)) {
+        if (initValue->getType()->isVoidTy()) {
+            llvm::errs() << "Error: '" << varName << "' is initialized with a function that returns nothing.\n";
+            return;
+        }
+        if (!initValue->hasName() && !llvm::isa<llvm::Constant>(initValue)) {
+            initValue->setName(varName);
+        }
+        NamedValues.bind(symbolOf(stmt, NamedValues), ValueBinding{ initValue, false });
+        if (stmt.contains("var-id")) {
+            BufferVariables.emplace(stmt["var-id"].get<size_t>(), ValueBinding{ initValue, false });
+        }
+        emitDebugVariable(varName, dtypeStr, initValue, false, 0, Builder);
+        return;
+    }
+
     llvm::Type *varType = getLLVMType(dtypeStr, Context);
-    llvm::AllocaInst *alloca = Builder.CreateAlloca(varType, nullptr, varName);
+    llvm::Function *function = Builder.GetInsertBlock()->getParent();
+    llvm::AllocaInst *alloca = createEntryBlockAlloca(function, varType, varName);
 
     // Store the initial value
-    llvm::Value *initValue = processExpression(src, Builder, NamedValues, Context, Module);
     Builder.CreateStore(initValue, alloca);
 
     // Add the variable to the symbol table
-    NamedValues[varName] = alloca;
+    NamedValues.bind(symbolOf(stmt, NamedValues), ValueBinding{ alloca, true });
+    if (stmt.contains("var-id")) {
+        BufferVariables.emplace(stmt["var-id"].get<size_t>(), ValueBinding{ alloca, true });
+    }
+    emitDebugVariable(varName, dtypeStr, alloca, true, 0, Builder);
 }
 
 void processAssignmentStatement(
     const nlohmann::json& stmt, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 ) {
@@ -406,26 +1424,62 @@ void processAssignmentStatement(
     nlohmann::json src = stmt["src"];
 
     // Check that the variable has been declared
-    if (NamedValues.find(varName) == NamedValues.end()) {
+    std::optional<ValueBinding> binding = NamedValues.get(symbolOf(stmt, NamedValues));
+    if (!binding.has_value()) {
         // Variable not found
         // Handle error
         llvm::errs() << "Undefined variable: " << varName << "\n";
         return;
     }
+    if (!binding->is_mutable) {
+        llvm::errs() << "Cannot assign to immutable variable: " << varName << "\n";
+        return;
+    }
 
-    llvm::AllocaInst *alloca = static_cast<llvm::AllocaInst*>(NamedValues[varName]);
+    llvm::AllocaInst *alloca = static_cast<llvm::AllocaInst*>(binding->value);
+
+    // `s = s + t` can append to the buffer of `s` if nothing else owns it
+    bool appends = FuseConcats && stmt.value("drop-old", false) && Memory == MemoryModel::AutoFree && isStringConcat(src);
+    if (appends) {
+        nlohmann::json const* first = &src;
+        while (isStringConcat(*first)) {
+            first = &(*first)["left-operand"];
+        }
+        appends = (*first)["type"] == "Variable" && first->contains("var-id") && stmt.contains("dst-id")
+            && (*first)["var-id"] == stmt["dst-id"];
+    }
 
     // Compute the new value
-    llvm::Value *newValue = processExpression(src, Builder, NamedValues, Context, Module);
+    llvm::Value *newValue = nullptr;
+    if (appends) {
+        llvm::Value* oldValue = Builder.CreateLoad(alloca->getAllocatedType(), alloca, varName + "_old");
+        newValue = processStringConcat(src, Builder, NamedValues, Context, Module, oldValue);
+    } else {
+        newValue = processExpression(src, Builder, NamedValues, Context, Module);
+    }
+    if (!newValue) {
+        llvm::errs() << "Error processing value assigned to '" << varName << "'.\n";
+        return;
+    }
+    if (isArrayType(newValue->getType())) {
+        newValue = emitArrayTransfer(stmt, newValue, Builder, Module);
+    } else if (stmt.value("copy", false)) {
+        newValue = emitCopy(newValue, Builder, Module);
+    }
+
+    // The new value was computed from the old one, which is dead now
+    if (stmt.value("drop-old", false) && !appends) {
+        emitDrop(Builder.CreateLoad(alloca->getAllocatedType(), alloca, varName + "_old"), Builder, Module);
+    }
 
     // Store the new value
     Builder.CreateStore(newValue, alloca);
 }
 
-void processFunctionCall(
+llvm::Value* processFunctionCall(
     const nlohmann::json& functionCall, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*>& NamedValues, 
+    ValueTable &NamedValues, 
     llvm::LLVMContext& Context, 
     llvm::Module* Module
 ) {
@@ -433,57 +1487,159 @@ void processFunctionCall(
 
     // Process parameters
     std::vector<llvm::Value*> args;
+    std::vector<llvm::Value*> temporaries;
     for (const auto& param : functionCall["parameters"]) {
         llvm::Value* argValue = processExpression(param, Builder, NamedValues, Context, Module);
         if (!argValue) {
             llvm::errs() << "Error processing argument in function call.\n";
-            return;
+            return nullptr;
         }
         args.push_back(argValue);
+        if (isTemporary(param)) {
+            temporaries.push_back(argValue);
+        }
+    }
+
+    // Buffers built just for this call die with it
+    auto dropTemporaries = [&]() {
+        for (llvm::Value* temporary : temporaries) {
+            emitDrop(temporary, Builder, Module);
+        }
+    };
+
+    if (isVectorBuiltin(functionCall)) {
+        llvm::Value* result = processVectorBuiltin(functionCall, args, Builder, Module);
+        dropTemporaries();
+        return result;
     }
 
     if (functionName == "print") {
         // Handle built-in 'print' function
         if (args.size() != 1) {
             llvm::errs() << "Error: 'print' function expects one argument.\n";
-            return;
+            return nullptr;
         }
 
         llvm::Value* arg = args[0];
-        llvm::Function* printFunc = nullptr;
+        std::string printFuncName;
 
         if (arg->getType()->isIntegerTy(64)) {
-            // Use the printInt function
-            printFunc = Module->getFunction("__compiler_reserved_print_int");
-            if (!printFunc) {
-                llvm::errs() << "Error: '__compiler_reserved_print_int' function not found.\n";
-                return;
-            }
+            bool isUnsigned = functionCall["parameters"][0].value("dtype", "") == "U64";
+            printFuncName = isUnsigned ? "__compiler_reserved_print_uint" : "__compiler_reserved_print_int";
         } 
         else if (arg->getType()->isIntegerTy(1)) {
-            // Use the printBool function
-            printFunc = Module->getFunction("__compiler_reserved_print_bool");
-            if (!printFunc) {
-                llvm::errs() << "Error: '__compiler_reserved_print_bool' function not found.\n";
-                return;
-            }
+            printFuncName = "__compiler_reserved_print_bool";
         } 
         else if (arg->getType()->isDoubleTy()) {
-            // Use the printFloat function
-            printFunc = Module->getFunction("__compiler_reserved_print_float");
-            if (!printFunc) {
-                llvm::errs() << "Error: '__compiler_reserved_print_float' function not found.\n";
-                return;
-            }
+            printFuncName = "__compiler_reserved_print_float";
+        }
+        else if (arg->getType() == getStringType(Context)) {
+            StringParts str = emitStringParts(arg, Builder);
+            llvm::Value* call = Builder.CreateCall(Module->getFunction("__compiler_reserved_print_str"), { str.data, str.len });
+            dropTemporaries();
+            return call;
         }
         else {
             llvm::errs() << "Error: Unsupported type for 'print' function.\n";
-            return;
+            return nullptr;
+        }
+
+        llvm::Function* printFunc = Module->getFunction(printFuncName);
+        if (!printFunc) {
+            llvm::errs() << "Error: '" << printFuncName << "' function not found.\n";
+            return nullptr;
         }
 
         // Create the function call to the appropriate print function
-        Builder.CreateCall(printFunc, { arg });
-    } else {
+        return Builder.CreateCall(printFunc, { arg });
+    }
+    else if (functionName == "flush") {
+        // Hands everything printed so far (by this thread) to the OS
+        if (!args.empty()) {
+            llvm::errs() << "Error: 'flush' function expects no arguments.\n";
+            return nullptr;
+        }
+        return Builder.CreateCall(Module->getFunction("__compiler_reserved_flush"));
+    }
+    else if (functionName == "likely" || functionName == "unlikely") {
+        // LLVM turns the expectation into the weights of the branch on the result
+        if (args.size() != 1 || !args[0]->getType()->isIntegerTy(1)) {
+            llvm::errs() << "Error: '" << functionName << "' function expects one bool argument.\n";
+            return nullptr;
+        }
+        llvm::Value* expected = Builder.getInt1(functionName == "likely");
+        return Builder.CreateIntrinsic(llvm::Intrinsic::expect, { Builder.getInt1Ty() }, { args[0], expected }, nullptr, functionName);
+    }
+    else if (functionName == "prefetch") {
+        // `prefetch(a, i[, locality])` starts loading `a[i]` into the caches,
+        // to be read soon. It never fails, not even out of bounds, so there is
+        // no bounds check. The locality goes from 0 (read once) to 3 (keep in
+        // every cache), like `__builtin_prefetch`.
+        if ((args.size() != 2 && args.size() != 3) || !isArrayType(args[0]->getType()) || !args[1]->getType()->isIntegerTy(64)) {
+            llvm::errs() << "Error: 'prefetch' function expects an array, an index and optionally a locality.\n";
+            return nullptr;
+        }
+        uint64_t locality = 3;
+        if (args.size() == 3) {
+            locality = llvm::cast<llvm::ConstantInt>(args[2])->getZExtValue();
+        }
+
+        llvm::Value* data = Builder.CreateExtractValue(args[0], 0, "data");
+        llvm::Value* ptr = Builder.CreateGEP(getArrayElementType(args[0]->getType()), data, args[1], "prefetch.ptr");
+        llvm::Value* call = Builder.CreateIntrinsic(llvm::Intrinsic::prefetch, { Builder.getInt8PtrTy() }, {
+            Builder.CreateBitCast(ptr, Builder.getInt8PtrTy()), Builder.getInt32(0), Builder.getInt32(locality), Builder.getInt32(1)
+        });
+        dropTemporaries();
+        return call;
+    }
+    else if (functionName == "len") {
+        if (args.size() != 1 || !isBufferType(args[0]->getType(), Context)) {
+            llvm::errs() << "Error: 'len' function expects one string or array argument.\n";
+            return nullptr;
+        }
+        llvm::Value* len = isArrayType(args[0]->getType())
+            ? Builder.CreateExtractValue(args[0], 1, "len")
+            : emitStringLength(args[0], Builder);
+        dropTemporaries();
+        return len;
+    }
+    else if (functionName == "slice") {
+        // `slice(s, start, end)` is the bytes of `s` in [start, end). Both
+        // bounds are clamped to the string, so it never fails.
+        if (args.size() != 3 || args[0]->getType() != getStringType(Context)
+            || !args[1]->getType()->isIntegerTy(64) || !args[2]->getType()->isIntegerTy(64)) {
+            llvm::errs() << "Error: 'slice' function expects a string and two integers.\n";
+            return nullptr;
+        }
+
+        StringParts src = emitStringParts(args[0], Builder);
+        llvm::Value* zero = Builder.getInt64(0);
+        llvm::Value* end = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, args[2], src.len);
+        end = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::smax, end, zero, nullptr, "slice.end");
+        llvm::Value* start = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, args[1], end);
+        start = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::smax, start, zero, nullptr, "slice.start");
+
+        StringParts part{
+            Builder.CreateInBoundsGEP(Builder.getInt8Ty(), src.data, start, "slice.data"),
+            Builder.CreateSub(end, start, "slice.len", true, true)
+        };
+        llvm::Value* view = llvm::UndefValue::get(getStringType(Context));
+        view = Builder.CreateInsertValue(view, part.data, 0);
+        view = Builder.CreateInsertValue(view, part.len, 1);
+        view = Builder.CreateInsertValue(view, zero, 2, "slice.view");
+        KnownParts[view] = part;
+
+        // A view shares the bytes of `s`, which AutoFree keeps alive for as
+        // long as the view (see `annotate_drops`). A short slice is copied
+        // anyway, since `s` may be a small string that only lives in a register.
+        bool isView = Memory == MemoryModel::Leak || (Memory == MemoryModel::AutoFree && functionCall.value("view", false));
+        llvm::Value* result = isView
+            ? emitBySize(part.len, [&]() { return emitSmallString({ part }, part.len, Builder); }, [&]() { return view; }, Builder)
+            : emitClone(view, Builder, Module);
+        dropTemporaries();
+        return result;
+    }
+    else {
         // Handle user-defined or external functions
         llvm::Function* calleeFunction = Module->getFunction(functionName);
         if (!calleeFunction) {
@@ -501,15 +1657,57 @@ void processFunctionCall(
             );
         }
 
+        // Functions that return a buffer take the region to build it in last
+        size_t numHidden = isBufferType(calleeFunction->getReturnType(), Context) ? 1 : 0;
+        if (calleeFunction->arg_size() != args.size() + numHidden) {
+            llvm::errs() << "Error: '" << functionName << "' expects " << calleeFunction->arg_size() - numHidden
+                         << " arguments but " << args.size() << " were given.\n";
+            return nullptr;
+        }
+
+        // With AutoFree the callee borrows its string and array arguments and
+        // the caller keeps ownership. With reference counting the callee gets
+        // a reference of its own: temporaries are handed over, variables are
+        // retained. Either way an array argument is the caller's array, not a copy.
+        if (Memory != MemoryModel::Leak) {
+            for (size_t i = 0; i < args.size(); i++) {
+                if (!isBufferType(args[i]->getType(), Context)) {
+                    continue;
+                }
+                if (Memory == MemoryModel::AutoFree && isArrayType(args[i]->getType())) {
+                    args[i] = Builder.CreateInsertValue(args[i], Builder.getInt64(0), 2, "borrow");
+                } else if (Memory == MemoryModel::AutoFree) {
+                    // A small string doesn't own anything, and its `cap` holds some of its bytes
+                    llvm::Value* cap = Builder.CreateExtractValue(args[i], 2);
+                    cap = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::smin, cap, Builder.getInt64(0));
+                    args[i] = Builder.CreateInsertValue(args[i], cap, 2, "borrow");
+                } else if (!isTemporary(functionCall["parameters"][i])) {
+                    args[i] = emitCopy(args[i], Builder, Module);
+                }
+            }
+            if (Memory == MemoryModel::RefCount) {
+                temporaries.clear();
+            }
+        }
+
+        if (numHidden) {
+            llvm::Value* region = getRegion(functionCall);
+            args.push_back(region ? region : llvm::ConstantPointerNull::get(Builder.getInt8PtrTy()));
+        }
+
         // Create the function call
-        Builder.CreateCall(calleeFunction, args);
+        llvm::CallInst* call = calleeFunction->getReturnType()->isVoidTy()
+            ? Builder.CreateCall(calleeFunction, args)
+            : Builder.CreateCall(calleeFunction, args, functionName + "_call");
+        dropTemporaries();
+        return call;
     }
 }
 
 void processReturn(
     const nlohmann::json& returnStmt, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues, 
+    ValueTable &NamedValues, 
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 ) {
@@ -533,28 +1731,71 @@ void processReturn(
             return;
         }
 
+        // The caller owns what it gets back, so a borrowed value is copied. So
+        // is an array parameter, the caller still has it (with reference
+        // counting the parameter's own reference dies here).
+        const nlohmann::json& value = returnStmt["value"];
+        bool returnsParameter = isArrayType(returnType) && value["type"] == "Variable"
+            && (!value.contains("var-id") || ArrayParameters.count(value["var-id"].get<size_t>()));
+        if (returnStmt.value("clone", false) || returnsParameter) {
+            llvm::Value* clone = emitClone(returnValue, Builder, Module);
+            if (returnsParameter && Memory == MemoryModel::RefCount) {
+                emitDrop(returnValue, Builder, Module);
+            }
+            returnValue = clone;
+        }
+        emitDrops(returnStmt, "drop", Builder, Module);
+        emitRegionReleases(Builder, Module);
+
         // Create the return instruction
         Builder.CreateRet(returnValue);
     } else {
+        emitRegionReleases(Builder, Module);
+
         // If there's no return value, create a void return
-        Builder.CreateRetVoid();
+        llvm::Type* returnType = Builder.GetInsertBlock()->getParent()->getReturnType();
+        if (returnType->isVoidTy()) {
+            Builder.CreateRetVoid();
+        } else {
+            Builder.CreateRet(llvm::Constant::getNullValue(returnType));
+        }
     }
 }
 llvm::Value* processExpression(
     const nlohmann::json& expr, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 ) {
     std::string exprType = expr["type"];
 
     if (exprType == "Literal") {
+        // String literals are constant globals, which need the module
+        if (expr["dtype"] == "String") {
+            return createStringConstant(decodeStringLiteral(expr["value"]), Context, Module);
+        }
         return processLiteral(expr, Context);
     } else if (exprType == "Variable") {
         return processVariable(expr, Builder, NamedValues);
     } else if (exprType == "Expression") {
         return processBinaryExpression(expr, Builder, NamedValues, Context, Module);
+    } else if (exprType == "FunctionCall") {
+        return processFunctionCall(expr, Builder, NamedValues, Context, Module);
+    } else if (exprType == "Index") {
+        return processIndex(expr, Builder, NamedValues, Context, Module);
+    } else if (exprType == "NewArray") {
+        return processNewArray(expr, Builder, NamedValues, Context, Module);
+    } else if (exprType == "Vector") {
+        return processVector(expr, Builder, NamedValues, Context, Module);
+    } else if (exprType == "VectorLoad") {
+        return processVectorLoad(expr, Builder, NamedValues, Context, Module);
+    } else if (exprType == "Cast") {
+        llvm::Value* value = processExpression(expr["value"], Builder, NamedValues, Context, Module);
+        if (!value) {
+            return nullptr;
+        }
+        return emitConversion(value, dtype_from_str(expr["value"]["dtype"]), dtype_from_str(expr["dtype"]), Builder);
     } else {
         // Handle other expression types
         return nullptr;
@@ -567,14 +1808,15 @@ llvm::Value* processLiteral(const nlohmann::json& literal, llvm::LLVMContext &Co
     std::string dtypeStr = literal["dtype"];
     std::string valueStr = literal["value"];
 
-    if (dtypeStr == "I64") {
+    BeDataType dtype = dtype_from_str(dtypeStr);
+    if (dtype_is_unsigned(dtype)) {
         llvm::Type *type = getLLVMType(dtypeStr, Context);
-        int64_t value = std::stoll(valueStr);
-        return llvm::ConstantInt::get(type, value, true);
+        uint64_t value = std::stoull(valueStr);
+        return llvm::ConstantInt::get(type, value, false);
     } 
-    else if (dtypeStr == "I32") {
+    else if (dtype_is_integer(dtype)) {
         llvm::Type *type = getLLVMType(dtypeStr, Context);
-        int32_t value = std::stoi(valueStr);
+        int64_t value = std::stoll(valueStr);
         return llvm::ConstantInt::get(type, value, true);
     } 
     else if (dtypeStr == "F64") {
@@ -602,19 +1844,25 @@ llvm::Value* processLiteral(const nlohmann::json& literal, llvm::LLVMContext &Co
 llvm::Value* processVariable(
     const nlohmann::json& var, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues
+    ValueTable &NamedValues
 ) {
-    std::string varName = var["name"];
+    const std::string& varName = var["name"].get_ref<const std::string&>();
 
     // Check if variable exists
-    if (NamedValues.find(varName) == NamedValues.end()) {
+    std::optional<ValueBinding> binding = NamedValues.get(symbolOf(var, NamedValues));
+    if (!binding.has_value()) {
         // Variable not found
         // Handle error
         llvm::errs() << "Undefined variable: " << varName << "\n";
         return nullptr;
     }
 
-    llvm::AllocaInst *alloca = static_cast<llvm::AllocaInst*>(NamedValues[varName]);
+    // Immutable variables are bound straight to their SSA value
+    if (!binding->is_mutable) {
+        return binding->value;
+    }
+
+    llvm::AllocaInst *alloca = static_cast<llvm::AllocaInst*>(binding->value);
     // Load the value
     return Builder.CreateLoad(alloca->getAllocatedType(), alloca, varName + "_load");
 }
@@ -622,7 +1870,7 @@ llvm::Value* processVariable(
 llvm::Value* processBinaryExpression(
     const nlohmann::json& expr, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 ) {
@@ -630,6 +1878,16 @@ llvm::Value* processBinaryExpression(
     nlohmann::json rhsJson = expr["right-operand"];
     std::string op = expr["operator"];
 
+    // The right hand side of `&&` and `||` may not be evaluated at all,
+    // unless they combine vectors of bools
+    if ((op == "&&" || op == "||") && !dtype_is_vector(dtype_from_str(expr["dtype"]))) {
+        return processLogicalExpression(expr, Builder, NamedValues, Context, Module);
+    }
+
+    if (expr["dtype"] == "String") {
+        return processStringConcat(expr, Builder, NamedValues, Context, Module);
+    }
+
     llvm::Value *L = processExpression(lhsJson, Builder, NamedValues, Context, Module);
     llvm::Value *R = processExpression(rhsJson, Builder, NamedValues, Context, Module);
 
@@ -638,29 +1896,41 @@ llvm::Value* processBinaryExpression(
         return nullptr;
     }
 
+    if (op == "&&") {
+        return Builder.CreateAnd(L, R, "andtmp");
+    } else if (op == "||") {
+        return Builder.CreateOr(L, R, "ortmp");
+    }
+
+    // Handle Comparison Operations
+    if (op == "<" || op == "<=" || op == ">" || op == ">=" || op == "==" || op == "!=") {
+        bool operandsUnsigned = dtype_is_unsigned(dtype_element(dtype_from_str(lhsJson["dtype"])));
+        return createComparison(op, L, R, operandsUnsigned, Builder);
+    }
+
+    // Signed integer overflow is undefined in truffle, so signed arithmetic
+    // is emitted with `nsw`. Unsigned arithmetic wraps and gets no flags.
+    // Vectors are handled like their lanes.
+    bool isUnsigned = dtype_is_unsigned(dtype_element(dtype_from_str(expr["dtype"])));
+
+    // Integer division and modulo stay in the integer domain
+    if ((op == "/" || op == "%") && L->getType()->isIntOrIntVectorTy() && R->getType()->isIntOrIntVectorTy()) {
+        return createIntegerDivision(op, L, R, isUnsigned, Builder);
+    }
+
     // Handle Division Operation Separately
     if (op == "/") {
-        // Convert operands to f64 (double) if they are not already
-        if (!L->getType()->isDoubleTy()) {
-            if (L->getType()->isIntegerTy()) {
-                L = Builder.CreateSIToFP(L, llvm::Type::getDoubleTy(Context), "lhsDouble");
-            } else if (L->getType()->isFloatingPointTy()) {
-                L = Builder.CreateFPExt(L, llvm::Type::getDoubleTy(Context), "lhsDoubleExt");
-            } else {
-                llvm::errs() << "Unsupported type for division on LHS\n";
-                return nullptr;
-            }
+        // The parser converts both operands to the type of the result, which
+        // may be `f32`, so only an integer operand is left to convert here
+        if (L->getType()->isIntegerTy() && R->getType()->isFloatingPointTy()) {
+            L = Builder.CreateSIToFP(L, R->getType(), "lhsToFP");
+        } else if (L->getType()->isFloatingPointTy() && R->getType()->isIntegerTy()) {
+            R = Builder.CreateSIToFP(R, L->getType(), "rhsToFP");
         }
 
-        if (!R->getType()->isDoubleTy()) {
-            if (R->getType()->isIntegerTy()) {
-                R = Builder.CreateSIToFP(R, llvm::Type::getDoubleTy(Context), "rhsDouble");
-            } else if (R->getType()->isFloatingPointTy()) {
-                R = Builder.CreateFPExt(R, llvm::Type::getDoubleTy(Context), "rhsDoubleExt");
-            } else {
-                llvm::errs() << "Unsupported type for division on RHS\n";
-                return nullptr;
-            }
+        if (L->getType() != R->getType() || !L->getType()->isFPOrFPVectorTy()) {
+            llvm::errs() << "Unsupported types for division\n";
+            return nullptr;
         }
 
         // Perform floating-point division
@@ -669,13 +1939,13 @@ llvm::Value* processBinaryExpression(
 
     // Handle Other Arithmetic Operations
     // If both operands are integers
-    if (L->getType()->isIntegerTy() && R->getType()->isIntegerTy()) {
+    if (L->getType()->isIntOrIntVectorTy() && R->getType()->isIntOrIntVectorTy()) {
         if (op == "+") {
-            return Builder.CreateAdd(L, R, "addtmp");
+            return Builder.CreateAdd(L, R, "addtmp", false, !isUnsigned);
         } else if (op == "-") {
-            return Builder.CreateSub(L, R, "subtmp");
+            return Builder.CreateSub(L, R, "subtmp", false, !isUnsigned);
         } else if (op == "*") {
-            return Builder.CreateMul(L, R, "multmp");
+            return Builder.CreateMul(L, R, "multmp", false, !isUnsigned);
         } else {
             // Handle other operators
             llvm::errs() << "Unsupported integer operator: " << op << "\n";
@@ -683,7 +1953,7 @@ llvm::Value* processBinaryExpression(
         }
     }
     // If both operands are floating-point
-    else if (L->getType()->isFloatingPointTy() && R->getType()->isFloatingPointTy()) {
+    else if (L->getType()->isFPOrFPVectorTy() && R->getType()->isFPOrFPVectorTy()) {
         if (op == "+") {
             return Builder.CreateFAdd(L, R, "faddtmp");
         } else if (op == "-") {
@@ -725,3 +1995,2509 @@ llvm::Value* processBinaryExpression(
         return nullptr;
     }
 }
+
+/// Lowers a `Cast` of `value` from the number (or vector) type `from` to `to`.
+///
+/// Integers are sign or zero extended (by the signedness of `from`) or
+/// truncated. Floats converted to integers saturate at the limits of `to`
+/// (`llvm.fptosi.sat`), so `i32(x)` is defined for every float `x`.
+llvm::Value* emitConversion(
+    llvm::Value* value,
+    BeDataType from,
+    BeDataType to,
+    llvm::IRBuilder<> &Builder
+) {
+    // A scalar converted to a vector is copied to every lane
+    if (dtype_is_vector(to) && !dtype_is_vector(from)) {
+        llvm::Value* lane = emitConversion(value, from, dtype_element(to), Builder);
+        return lane ? Builder.CreateVectorSplat(dtype_lanes(to), lane, "splat") : nullptr;
+    }
+
+    // Vectors are converted lane by lane
+    llvm::Type* type = getLLVMType(dtype_to_str(to), Builder.getContext());
+    if (value->getType() == type) {
+        return value;
+    }
+    from = dtype_element(from);
+    to = dtype_element(to);
+    if (!dtype_is_numeric(from) || !dtype_is_numeric(to) || !type) {
+        llvm::errs() << "Can't convert " << dtype_to_str(from) << " to " << dtype_to_str(to) << "\n";
+        return nullptr;
+    }
+
+    if (dtype_is_integer(from) && dtype_is_integer(to)) {
+        return Builder.CreateIntCast(value, type, !dtype_is_unsigned(from), "conv");
+    }
+    if (dtype_is_integer(from)) {
+        return dtype_is_unsigned(from)
+            ? Builder.CreateUIToFP(value, type, "conv")
+            : Builder.CreateSIToFP(value, type, "conv");
+    }
+    if (dtype_is_float(to)) {
+        return Builder.CreateFPCast(value, type, "conv");
+    }
+
+    llvm::Intrinsic::ID intrinsic = dtype_is_unsigned(to) ? llvm::Intrinsic::fptoui_sat : llvm::Intrinsic::fptosi_sat;
+    return Builder.CreateIntrinsic(intrinsic, { type, value->getType() }, { value }, nullptr, "conv");
+}
+
+llvm::Value* createComparison(
+    const std::string& op,
+    llvm::Value* L,
+    llvm::Value* R,
+    bool isUnsigned,
+    llvm::IRBuilder<> &Builder
+) {
+    // Mixed comparisons are done in floating-point
+    if (L->getType()->isIntegerTy() && R->getType()->isFloatingPointTy()) {
+        L = Builder.CreateSIToFP(L, R->getType(), "lhsToFP");
+    } else if (L->getType()->isFloatingPointTy() && R->getType()->isIntegerTy()) {
+        R = Builder.CreateSIToFP(R, L->getType(), "rhsToFP");
+    }
+
+    if (L->getType() != R->getType()) {
+        llvm::errs() << "Type mismatch in comparison\n";
+        return nullptr;
+    }
+
+    if (L->getType()->isIntOrIntVectorTy() && isUnsigned) {
+        if (op == "<") return Builder.CreateICmpULT(L, R, "cmptmp");
+        if (op == "<=") return Builder.CreateICmpULE(L, R, "cmptmp");
+        if (op == ">") return Builder.CreateICmpUGT(L, R, "cmptmp");
+        if (op == ">=") return Builder.CreateICmpUGE(L, R, "cmptmp");
+        if (op == "==") return Builder.CreateICmpEQ(L, R, "cmptmp");
+        if (op == "!=") return Builder.CreateICmpNE(L, R, "cmptmp");
+    }
+    else if (L->getType()->isIntOrIntVectorTy()) {
+        if (op == "<") return Builder.CreateICmpSLT(L, R, "cmptmp");
+        if (op == "<=") return Builder.CreateICmpSLE(L, R, "cmptmp");
+        if (op == ">") return Builder.CreateICmpSGT(L, R, "cmptmp");
+        if (op == ">=") return Builder.CreateICmpSGE(L, R, "cmptmp");
+        if (op == "==") return Builder.CreateICmpEQ(L, R, "cmptmp");
+        if (op == "!=") return Builder.CreateICmpNE(L, R, "cmptmp");
+    }
+    else if (L->getType()->isFPOrFPVectorTy()) {
+        if (op == "<") return Builder.CreateFCmpOLT(L, R, "fcmptmp");
+        if (op == "<=") return Builder.CreateFCmpOLE(L, R, "fcmptmp");
+        if (op == ">") return Builder.CreateFCmpOGT(L, R, "fcmptmp");
+        if (op == ">=") return Builder.CreateFCmpOGE(L, R, "fcmptmp");
+        if (op == "==") return Builder.CreateFCmpOEQ(L, R, "fcmptmp");
+        if (op == "!=") return Builder.CreateFCmpUNE(L, R, "fcmptmp");
+    }
+
+    llvm::errs() << "Unsupported comparison: " << op << "\n";
+    return nullptr;
+}
+
+/// Lowers a condition to an `i1`. Non-boolean conditions are compared against zero.
+llvm::Value* processCondition(
+    const nlohmann::json& cond,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Value *condValue = processExpression(cond, Builder, NamedValues, Context, Module);
+    if (!condValue) {
+        return nullptr;
+    }
+
+    llvm::Type *condType = condValue->getType();
+    if (condType->isIntegerTy(1)) {
+        return condValue;
+    } else if (condType->isIntegerTy()) {
+        return Builder.CreateICmpNE(condValue, llvm::ConstantInt::get(condType, 0), "tobool");
+    } else if (condType->isFloatingPointTy()) {
+        return Builder.CreateFCmpUNE(condValue, llvm::ConstantFP::get(condType, 0.0), "tobool");
+    }
+
+    llvm::errs() << "Error: Unsupported type for condition.\n";
+    return nullptr;
+}
+
+/// Lowers an if / else if / else chain. Every condition after the first one is
+/// evaluated in the `else` block of the previous branch, and all branches that
+/// don't return jump to a shared `if.end` block.
+void processIfBlock(
+    const nlohmann::json& ifBlock,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    if (tryIfConversion(ifBlock, Builder, NamedValues, Context, Module)) {
+        return;
+    }
+
+    llvm::Function *function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(Context, "if.end");
+
+    for (const auto& statement : ifBlock["statements"]) {
+        llvm::BasicBlock *thenBB = llvm::BasicBlock::Create(Context, "if.then", function);
+        llvm::BasicBlock *elseBB = llvm::BasicBlock::Create(Context, "if.else", function);
+
+        emitLocation(Builder, statement);
+        if (!emitConditionalBranch(statement["condition"], thenBB, elseBB, Builder, NamedValues, Context, Module)) {
+            // Earlier branches (and part of a `&&`/`||` chain) may already jump
+            // to these blocks, so every open block goes on to `if.end`
+            llvm::errs() << "Error processing if condition.\n";
+            for (llvm::BasicBlock* block : { Builder.GetInsertBlock(), thenBB, elseBB }) {
+                if (!block->getTerminator()) {
+                    llvm::BranchInst::Create(mergeBB, block);
+                }
+            }
+            mergeBB->insertInto(function);
+            Builder.SetInsertPoint(mergeBB);
+            return;
+        }
+
+        Builder.SetInsertPoint(thenBB);
+        processCodeBlock(statement["code-block"], Builder, NamedValues, Context, Module);
+        if (!Builder.GetInsertBlock()->getTerminator()) {
+            Builder.CreateBr(mergeBB);
+        }
+
+        Builder.SetInsertPoint(elseBB);
+    }
+
+    if (ifBlock.contains("default")) {
+        processCodeBlock(ifBlock["default"], Builder, NamedValues, Context, Module);
+    } else {
+        emitDrops(ifBlock, "else-drop", Builder, Module);
+    }
+    if (!Builder.GetInsertBlock()->getTerminator()) {
+        Builder.CreateBr(mergeBB);
+    }
+
+    // Every branch returned, so there is nothing to merge
+    if (llvm::pred_empty(mergeBB)) {
+        delete mergeBB;
+        return;
+    }
+
+    mergeBB->insertInto(function);
+    Builder.SetInsertPoint(mergeBB);
+}
+
+/// Lowers a while loop to LLVM's canonical loop form:
+///
+/// ```
+/// loop.preheader -> loop.header -> loop.body -> ... -> loop.latch -> loop.header
+///                        |
+///                        +-> loop.exit
+/// ```
+///
+/// The preheader is the single entry into the loop, the latch holds the only
+/// backedge (which carries the `!llvm.loop` metadata) and the exit block is
+/// only reachable from inside the loop.
+void processLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Function *function = Builder.GetInsertBlock()->getParent();
+    llvm::DebugLoc loopLoc = Builder.getCurrentDebugLocation();
+
+    llvm::BasicBlock *preheaderBB = llvm::BasicBlock::Create(Context, "loop.preheader", function);
+    llvm::BasicBlock *headerBB = llvm::BasicBlock::Create(Context, "loop.header", function);
+    Builder.CreateBr(preheaderBB);
+
+    // Buffers that die within an iteration are freed all at once at the latch
+    llvm::Value *region = loop.value("region", false) ? createRegion(function, "loop.region") : nullptr;
+    LoopRegions.push_back(region);
+
+    Builder.SetInsertPoint(preheaderBB);
+    Builder.CreateBr(headerBB);
+
+    llvm::BasicBlock *bodyBB = llvm::BasicBlock::Create(Context, "loop.body", function);
+    llvm::BasicBlock *latchBB = llvm::BasicBlock::Create(Context, "loop.latch", function);
+    llvm::BasicBlock *exitBB = llvm::BasicBlock::Create(Context, "loop.exit", function);
+
+    Builder.SetInsertPoint(headerBB);
+    if (!emitConditionalBranch(loop["condition"], bodyBB, exitBB, Builder, NamedValues, Context, Module)) {
+        // Part of a `&&`/`||` chain may already jump to the body
+        llvm::errs() << "Error processing loop condition.\n";
+        llvm::BranchInst::Create(exitBB, bodyBB);
+        latchBB->eraseFromParent();
+        Builder.CreateBr(exitBB);
+        Builder.SetInsertPoint(exitBB);
+        LoopRegions.pop_back();
+        return;
+    }
+
+    Builder.SetInsertPoint(bodyBB);
+    processCodeBlock(loop["code-block"], Builder, NamedValues, Context, Module);
+    if (!Builder.GetInsertBlock()->getTerminator()) {
+        Builder.CreateBr(latchBB);
+    }
+
+    if (llvm::pred_empty(latchBB)) {
+        // The body always returns, so the loop never repeats
+        latchBB->eraseFromParent();
+    } else {
+        Builder.SetInsertPoint(latchBB);
+        Builder.SetCurrentDebugLocation(loopLoc);
+        if (region) {
+            Builder.CreateCall(Module->getFunction("__compiler_reserved_region_reset"), { region });
+        }
+        llvm::BranchInst *backedge = Builder.CreateBr(headerBB);
+        backedge->setMetadata(llvm::LLVMContext::MD_loop, createLoopMetadata(Context, loopLoc, false, loop.value("attributes", nlohmann::json::object())));
+    }
+
+    Builder.SetInsertPoint(exitBB);
+    LoopRegions.pop_back();
+    if (region) {
+        Builder.CreateCall(Module->getFunction("__compiler_reserved_region_release"), { region });
+    }
+    emitDrops(loop, "drop-on-exit", Builder, Module);
+}
+
+/// Lowers `for x in start..end` (or `start..=end`) and `for x in array` to a
+/// counted loop, already in the rotated form LLVM's loop passes work on:
+///
+/// ```
+/// for.guard -> for.preheader -> for.body -> ... -> for.latch -> for.body
+///     |                                                 |
+///     +-----------------------------------------------> for.exit
+/// ```
+///
+/// The induction variable is a phi that goes from `start` to `end` in steps
+/// of one and the latch exits once it reaches `end`, which it can't step
+/// past, so the increment is `nsw` (`nuw` for unsigned ranges and array
+/// indexes) and the trip count is known exactly before the loop is entered.
+/// LLVM can then unroll and vectorize it without checking for overflow.
+void processForLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Function *function = Builder.GetInsertBlock()->getParent();
+    llvm::DebugLoc loopLoc = Builder.getCurrentDebugLocation();
+    std::string varName = loop["variable"];
+    bool inclusive = loop.value("inclusive", false);
+
+    // `for x in array` walks the indexes of the array
+    llvm::Value *start = nullptr;
+    llvm::Value *end = nullptr;
+    llvm::Value *data = nullptr;
+    llvm::Type *elementType = nullptr;
+    bool isUnsigned = true;
+    if (loop.contains("array")) {
+        llvm::Value *array = processExpression(loop["array"], Builder, NamedValues, Context, Module);
+        if (!array || !isArrayType(array->getType())) {
+            llvm::errs() << "Error: only ranges and arrays can be looped over.\n";
+            return;
+        }
+        start = Builder.getInt64(0);
+        end = Builder.CreateExtractValue(array, 1, "len");
+        data = Builder.CreateExtractValue(array, 0, "data");
+        elementType = getArrayElementType(array->getType());
+    } else {
+        start = processExpression(loop["start"], Builder, NamedValues, Context, Module);
+        end = processExpression(loop["end"], Builder, NamedValues, Context, Module);
+        if (!start || !end || !start->getType()->isIntegerTy() || start->getType() != end->getType()) {
+            llvm::errs() << "Error: both ends of a range have to be integers of the same type.\n";
+            return;
+        }
+        isUnsigned = dtype_is_unsigned(dtype_from_str(loop["dtype"]));
+    }
+
+    llvm::BasicBlock *preheaderBB = llvm::BasicBlock::Create(Context, "for.preheader", function);
+    llvm::BasicBlock *bodyBB = llvm::BasicBlock::Create(Context, "for.body", function);
+    llvm::BasicBlock *latchBB = llvm::BasicBlock::Create(Context, "for.latch", function);
+    llvm::BasicBlock *exitBB = llvm::BasicBlock::Create(Context, "for.exit", function);
+
+    // Buffers that die within an iteration are freed all at once at the latch
+    llvm::Value *region = loop.value("region", false) ? createRegion(function, "loop.region") : nullptr;
+    LoopRegions.push_back(region);
+
+    // An empty range skips the loop, so the body runs at least once when it's entered
+    llvm::Value *entered = nullptr;
+    if (inclusive) {
+        entered = isUnsigned ? Builder.CreateICmpULE(start, end) : Builder.CreateICmpSLE(start, end);
+    } else {
+        entered = isUnsigned ? Builder.CreateICmpULT(start, end) : Builder.CreateICmpSLT(start, end);
+    }
+    Builder.CreateCondBr(entered, preheaderBB, exitBB);
+
+    Builder.SetInsertPoint(preheaderBB);
+    Builder.CreateBr(bodyBB);
+
+    Builder.SetInsertPoint(bodyBB);
+    llvm::PHINode *iv = Builder.CreatePHI(start->getType(), 2, varName + ".iv");
+    iv->addIncoming(start, preheaderBB);
+
+    llvm::Value *value = iv;
+    std::string dtypeStr = loop["dtype"];
+    if (data) {
+        llvm::Value *ptr = Builder.CreateInBoundsGEP(elementType, data, iv, "elem.ptr");
+        llvm::LoadInst* load = Builder.CreateLoad(elementType, ptr, varName);
+        tagElementAccess(load, elementType);
+        value = load;
+    }
+
+    // Assigning to the variable only changes it for the rest of the iteration
+    NamedValues.push_scope();
+    if (loop.value("mutable", true)) {
+        llvm::AllocaInst *alloca = createEntryBlockAlloca(function, value->getType(), varName);
+        Builder.CreateStore(value, alloca);
+        NamedValues.bind(symbolOf(loop, NamedValues), ValueBinding{ alloca, true });
+        emitDebugVariable(varName, dtypeStr, alloca, true, 0, Builder);
+    } else {
+        if (!value->hasName()) {
+            value->setName(varName);
+        }
+        NamedValues.bind(symbolOf(loop, NamedValues), ValueBinding{ value, false });
+        emitDebugVariable(varName, dtypeStr, value, false, 0, Builder);
+    }
+
+    processCodeBlock(loop["code-block"], Builder, NamedValues, Context, Module);
+    NamedValues.pop_scope();
+    if (!Builder.GetInsertBlock()->getTerminator()) {
+        Builder.CreateBr(latchBB);
+    }
+
+    if (llvm::pred_empty(latchBB)) {
+        // The body always returns, so the loop never repeats
+        latchBB->eraseFromParent();
+    } else {
+        Builder.SetInsertPoint(latchBB);
+        Builder.SetCurrentDebugLocation(loopLoc);
+        if (region) {
+            Builder.CreateCall(Module->getFunction("__compiler_reserved_region_reset"), { region });
+        }
+
+        // `iv < end` (or `iv <= end` before the check), so the increment never wraps
+        llvm::Value *next = Builder.CreateAdd(iv, llvm::ConstantInt::get(iv->getType(), 1), varName + ".next", isUnsigned, !isUnsigned || data);
+        llvm::Value *done = inclusive
+            ? Builder.CreateICmpEQ(iv, end, "for.done")
+            : Builder.CreateICmpEQ(next, end, "for.done");
+        iv->addIncoming(next, latchBB);
+
+        // Elements are only known to be indexed by the loop variable if it's never reassigned
+        bool indexedByVar = !data && !loop.value("mutable", true);
+        bool vectorize = isVectorizableBody(loop["code-block"], indexedByVar ? varName : "");
+        llvm::BranchInst *backedge = Builder.CreateCondBr(done, exitBB, bodyBB);
+        backedge->setMetadata(llvm::LLVMContext::MD_loop, createLoopMetadata(Context, loopLoc, vectorize, loop.value("attributes", nlohmann::json::object())));
+    }
+
+    Builder.SetInsertPoint(exitBB);
+    LoopRegions.pop_back();
+    if (region) {
+        Builder.CreateCall(Module->getFunction("__compiler_reserved_region_release"), { region });
+    }
+    emitDrops(loop, "drop-on-exit", Builder, Module);
+}
+
+/// The names of the variables `node` reads, or writes elements of
+void collectReferencedNames(const nlohmann::json& node, std::set<std::string>& names) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            collectReferencedNames(child, names);
+        }
+        return;
+    }
+    if (!node.is_object()) {
+        return;
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "Variable") {
+        names.insert(node["name"].get<std::string>());
+    } else if (type == "ElementAssignmentStatement") {
+        names.insert(node["dst"].get<std::string>());
+    }
+    for (const auto& [key, child] : node.items()) {
+        collectReferencedNames(child, names);
+    }
+}
+
+/// The value a reduction variable starts out with on every worker, which
+/// combining with `op` leaves unchanged
+llvm::Value* getReductionIdentity(const std::string& op, llvm::Type* type) {
+    if (op == "&&") {
+        return llvm::ConstantInt::getTrue(type);
+    } else if (op == "||") {
+        return llvm::ConstantInt::getFalse(type);
+    } else if (op == "*") {
+        return type->isFloatingPointTy() ? llvm::ConstantFP::get(type, 1.0) : llvm::ConstantInt::get(type, 1);
+    }
+    return type->isFloatingPointTy() ? llvm::ConstantFP::getNegativeZero(type) : llvm::ConstantInt::get(type, 0);
+}
+
+llvm::Value* emitReductionStep(const std::string& op, llvm::Value* acc, llvm::Value* value, llvm::IRBuilder<> &Builder) {
+    bool isFloat = acc->getType()->isFloatingPointTy();
+    if (op == "&&") {
+        return Builder.CreateAnd(acc, value, "red.and");
+    } else if (op == "||") {
+        return Builder.CreateOr(acc, value, "red.or");
+    } else if (op == "*") {
+        return isFloat ? Builder.CreateFMul(acc, value, "red.mul") : Builder.CreateMul(acc, value, "red.mul");
+    }
+    return isFloat ? Builder.CreateFAdd(acc, value, "red.add") : Builder.CreateAdd(acc, value, "red.add");
+}
+
+/// Emits `body(i)` for every `i` in [0, count), where `count` is at least one
+void emitCountedLoop(llvm::Value* count, const std::string& name, llvm::IRBuilder<> &Builder, std::function<void(llvm::Value*)> body) {
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* preheaderBB = Builder.GetInsertBlock();
+    llvm::BasicBlock* bodyBB = llvm::BasicBlock::Create(Builder.getContext(), name + ".body", function);
+    llvm::BasicBlock* exitBB = llvm::BasicBlock::Create(Builder.getContext(), name + ".exit", function);
+    Builder.CreateBr(bodyBB);
+
+    Builder.SetInsertPoint(bodyBB);
+    llvm::PHINode* i = Builder.CreatePHI(count->getType(), 2, name + ".i");
+    i->addIncoming(llvm::ConstantInt::get(count->getType(), 0), preheaderBB);
+    body(i);
+    llvm::Value* next = Builder.CreateAdd(i, llvm::ConstantInt::get(count->getType(), 1), name + ".next", true, true);
+    i->addIncoming(next, Builder.GetInsertBlock());
+    Builder.CreateCondBr(Builder.CreateICmpEQ(next, count), exitBB, bodyBB);
+
+    Builder.SetInsertPoint(exitBB);
+}
+
+/// Lowers a `parallel for` (see `parse_parallel_for`). The loop is outlined
+/// into a function
+///
+/// ```
+/// void f.parallel(i8* ctx, i64 lo, i64 hi, i64 worker)
+/// ```
+///
+/// that runs the iterations [lo, hi) as an ordinary counted loop (see
+/// `processForLoop`), which `__compiler_reserved_parallel_for` in the runtime
+/// calls on every worker thread. `ctx` points at a struct on the stack of the
+/// function running the loop, with the start of the range, a copy of every
+/// variable the body uses (none of them can change while the loop runs) and
+/// the partial results of the reductions.
+///
+/// Every worker accumulates each reduction variable into a local that starts
+/// at the identity of its operator, and after each of its chunks adds that to
+/// its own slot of the partial results. Slots are a cache line apart, so
+/// workers never write to the same line. The slots are combined into the
+/// variables once all iterations ran.
+void processParallelForLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Function *function = Builder.GetInsertBlock()->getParent();
+    llvm::DebugLoc loopLoc = Builder.getCurrentDebugLocation();
+    const llvm::DataLayout& layout = Module->getDataLayout();
+    std::string varName = loop["variable"];
+    bool inclusive = loop.value("inclusive", false);
+    bool isUnsigned = dtype_is_unsigned(dtype_from_str(loop["dtype"]));
+    llvm::Type* i64Ty = Builder.getInt64Ty();
+    llvm::Type* charPtrTy = Builder.getInt8PtrTy();
+
+    llvm::Value *start = processExpression(loop["start"], Builder, NamedValues, Context, Module);
+    llvm::Value *end = processExpression(loop["end"], Builder, NamedValues, Context, Module);
+    if (!start || !end || !start->getType()->isIntegerTy() || start->getType() != end->getType()) {
+        llvm::errs() << "Error: both ends of a range have to be integers of the same type.\n";
+        return;
+    }
+
+    // The number of iterations, in 64 bits so that it can't overflow for narrow types
+    llvm::Value *entered = nullptr;
+    if (inclusive) {
+        entered = isUnsigned ? Builder.CreateICmpULE(start, end) : Builder.CreateICmpSLE(start, end);
+    } else {
+        entered = isUnsigned ? Builder.CreateICmpULT(start, end) : Builder.CreateICmpSLT(start, end);
+    }
+    llvm::Value* count = Builder.CreateSub(
+        Builder.CreateIntCast(end, i64Ty, !isUnsigned), Builder.CreateIntCast(start, i64Ty, !isUnsigned), "par.count"
+    );
+    if (inclusive) {
+        count = Builder.CreateAdd(count, Builder.getInt64(1), "par.count");
+    }
+    count = Builder.CreateSelect(entered, count, Builder.getInt64(0), "par.count");
+
+    // Everything the body reads from outside of the loop
+    std::set<std::string> names;
+    collectReferencedNames(loop["code-block"], names);
+    names.erase(varName);
+    for (const auto& reduction : loop["reductions"]) {
+        names.erase(reduction["name"].get<std::string>());
+    }
+
+    std::vector<std::string> captured;
+    std::vector<SymbolId> capturedIds;
+    std::vector<llvm::Value*> capturedValues = { start };
+    for (const std::string& name : names) {
+        SymbolId id = NamedValues.intern(name);
+        std::optional<ValueBinding> binding = NamedValues.get(id);
+        if (!binding.has_value()) {
+            continue;
+        }
+        captured.push_back(name);
+        capturedIds.push_back(id);
+        capturedValues.push_back(processVariable({{"name", name}}, Builder, NamedValues));
+    }
+
+    std::vector<llvm::Type*> ctxFields;
+    for (llvm::Value* value : capturedValues) {
+        ctxFields.push_back(value->getType());
+    }
+    ctxFields.push_back(charPtrTy);
+    llvm::StructType* ctxType = llvm::StructType::get(Context, ctxFields);
+
+    // One slot of partial results per worker
+    const nlohmann::json& reductions = loop["reductions"];
+    std::vector<llvm::Type*> slotFields;
+    std::vector<llvm::AllocaInst*> reductionVars;
+    for (const auto& reduction : reductions) {
+        std::optional<ValueBinding> binding = NamedValues.get(symbolOf(reduction, NamedValues));
+        if (!binding.has_value() || !binding->is_mutable) {
+            llvm::errs() << "Error: reduction variable '" << reduction["name"].get<std::string>() << "' isn't mutable.\n";
+            return;
+        }
+        reductionVars.push_back(static_cast<llvm::AllocaInst*>(binding->value));
+        slotFields.push_back(reductionVars.back()->getAllocatedType());
+    }
+    llvm::StructType* slotType = llvm::StructType::get(Context, slotFields);
+    uint64_t slotStride = llvm::alignTo(std::max<uint64_t>(layout.getTypeAllocSize(slotType), 1), ARRAY_ALIGNMENT);
+
+    llvm::Value* partials = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(charPtrTy));
+    llvm::Value* workers = nullptr;
+    llvm::Value* stack = nullptr;
+    auto getSlot = [&](llvm::Value* partials, llvm::Value* worker) {
+        llvm::Value* offset = Builder.CreateMul(worker, Builder.getInt64(slotStride), "slot.offset");
+        return Builder.CreateBitCast(Builder.CreateInBoundsGEP(Builder.getInt8Ty(), partials, offset), slotType->getPointerTo(), "slot");
+    };
+    if (!reductions.empty()) {
+        workers = Builder.CreateCall(Module->getFunction("__compiler_reserved_parallel_workers"), {}, "workers");
+        stack = Builder.CreateIntrinsic(llvm::Intrinsic::stacksave, {}, {});
+        llvm::AllocaInst* slots = Builder.CreateAlloca(Builder.getInt8Ty(), Builder.CreateMul(workers, Builder.getInt64(slotStride)), "partials");
+        slots->setAlignment(llvm::Align(ARRAY_ALIGNMENT));
+        partials = slots;
+
+        emitCountedLoop(workers, "par.init", Builder, [&](llvm::Value* worker) {
+            llvm::Value* slot = getSlot(partials, worker);
+            for (size_t j = 0; j < reductions.size(); j++) {
+                Builder.CreateStore(getReductionIdentity(reductions[j]["operator"], slotFields[j]), Builder.CreateStructGEP(slotType, slot, j));
+            }
+        });
+    }
+
+    llvm::AllocaInst* ctx = createEntryBlockAlloca(function, ctxType, "par.ctx");
+    for (size_t i = 0; i < capturedValues.size(); i++) {
+        Builder.CreateStore(capturedValues[i], Builder.CreateStructGEP(ctxType, ctx, i));
+    }
+    Builder.CreateStore(partials, Builder.CreateStructGEP(ctxType, ctx, capturedValues.size()));
+
+    // The outlined body is generated from scratch, with the state of this function put aside
+    llvm::FunctionType* bodyType = llvm::FunctionType::get(Builder.getVoidTy(), { charPtrTy, i64Ty, i64Ty, i64Ty }, false);
+    llvm::Function* body = llvm::Function::Create(bodyType, llvm::Function::InternalLinkage, function->getName() + ".parallel", Module);
+    body->addFnAttr(llvm::Attribute::NoUnwind);
+    for (const char* name : { "target-features", "unsafe-fp-math", "no-nans-fp-math", "no-infs-fp-math", "no-signed-zeros-fp-math" }) {
+        if (function->hasFnAttribute(name)) {
+            body->addFnAttr(function->getFnAttribute(name));
+        }
+    }
+    uint64_t ctxSize = layout.getTypeAllocSize(ctxType);
+    if (AliasInfo) {
+        // Nothing writes the context while the loop runs
+        body->addParamAttr(0, llvm::Attribute::NoAlias);
+        body->addParamAttr(0, llvm::Attribute::NoCapture);
+        body->addParamAttr(0, llvm::Attribute::ReadOnly);
+        body->addDereferenceableParamAttr(0, ctxSize);
+    }
+    llvm::Value* ctxArg = body->getArg(0);
+    llvm::Value* loArg = body->getArg(1);
+    llvm::Value* hiArg = body->getArg(2);
+    llvm::Value* workerArg = body->getArg(3);
+    ctxArg->setName("ctx");
+    loArg->setName("lo");
+    hiArg->setName("hi");
+    workerArg->setName("worker");
+
+    llvm::IRBuilderBase::InsertPoint savedInsertPoint = Builder.saveIP();
+    std::map<size_t, ValueBinding> savedBufferVariables = BufferVariables;
+    std::map<llvm::Value*, StringParts> savedKnownParts = KnownParts;
+    std::vector<llvm::Value*> savedLoopRegions = LoopRegions;
+    llvm::Value* savedFunctionRegion = FunctionRegion;
+    llvm::Value* savedCallerRegion = CallerRegion;
+    std::vector<llvm::DIScope*> savedLexicalBlocks;
+
+    Builder.SetInsertPoint(llvm::BasicBlock::Create(Context, "entry", body));
+    Builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    llvm::DISubprogram* subprogram = nullptr;
+    if (DbgInfo) {
+        unsigned int line = loop.value("line", 0u);
+        subprogram = DbgInfo->DBuilder->createFunction(
+            DbgInfo->File, body->getName(), body->getName(), DbgInfo->File, line,
+            DbgInfo->DBuilder->createSubroutineType(DbgInfo->DBuilder->getOrCreateTypeArray({})),
+            line, llvm::DINode::FlagPrototyped | llvm::DINode::FlagArtificial,
+            llvm::DISubprogram::SPFlagDefinition | llvm::DISubprogram::SPFlagLocalToUnit
+        );
+        body->setSubprogram(subprogram);
+        savedLexicalBlocks = DbgInfo->LexicalBlocks;
+        DbgInfo->LexicalBlocks = { subprogram };
+        Builder.SetCurrentDebugLocation(llvm::DILocation::get(Context, line, loop.value("col", 0u), subprogram));
+    }
+
+    // Buffers that live as long as the function live as long as a chunk
+    CallerRegion = nullptr;
+    FunctionRegion = savedFunctionRegion ? createRegion(body, "fn.region") : nullptr;
+    LoopRegions.clear();
+    KnownParts.clear();
+
+    NamedValues.push_scope();
+    llvm::Value* ctxPtr = Builder.CreateBitCast(ctxArg, ctxType->getPointerTo(), "ctx");
+    auto loadField = [&](size_t i, const std::string& name) {
+        return Builder.CreateLoad(ctxFields[i], Builder.CreateStructGEP(ctxType, ctxPtr, i), name);
+    };
+    llvm::Value* bodyStart = loadField(0, "start");
+    for (size_t i = 0; i < captured.size(); i++) {
+        NamedValues.bind(capturedIds[i], ValueBinding{ loadField(i + 1, captured[i]), false });
+    }
+
+    std::vector<llvm::AllocaInst*> locals;
+    for (size_t j = 0; j < reductions.size(); j++) {
+        std::string name = reductions[j]["name"];
+        llvm::AllocaInst* local = createEntryBlockAlloca(body, slotFields[j], name);
+        Builder.CreateStore(getReductionIdentity(reductions[j]["operator"], slotFields[j]), local);
+        NamedValues.bind(symbolOf(reductions[j], NamedValues), ValueBinding{ local, true });
+        locals.push_back(local);
+    }
+
+    // The chunk is the inclusive range [start + lo, start + hi - 1], whose ends
+    // are both in the range of the loop's type
+    llvm::Type* ivType = start->getType();
+    llvm::Value* first = Builder.CreateAdd(bodyStart, Builder.CreateTrunc(loArg, ivType), "first");
+    llvm::Value* last = Builder.CreateAdd(bodyStart, Builder.CreateTrunc(Builder.CreateSub(hiArg, Builder.getInt64(1)), ivType), "last");
+    NamedValues.bind(NamedValues.intern("parallel.first"), ValueBinding{ first, false });
+    NamedValues.bind(NamedValues.intern("parallel.last"), ValueBinding{ last, false });
+
+    nlohmann::json chunk = loop;
+    chunk.erase("parallel");
+    chunk.erase("reductions");
+    chunk.erase("drop-on-exit");
+    chunk["start"] = {{"type", "Variable"}, {"name", "parallel.first"}, {"dtype", loop["dtype"]}};
+    chunk["end"] = {{"type", "Variable"}, {"name", "parallel.last"}, {"dtype", loop["dtype"]}};
+    chunk["inclusive"] = true;
+    processForLoop(chunk, Builder, NamedValues, Context, Module);
+
+    if (!reductions.empty()) {
+        llvm::Value* slot = getSlot(loadField(ctxFields.size() - 1, "partials"), workerArg);
+        for (size_t j = 0; j < reductions.size(); j++) {
+            llvm::Value* ptr = Builder.CreateStructGEP(slotType, slot, j);
+            llvm::Value* local = Builder.CreateLoad(slotFields[j], locals[j]);
+            llvm::Value* acc = Builder.CreateLoad(slotFields[j], ptr);
+            Builder.CreateStore(emitReductionStep(reductions[j]["operator"], acc, local, Builder), ptr);
+        }
+    }
+    NamedValues.pop_scope();
+    emitRegionReleases(Builder, Module);
+    Builder.CreateRetVoid();
+
+    if (subprogram) {
+        DbgInfo->DBuilder->finalizeSubprogram(subprogram);
+        DbgInfo->LexicalBlocks = savedLexicalBlocks;
+    }
+    if (llvm::verifyFunction(*body, &llvm::errs())) {
+        llvm::errs() << "Error: generated invalid IR for the parallel loop in '" << function->getName() << "'.\n";
+    }
+
+    Builder.restoreIP(savedInsertPoint);
+    Builder.SetCurrentDebugLocation(loopLoc);
+    BufferVariables = savedBufferVariables;
+    KnownParts = savedKnownParts;
+    LoopRegions = savedLoopRegions;
+    FunctionRegion = savedFunctionRegion;
+    CallerRegion = savedCallerRegion;
+
+    llvm::Value* bodyPtr = Builder.CreateBitCast(body, charPtrTy);
+    llvm::Value* ctxBytes = Builder.CreateBitCast(ctx, charPtrTy);
+    llvm::Value* invariant = nullptr;
+    if (AliasInfo) {
+        // Lets the fields be kept in registers once the serial call is inlined.
+        // Not `!invariant.load`: the context is filled again every time the loop is reached
+        invariant = Builder.CreateInvariantStart(ctxBytes, Builder.getInt64(ctxSize));
+    }
+    if (loop.contains("min-parallel-iterations")) {
+        // Too few iterations to pay for handing them out run on this thread
+        // (see `annotate_auto_parallel`), and the call can be inlined
+        llvm::BasicBlock* spawnBB = llvm::BasicBlock::Create(Context, "par.spawn", function);
+        llvm::BasicBlock* smallBB = llvm::BasicBlock::Create(Context, "par.small", function);
+        llvm::BasicBlock* serialBB = llvm::BasicBlock::Create(Context, "par.serial", function);
+        llvm::BasicBlock* doneBB = llvm::BasicBlock::Create(Context, "par.done", function);
+        llvm::Value* minIterations = Builder.getInt64(loop["min-parallel-iterations"].get<uint64_t>());
+        Builder.CreateCondBr(Builder.CreateICmpUGE(count, minIterations), spawnBB, smallBB);
+
+        Builder.SetInsertPoint(smallBB);
+        Builder.CreateCondBr(Builder.CreateICmpEQ(count, Builder.getInt64(0)), doneBB, serialBB);
+        Builder.SetInsertPoint(serialBB);
+        Builder.CreateCall(body, { ctxBytes, Builder.getInt64(0), count, Builder.getInt64(0) });
+        Builder.CreateBr(doneBB);
+
+        Builder.SetInsertPoint(spawnBB);
+        Builder.CreateCall(Module->getFunction("__compiler_reserved_parallel_for"), { count, bodyPtr, ctxBytes });
+        Builder.CreateBr(doneBB);
+        Builder.SetInsertPoint(doneBB);
+    } else {
+        Builder.CreateCall(Module->getFunction("__compiler_reserved_parallel_for"), { count, bodyPtr, ctxBytes });
+    }
+    if (invariant) {
+        llvm::Function* invariantEnd = llvm::Intrinsic::getDeclaration(Module, llvm::Intrinsic::invariant_end, { charPtrTy });
+        Builder.CreateCall(invariantEnd, { invariant, Builder.getInt64(ctxSize), ctxBytes });
+    }
+
+    if (!reductions.empty()) {
+        emitCountedLoop(workers, "par.combine", Builder, [&](llvm::Value* worker) {
+            llvm::Value* slot = getSlot(partials, worker);
+            for (size_t j = 0; j < reductions.size(); j++) {
+                llvm::Value* partial = Builder.CreateLoad(slotFields[j], Builder.CreateStructGEP(slotType, slot, j));
+                llvm::Value* acc = Builder.CreateLoad(slotFields[j], reductionVars[j]);
+                Builder.CreateStore(emitReductionStep(reductions[j]["operator"], acc, partial, Builder), reductionVars[j]);
+            }
+        });
+        Builder.CreateIntrinsic(llvm::Intrinsic::stackrestore, {}, { stack });
+    }
+    emitDrops(loop, "drop-on-exit", Builder, Module);
+}
+
+/// Whether the body of a counted loop is straight-line arithmetic on
+/// variables and on elements at index `varName` (the loop variable of a
+/// range, "" for none), which the loop vectorizer can be asked to vectorize.
+///
+/// Variables from outside of the body may only be assigned like an integer
+/// reduction (`x = x + e`, `x = x - e` or `x = x * e`) and not read
+/// otherwise. Any other recurrence, like `x = (x * 3 + 1) % 7`, can't be
+/// vectorized, and forcing it only makes LLVM warn. Forcing vectorization
+/// also lets LLVM reorder floating point math, so bodies that accumulate a
+/// float across iterations are left to its cost model, which keeps them in
+/// order.
+bool isVectorizableBody(const nlohmann::json& codeBlock, const std::string& varName) {
+    std::function<bool(const nlohmann::json&)> isSimple = [&](const nlohmann::json& expr) {
+        std::string type = expr["type"];
+        if (type == "Literal" || type == "Variable") {
+            return true;
+        }
+        if (type == "Cast") {
+            return isSimple(expr["value"]);
+        }
+        if (type == "Expression") {
+            std::string op = expr["operator"];
+            return op != "&&" && op != "||" && isSimple(expr["left-operand"]) && isSimple(expr["right-operand"]);
+        }
+        if (type == "Index") {
+            return !varName.empty() && expr["array"]["type"] == "Variable"
+                && expr["index"]["type"] == "Variable" && expr["index"]["name"] == varName;
+        }
+        if (type == "FunctionCall") {
+            return expr["function-name"] == "len" && expr["parameters"].size() == 1 && expr["parameters"][0]["type"] == "Variable";
+        }
+        return false;
+    };
+
+    // `x = x op e` with `e` not reading `x`, as the operator it combines with
+    auto reductionOperator = [](const nlohmann::json& stmt) -> std::string {
+        const nlohmann::json& src = stmt["src"];
+        if (src["type"] != "Expression") {
+            return "";
+        }
+        std::string name = stmt["dst"];
+        std::string op = src["operator"];
+        const nlohmann::json& left = src["left-operand"];
+        const nlohmann::json& right = src["right-operand"];
+        if ((op == "+" || op == "-" || op == "*") && left["type"] == "Variable" && left["name"] == name && count_reads(right, name) == 0) {
+            return op == "-" ? "+" : op;
+        }
+        if ((op == "+" || op == "*") && right["type"] == "Variable" && right["name"] == name && count_reads(left, name) == 0) {
+            return op;
+        }
+        return "";
+    };
+
+    if (codeBlock.contains("drop-on-entry")) {
+        return false;
+    }
+    std::set<std::string> declared;
+    std::map<std::string, std::string> reductions;
+    std::map<std::string, size_t> updates;
+    for (const auto& stmt : codeBlock["statements"]) {
+        std::string type = stmt["type"];
+        if (stmt.contains("drop")) {
+            return false;
+        }
+
+        if (type == "DeclarationStatement") {
+            if (dtype_has_buffer(dtype_from_str(stmt["dtype"])) || !isSimple(stmt["src"])) {
+                return false;
+            }
+            declared.insert(stmt["dst"].get<std::string>());
+        }
+        else if (type == "AssignmentStatement") {
+            BeDataType dtype = dtype_from_str(stmt["src"]["dtype"]);
+            if (dtype_has_buffer(dtype) || dtype_is_float(dtype) || !isSimple(stmt["src"])) {
+                return false;
+            }
+            std::string name = stmt["dst"];
+            if (declared.count(name)) {
+                continue;
+            }
+            std::string op = reductionOperator(stmt);
+            if (op.empty() || name == varName || (reductions.count(name) && reductions[name] != op)) {
+                return false;
+            }
+            reductions[name] = op;
+            updates[name]++;
+        }
+        else if (type == "ElementAssignmentStatement") {
+            const nlohmann::json& index = stmt["index"];
+            if (varName.empty() || index["type"] != "Variable" || index["name"] != varName || !isSimple(stmt["src"])) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+
+    // A reduction variable is only read to update it
+    for (const auto& [name, count] : updates) {
+        if (count_reads(codeBlock["statements"], name) != count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Lowers `/` and `%` on integers to `sdiv`/`srem` or `udiv`/`urem`.
+///
+/// Division by a constant power of two is strength-reduced to shifts and masks
+/// here so that it's cheap even when the module isn't optimized. Any other
+/// constant divisor is left as a division, which LLVM's instruction selection
+/// turns into a multiply by a magic number.
+llvm::Value* createIntegerDivision(
+    const std::string& op,
+    llvm::Value* L,
+    llvm::Value* R,
+    bool isUnsigned,
+    llvm::IRBuilder<> &Builder
+) {
+    bool isDiv = op == "/";
+
+    if (L->getType() != R->getType()) {
+        llvm::errs() << "Type mismatch in integer division\n";
+        return nullptr;
+    }
+
+    llvm::Type *type = L->getType();
+    unsigned bitWidth = type->getScalarSizeInBits();
+
+    if (auto *divisorConst = llvm::dyn_cast<llvm::ConstantInt>(R)) {
+        const llvm::APInt& divisor = divisorConst->getValue();
+
+        if (divisor.isOne()) {
+            return isDiv ? L : llvm::ConstantInt::get(type, 0);
+        }
+
+        if (!isUnsigned && divisor.isAllOnesValue()) {
+            return isDiv ? Builder.CreateNeg(L, "divneg", false, true) : llvm::ConstantInt::get(type, 0);
+        }
+
+        if (isUnsigned && divisor.isPowerOf2()) {
+            unsigned shift = divisor.logBase2();
+            if (isDiv) {
+                return Builder.CreateLShr(L, shift, "divtmp");
+            }
+            return Builder.CreateAnd(L, llvm::ConstantInt::get(type, divisor - 1), "modtmp");
+        }
+
+        if (!isUnsigned && !divisor.isMinSignedValue() && divisor.abs().isPowerOf2()) {
+            unsigned shift = divisor.abs().logBase2();
+
+            // Signed division rounds towards zero, so negative dividends are
+            // biased by `2^shift - 1` before shifting:
+            //   bias = (L >>a (bits - 1)) >>l (bits - shift)
+            llvm::Value *sign = Builder.CreateAShr(L, bitWidth - 1, "sign");
+            llvm::Value *bias = Builder.CreateLShr(sign, bitWidth - shift, "bias");
+            llvm::Value *biased = Builder.CreateAdd(L, bias, "biased", false, true);
+
+            if (isDiv) {
+                llvm::Value *quotient = Builder.CreateAShr(biased, shift, "divtmp");
+                if (divisor.isNegative()) {
+                    quotient = Builder.CreateNeg(quotient, "divneg", false, true);
+                }
+                return quotient;
+            }
+
+            // L - (biased & -2^shift), the remainder takes the sign of the dividend
+            llvm::APInt mask = llvm::APInt::getHighBitsSet(bitWidth, bitWidth - shift);
+            llvm::Value *truncated = Builder.CreateAnd(biased, llvm::ConstantInt::get(type, mask), "rounded");
+            return Builder.CreateSub(L, truncated, "modtmp", false, true);
+        }
+    }
+
+    if (isDiv) {
+        return isUnsigned ? Builder.CreateUDiv(L, R, "divtmp") : Builder.CreateSDiv(L, R, "divtmp");
+    }
+    return isUnsigned ? Builder.CreateURem(L, R, "modtmp") : Builder.CreateSRem(L, R, "modtmp");
+}
+
+/// Returns true if evaluating `expr` could have an observable effect or trap.
+/// Expressions without side effects can be evaluated speculatively, which is
+/// what allows `&&`, `||` and small if blocks to be lowered without branches.
+bool hasSideEffects(const nlohmann::json& expr) {
+    std::string exprType = expr["type"];
+
+    if (exprType == "Literal" || exprType == "Variable") {
+        return false;
+    }
+    else if (exprType == "Expression") {
+        std::string op = expr["operator"];
+
+        // Integer division traps on a zero divisor (and on INT_MIN / -1)
+        if ((op == "/" || op == "%") && dtype_is_integer(dtype_element(dtype_from_str(expr["dtype"])))) {
+            const nlohmann::json& divisor = expr["right-operand"];
+            if (divisor["type"] != "Literal") {
+                return true;
+            }
+            std::string divisorStr = divisor["value"];
+            if (divisorStr == "0" || divisorStr == "-1") {
+                return true;
+            }
+        }
+
+        return hasSideEffects(expr["left-operand"]) || hasSideEffects(expr["right-operand"]);
+    }
+    else if (exprType == "Cast") {
+        // Float to integer conversions saturate instead of trapping
+        return hasSideEffects(expr["value"]);
+    }
+    else if (exprType == "Vector") {
+        for (const auto& element : expr["elements"]) {
+            if (hasSideEffects(element)) return true;
+        }
+        return false;
+    }
+
+    // Function calls and anything unknown
+    return true;
+}
+
+/// Lowers `&&` and `||` to an `i1`. If the right hand side is free of side
+/// effects both sides are evaluated and combined with a `select`, which avoids
+/// a hard to predict branch. Otherwise the right hand side is only evaluated
+/// when it decides the result.
+llvm::Value* processLogicalExpression(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    bool isAnd = expr["operator"] == "&&";
+    const nlohmann::json& rhsJson = expr["right-operand"];
+
+    llvm::Value *L = processCondition(expr["left-operand"], Builder, NamedValues, Context, Module);
+    if (!L) {
+        return nullptr;
+    }
+
+    if (!hasSideEffects(rhsJson)) {
+        llvm::Value *R = processCondition(rhsJson, Builder, NamedValues, Context, Module);
+        if (!R) {
+            return nullptr;
+        }
+        return isAnd ? Builder.CreateLogicalAnd(L, R, "andtmp") : Builder.CreateLogicalOr(L, R, "ortmp");
+    }
+
+    llvm::Function *function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *lhsBB = Builder.GetInsertBlock();
+    llvm::BasicBlock *rhsBB = llvm::BasicBlock::Create(Context, isAnd ? "land.rhs" : "lor.rhs", function);
+    llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(Context, isAnd ? "land.end" : "lor.end", function);
+
+    if (isAnd) {
+        Builder.CreateCondBr(L, rhsBB, mergeBB);
+    } else {
+        Builder.CreateCondBr(L, mergeBB, rhsBB);
+    }
+
+    Builder.SetInsertPoint(rhsBB);
+    llvm::Value *R = processCondition(rhsJson, Builder, NamedValues, Context, Module);
+    if (!R) {
+        return nullptr;
+    }
+    llvm::BasicBlock *rhsEndBB = Builder.GetInsertBlock();
+    Builder.CreateBr(mergeBB);
+
+    Builder.SetInsertPoint(mergeBB);
+    llvm::PHINode *phi = Builder.CreatePHI(llvm::Type::getInt1Ty(Context), 2, isAnd ? "landtmp" : "lortmp");
+    phi->addIncoming(llvm::ConstantInt::getBool(Context, !isAnd), lhsBB);
+    phi->addIncoming(R, rhsEndBB);
+    return phi;
+}
+
+/// Branches to `trueBB` or `falseBB` on a condition. A short-circuiting `&&` or
+/// `||` branches straight to the targets instead of materializing an `i1` first.
+bool emitConditionalBranch(
+    const nlohmann::json& cond,
+    llvm::BasicBlock* trueBB,
+    llvm::BasicBlock* falseBB,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    if (
+        cond["type"] == "Expression" &&
+        (cond["operator"] == "&&" || cond["operator"] == "||") &&
+        hasSideEffects(cond["right-operand"])
+    ) {
+        bool isAnd = cond["operator"] == "&&";
+        llvm::Function *function = Builder.GetInsertBlock()->getParent();
+        llvm::BasicBlock *rhsBB = llvm::BasicBlock::Create(Context, isAnd ? "land.rhs" : "lor.rhs", function, trueBB);
+
+        bool ok = isAnd
+            ? emitConditionalBranch(cond["left-operand"], rhsBB, falseBB, Builder, NamedValues, Context, Module)
+            : emitConditionalBranch(cond["left-operand"], trueBB, rhsBB, Builder, NamedValues, Context, Module);
+        if (!ok) {
+            return false;
+        }
+
+        Builder.SetInsertPoint(rhsBB);
+        return emitConditionalBranch(cond["right-operand"], trueBB, falseBB, Builder, NamedValues, Context, Module);
+    }
+
+    llvm::Value *condValue = processCondition(cond, Builder, NamedValues, Context, Module);
+    if (!condValue) {
+        return false;
+    }
+    Builder.CreateCondBr(condValue, trueBB, falseBB);
+    return true;
+}
+
+/// Returns true if `expr` reads the variable `name`.
+bool readsVariable(const nlohmann::json& expr, const std::string& name) {
+    if (expr["type"] == "Variable") {
+        return expr["name"] == name;
+    }
+    else if (expr["type"] == "Expression") {
+        return readsVariable(expr["left-operand"], name) || readsVariable(expr["right-operand"], name);
+    }
+    else if (expr["type"] == "Cast") {
+        return readsVariable(expr["value"], name);
+    }
+    else if (expr["type"] == "Vector") {
+        for (const auto& element : expr["elements"]) {
+            if (readsVariable(element, name)) return true;
+        }
+    }
+    else if (expr["type"] == "FunctionCall") {
+        for (const auto& param : expr["parameters"]) {
+            if (readsVariable(param, name)) return true;
+        }
+    }
+    return false;
+}
+
+/// If-conversion for small if blocks that only assign to existing variables,
+/// the shape that filter-style loops are made of:
+///
+/// ```
+/// if x > max { max = x }   ->   max = select(x > max, x, max)
+/// ```
+///
+/// Every condition and every assigned value is evaluated up front and the
+/// results are merged with `select`s, so no branch is emitted at all. Returns
+/// false if the block doesn't qualify, or if lowering it fails, and then leaves
+/// behind no code.
+bool tryIfConversion(
+    const nlohmann::json& ifBlock,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    // Beyond this many assignments speculating every branch costs more than a mispredict
+    const size_t maxSpeculatedAssignments = 4;
+
+    // Branch `i` of the chain, with the default block (if any) as the last branch
+    std::vector<const nlohmann::json*> branches;
+    for (const auto& statement : ifBlock["statements"]) {
+        if (hasSideEffects(statement["condition"])) {
+            return false;
+        }
+        branches.push_back(&statement["code-block"]);
+    }
+    if (ifBlock.contains("default")) {
+        branches.push_back(&ifBlock["default"]);
+    }
+
+    // Freeing buffers needs to happen on the paths that were actually taken
+    if (ifBlock.contains("else-drop")) {
+        return false;
+    }
+    for (const nlohmann::json* branch : branches) {
+        if (branch->contains("drop-on-entry")) {
+            return false;
+        }
+    }
+
+    std::vector<std::string> assignedVars;
+    std::vector<llvm::AllocaInst*> assignedAllocas;
+    size_t numAssignments = 0;
+
+    for (const nlohmann::json* branch : branches) {
+        std::vector<std::string> branchVars;
+        for (const auto& stmt : (*branch)["statements"]) {
+            if (stmt["type"] != "AssignmentStatement" || hasSideEffects(stmt["src"])) {
+                return false;
+            }
+            if (stmt.contains("drop") || dtype_has_buffer(dtype_from_str(stmt["src"].value("dtype", "Null")))) {
+                return false;
+            }
+
+            std::string dst = stmt["dst"];
+            std::optional<ValueBinding> binding = NamedValues.get(symbolOf(stmt, NamedValues));
+            if (!binding.has_value() || !binding->is_mutable) {
+                return false;
+            }
+
+            // Every value is computed from the state before the if block, so
+            // a branch can't depend on its own earlier assignments
+            for (const auto& var : branchVars) {
+                if (var == dst || readsVariable(stmt["src"], var)) {
+                    return false;
+                }
+            }
+            branchVars.push_back(dst);
+
+            if (std::find(assignedVars.begin(), assignedVars.end(), dst) == assignedVars.end()) {
+                assignedVars.push_back(dst);
+                assignedAllocas.push_back(static_cast<llvm::AllocaInst*>(binding->value));
+            }
+            numAssignments++;
+        }
+    }
+
+    if (numAssignments == 0 || numAssignments > maxSpeculatedAssignments) {
+        return false;
+    }
+
+    // The conditions and values can still fail to lower, some of them after
+    // adding blocks. Everything emitted from here on is thrown away again if so,
+    // and the chain gets lowered with branches from the same starting point
+    llvm::BasicBlock *startBB = Builder.GetInsertBlock();
+    llvm::Function *function = startBB->getParent();
+    llvm::Instruction *lastBefore = startBB->empty() ? nullptr : &startBB->back();
+    std::set<llvm::BasicBlock*> blocksBefore;
+    for (llvm::BasicBlock &BB : *function) {
+        blocksBefore.insert(&BB);
+    }
+    auto discardEmitted = [&]() {
+        std::vector<llvm::Instruction*> insts;
+        auto it = lastBefore ? std::next(lastBefore->getIterator()) : startBB->begin();
+        for (; it != startBB->end(); ++it) {
+            insts.push_back(&*it);
+        }
+        std::vector<llvm::BasicBlock*> blocks;
+        for (llvm::BasicBlock &BB : *function) {
+            if (!blocksBefore.count(&BB)) {
+                blocks.push_back(&BB);
+            }
+        }
+
+        // The new code only refers to itself and to values from before it
+        for (llvm::Instruction *inst : insts) {
+            inst->dropAllReferences();
+        }
+        for (llvm::BasicBlock *BB : blocks) {
+            BB->dropAllReferences();
+        }
+        for (llvm::Instruction *inst : insts) {
+            inst->eraseFromParent();
+        }
+        for (llvm::BasicBlock *BB : blocks) {
+            BB->eraseFromParent();
+        }
+        Builder.SetInsertPoint(startBB);
+        return false;
+    };
+
+    std::vector<llvm::Value*> conds;
+    for (const auto& statement : ifBlock["statements"]) {
+        llvm::Value *cond = processCondition(statement["condition"], Builder, NamedValues, Context, Module);
+        if (!cond) {
+            return discardEmitted();
+        }
+        conds.push_back(cond);
+    }
+
+    // Compute every new value before storing any of them
+    std::vector<llvm::Value*> newValues;
+    for (size_t j = 0; j < assignedVars.size(); j++) {
+        const std::string& varName = assignedVars[j];
+        llvm::AllocaInst *alloca = assignedAllocas[j];
+        llvm::Value *current = Builder.CreateLoad(alloca->getAllocatedType(), alloca, varName + "_load");
+
+        // Value of the variable after each branch
+        std::vector<llvm::Value*> branchValues;
+        for (const nlohmann::json* branch : branches) {
+            llvm::Value *value = current;
+            for (const auto& stmt : (*branch)["statements"]) {
+                if (stmt["dst"] == varName) {
+                    value = processExpression(stmt["src"], Builder, NamedValues, Context, Module);
+                    if (!value || value->getType() != current->getType()) {
+                        return discardEmitted();
+                    }
+                }
+            }
+            branchValues.push_back(value);
+        }
+
+        // Without a default block, falling through every condition keeps the current value
+        llvm::Value *result = ifBlock.contains("default") ? branchValues.back() : current;
+        for (size_t i = conds.size(); i-- > 0;) {
+            if (branchValues[i] != result) {
+                result = Builder.CreateSelect(conds[i], branchValues[i], result, varName + "_sel");
+            }
+        }
+        newValues.push_back(result);
+    }
+
+    for (size_t i = 0; i < assignedVars.size(); i++) {
+        Builder.CreateStore(newValues[i], assignedAllocas[i]);
+    }
+    return true;
+}
+
+/// Upper bound on the bytes a fused run of prints may reserve at once. Has to
+/// stay below the runtime's output buffer size.
+const uint64_t MAX_FUSED_PRINT_SIZE = 4096;
+
+/// Most bytes a single printed value (without its newline) can take:
+/// "-9223372036854775808", or a float whose integer part has 309 digits
+uint64_t maxPrintedSize(const std::string& dtype) {
+    if (dtype == "Bool") {
+        return 5;
+    } else if (dtype == "F64") {
+        return 351;
+    }
+    return 20;
+}
+
+/// A `print` that can be merged with its neighbours. Evaluating its argument
+/// must not print anything (or trap), since the output buffer is held while
+/// the arguments of the whole run are formatted into it.
+bool isFusablePrint(const nlohmann::json& stmt) {
+    if (stmt["type"] != "FunctionCall" || stmt["function-name"] != "print") {
+        return false;
+    }
+
+    const nlohmann::json& params = stmt["parameters"];
+    if (params.size() != 1 || hasSideEffects(params[0]) || stmt.contains("drop")) {
+        return false;
+    }
+
+    std::string dtype = params[0].value("dtype", "");
+    return dtype == "I64" || dtype == "U64" || dtype == "Bool" || dtype == "F64";
+}
+
+/// Compile-time text of a constant printed value
+std::optional<std::string> formatConstant(llvm::Value* value, const std::string& dtype) {
+    if (auto* constInt = llvm::dyn_cast<llvm::ConstantInt>(value)) {
+        if (dtype == "Bool") {
+            return std::string(constInt->isOne() ? "true" : "false");
+        } else if (dtype == "U64") {
+            return std::to_string(constInt->getZExtValue());
+        }
+        return std::to_string(constInt->getSExtValue());
+    }
+    if (auto* constFP = llvm::dyn_cast<llvm::ConstantFP>(value)) {
+        // Exactly what the runtime (and printf) prints
+        char buf[400];
+        snprintf(buf, sizeof(buf), "%f", constFP->getValueAPF().convertToDouble());
+        return std::string(buf);
+    }
+    return std::nullopt;
+}
+
+/// Lowers the prints `statements[begin..end)` (all `isFusablePrint`) to one
+/// write into the runtime's output buffer:
+///
+/// ```
+/// p = __compiler_reserved_out_reserve(<upper bound of the run's size>)
+/// memcpy(p, "<constant text>", n); p += n           ; literals and newlines
+/// p = __compiler_reserved_format_int(p, <value>)    ; dynamic values
+/// ...
+/// __compiler_reserved_out_commit(p)
+/// ```
+///
+/// Adjacent constant text (newlines and values known at compile time) is merged
+/// into a single skeleton string. A run stops early once its upper bound would
+/// exceed `MAX_FUSED_PRINT_SIZE`; returns the index after the last fused print.
+size_t processPrintSequence(
+    const nlohmann::json& statements,
+    size_t begin,
+    size_t end,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    emitLocation(Builder, statements[begin]);
+
+    // Only the dynamic values are evaluated up front, the rest is plain text
+    struct PrintPart {
+        std::string text;
+        llvm::Value* value;
+        std::string dtype;
+    };
+    std::vector<PrintPart> parts;
+
+    uint64_t reserveSize = 0;
+    size_t idx = begin;
+    for (; idx < end; idx++) {
+        const nlohmann::json& param = statements[idx]["parameters"][0];
+        std::string dtype = param["dtype"];
+
+        uint64_t itemSize = maxPrintedSize(dtype) + 1;
+        if (idx > begin && reserveSize + itemSize > MAX_FUSED_PRINT_SIZE) {
+            break;
+        }
+        reserveSize += itemSize;
+
+        llvm::Value* value = processExpression(param, Builder, NamedValues, Context, Module);
+        if (!value) {
+            llvm::errs() << "Error processing argument in function call.\n";
+            return idx + 1;
+        }
+
+        std::optional<std::string> text = formatConstant(value, dtype);
+        if (text.has_value()) {
+            parts.push_back(PrintPart{ text.value() + "\n", nullptr, dtype });
+        } else {
+            parts.push_back(PrintPart{ "", value, dtype });
+            parts.push_back(PrintPart{ "\n", nullptr, dtype });
+        }
+    }
+
+    llvm::Type* i8Ty = llvm::Type::getInt8Ty(Context);
+    llvm::Type* i64Ty = llvm::Type::getInt64Ty(Context);
+
+    llvm::Value* cursor = Builder.CreateCall(
+        Module->getFunction("__compiler_reserved_out_reserve"),
+        { llvm::ConstantInt::get(i64Ty, reserveSize) },
+        "print.buf"
+    );
+
+    auto emitText = [&](const std::string& text) {
+        if (text.empty()) {
+            return;
+        }
+        llvm::Value* skeleton = Builder.CreateGlobalStringPtr(text, "print.text");
+        Builder.CreateMemCpy(cursor, llvm::MaybeAlign(1), skeleton, llvm::MaybeAlign(1), text.size());
+        cursor = Builder.CreateInBoundsGEP(i8Ty, cursor, llvm::ConstantInt::get(i64Ty, text.size()), "print.pos");
+    };
+
+    std::string pendingText;
+    for (const PrintPart& part : parts) {
+        if (!part.value) {
+            pendingText += part.text;
+            continue;
+        }
+        emitText(pendingText);
+        pendingText.clear();
+
+        if (part.dtype == "Bool") {
+            // Both spellings are copied with a fixed size; only the length differs
+            llvm::Value* spelling = Builder.CreateSelect(
+                part.value,
+                Builder.CreateGlobalStringPtr("true", "print.true"),
+                Builder.CreateGlobalStringPtr("false", "print.false")
+            );
+            Builder.CreateMemCpy(cursor, llvm::MaybeAlign(1), spelling, llvm::MaybeAlign(1), 5);
+            llvm::Value* len = Builder.CreateSelect(part.value, llvm::ConstantInt::get(i64Ty, 4), llvm::ConstantInt::get(i64Ty, 5));
+            cursor = Builder.CreateInBoundsGEP(i8Ty, cursor, len, "print.pos");
+            continue;
+        }
+
+        std::string formatFunc = "__compiler_reserved_format_int";
+        if (part.dtype == "U64") {
+            formatFunc = "__compiler_reserved_format_uint";
+        } else if (part.dtype == "F64") {
+            formatFunc = "__compiler_reserved_format_float";
+        }
+        cursor = Builder.CreateCall(Module->getFunction(formatFunc), { cursor, part.value }, "print.pos");
+    }
+    emitText(pendingText);
+
+    Builder.CreateCall(Module->getFunction("__compiler_reserved_out_commit"), { cursor });
+    return idx;
+}
+
+
+/// Largest buffer a non-escaping allocation site gets on the stack. Longer
+/// strings built at such a site still go to the heap.
+const uint64_t MAX_STACK_BUFFER_SIZE = 256;
+
+/// Longest string that is stored in the `String` value itself
+const uint64_t SMALL_STRING_CAPACITY = 23;
+
+/// `String` values are `{ i8* data, i64 len, i64 cap }` and are passed around
+/// by value. Their bytes are never modified after they are built.
+///
+/// `cap` is the size of the heap buffer the value owns, and 0 if it doesn't
+/// own one (literals, stack buffers, regions and borrowed values), so whoever
+/// drops the last owner of a buffer can tell whether there is anything to free.
+///
+/// Strings of up to `SMALL_STRING_CAPACITY` bytes that are built at run time
+/// are small strings instead: the text is stored in the value itself, and its
+/// last byte (the top byte of `cap`, on the little-endian targets we support)
+/// is `0x80 | len`. So `cap` is negative for a small string, which never owns
+/// anything. `emitStringParts` gets the bytes of any string.
+llvm::StructType* getStringType(llvm::LLVMContext &Context) {
+    llvm::StructType* type = llvm::StructType::getTypeByName(Context, "String");
+    if (!type) {
+        llvm::Type* i64Ty = llvm::Type::getInt64Ty(Context);
+        type = llvm::StructType::create(Context, { llvm::Type::getInt8PtrTy(Context), i64Ty, i64Ty }, "String");
+    }
+    return type;
+}
+
+/// Strips the quotes of a string literal token and resolves its escapes
+std::string decodeStringLiteral(const std::string& token) {
+    std::string text;
+    for (size_t i = 1; i + 1 < token.size(); i++) {
+        if (token[i] != '\\' || i + 2 >= token.size()) {
+            text += token[i];
+            continue;
+        }
+
+        char escaped = token[++i];
+        if (escaped == 'n') {
+            text += '\n';
+        } else if (escaped == 't') {
+            text += '\t';
+        } else if (escaped == '0') {
+            text += '\0';
+        } else {
+            text += escaped;
+        }
+    }
+    return text;
+}
+
+/// A string whose bytes are a private constant global, so using a literal
+/// never allocates
+llvm::Value* createStringConstant(const std::string& text, llvm::LLVMContext &Context, llvm::Module *Module) {
+    llvm::Constant* data = llvm::ConstantDataArray::getString(Context, text, false);
+    auto* global = new llvm::GlobalVariable(
+        *Module, data->getType(), true, llvm::GlobalValue::PrivateLinkage, data, "str"
+    );
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(llvm::Align(1));
+
+    llvm::Constant* zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Context), 0);
+    llvm::Constant* ptr = llvm::ConstantExpr::getInBoundsGetElementPtr(
+        data->getType(), global, llvm::ArrayRef<llvm::Constant*>{ zero, zero }
+    );
+    llvm::Type* i64Ty = llvm::Type::getInt64Ty(Context);
+    return llvm::ConstantStruct::get(
+        getStringType(Context), { ptr, llvm::ConstantInt::get(i64Ty, text.size()), llvm::ConstantInt::get(i64Ty, 0) }
+    );
+}
+
+/// Returns a buffer of `size` bytes for the allocation site `site`, and sets
+/// `capacity` to the `cap` of a string that owns it.
+///
+/// Escape analysis (see `analyze_escapes`) marks the sites whose value never
+/// leaves the function, or the loop iteration, with `"alloc": "stack"`. Those
+/// get a buffer in the entry block that every execution of the site reuses:
+/// exactly `size` bytes if that's a constant, otherwise `MAX_STACK_BUFFER_SIZE`
+/// bytes with a fallback to the heap for longer values. Everything else is
+/// allocated on the heap.
+///
+/// The buffer of an array is aligned to `ARRAY_ALIGNMENT` bytes (except for
+/// reference counted heap buffers, see `arrayAlignment`).
+llvm::Value* allocateBuffer(
+    const nlohmann::json& site,
+    llvm::Value* size,
+    llvm::Value*& capacity,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module,
+    bool isArray
+) {
+    // An owned buffer never has a capacity of 0, even for an empty string
+    auto heapSizeOf = [&]() {
+        return Builder.CreateBinaryIntrinsic(llvm::Intrinsic::umax, size, Builder.getInt64(1), nullptr, "heap.size");
+    };
+    llvm::Value* region = getRegion(site);
+
+    // Regions only align to 8 bytes, so an array gets enough slack to align itself
+    auto regionAlloc = [&]() -> llvm::Value* {
+        llvm::Function* regionAllocFunc = Module->getFunction("__compiler_reserved_region_alloc");
+        if (!isArray) {
+            return Builder.CreateCall(regionAllocFunc, { region, size }, "region.buf");
+        }
+        llvm::Value* padded = Builder.CreateAdd(size, Builder.getInt64(ARRAY_ALIGNMENT - 1), "region.size");
+        llvm::Value* raw = Builder.CreateCall(regionAllocFunc, { region, padded }, "region.raw");
+        llvm::Value* offset = Builder.CreateAnd(
+            Builder.CreateNeg(Builder.CreatePtrToInt(raw, Builder.getInt64Ty())), ARRAY_ALIGNMENT - 1, "region.pad"
+        );
+        return Builder.CreateInBoundsGEP(Builder.getInt8Ty(), raw, offset, "region.buf");
+    };
+
+    if (site.value("alloc", "heap") != "stack") {
+        if (!region) {
+            capacity = heapSizeOf();
+            return emitHeapAlloc(capacity, Builder, Module, isArray);
+        }
+
+        // Only the caller's region can be used for a value that escapes, and
+        // the caller may not have passed one
+        llvm::Value* hasRegion = Builder.CreateIsNotNull(region, "has.region");
+        llvm::Function* function = Builder.GetInsertBlock()->getParent();
+        llvm::BasicBlock* regionBB = llvm::BasicBlock::Create(Builder.getContext(), "buf.region", function);
+        llvm::BasicBlock* heapBB = llvm::BasicBlock::Create(Builder.getContext(), "buf.heap", function);
+        llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(Builder.getContext(), "buf.end", function);
+        Builder.CreateCondBr(hasRegion, regionBB, heapBB);
+
+        Builder.SetInsertPoint(regionBB);
+        llvm::Value* regionPtr = regionAlloc();
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(heapBB);
+        llvm::Value* heapSize = heapSizeOf();
+        llvm::Value* heapPtr = emitHeapAlloc(heapSize, Builder, Module, isArray);
+        llvm::BasicBlock* heapEndBB = Builder.GetInsertBlock();
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(mergeBB);
+        llvm::PHINode* ptr = Builder.CreatePHI(Builder.getInt8PtrTy(), 2, "buf");
+        ptr->addIncoming(regionPtr, regionBB);
+        ptr->addIncoming(heapPtr, heapEndBB);
+        llvm::PHINode* cap = Builder.CreatePHI(Builder.getInt64Ty(), 2, "buf.cap");
+        cap->addIncoming(Builder.getInt64(0), regionBB);
+        cap->addIncoming(heapSize, heapEndBB);
+        capacity = cap;
+        return ptr;
+    }
+
+    capacity = Builder.getInt64(0);
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    auto* constSize = llvm::dyn_cast<llvm::ConstantInt>(size);
+    if (constSize && constSize->getZExtValue() <= MAX_STACK_BUFFER_SIZE) {
+        llvm::Type* bufferType = llvm::ArrayType::get(Builder.getInt8Ty(), constSize->getZExtValue());
+        llvm::AllocaInst* buffer = createEntryBlockAlloca(function, bufferType, "stack.buf");
+        if (isArray) {
+            buffer->setAlignment(llvm::Align(ARRAY_ALIGNMENT));
+        }
+        return Builder.CreateConstInBoundsGEP2_64(bufferType, buffer, 0, 0, "stack.ptr");
+    }
+
+    llvm::Type* bufferType = llvm::ArrayType::get(Builder.getInt8Ty(), MAX_STACK_BUFFER_SIZE);
+    llvm::AllocaInst* buffer = createEntryBlockAlloca(function, bufferType, "stack.buf");
+    if (isArray) {
+        buffer->setAlignment(llvm::Align(ARRAY_ALIGNMENT));
+    }
+    llvm::Value* stackPtr = Builder.CreateConstInBoundsGEP2_64(bufferType, buffer, 0, 0, "stack.ptr");
+
+    llvm::BasicBlock* stackBB = Builder.GetInsertBlock();
+    llvm::BasicBlock* heapBB = llvm::BasicBlock::Create(Builder.getContext(), "buf.heap", function);
+    llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(Builder.getContext(), "buf.end", function);
+
+    llvm::Value* fits = Builder.CreateICmpULE(size, Builder.getInt64(MAX_STACK_BUFFER_SIZE), "buf.fits");
+    Builder.CreateCondBr(fits, mergeBB, heapBB);
+
+    Builder.SetInsertPoint(heapBB);
+    if (region) {
+        // Regions don't give ownership of the buffer to the value
+        llvm::Value* regionPtr = regionAlloc();
+        llvm::BasicBlock* regionEndBB = Builder.GetInsertBlock();
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(mergeBB);
+        llvm::PHINode* ptr = Builder.CreatePHI(Builder.getInt8PtrTy(), 2, "buf");
+        ptr->addIncoming(stackPtr, stackBB);
+        ptr->addIncoming(regionPtr, regionEndBB);
+        return ptr;
+    }
+
+    llvm::Value* heapSize = heapSizeOf();
+    llvm::Value* heapPtr = emitHeapAlloc(heapSize, Builder, Module, isArray);
+    llvm::BasicBlock* heapEndBB = Builder.GetInsertBlock();
+    Builder.CreateBr(mergeBB);
+
+    Builder.SetInsertPoint(mergeBB);
+    llvm::PHINode* ptr = Builder.CreatePHI(Builder.getInt8PtrTy(), 2, "buf");
+    ptr->addIncoming(stackPtr, stackBB);
+    ptr->addIncoming(heapPtr, heapEndBB);
+
+    llvm::PHINode* cap = Builder.CreatePHI(Builder.getInt64Ty(), 2, "buf.cap");
+    cap->addIncoming(capacity, stackBB);
+    cap->addIncoming(heapSize, heapEndBB);
+    capacity = cap;
+    return ptr;
+}
+
+/// Whether `expr` is a `+` on strings, i.e. builds a new buffer
+bool isStringConcat(const nlohmann::json& expr) {
+    return expr["type"] == "Expression" && expr.value("dtype", "Null") == "String" && expr["operator"] == "+";
+}
+
+/// The operands of a chain of concatenations like `a + b + c`, from left to
+/// right. The concatenations in between are never built.
+void collectConcatOperands(const nlohmann::json& expr, std::vector<const nlohmann::json*>& operands) {
+    for (const char* side : {"left-operand", "right-operand"}) {
+        const nlohmann::json& operand = expr[side];
+        if (FuseConcats && isStringConcat(operand)) {
+            collectConcatOperands(operand, operands);
+        } else {
+            operands.push_back(&operand);
+        }
+    }
+}
+
+/// Lowers `a + b + ...` on strings to one new buffer holding every operand:
+/// the total length is computed first, then each operand is copied in.
+///
+/// `reuse` is the old value of the variable `s` in `s = s + ...`, which dies
+/// here (`"drop-old"`). With AutoFree its buffer belongs to nobody else, so
+/// the result is built in it if it is large enough, and it is dropped
+/// otherwise.
+llvm::Value* processStringConcat(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module,
+    llvm::Value* reuse
+) {
+    if (expr["operator"] != "+") {
+        llvm::errs() << "Unsupported string operator: " << expr["operator"].get<std::string>() << "\n";
+        return nullptr;
+    }
+
+    std::vector<const nlohmann::json*> operands;
+    collectConcatOperands(expr, operands);
+
+    std::vector<llvm::Value*> values;
+    std::vector<StringParts> pieces;
+    for (const nlohmann::json* operand : operands) {
+        llvm::Value* value = processExpression(*operand, Builder, NamedValues, Context, Module);
+        if (!value) {
+            return nullptr;
+        }
+        values.push_back(value);
+        pieces.push_back(emitStringParts(value, Builder));
+    }
+
+    // Every length is the size of an existing buffer, so this can't overflow
+    llvm::Value* len = pieces[0].len;
+    for (size_t i = 1; i < pieces.size(); i++) {
+        len = Builder.CreateAdd(len, pieces[i].len, "concat.len", true, true);
+    }
+
+    // Copies `pieces[first..]` into `buffer`, starting at `offset`
+    auto copyPieces = [&](llvm::Value* buffer, size_t first, llvm::Value* offset) {
+        for (size_t i = first; i < pieces.size(); i++) {
+            llvm::Value* dst = Builder.CreateInBoundsGEP(Builder.getInt8Ty(), buffer, offset, "concat.dst");
+            Builder.CreateMemCpy(dst, llvm::MaybeAlign(1), pieces[i].data, llvm::MaybeAlign(1), pieces[i].len);
+            offset = Builder.CreateAdd(offset, pieces[i].len, "concat.offset", true, true);
+        }
+    };
+    auto makeString = [&](llvm::Value* buffer, llvm::Value* capacity) {
+        llvm::Value* str = llvm::UndefValue::get(getStringType(Context));
+        str = Builder.CreateInsertValue(str, buffer, 0);
+        str = Builder.CreateInsertValue(str, len, 1);
+        str = Builder.CreateInsertValue(str, capacity, 2, "concat");
+        KnownParts[str] = StringParts{ buffer, len };
+        return str;
+    };
+
+    // The bytes of `s` are already at the start of its buffer. Nothing else
+    // is written there, so the other operands can even be views of `s`.
+    bool appends = reuse != nullptr;
+    auto buildInBuffer = [&]() {
+        llvm::Value* size = len;
+        if (appends && expr.value("alloc", "heap") == "heap" && !getRegion(expr)) {
+            // Room to append as much again before the buffer has to grow
+            size = Builder.CreateMul(len, Builder.getInt64(2), "concat.grow", true, true);
+        }
+        llvm::Value* capacity = nullptr;
+        llvm::Value* buffer = allocateBuffer(expr, size, capacity, Builder, Module);
+        copyPieces(buffer, 0, Builder.getInt64(0));
+        return makeString(buffer, capacity);
+    };
+    auto build = [&]() {
+        // A stack buffer costs nothing either, but anything else would have
+        // to be allocated
+        if (expr.value("alloc", "heap") == "stack") {
+            return buildInBuffer();
+        }
+        return emitBySize(len, [&]() {
+            return emitSmallString(pieces, len, Builder);
+        }, buildInBuffer, Builder);
+    };
+
+    llvm::Value* result = nullptr;
+    if (appends) {
+        llvm::Value* oldCap = Builder.CreateExtractValue(reuse, 2, "reuse.cap");
+        llvm::Value* fits = Builder.CreateAnd(
+            Builder.CreateICmpSGT(oldCap, Builder.getInt64(0)), Builder.CreateICmpSGE(oldCap, len), "reuse.fits"
+        );
+
+        llvm::Function* function = Builder.GetInsertBlock()->getParent();
+        llvm::BasicBlock* reuseBB = llvm::BasicBlock::Create(Context, "concat.reuse", function);
+        llvm::BasicBlock* newBB = llvm::BasicBlock::Create(Context, "concat.new", function);
+        llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(Context, "concat.end", function);
+        Builder.CreateCondBr(fits, reuseBB, newBB);
+
+        Builder.SetInsertPoint(reuseBB);
+        llvm::Value* oldData = Builder.CreateExtractValue(reuse, 0, "reuse.data");
+        copyPieces(oldData, 1, pieces[0].len);
+        llvm::Value* reused = makeString(oldData, oldCap);
+        llvm::BasicBlock* reuseEndBB = Builder.GetInsertBlock();
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(newBB);
+        llvm::Value* fresh = build();
+        emitDrop(reuse, Builder, Module);
+        llvm::BasicBlock* newEndBB = Builder.GetInsertBlock();
+        Builder.CreateBr(mergeBB);
+
+        Builder.SetInsertPoint(mergeBB);
+        llvm::PHINode* phi = Builder.CreatePHI(reused->getType(), 2, "concat");
+        phi->addIncoming(reused, reuseEndBB);
+        phi->addIncoming(fresh, newEndBB);
+        result = phi;
+    } else {
+        result = build();
+    }
+
+    // The operands were copied, so operands that were built just for this are dead
+    for (size_t i = 0; i < operands.size(); i++) {
+        if (isTemporary(*operands[i])) {
+            emitDrop(values[i], Builder, Module);
+        }
+    }
+    return result;
+}
+
+StringParts emitStringParts(llvm::Value* str, llvm::IRBuilder<> &Builder) {
+    if (auto known = KnownParts.find(str); known != KnownParts.end()) {
+        return known->second;
+    }
+
+    llvm::Value* cap = Builder.CreateExtractValue(str, 2, "str.cap");
+    if (auto* constCap = llvm::dyn_cast<llvm::ConstantInt>(cap); constCap && !constCap->isNegative()) {
+        return StringParts{ Builder.CreateExtractValue(str, 0, "str.data"), Builder.CreateExtractValue(str, 1, "str.len") };
+    }
+
+    // The text of a small string has to be in memory to be pointed at
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::AllocaInst* spill = createEntryBlockAlloca(function, str->getType(), "str.spill");
+    Builder.CreateStore(str, spill);
+
+    llvm::Value* isSmall = Builder.CreateICmpSLT(cap, Builder.getInt64(0), "str.issmall");
+    llvm::Value* data = Builder.CreateSelect(
+        isSmall, Builder.CreateBitCast(spill, Builder.getInt8PtrTy()), Builder.CreateExtractValue(str, 0), "str.data"
+    );
+    return StringParts{ data, emitStringLength(str, Builder) };
+}
+
+llvm::Value* emitStringLength(llvm::Value* str, llvm::IRBuilder<> &Builder) {
+    if (auto known = KnownParts.find(str); known != KnownParts.end()) {
+        return known->second.len;
+    }
+
+    llvm::Value* cap = Builder.CreateExtractValue(str, 2, "str.cap");
+    llvm::Value* len = Builder.CreateExtractValue(str, 1, "str.len");
+    if (auto* constCap = llvm::dyn_cast<llvm::ConstantInt>(cap); constCap && !constCap->isNegative()) {
+        return len;
+    }
+
+    llvm::Value* isSmall = Builder.CreateICmpSLT(cap, Builder.getInt64(0), "str.issmall");
+    llvm::Value* smallLen = Builder.CreateAnd(Builder.CreateLShr(cap, 56), Builder.getInt64(0x7f), "str.smalllen");
+    return Builder.CreateSelect(isSmall, smallLen, len, "len");
+}
+
+/// A small string holding `pieces` one after the other, `len` (at most
+/// `SMALL_STRING_CAPACITY`) bytes in total
+llvm::Value* emitSmallString(std::vector<StringParts> const& pieces, llvm::Value* len, llvm::IRBuilder<> &Builder) {
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::Type* stringType = getStringType(Builder.getContext());
+    llvm::AllocaInst* slot = createEntryBlockAlloca(function, stringType, "small.slot");
+    Builder.CreateStore(llvm::Constant::getNullValue(stringType), slot);
+
+    llvm::Value* text = Builder.CreateBitCast(slot, Builder.getInt8PtrTy(), "small.text");
+    llvm::Value* offset = Builder.getInt64(0);
+    for (StringParts const& piece : pieces) {
+        llvm::Value* dst = Builder.CreateInBoundsGEP(Builder.getInt8Ty(), text, offset);
+        Builder.CreateMemCpy(dst, llvm::MaybeAlign(1), piece.data, llvm::MaybeAlign(1), piece.len);
+        offset = Builder.CreateAdd(offset, piece.len, "", true, true);
+    }
+
+    // The tag is put into `cap` by hand instead of being stored, so that its
+    // length is still known once the string has been loaded
+    llvm::Value* str = Builder.CreateLoad(stringType, slot, "small.bytes");
+    llvm::Value* tag = Builder.CreateShl(Builder.CreateOr(len, 0x80), 56, "small.tag");
+    llvm::Value* cap = Builder.CreateAnd(Builder.CreateExtractValue(str, 2), Builder.getInt64((1ull << 56) - 1));
+    str = Builder.CreateInsertValue(str, Builder.CreateOr(cap, tag), 2, "small");
+    KnownParts[str] = StringParts{ text, len };
+    return str;
+}
+
+/// The string `small` builds if `len` bytes fit in a small string, otherwise
+/// the one `large` builds. Only one of them is generated if `len` is a constant.
+llvm::Value* emitBySize(
+    llvm::Value* len,
+    std::function<llvm::Value*()> const& small,
+    std::function<llvm::Value*()> const& large,
+    llvm::IRBuilder<> &Builder
+) {
+    if (auto* constLen = llvm::dyn_cast<llvm::ConstantInt>(len)) {
+        return constLen->getZExtValue() <= SMALL_STRING_CAPACITY ? small() : large();
+    }
+
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* smallBB = llvm::BasicBlock::Create(Builder.getContext(), "str.small", function);
+    llvm::BasicBlock* largeBB = llvm::BasicBlock::Create(Builder.getContext(), "str.large", function);
+    llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(Builder.getContext(), "str.end", function);
+    llvm::Value* fits = Builder.CreateICmpULE(len, Builder.getInt64(SMALL_STRING_CAPACITY), "str.fits");
+    Builder.CreateCondBr(fits, smallBB, largeBB);
+
+    Builder.SetInsertPoint(smallBB);
+    llvm::Value* smallStr = small();
+    llvm::BasicBlock* smallEndBB = Builder.GetInsertBlock();
+    Builder.CreateBr(mergeBB);
+
+    Builder.SetInsertPoint(largeBB);
+    llvm::Value* largeStr = large();
+    llvm::BasicBlock* largeEndBB = Builder.GetInsertBlock();
+    Builder.CreateBr(mergeBB);
+
+    Builder.SetInsertPoint(mergeBB);
+    llvm::PHINode* result = Builder.CreatePHI(smallStr->getType(), 2, "str");
+    result->addIncoming(smallStr, smallEndBB);
+    result->addIncoming(largeStr, largeEndBB);
+
+    auto smallParts = KnownParts.find(smallStr);
+    auto largeParts = KnownParts.find(largeStr);
+    if (smallParts != KnownParts.end() && largeParts != KnownParts.end()) {
+        llvm::PHINode* data = Builder.CreatePHI(Builder.getInt8PtrTy(), 2, "str.data");
+        data->addIncoming(smallParts->second.data, smallEndBB);
+        data->addIncoming(largeParts->second.data, largeEndBB);
+        KnownParts[result] = StringParts{ data, len };
+    }
+    return result;
+}
+
+
+/// Size in words of `struct Region` in the runtime (runtime/truffle_rt.c)
+const uint64_t REGION_SIZE_WORDS = 3;
+
+/// A region lives in the entry block so that it dominates every use. It starts
+/// out empty (all zeros), and resetting or releasing it leaves it usable.
+llvm::Value* createRegion(llvm::Function* function, const std::string& name) {
+    llvm::Type* regionType = llvm::ArrayType::get(llvm::Type::getInt8PtrTy(function->getContext()), REGION_SIZE_WORDS);
+    llvm::AllocaInst* region = createEntryBlockAlloca(function, regionType, name);
+
+    llvm::IRBuilder<> TmpBuilder(region->getParent(), std::next(region->getIterator()));
+    TmpBuilder.CreateStore(llvm::ConstantAggregateZero::get(regionType), region);
+    return TmpBuilder.CreateBitCast(region, TmpBuilder.getInt8PtrTy(), name + ".ptr");
+}
+
+/// The region named by the `"region"` annotation of an allocation site or a
+/// call (see `analyze_escapes`), or nullptr if it has none
+llvm::Value* getRegion(const nlohmann::json& node) {
+    std::string region = node.value("region", "");
+    if (region == "loop" && !LoopRegions.empty()) {
+        return LoopRegions.back();
+    } else if (region == "function") {
+        return FunctionRegion;
+    } else if (region == "caller") {
+        return CallerRegion;
+    }
+    return nullptr;
+}
+
+/// Releases every region of the current function before it returns
+void emitRegionReleases(llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    llvm::Function* releaseFunc = Module->getFunction("__compiler_reserved_region_release");
+    for (auto it = LoopRegions.rbegin(); it != LoopRegions.rend(); ++it) {
+        if (*it) {
+            Builder.CreateCall(releaseFunc, { *it });
+        }
+    }
+    if (FunctionRegion) {
+        Builder.CreateCall(releaseFunc, { FunctionRegion });
+    }
+}
+
+/// A buffer-owning value that no variable owns, i.e. one that was built (or
+/// returned) just to be used by the expression around it
+bool isTemporary(const nlohmann::json& expr) {
+    std::string exprType = expr["type"];
+    return (exprType == "Expression" || exprType == "FunctionCall" || exprType == "NewArray")
+        && dtype_has_buffer(dtype_from_str(expr.value("dtype", "Null")));
+}
+
+/// Allocates a heap buffer of `size` (> 0) bytes for the current memory model.
+/// The buffer of an array is aligned to `ARRAY_ALIGNMENT` bytes, unless it is
+/// reference counted.
+llvm::Value* emitHeapAlloc(llvm::Value* size, llvm::IRBuilder<> &Builder, llvm::Module *Module, bool isArray) {
+    if (Memory == MemoryModel::RefCount) {
+        return Builder.CreateCall(Module->getFunction("__compiler_reserved_rc_alloc"), { size }, "heap.buf");
+    }
+    if (CheckMemory) {
+        const char* allocFunc = isArray ? "__compiler_reserved_checked_array_alloc" : "__compiler_reserved_checked_alloc";
+        return Builder.CreateCall(Module->getFunction(allocFunc), { size, Builder.getInt32(CurrentLine) }, "heap.buf");
+    }
+    const char* allocFunc = isArray ? "__compiler_reserved_array_alloc" : "__compiler_reserved_alloc";
+    return Builder.CreateCall(Module->getFunction(allocFunc), { size }, "heap.buf");
+}
+
+/// Frees the heap buffer that `str` owns, if it owns one. With reference
+/// counting this drops one reference instead.
+void emitDrop(llvm::Value* str, llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    if (Memory == MemoryModel::Leak) {
+        return;
+    }
+
+    llvm::Value* cap = Builder.CreateExtractValue(str, 2, "drop.cap");
+    auto* constCap = llvm::dyn_cast<llvm::ConstantInt>(cap);
+    if (constCap && !constCap->getValue().isStrictlyPositive()) {
+        return;
+    }
+    llvm::Value* data = Builder.CreatePointerCast(Builder.CreateExtractValue(str, 0), Builder.getInt8PtrTy(), "drop.data");
+
+    auto emitFree = [&]() {
+        if (Memory == MemoryModel::RefCount) {
+            Builder.CreateCall(Module->getFunction("__compiler_reserved_rc_release"), { data });
+        } else if (CheckMemory) {
+            Builder.CreateCall(Module->getFunction("__compiler_reserved_checked_free"), { data, cap, Builder.getInt32(CurrentLine) });
+        } else {
+            Builder.CreateCall(Module->getFunction("__compiler_reserved_free"), { data, cap });
+        }
+    };
+    if (constCap) {
+        emitFree();
+        return;
+    }
+
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* freeBB = llvm::BasicBlock::Create(Builder.getContext(), "drop.free", function);
+    llvm::BasicBlock* endBB = llvm::BasicBlock::Create(Builder.getContext(), "drop.end", function);
+    Builder.CreateCondBr(Builder.CreateICmpSGT(cap, Builder.getInt64(0), "drop.owned"), freeBB, endBB);
+
+    Builder.SetInsertPoint(freeBB);
+    emitFree();
+    Builder.CreateBr(endBB);
+    Builder.SetInsertPoint(endBB);
+}
+
+/// Drops the variables listed under `key` in `node` (see `annotate_drops`)
+void emitDrops(const nlohmann::json& node, const std::string& key, llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    if (!node.contains(key) || Builder.GetInsertBlock()->getTerminator()) {
+        return;
+    }
+
+    for (const auto& id : node[key]) {
+        auto it = BufferVariables.find(id.get<size_t>());
+        if (it == BufferVariables.end()) {
+            continue;
+        }
+
+        llvm::Value* value = it->second.value;
+        if (it->second.is_mutable) {
+            auto* alloca = static_cast<llvm::AllocaInst*>(value);
+            value = Builder.CreateLoad(alloca->getAllocatedType(), alloca, alloca->getName() + "_drop");
+        }
+        emitDrop(value, Builder, Module);
+    }
+}
+
+/// A second owner for the value of `str`, which stays alive: a copy of its
+/// buffer with AutoFree, another reference with reference counting
+llvm::Value* emitCopy(llvm::Value* str, llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    if (Memory == MemoryModel::Leak) {
+        return str;
+    }
+
+    llvm::Value* cap = Builder.CreateExtractValue(str, 2, "copy.cap");
+    if (auto* constCap = llvm::dyn_cast<llvm::ConstantInt>(cap); constCap && !constCap->getValue().isStrictlyPositive()) {
+        return str;
+    }
+
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* sharedBB = Builder.GetInsertBlock();
+    llvm::BasicBlock* ownedBB = llvm::BasicBlock::Create(Builder.getContext(), "copy.owned", function);
+    llvm::BasicBlock* endBB = llvm::BasicBlock::Create(Builder.getContext(), "copy.end", function);
+    Builder.CreateCondBr(Builder.CreateICmpSGT(cap, Builder.getInt64(0), "copy.isowned"), ownedBB, endBB);
+
+    Builder.SetInsertPoint(ownedBB);
+    if (Memory == MemoryModel::RefCount) {
+        llvm::Value* data = Builder.CreatePointerCast(Builder.CreateExtractValue(str, 0), Builder.getInt8PtrTy());
+        Builder.CreateCall(Module->getFunction("__compiler_reserved_rc_retain"), { data });
+        Builder.CreateBr(endBB);
+        Builder.SetInsertPoint(endBB);
+        return str;
+    }
+
+    llvm::Value* clone = emitClone(str, Builder, Module);
+    llvm::BasicBlock* ownedEndBB = Builder.GetInsertBlock();
+    Builder.CreateBr(endBB);
+
+    Builder.SetInsertPoint(endBB);
+    llvm::PHINode* result = Builder.CreatePHI(str->getType(), 2, "copy");
+    result->addIncoming(str, sharedBB);
+    result->addIncoming(clone, ownedEndBB);
+    return result;
+}
+
+/// A copy of `str` that doesn't depend on its buffer: a small string if it
+/// fits, otherwise a new heap buffer owned by the result
+llvm::Value* emitClone(llvm::Value* str, llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    if (isArrayType(str->getType())) {
+        return emitArrayClone(str, Builder, Module);
+    }
+
+    StringParts src = emitStringParts(str, Builder);
+    return emitBySize(src.len, [&]() {
+        return emitSmallString({ src }, src.len, Builder);
+    }, [&]() {
+        // Longer than a small string, so the buffer isn't empty
+        llvm::Value* buffer = emitHeapAlloc(src.len, Builder, Module);
+        Builder.CreateMemCpy(buffer, llvm::MaybeAlign(1), src.data, llvm::MaybeAlign(1), src.len);
+
+        llvm::Value* result = llvm::UndefValue::get(str->getType());
+        result = Builder.CreateInsertValue(result, buffer, 0);
+        result = Builder.CreateInsertValue(result, src.len, 1);
+        result = Builder.CreateInsertValue(result, src.len, 2, "clone");
+        KnownParts[result] = StringParts{ buffer, src.len };
+        return result;
+    }, Builder);
+}
+
+
+/// `T[]` values are `{ T* data, i64 len, i64 cap }`, named `Array.T`, and
+/// are passed around by value like strings. Unlike strings their elements are
+/// mutable, so two variables never share a buffer (see `emitArrayTransfer`),
+/// with one exception: an array parameter is the caller's array.
+///
+/// `cap` is the size in bytes of the heap buffer the value owns, and 0 if it
+/// doesn't own one (stack buffers, regions and borrowed values).
+llvm::StructType* getArrayType(const std::string& dtype, llvm::LLVMContext &Context) {
+    std::string elementDtype = dtype.substr(0, dtype.size() - 2);
+    llvm::StructType* type = llvm::StructType::getTypeByName(Context, "Array." + elementDtype);
+    if (!type) {
+        llvm::Type* i64Ty = llvm::Type::getInt64Ty(Context);
+        llvm::Type* elementType = getLLVMType(elementDtype, Context);
+        type = llvm::StructType::create(Context, { elementType->getPointerTo(), i64Ty, i64Ty }, "Array." + elementDtype);
+    }
+    return type;
+}
+
+llvm::Type* getArrayElementType(llvm::Type* arrayType) {
+    return arrayType->getStructElementType(0)->getPointerElementType();
+}
+
+bool isArrayType(llvm::Type* type) {
+    auto* structType = llvm::dyn_cast<llvm::StructType>(type);
+    return structType && structType->hasName() && structType->getName().startswith("Array.");
+}
+
+/// Whether values of `type` can own a heap buffer (see `dtype_has_buffer`)
+bool isBufferType(llvm::Type* type, llvm::LLVMContext &Context) {
+    return type == getStringType(Context) || isArrayType(type);
+}
+
+/// Reference counted buffers only get the 16 byte alignment of their header
+uint64_t arrayAlignment() {
+    return Memory == MemoryModel::RefCount ? 16 : ARRAY_ALIGNMENT;
+}
+
+/// `T[](n)`: an array of `n` zeros. Its buffer goes wherever escape analysis
+/// put the site, like the buffer of a string (see `allocateBuffer`).
+llvm::Value* processNewArray(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::StructType* arrayType = getArrayType(expr["dtype"], Context);
+    llvm::Type* elementType = getArrayElementType(arrayType);
+
+    llvm::Value* len = processExpression(expr["length"], Builder, NamedValues, Context, Module);
+    if (!len || !len->getType()->isIntegerTy(64)) {
+        llvm::errs() << "Error: the length of an array has to be an integer.\n";
+        return nullptr;
+    }
+
+    // Negative lengths look huge unsigned, so one comparison also catches them
+    uint64_t elementSize = Module->getDataLayout().getTypeAllocSize(elementType);
+    llvm::Value* valid = Builder.CreateICmpULE(len, Builder.getInt64(INT64_MAX / elementSize), "len.valid");
+    emitRuntimeCheck(valid, "__compiler_reserved_array_length_fail", { len }, "len", Builder, Module);
+
+    llvm::Value* bytes = Builder.CreateMul(len, Builder.getInt64(elementSize), "array.bytes", true, true);
+    llvm::Value* capacity = nullptr;
+    llvm::Value* buffer = allocateBuffer(expr, bytes, capacity, Builder, Module, true);
+    Builder.CreateMemSet(buffer, Builder.getInt8(0), bytes, llvm::MaybeAlign(arrayAlignment()));
+
+    llvm::Value* array = llvm::UndefValue::get(arrayType);
+    array = Builder.CreateInsertValue(array, Builder.CreateBitCast(buffer, elementType->getPointerTo()), 0);
+    array = Builder.CreateInsertValue(array, len, 1);
+    return Builder.CreateInsertValue(array, capacity, 2, "array");
+}
+
+/// `a[i]`
+llvm::Value* processIndex(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Value* array = processExpression(expr["array"], Builder, NamedValues, Context, Module);
+    llvm::Value* index = processExpression(expr["index"], Builder, NamedValues, Context, Module);
+
+    // A lane of a vector
+    if (array && index && array->getType()->isVectorTy() && index->getType()->isIntegerTy(64)) {
+        llvm::Value* lanes = Builder.getInt64(llvm::cast<llvm::FixedVectorType>(array->getType())->getNumElements());
+        llvm::Value* inBounds = Builder.CreateICmpULT(index, lanes, "in.bounds");
+        emitRuntimeCheck(inBounds, "__compiler_reserved_bounds_fail", { index, lanes }, "bounds", Builder, Module);
+        return Builder.CreateExtractElement(array, index, "lane");
+    }
+
+    if (!array || !index || !isArrayType(array->getType()) || !index->getType()->isIntegerTy(64)) {
+        llvm::errs() << "Error: only arrays can be indexed, and only with integers.\n";
+        return nullptr;
+    }
+
+    llvm::Value* ptr = emitElementPointer(array, index, expr, Builder, Module);
+    llvm::LoadInst* element = Builder.CreateLoad(getArrayElementType(array->getType()), ptr, "elem");
+    tagElementAccess(element, element->getType());
+
+    // An array built just to be indexed dies right away
+    if (isTemporary(expr["array"])) {
+        emitDrop(array, Builder, Module);
+    }
+    return element;
+}
+
+/// `a[i] = x` writes into the buffer of `a`, so `a` doesn't have to be mutable
+void processElementAssignment(
+    const nlohmann::json& stmt,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    std::string varName = stmt["dst"];
+    std::optional<ValueBinding> binding = NamedValues.get(symbolOf(stmt, NamedValues));
+    if (!binding.has_value()) {
+        llvm::errs() << "Undefined variable: " << varName << "\n";
+        return;
+    }
+
+    llvm::Value* array = binding->value;
+    if (binding->is_mutable) {
+        auto* alloca = static_cast<llvm::AllocaInst*>(array);
+        array = Builder.CreateLoad(alloca->getAllocatedType(), alloca, varName + "_load");
+    }
+    if (!isArrayType(array->getType())) {
+        llvm::errs() << "Error: '" << varName << "' is not an array.\n";
+        return;
+    }
+
+    llvm::Value* index = processExpression(stmt["index"], Builder, NamedValues, Context, Module);
+    llvm::Value* value = processExpression(stmt["src"], Builder, NamedValues, Context, Module);
+    if (!index || !value) {
+        llvm::errs() << "Error processing element assigned to '" << varName << "'.\n";
+        return;
+    }
+    if (!index->getType()->isIntegerTy(64) || value->getType() != getArrayElementType(array->getType())) {
+        llvm::errs() << "Error: mismatched type assigned to an element of '" << varName << "'.\n";
+        return;
+    }
+
+    llvm::StoreInst* store = Builder.CreateStore(value, emitElementPointer(array, index, stmt, Builder, Module));
+    tagElementAccess(store, value->getType());
+}
+
+/// The address of element `index` of `array`. The index is checked against
+/// the length first, unless range analysis proved that it's in bounds
+/// (`"in-bounds"` on `node`, see `annotate_bounds_checks`).
+llvm::Value* emitElementPointer(
+    llvm::Value* array,
+    llvm::Value* index,
+    const nlohmann::json& node,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+) {
+    if (!node.value("in-bounds", false)) {
+        // Unsigned, so that a negative index is out of bounds too
+        llvm::Value* len = Builder.CreateExtractValue(array, 1, "len");
+        llvm::Value* inBounds = Builder.CreateICmpULT(index, len, "in.bounds");
+        emitRuntimeCheck(inBounds, "__compiler_reserved_bounds_fail", { index, len }, "bounds", Builder, Module);
+    }
+
+    llvm::Value* data = Builder.CreateExtractValue(array, 0, "data");
+    return Builder.CreateInBoundsGEP(getArrayElementType(array->getType()), data, index, "elem.ptr");
+}
+
+/// Continues only if `ok` holds, otherwise calls the runtime function
+/// `failFunc` (which reports the error and doesn't return) with `args` and
+/// the current line
+void emitRuntimeCheck(
+    llvm::Value* ok,
+    const std::string& failFunc,
+    std::vector<llvm::Value*> args,
+    const std::string& name,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+) {
+    if (auto* constOk = llvm::dyn_cast<llvm::ConstantInt>(ok); constOk && constOk->isOne()) {
+        return;
+    }
+
+    llvm::Function* function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* failBB = llvm::BasicBlock::Create(Builder.getContext(), name + ".fail", function);
+    llvm::BasicBlock* okBB = llvm::BasicBlock::Create(Builder.getContext(), name + ".ok", function);
+    Builder.CreateCondBr(ok, okBB, failBB);
+
+    Builder.SetInsertPoint(failBB);
+    args.push_back(Builder.getInt32(CurrentLine));
+    Builder.CreateCall(Module->getFunction(failFunc), args);
+    Builder.CreateUnreachable();
+
+    Builder.SetInsertPoint(okBB);
+}
+
+/// `T(a, b, ...)`, a vector of the values of its lanes
+llvm::Value* processVector(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Value* vector = llvm::PoisonValue::get(getLLVMType(expr["dtype"], Context));
+    for (size_t i = 0; i < expr["elements"].size(); i++) {
+        llvm::Value* element = processExpression(expr["elements"][i], Builder, NamedValues, Context, Module);
+        if (!element) {
+            return nullptr;
+        }
+        vector = Builder.CreateInsertElement(vector, element, Builder.getInt64(i), "vec");
+    }
+    return vector;
+}
+
+/// Where the `lanes` elements starting at `index` of `array` are, for a
+/// vector load or store. Without `mask` they all have to be in bounds.
+/// Otherwise only the lanes of `mask` that are in bounds stay on, which is
+/// what `mask` is set to.
+llvm::Value* emitVectorPointer(
+    llvm::Value* array,
+    llvm::Value* index,
+    llvm::Value* &mask,
+    unsigned int lanes,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+) {
+    llvm::Type* elementType = getArrayElementType(array->getType());
+    llvm::Value* len = Builder.CreateExtractValue(array, 1, "len");
+    llvm::Value* data = Builder.CreateExtractValue(array, 0, "data");
+
+    if (mask) {
+        // Lane k is in bounds if `index + k < len`, unsigned so that negative
+        // indexes are out of bounds
+        llvm::SmallVector<llvm::Constant*, 16> steps;
+        for (unsigned int k = 0; k < lanes; k++) {
+            steps.push_back(Builder.getInt64(k));
+        }
+        llvm::Value* laneIndexes = Builder.CreateAdd(Builder.CreateVectorSplat(lanes, index), llvm::ConstantVector::get(steps), "lane.idx");
+        llvm::Value* inBounds = Builder.CreateICmpULT(laneIndexes, Builder.CreateVectorSplat(lanes, len), "lane.in.bounds");
+        mask = Builder.CreateAnd(mask, inBounds, "lane.mask");
+
+        // Only the lanes that are on are accessed, so the address may be outside of the array
+        llvm::Value* ptr = Builder.CreateGEP(elementType, data, index, "vec.ptr");
+        return Builder.CreateBitCast(ptr, llvm::FixedVectorType::get(elementType, lanes)->getPointerTo(), "vec.ptr");
+    }
+
+    // `len >= lanes && index <= len - lanes`
+    llvm::Value* fits = Builder.CreateICmpUGE(len, Builder.getInt64(lanes), "vec.fits");
+    llvm::Value* last = Builder.CreateSub(len, Builder.getInt64(lanes), "vec.last");
+    llvm::Value* inBounds = Builder.CreateAnd(fits, Builder.CreateICmpULE(index, last), "in.bounds");
+    llvm::Value* lastLane = Builder.CreateAdd(index, Builder.getInt64(lanes - 1), "vec.last.idx");
+    emitRuntimeCheck(inBounds, "__compiler_reserved_bounds_fail", { lastLane, len }, "bounds", Builder, Module);
+
+    llvm::Value* ptr = Builder.CreateInBoundsGEP(elementType, data, index, "vec.ptr");
+    return Builder.CreateBitCast(ptr, llvm::FixedVectorType::get(elementType, lanes)->getPointerTo(), "vec.ptr");
+}
+
+/// `T(a, i)` and `T(a, i, mask)`. The lanes are only as aligned as an element.
+llvm::Value* processVectorLoad(
+    const nlohmann::json& expr,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+) {
+    llvm::Value* array = processExpression(expr["array"], Builder, NamedValues, Context, Module);
+    llvm::Value* index = processExpression(expr["index"], Builder, NamedValues, Context, Module);
+    llvm::Value* mask = expr.contains("mask") ? processExpression(expr["mask"], Builder, NamedValues, Context, Module) : nullptr;
+    if (!array || !index || (expr.contains("mask") && !mask) || !isArrayType(array->getType())) {
+        llvm::errs() << "Error: vectors can only be loaded from arrays.\n";
+        return nullptr;
+    }
+
+    auto* vectorType = llvm::cast<llvm::FixedVectorType>(getLLVMType(expr["dtype"], Context));
+    llvm::Value* ptr = emitVectorPointer(array, index, mask, vectorType->getNumElements(), Builder, Module);
+    llvm::Align alignment = Module->getDataLayout().getABITypeAlign(vectorType->getElementType());
+
+    llvm::Value* vector = nullptr;
+    if (mask) {
+        vector = Builder.CreateMaskedLoad(vectorType, ptr, alignment, mask, llvm::Constant::getNullValue(vectorType), "vec");
+    } else {
+        vector = Builder.CreateAlignedLoad(vectorType, ptr, alignment, "vec");
+        tagElementAccess(llvm::cast<llvm::Instruction>(vector), vectorType->getElementType());
+    }
+
+    if (isTemporary(expr["array"])) {
+        emitDrop(array, Builder, Module);
+    }
+    return vector;
+}
+
+/// A call to a vector builtin, see `check_vector_builtin`
+bool isVectorBuiltin(const nlohmann::json& functionCall) {
+    static const std::set<std::string> names = {
+        "store", "select", "shuffle", "reduce_add", "reduce_mul", "reduce_min", "reduce_max", "any", "all"
+    };
+    const nlohmann::json& params = functionCall["parameters"];
+    return names.count(functionCall["function-name"]) && !params.empty()
+        && dtype_is_vector(dtype_from_str(params[0].value("dtype", "Null")));
+}
+
+llvm::Value* processVectorBuiltin(
+    const nlohmann::json& functionCall,
+    std::vector<llvm::Value*> const& args,
+    llvm::IRBuilder<> &Builder,
+    llvm::Module *Module
+) {
+    std::string functionName = functionCall["function-name"];
+    BeDataType element = dtype_element(dtype_from_str(functionCall["parameters"][0]["dtype"]));
+
+    if (functionName == "store") {
+        auto* vectorType = llvm::cast<llvm::FixedVectorType>(args[0]->getType());
+        llvm::Value* mask = args.size() > 3 ? args[3] : nullptr;
+        llvm::Value* ptr = emitVectorPointer(args[1], args[2], mask, vectorType->getNumElements(), Builder, Module);
+        llvm::Align alignment = Module->getDataLayout().getABITypeAlign(vectorType->getElementType());
+        if (mask) {
+            return Builder.CreateMaskedStore(args[0], ptr, alignment, mask);
+        }
+        llvm::StoreInst* store = Builder.CreateAlignedStore(args[0], ptr, alignment);
+        tagElementAccess(store, vectorType->getElementType());
+        return store;
+    }
+    else if (functionName == "select") {
+        return Builder.CreateSelect(args[0], args[1], args[2], "select");
+    }
+    else if (functionName == "shuffle") {
+        const nlohmann::json& params = functionCall["parameters"];
+        bool twoSources = params.size() > 1 && params[1]["dtype"] == params[0]["dtype"];
+        llvm::SmallVector<int, 16> lanes;
+        for (size_t i = twoSources ? 2 : 1; i < params.size(); i++) {
+            lanes.push_back(std::stoi(params[i]["value"].get<std::string>()));
+        }
+        if (twoSources) {
+            return Builder.CreateShuffleVector(args[0], args[1], lanes, "shuffle");
+        }
+        return Builder.CreateShuffleVector(args[0], lanes, "shuffle");
+    }
+    else if (functionName == "any") {
+        return Builder.CreateOrReduce(args[0]);
+    }
+    else if (functionName == "all") {
+        return Builder.CreateAndReduce(args[0]);
+    }
+
+    llvm::Value* v = args[0];
+    if (dtype_is_integer(element)) {
+        bool isSigned = !dtype_is_unsigned(element);
+        if (functionName == "reduce_add") return Builder.CreateAddReduce(v);
+        if (functionName == "reduce_mul") return Builder.CreateMulReduce(v);
+        if (functionName == "reduce_min") return Builder.CreateIntMinReduce(v, isSigned);
+        if (functionName == "reduce_max") return Builder.CreateIntMaxReduce(v, isSigned);
+    }
+    else {
+        if (functionName == "reduce_min") return Builder.CreateFPMinReduce(v);
+        if (functionName == "reduce_max") return Builder.CreateFPMaxReduce(v);
+
+        // Sums and products are reassociated into a tree, like integer ones
+        llvm::Type* scalarType = v->getType()->getScalarType();
+        llvm::CallInst* reduction = functionName == "reduce_add"
+            ? Builder.CreateFAddReduce(llvm::ConstantFP::getNegativeZero(scalarType), v)
+            : Builder.CreateFMulReduce(llvm::ConstantFP::get(scalarType, 1.0), v);
+        llvm::FastMathFlags flags = Builder.getFastMathFlags();
+        flags.setAllowReassoc();
+        reduction->setFastMathFlags(flags);
+        return reduction;
+    }
+
+    llvm::errs() << "Error: unknown vector builtin '" << functionName << "'.\n";
+    return nullptr;
+}
+
+/// A copy of the elements of `array` in a new heap buffer owned by the result
+llvm::Value* emitArrayClone(llvm::Value* array, llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    llvm::Type* elementType = getArrayElementType(array->getType());
+    uint64_t elementSize = Module->getDataLayout().getTypeAllocSize(elementType);
+
+    llvm::Value* len = Builder.CreateExtractValue(array, 1, "clone.len");
+    llvm::Value* bytes = Builder.CreateMul(len, Builder.getInt64(elementSize), "clone.bytes", true, true);
+    llvm::Value* size = Builder.CreateBinaryIntrinsic(llvm::Intrinsic::umax, bytes, Builder.getInt64(1), nullptr, "heap.size");
+    llvm::Value* buffer = emitHeapAlloc(size, Builder, Module, true);
+
+    llvm::Value* src = Builder.CreateExtractValue(array, 0, "clone.src");
+    uint64_t elementAlignment = Module->getDataLayout().getABITypeAlignment(elementType);
+    Builder.CreateMemCpy(buffer, llvm::MaybeAlign(arrayAlignment()), src, llvm::MaybeAlign(elementAlignment), bytes);
+
+    llvm::Value* result = llvm::UndefValue::get(array->getType());
+    result = Builder.CreateInsertValue(result, Builder.CreateBitCast(buffer, elementType->getPointerTo()), 0);
+    result = Builder.CreateInsertValue(result, len, 1);
+    return Builder.CreateInsertValue(result, size, 2, "clone");
+}
+
+/// The value a declaration or assignment of an array stores. The value of
+/// another variable is only moved if that variable dies there (`"move"`, see
+/// `annotate_drops`) and isn't a parameter, otherwise the elements are copied,
+/// so that writing to one variable never changes another one.
+llvm::Value* emitArrayTransfer(const nlohmann::json& stmt, llvm::Value* value, llvm::IRBuilder<> &Builder, llvm::Module *Module) {
+    const nlohmann::json& src = stmt["src"];
+    if (src["type"] != "Variable") {
+        return value;
+    }
+
+    // `a = a` keeps the value where it is
+    if (stmt["type"] == "AssignmentStatement" && stmt["dst"] == src["name"]) {
+        return value;
+    }
+
+    bool moved = stmt.value("move", false);
+    bool isParameter = src.contains("var-id") && ArrayParameters.count(src["var-id"].get<size_t>());
+    if (moved && !isParameter) {
+        return value;
+    }
+
+    llvm::Value* clone = emitArrayClone(value, Builder, Module);
+
+    // With reference counting the parameter's own reference dies where it's moved
+    if (moved && Memory == MemoryModel::RefCount) {
+        emitDrop(value, Builder, Module);
+    }
+    return clone;
+}
@@ -1,4 +1,8 @@
+#ifndef CODE_GEN_H
+#define CODE_GEN_H
+
 #include "json.hpp"
+#include "value_table.h"
 
 #include <string>
 
@@ -14,7 +18,7 @@ llvm::Type* getLLVMType(const std::string& dtype, llvm::LLVMContext &Context);
 void processCodeBlock(
     const nlohmann::json& codeBlock,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
@@ -22,7 +26,7 @@ void processCodeBlock(
 void processStatement(
     const nlohmann::json& stmt,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
@@ -30,7 +34,7 @@ void processStatement(
 void processDeclarationStatement(
     const nlohmann::json& stmt,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
@@ -38,23 +42,47 @@ void processDeclarationStatement(
 void processAssignmentStatement(
     const nlohmann::json& stmt,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
 
-void processFunctionCall(
+llvm::Value* processFunctionCall(
     const nlohmann::json& functionCall, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues, 
+    ValueTable &NamedValues, 
     llvm::LLVMContext &Context, 
     llvm::Module *Module
 );
 
+void processIfBlock(
+    const nlohmann::json& ifBlock,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+void processLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
+void processForLoop(
+    const nlohmann::json& loop,
+    llvm::IRBuilder<> &Builder,
+    ValueTable &NamedValues,
+    llvm::LLVMContext &Context,
+    llvm::Module *Module
+);
+
 llvm::Value* processExpression(
     const nlohmann::json& expr,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module = nullptr
 );
@@ -64,17 +92,128 @@ llvm::Value* processLiteral(const nlohmann::json& literal, llvm::LLVMContext &Co
 llvm::Value* processVariable(
     const nlohmann::json& var, 
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues
+    ValueTable &NamedValues
 );
 
 llvm::Value* processBinaryExpression(
     const nlohmann::json& expr,
     llvm::IRBuilder<> &Builder,
-    std::map<std::string, llvm::Value*> &NamedValues,
+    ValueTable &NamedValues,
     llvm::LLVMContext &Context,
     llvm::Module *Module
 );
 
 
+enum class DebugInfoLevel {
+    None,
+    /// Only line tables (`-gline-tables-only`), enough for profilers and backtraces
+    LineTablesOnly,
+    /// Line tables plus variables and their types (`-g`)
+    Full,
+};
+
+enum class MemoryModel {
+    /// Buffers are never freed (`-fno-autofree`)
+    Leak,
+    /// Buffers are freed after their last use, which is found at compile time
+    /// (see `annotate_drops`)
+    AutoFree,
+    /// Buffers carry a reference count (`-frefcount`). Only there as the
+    /// baseline AutoFree is measured against.
+    RefCount,
+};
+
+struct CodeGenOptions {
+    /// Path of the source file, as it should appear in the debug info
+    std::string source_path;
+    DebugInfoLevel debug_info = DebugInfoLevel::None;
+
+    /// `--profile-generate[=<file>]`: instrument the module so that running it
+    /// writes a `.profraw` file (linking needs the LLVM profile runtime).
+    bool profile_generate = false;
+    std::string profile_generate_path = "default_%m.profraw";
+
+    /// `--profile-use=<file>`: an indexed profile (`llvm-profdata merge`) used
+    /// to annotate branch weights and function entry counts
+    std::string profile_use_path;
+
+    /// `--profile-sample-use=<file>`: a sample profile, e.g. made from `perf`
+    /// data by `llvm-profgen`. Needs (at least) line tables.
+    std::string profile_sample_use_path;
+
+    /// `-O<n>`: optimize in process instead of leaving it to `opt`
+    unsigned int opt_level = 0;
+
+    /// `-mcpu=<cpu>`: the CPU to generate code for, `native` for this one.
+    /// Vectors wider than its registers are split up.
+    std::string cpu = "generic";
+
+    /// Write an object file instead of textual IR (output path ends in `.o`)
+    bool emit_object = false;
+
+    /// `--runtime=<file>`: runtime bitcode library (runtime/truffle_rt.bc) linked
+    /// into the module so its functions can be inlined. If empty the runtime
+    /// is only declared and has to be linked into the executable instead.
+    std::string runtime_path;
+
+    /// Merge runs of consecutive prints into one write (`-fno-print-fusion` turns it off)
+    bool fuse_prints = true;
+
+    /// Build a chain of concatenations like `a + b + c` in one buffer, and
+    /// append in place for `s = s + ...` when the buffer of `s` has room
+    /// (`-fno-concat-fusion` builds every `+` on its own)
+    bool fuse_concats = true;
+
+    /// Put buffers that never leave the function that builds them on the stack
+    /// (`-fno-escape-analysis` puts every buffer on the heap)
+    bool escape_analysis = true;
+
+    /// `-fescape-report`: print where every allocation went, and why
+    bool escape_report = false;
+
+    /// `-fauto-parallel`: run range loops whose iterations are independent,
+    /// and that do enough work, on the worker threads (see `annotate_auto_parallel`)
+    bool auto_parallel = false;
+
+    /// `-fparallel-report`: print which loops run in parallel, and why the others don't
+    bool parallel_report = false;
+
+    /// Tell LLVM what can't alias: elements of arrays of different types
+    /// (`!tbaa`), the context of a `parallel for` body, pointers the runtime
+    /// doesn't keep, and functions that only read memory or none at all (see
+    /// `annotate_memory_effects`). `-fno-alias-info` leaves all of it out.
+    bool alias_info = true;
+
+    /// `-ffast-math`: let LLVM reorder float sums and products (so reductions
+    /// vectorize), fuse multiplies and adds, and assume there are no NaNs,
+    /// infinities or negative zeros, in every function without `@fastmath`
+    bool fast_math = false;
+
+    /// `-Rpass=<regex>`, `-Rpass-missed=<regex>`, `-Rpass-analysis=<regex>`:
+    /// print the optimization remarks of the passes whose names match (e.g.
+    /// `loop-vectorize`): what they did, what they didn't do, and why
+    std::string remarks_passed;
+    std::string remarks_missed;
+    std::string remarks_analysis;
+
+    /// Leave out the bounds check of `a[i]` where range analysis proves that
+    /// `i` is in bounds (`-fno-bounds-check-elimination` checks every index)
+    bool bounds_check_elimination = true;
+
+    /// Build buffers whose lifetime is bounded by a loop iteration, a call or
+    /// the caller of a function in a region that is freed all at once, instead
+    /// of on the heap (`-fno-regions` turns it off)
+    bool regions = true;
+
+    MemoryModel memory_model = MemoryModel::AutoFree;
+
+    /// `-fcheck-memory`: the runtime keeps track of every heap buffer and
+    /// aborts on a double free, and fails the program if any buffer leaks
+    bool check_memory = false;
+};
+
+/// Writes `ast` to `filepath` as LLVM IR or an object file. Returns false if
+/// code gen failed, and then writes nothing.
+bool gen_llvm_ir(std::string filepath, nlohmann::json ast, CodeGenOptions const& options = CodeGenOptions());
 
-void gen_llvm_ir(std::string filepath, nlohmann::json ast);
+#endif
@@ -5,18 +5,43 @@
 
 
 BeDataType dtype_from_str(std::string s) {
+    if (s.size() > 2 && s.substr(s.size() - 2) == "[]") {
+        return dtype_array_of(dtype_from_str(s.substr(0, s.size() - 2)));
+    }
+
+    // `f32x8` in the source, `F32x8` in the AST
+    size_t x = s.rfind('x');
+    if (x != std::string::npos && x > 0 && x + 1 < s.size() && s.find_first_not_of("0123456789", x + 1) == std::string::npos) {
+        std::string element = s.substr(0, x);
+        unsigned int lanes = std::stoul(s.substr(x + 1));
+        if (element == "i64") return dtype_vector_of(BeDataType::I64, lanes);
+        if (element == "u64") return dtype_vector_of(BeDataType::U64, lanes);
+        if (element == "f64") return dtype_vector_of(BeDataType::F64, lanes);
+        return dtype_vector_of(dtype_from_str(element), lanes);
+    }
+
     if (s == "byte") return BeDataType::U8;
+    if (s == "i8") return BeDataType::I8;
+    if (s == "i16") return BeDataType::I16;
+    if (s == "i32") return BeDataType::I32;
+    if (s == "u32") return BeDataType::U32;
     if (s == "int") return BeDataType::I64;
     if (s == "uint") return BeDataType::U64;
+    if (s == "f32") return BeDataType::F32;
     if (s == "float") return BeDataType::F64;
     if (s == "bool") return BeDataType::Bool;
     if (s == "string") return BeDataType::String;
     if (s == "char") return BeDataType::Char;
     if (s == "null") return BeDataType::Null;
 
-    if (s == "U8") return BeDataType::U8;
+    if (s == "I8") return BeDataType::I8;
+    if (s == "I16") return BeDataType::I16;
+    if (s == "I32") return BeDataType::I32;
     if (s == "I64") return BeDataType::I64;
+    if (s == "U8") return BeDataType::U8;
+    if (s == "U32") return BeDataType::U32;
     if (s == "U64") return BeDataType::U64;
+    if (s == "F32") return BeDataType::F32;
     if (s == "F64") return BeDataType::F64;
     if (s == "Bool") return BeDataType::Bool;
     if (s == "String") return BeDataType::String;
@@ -27,18 +52,137 @@ BeDataType dtype_from_str(std::string s) {
 }
 
 std::string dtype_to_str(BeDataType dtype) {
-    if (dtype == BeDataType::U8) return "U8";
+    if (dtype_is_array(dtype)) return dtype_to_str(dtype_element(dtype)) + "[]";
+    if (dtype_is_vector(dtype)) return dtype_to_str(dtype_element(dtype)) + "x" + std::to_string(dtype_lanes(dtype));
+
+    if (dtype == BeDataType::I8) return "I8";
+    if (dtype == BeDataType::I16) return "I16";
+    if (dtype == BeDataType::I32) return "I32";
     if (dtype == BeDataType::I64) return "I64";
+    if (dtype == BeDataType::U8) return "U8";
+    if (dtype == BeDataType::U32) return "U32";
     if (dtype == BeDataType::U64) return "U64";
+    if (dtype == BeDataType::F32) return "F32";
     if (dtype == BeDataType::F64) return "F64";
     if (dtype == BeDataType::Bool) return "Bool";
     if (dtype == BeDataType::String) return "String";
     if (dtype == BeDataType::Char) return "Char";
     if (dtype == BeDataType::Null) return "Null";
 
-    throw std::runtime_error("Unknown data type [fn dtype_to_str]: " + dtype);
+    throw std::runtime_error("Unknown data type [fn dtype_to_str]: " + std::to_string(dtype));
 }
 
 bool dtypes_check_valid(BeDataType actual, BeDataType inferenced) {
     return true;
-}
\ No newline at end of file
+}
+
+bool dtype_is_integer(BeDataType dtype) {
+    return dtype == BeDataType::I8 || dtype == BeDataType::I16 || dtype == BeDataType::I32 || dtype == BeDataType::I64
+        || dtype_is_unsigned(dtype);
+}
+
+bool dtype_is_unsigned(BeDataType dtype) {
+    return dtype == BeDataType::U8 || dtype == BeDataType::U32 || dtype == BeDataType::U64;
+}
+
+bool dtype_is_float(BeDataType dtype) {
+    return dtype == BeDataType::F32 || dtype == BeDataType::F64;
+}
+
+bool dtype_is_numeric(BeDataType dtype) {
+    return dtype_is_integer(dtype) || dtype_is_float(dtype);
+}
+
+unsigned int dtype_bits(BeDataType dtype) {
+    switch (dtype) {
+        case BeDataType::I8:
+        case BeDataType::U8:
+            return 8;
+        case BeDataType::I16:
+            return 16;
+        case BeDataType::I32:
+        case BeDataType::U32:
+        case BeDataType::F32:
+            return 32;
+        case BeDataType::I64:
+        case BeDataType::U64:
+        case BeDataType::F64:
+            return 64;
+        default:
+            throw std::runtime_error("Not a number type [fn dtype_bits]: " + dtype_to_str(dtype));
+    }
+}
+
+bool dtype_widens_to(BeDataType from, BeDataType to) {
+    if (from == to) {
+        return true;
+    }
+    if (!dtype_is_numeric(from) || !dtype_is_numeric(to)) {
+        return false;
+    }
+
+    if (dtype_is_float(to)) {
+        return !dtype_is_float(from) || dtype_bits(from) < dtype_bits(to);
+    }
+    if (dtype_is_float(from)) {
+        return false;
+    }
+
+    // A signed type only holds every value of a narrower unsigned type
+    if (dtype_is_unsigned(from) == dtype_is_unsigned(to)) {
+        return dtype_bits(from) < dtype_bits(to);
+    }
+    return dtype_is_unsigned(from) && dtype_bits(from) < dtype_bits(to);
+}
+
+BeDataType dtype_common(BeDataType a, BeDataType b) {
+    if (dtype_widens_to(a, b)) {
+        return b;
+    }
+    if (dtype_widens_to(b, a)) {
+        return a;
+    }
+    throw std::runtime_error("No common type of " + dtype_to_str(a) + " and " + dtype_to_str(b) + " [fn dtype_common]");
+}
+
+bool dtype_has_buffer(BeDataType dtype) {
+    return dtype == BeDataType::String || dtype_is_array(dtype);
+}
+
+BeDataType dtype_array_of(BeDataType element) {
+    if (dtype_is_array(element) || dtype_is_vector(element)) {
+        throw std::runtime_error("Arrays of arrays or vectors are not supported [fn dtype_array_of]: " + dtype_to_str(element) + "[]");
+    }
+    if (!dtype_is_numeric(element) && element != BeDataType::Bool) {
+        throw std::runtime_error("Arrays of " + dtype_to_str(element) + " are not supported [fn dtype_array_of]");
+    }
+    return static_cast<BeDataType>(element | DTYPE_ARRAY_FLAG);
+}
+
+bool dtype_is_array(BeDataType dtype) {
+    return (dtype & DTYPE_ARRAY_FLAG) != 0;
+}
+
+BeDataType dtype_vector_of(BeDataType element, unsigned int lanes) {
+    if (!dtype_is_numeric(element) && element != BeDataType::Bool) {
+        throw std::runtime_error("Vectors of " + dtype_to_str(element) + " are not supported [fn dtype_vector_of]");
+    }
+    for (int log_lanes = 1; log_lanes <= 6; log_lanes++) {
+        if (lanes == (1u << log_lanes)) {
+            return static_cast<BeDataType>(element | (log_lanes << DTYPE_LANES_SHIFT));
+        }
+    }
+    throw std::runtime_error("A vector has 2, 4, 8, 16, 32 or 64 lanes, not " + std::to_string(lanes) + " [fn dtype_vector_of]");
+}
+
+bool dtype_is_vector(BeDataType dtype) {
+    return (dtype & DTYPE_LANES_MASK) != 0;
+}
+
+unsigned int dtype_lanes(BeDataType vector) {
+    return 1u << ((vector & DTYPE_LANES_MASK) >> DTYPE_LANES_SHIFT);
+}
+
+BeDataType dtype_element(BeDataType array) {
+    return static_cast<BeDataType>(array & ~(DTYPE_ARRAY_FLAG | DTYPE_LANES_MASK));
+}
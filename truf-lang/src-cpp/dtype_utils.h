@@ -4,10 +4,15 @@
 #include <string>
 
 // Backend data types
-enum BeDataType {
+enum BeDataType : int {
+    I8,
+    I16,
+    I32,
     I64,
-    U64,
     U8,
+    U32,
+    U64,
+    F32,
     F64,
     Bool,
     Char,
@@ -15,8 +20,49 @@ enum BeDataType {
     Null,
 };
 
+/// Set on the element type of an array type (`int[]` is `I64 | DTYPE_ARRAY_FLAG`)
+const int DTYPE_ARRAY_FLAG = 1 << 8;
+
+/// log2 of the number of lanes of a SIMD vector type, on top of its element
+/// type (`f32x8` is `F32 | 3 << DTYPE_LANES_SHIFT`). Zero for everything else.
+const int DTYPE_LANES_SHIFT = 9;
+const int DTYPE_LANES_MASK = 0x7 << DTYPE_LANES_SHIFT;
+
 BeDataType dtype_from_str(std::string s);
 std::string dtype_to_str(BeDataType dtype);
 bool dtypes_check_valid(BeDataType actual, BeDataType inferenced);
+bool dtype_is_integer(BeDataType dtype);
+bool dtype_is_unsigned(BeDataType dtype);
+bool dtype_is_float(BeDataType dtype);
+bool dtype_is_numeric(BeDataType dtype);
+
+/// Size of a number type in bits
+unsigned int dtype_bits(BeDataType dtype);
+
+/// Whether every value of `from` is a value of `to` (`i32` to `int`, `u32`
+/// to `int`, `f32` to `float`, or any integer to a float)
+bool dtype_widens_to(BeDataType from, BeDataType to);
+
+/// The type both operands of an arithmetic operation or comparison are
+/// converted to: the one the other widens to. Throws if neither does (`int`
+/// and `uint`, or `i32` and `u32`).
+BeDataType dtype_common(BeDataType a, BeDataType b);
+
+/// Values of these types point at a buffer (that may have to be allocated)
+bool dtype_has_buffer(BeDataType dtype);
+
+/// `T[]`, a contiguous array of numbers or bools. Throws for element types
+/// arrays can't hold (strings and other arrays).
+BeDataType dtype_array_of(BeDataType element);
+bool dtype_is_array(BeDataType dtype);
+
+/// `<element>x<lanes>` (like `f32x8`), a SIMD vector of 2 to 64 numbers or
+/// bools. Throws for other element types and lane counts.
+BeDataType dtype_vector_of(BeDataType element, unsigned int lanes);
+bool dtype_is_vector(BeDataType dtype);
+unsigned int dtype_lanes(BeDataType vector);
+
+/// The element type of an array or vector type
+BeDataType dtype_element(BeDataType array);
 
-#endif
\ No newline at end of file
+#endif
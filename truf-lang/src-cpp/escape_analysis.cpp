@@ -0,0 +1,506 @@
+#include "escape_analysis.h"
+#include "dtype_utils.h"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Built-in functions that only read their arguments
+const std::vector<std::string> NON_ESCAPING_BUILTINS = {"print", "flush", "len", "store", "prefetch"};
+
+/// Flow graph of one function. There is a node per variable (by name, like
+/// `mark_mutable_bindings`) and per allocation site, and an edge `a -> b`
+/// means that the value of `a` may end up in `b`. Only values that point at
+/// a buffer are tracked.
+struct EscapeGraph {
+    std::vector<std::vector<size_t>> edges;
+
+    /// Why the value of a node leaves the function, empty if it doesn't
+    std::vector<std::string> escapes;
+
+    /// Whether it leaves the function in some other way than being returned
+    std::vector<bool> leaks;
+
+    std::map<std::string, size_t> variables;
+
+    /// For every variable node, the loops around each of its declarations
+    std::map<size_t, std::vector<std::vector<size_t>>> declared_in;
+
+    struct Site {
+        nlohmann::json* node;
+        size_t graph_node;
+        unsigned int line;
+        std::vector<size_t> loops;
+    };
+    std::vector<Site> sites;
+
+    /// Calls that return a buffer, which the callee can build in a region of the caller
+    std::vector<Site> calls;
+
+    size_t add_node() {
+        edges.emplace_back();
+        escapes.emplace_back();
+        leaks.push_back(false);
+        return edges.size() - 1;
+    }
+
+    size_t variable(const std::string& name) {
+        auto it = variables.find(name);
+        if (it != variables.end()) {
+            return it->second;
+        }
+        size_t node = add_node();
+        variables[name] = node;
+        return node;
+    }
+};
+
+struct EscapeWalker {
+    EscapeGraph graph;
+    std::map<std::string, std::vector<bool>> const& param_escapes;
+    bool fuse_concats;
+
+    /// Loops around the statement being visited, as indices into `loop_lines`
+    std::vector<size_t> loops = {};
+    std::vector<unsigned int> loop_lines = {};
+    std::vector<nlohmann::json*> loop_nodes = {};
+    unsigned int line = 0;
+};
+
+void flow_into(std::vector<size_t> const& sources, size_t dst, EscapeGraph &graph) {
+    for (size_t src : sources) {
+        graph.edges[src].push_back(dst);
+    }
+}
+
+const std::string RETURNED = "returned";
+
+void mark_escaping(std::vector<size_t> const& sources, const std::string& reason, EscapeGraph &graph) {
+    for (size_t src : sources) {
+        if (graph.escapes[src].empty()) {
+            graph.escapes[src] = reason;
+        }
+        graph.leaks[src] = graph.leaks[src] || reason != RETURNED;
+    }
+}
+
+std::vector<size_t> visit_expression(nlohmann::json &expr, EscapeWalker &walker);
+
+/// A chain of concatenations like `a + b + c` is built in one buffer (see
+/// `processStringConcat`), so only the outermost one is an allocation site
+void visit_concat_operands(nlohmann::json &expr, EscapeWalker &walker) {
+    for (const char* side : {"left-operand", "right-operand"}) {
+        nlohmann::json &operand = expr[side];
+        bool is_concat = operand["type"] == "Expression" && dtype_has_buffer(dtype_from_str(operand.value("dtype", "Null")));
+        if (is_concat && walker.fuse_concats) {
+            operand.erase("alloc");
+            operand.erase("region");
+            visit_concat_operands(operand, walker);
+        } else {
+            visit_expression(operand, walker);
+        }
+    }
+}
+
+/// Visits `expr` and returns the nodes whose value it may evaluate to
+std::vector<size_t> visit_expression(nlohmann::json &expr, EscapeWalker &walker) {
+    std::string type = expr["type"];
+    bool has_buffer = dtype_has_buffer(dtype_from_str(expr.value("dtype", "Null")));
+
+    if (type == "Variable") {
+        if (!has_buffer) {
+            return {};
+        }
+        return { walker.graph.variable(expr["name"]) };
+    }
+    else if (type == "Expression") {
+        // The operands are only read (a concatenation copies them)
+        if (!has_buffer) {
+            visit_expression(expr["left-operand"], walker);
+            visit_expression(expr["right-operand"], walker);
+            return {};
+        }
+        visit_concat_operands(expr, walker);
+
+        size_t node = walker.graph.add_node();
+        walker.graph.sites.push_back(EscapeGraph::Site{ &expr, node, walker.line, walker.loops });
+        return { node };
+    }
+    else if (type == "FunctionCall") {
+        std::string callee = expr["function-name"];
+        bool is_builtin = std::find(NON_ESCAPING_BUILTINS.begin(), NON_ESCAPING_BUILTINS.end(), callee) != NON_ESCAPING_BUILTINS.end();
+        auto summary = walker.param_escapes.find(callee);
+
+        nlohmann::json &params = expr["parameters"];
+
+        // A slice may be a view of the string it is taken from
+        if (callee == "slice") {
+            std::vector<size_t> sources;
+            for (size_t i = 0; i < params.size(); i++) {
+                std::vector<size_t> param_sources = visit_expression(params[i], walker);
+                if (i == 0 && has_buffer) {
+                    sources = param_sources;
+                }
+            }
+            return sources;
+        }
+
+        for (size_t i = 0; i < params.size(); i++) {
+            std::vector<size_t> sources = visit_expression(params[i], walker);
+            if (is_builtin) {
+                continue;
+            }
+
+            // Functions defined elsewhere could keep anything they are given
+            bool escapes = summary == walker.param_escapes.end() || i >= summary->second.size() || summary->second[i];
+            if (escapes) {
+                mark_escaping(sources, "passed to `" + callee + "`", walker.graph);
+            }
+        }
+
+        // A returned buffer was allocated by the callee, but it may come from
+        // a region of this function (see `assign_regions`)
+        if (!has_buffer || summary == walker.param_escapes.end()) {
+            return {};
+        }
+        size_t node = walker.graph.add_node();
+        walker.graph.calls.push_back(EscapeGraph::Site{ &expr, node, walker.line, walker.loops });
+        return { node };
+    }
+    else if (type == "NewArray") {
+        visit_expression(expr["length"], walker);
+
+        size_t node = walker.graph.add_node();
+        walker.graph.sites.push_back(EscapeGraph::Site{ &expr, node, walker.line, walker.loops });
+        return { node };
+    }
+    else if (type == "Index") {
+        // Elements never point at a buffer
+        visit_expression(expr["array"], walker);
+        visit_expression(expr["index"], walker);
+        return {};
+    }
+    else if (type == "Cast") {
+        // Only numbers are converted
+        visit_expression(expr["value"], walker);
+        return {};
+    }
+    else if (type == "Vector") {
+        for (auto& element : expr["elements"]) {
+            visit_expression(element, walker);
+        }
+        return {};
+    }
+    else if (type == "VectorLoad") {
+        // Lanes are copied out of the array
+        visit_expression(expr["array"], walker);
+        visit_expression(expr["index"], walker);
+        if (expr.contains("mask")) {
+            visit_expression(expr["mask"], walker);
+        }
+        return {};
+    }
+
+    // Literals point at constant data
+    return {};
+}
+
+void visit_code_block(nlohmann::json &code_block, EscapeWalker &walker);
+
+void visit_statement(nlohmann::json &stmt, EscapeWalker &walker) {
+    std::string type = stmt["type"];
+    walker.line = stmt.value("line", walker.line);
+
+    if (type == "DeclarationStatement") {
+        std::vector<size_t> sources = visit_expression(stmt["src"], walker);
+        if (dtype_has_buffer(dtype_from_str(stmt["dtype"]))) {
+            size_t dst = walker.graph.variable(stmt["dst"]);
+            walker.graph.declared_in[dst].push_back(walker.loops);
+            flow_into(sources, dst, walker.graph);
+        }
+    }
+    else if (type == "AssignmentStatement") {
+        std::vector<size_t> sources = visit_expression(stmt["src"], walker);
+        if (!sources.empty()) {
+            flow_into(sources, walker.graph.variable(stmt["dst"]), walker.graph);
+        }
+    }
+    else if (type == "ElementAssignmentStatement") {
+        visit_expression(stmt["index"], walker);
+        visit_expression(stmt["src"], walker);
+    }
+    else if (type == "ReturnStatement") {
+        mark_escaping(visit_expression(stmt["value"], walker), RETURNED, walker.graph);
+    }
+    else if (type == "FunctionCall") {
+        visit_expression(stmt, walker);
+    }
+    else if (type == "IfBlock") {
+        for (auto& branch : stmt["statements"]) {
+            walker.line = branch.value("line", walker.line);
+            visit_expression(branch["condition"], walker);
+            visit_code_block(branch["code-block"], walker);
+        }
+        if (stmt.contains("default")) {
+            visit_code_block(stmt["default"], walker);
+        }
+    }
+    else if (type == "Loop") {
+        stmt.erase("region");
+        walker.loops.push_back(walker.loop_lines.size());
+        walker.loop_lines.push_back(walker.line);
+        walker.loop_nodes.push_back(&stmt);
+        visit_expression(stmt["condition"], walker);
+        visit_code_block(stmt["code-block"], walker);
+        walker.loops.pop_back();
+    }
+    else if (type == "ForLoop") {
+        // The range (or the array) is evaluated once, before the loop
+        for (auto key : {"start", "end", "array"}) {
+            if (stmt.contains(key)) {
+                visit_expression(stmt[key], walker);
+            }
+        }
+
+        stmt.erase("region");
+        walker.loops.push_back(walker.loop_lines.size());
+        walker.loop_lines.push_back(walker.line);
+        walker.loop_nodes.push_back(&stmt);
+        visit_code_block(stmt["code-block"], walker);
+        walker.loops.pop_back();
+    }
+}
+
+void visit_code_block(nlohmann::json &code_block, EscapeWalker &walker) {
+    for (auto& stmt : code_block["statements"]) {
+        visit_statement(stmt, walker);
+    }
+}
+
+/// Returns the loop (index into `loop_lines`) that a site's value outlives an
+/// iteration of, if any. Every execution of a stack site reuses the same
+/// buffer, so inside of a loop its value may only be stored in variables that
+/// are declared in the same iteration.
+std::optional<size_t> outlived_loop(EscapeGraph::Site const& site, EscapeGraph const& graph) {
+    if (site.loops.empty()) {
+        return std::nullopt;
+    }
+    size_t loop = site.loops.back();
+
+    std::vector<bool> visited(graph.edges.size(), false);
+    std::vector<size_t> stack = { site.graph_node };
+    visited[site.graph_node] = true;
+
+    while (!stack.empty()) {
+        size_t node = stack.back();
+        stack.pop_back();
+
+        if (node != site.graph_node) {
+            // Parameters (and anything never declared) live outside of every loop
+            auto declarations = graph.declared_in.find(node);
+            if (declarations == graph.declared_in.end()) {
+                return loop;
+            }
+            for (auto const& loops : declarations->second) {
+                if (std::find(loops.begin(), loops.end(), loop) == loops.end()) {
+                    return loop;
+                }
+            }
+        }
+
+        for (size_t next : graph.edges[node]) {
+            if (!visited[next]) {
+                visited[next] = true;
+                stack.push_back(next);
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+/// Analyzes one function, annotates its allocation sites and returns which of
+/// its parameters escape
+std::vector<bool> analyze_function(
+    nlohmann::json &func,
+    std::map<std::string, std::vector<bool>> const& param_escapes,
+    bool use_regions,
+    bool fuse_concats,
+    std::vector<AllocationSite> &sites
+) {
+    EscapeWalker walker{ EscapeGraph(), param_escapes, fuse_concats };
+    walker.line = func.value("line", 0u);
+
+    std::vector<size_t> param_nodes;
+    for (auto& param : func["parameters"]) {
+        param_nodes.push_back(walker.graph.variable(param["name"]));
+    }
+    visit_code_block(func["code-block"], walker);
+
+    // Anything that flows into an escaping node escapes too
+    EscapeGraph &graph = walker.graph;
+    std::vector<std::vector<size_t>> predecessors(graph.edges.size());
+    std::vector<size_t> stack;
+    for (size_t node = 0; node < graph.edges.size(); node++) {
+        for (size_t next : graph.edges[node]) {
+            predecessors[next].push_back(node);
+        }
+        if (!graph.escapes[node].empty()) {
+            stack.push_back(node);
+        }
+    }
+    while (!stack.empty()) {
+        size_t node = stack.back();
+        stack.pop_back();
+        for (size_t prev : predecessors[node]) {
+            bool changed = false;
+            if (graph.escapes[prev].empty()) {
+                graph.escapes[prev] = graph.escapes[node];
+                changed = true;
+            }
+            if (graph.leaks[node] && !graph.leaks[prev]) {
+                graph.leaks[prev] = true;
+                changed = true;
+            }
+            if (changed) {
+                stack.push_back(prev);
+            }
+        }
+    }
+
+    func.erase("function-region");
+    auto region_of = [&](EscapeGraph::Site const& site, std::string const& reason) -> std::string {
+        if (!use_regions) {
+            return "";
+        }
+        if (reason.empty()) {
+            if (site.loops.empty()) {
+                func["function-region"] = true;
+                return "function";
+            }
+            (*walker.loop_nodes[site.loops.back()])["region"] = true;
+            return "loop";
+        }
+        // Only returned, and built at most once per call
+        if (!graph.leaks[site.graph_node] && site.loops.empty()) {
+            return "caller";
+        }
+        return "";
+    };
+    auto set_region = [](nlohmann::json& node, std::string const& region) {
+        if (region.empty()) {
+            node.erase("region");
+        } else {
+            node["region"] = region;
+        }
+    };
+
+    for (auto const& site : graph.sites) {
+        std::string reason = graph.escapes[site.graph_node];
+        if (reason.empty()) {
+            if (auto loop = outlived_loop(site, graph)) {
+                reason = "outlives an iteration of the loop at line " + std::to_string(walker.loop_lines[*loop]);
+            }
+        }
+
+        // Stack buffers fall back to a region when the value is too long for them
+        std::string region = region_of(site, reason);
+        (*site.node)["alloc"] = reason.empty() ? "stack" : "heap";
+        set_region(*site.node, region);
+        sites.push_back(AllocationSite{ func["name"], site.line, reason.empty(), reason, region, "" });
+    }
+
+    for (auto const& call : graph.calls) {
+        std::string reason = graph.escapes[call.graph_node];
+        if (reason.empty()) {
+            if (auto loop = outlived_loop(call, graph)) {
+                reason = "outlives an iteration of the loop at line " + std::to_string(walker.loop_lines[*loop]);
+            }
+        }
+
+        std::string region = region_of(call, reason);
+        set_region(*call.node, region);
+        sites.push_back(AllocationSite{ func["name"], call.line, false, reason, region, (*call.node)["function-name"] });
+    }
+
+    std::vector<bool> escapes;
+    for (size_t node : param_nodes) {
+        escapes.push_back(!graph.escapes[node].empty());
+    }
+    return escapes;
+}
+
+std::vector<AllocationSite> analyze_escapes(nlohmann::json &module, bool use_regions, bool fuse_concats) {
+    std::vector<nlohmann::json*> functions;
+    if (module["type"] == "Function") {
+        functions.push_back(&module);
+    } else {
+        for (auto& stmt : module["statements"]) {
+            if (stmt["type"] == "Function") {
+                functions.push_back(&stmt);
+            }
+        }
+    }
+
+    // Start from "nothing escapes" and only ever add to it, so this terminates
+    std::map<std::string, std::vector<bool>> param_escapes;
+    for (nlohmann::json* func : functions) {
+        param_escapes[(*func)["name"]] = std::vector<bool>((*func)["parameters"].size(), false);
+    }
+
+    std::vector<AllocationSite> sites;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        sites.clear();
+        for (nlohmann::json* func : functions) {
+            std::vector<bool> escapes = analyze_function(*func, param_escapes, use_regions, fuse_concats, sites);
+            if (escapes != param_escapes[(*func)["name"]]) {
+                param_escapes[(*func)["name"]] = escapes;
+                changed = true;
+            }
+        }
+    }
+    return sites;
+}
+
+void print_escape_report(std::vector<AllocationSite> const& sites, llvm::raw_ostream &os) {
+    std::map<std::string, std::pair<size_t, size_t>> per_function;
+    size_t num_on_stack = 0;
+
+    size_t num_sites = 0;
+    size_t num_in_regions = 0;
+
+    for (auto const& site : sites) {
+        std::string where = site.function + ":" + std::to_string(site.line);
+        if (!site.callee.empty()) {
+            // Results of calls are only interesting when the callee can use a region
+            if (!site.region.empty()) {
+                os << "escape: " << where << ": result of `" << site.callee << "` in the " << site.region << " region\n";
+                num_in_regions++;
+            }
+            continue;
+        }
+
+        auto& [on_stack, total] = per_function[site.function];
+        on_stack += site.on_stack;
+        total++;
+        num_on_stack += site.on_stack;
+        num_sites++;
+
+        if (!site.on_stack && !site.region.empty()) {
+            os << "escape: " << where << ": " << site.region << " region, " << site.reason << "\n";
+            num_in_regions++;
+        } else if (!site.on_stack) {
+            os << "escape: " << where << ": heap allocation, " << site.reason << "\n";
+        }
+    }
+
+    for (auto const& [function, counts] : per_function) {
+        os << "escape: " << function << ": " << counts.first << " of " << counts.second << " allocations on the stack\n";
+    }
+    os << "escape: " << num_on_stack << " of " << num_sites << " allocations on the stack, "
+       << num_in_regions << " buffers in regions\n";
+}
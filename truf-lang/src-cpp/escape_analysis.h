@@ -0,0 +1,59 @@
+#ifndef ESCAPE_ANALYSIS_H
+#define ESCAPE_ANALYSIS_H
+
+#include "json.hpp"
+
+#include <string>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+
+/// An expression that creates a new buffer (a string concatenation or a new
+/// array), or a call whose callee returns one
+struct AllocationSite {
+    std::string function;
+    unsigned int line;
+    bool on_stack;
+
+    /// Why the buffer has to be on the heap, empty if it's on the stack
+    std::string reason;
+
+    /// "loop", "function" or "caller" if heap memory for it comes from a region
+    std::string region;
+
+    /// The function called, if this is a call
+    std::string callee;
+};
+
+/// Decides for every allocation site of the module whether its value can
+/// outlive the call (or the loop iteration) that creates it. Sites whose value
+/// is only used locally get `"alloc": "stack"`, the others `"alloc": "heap"`.
+///
+/// A value escapes when it is returned, or passed to a function that may
+/// return it (or pass it on to one that does). Parameters are summarized per
+/// function and the summaries are iterated until they don't change, so this
+/// works across (mutually) recursive functions.
+///
+/// With `use_regions`, buffers whose lifetime is known also get a `"region"`
+/// that heap memory for them comes from instead of malloc (see
+/// runtime/truffle_rt.c). The region is released in bulk when they are all dead:
+///
+/// - `"loop"`: the value dies within an iteration of the innermost loop around
+///   it, and the loop's region is reset at its latch (the Loop or ForLoop gets
+///   `"region"`)
+/// - `"function"`: the value is built outside of any loop and never leaves the
+///   function (which gets `"function-region"`)
+/// - `"caller"`: the value is built outside of any loop and is only returned,
+///   so it goes in the region the caller passes along with the call
+///
+/// Stack sites use their region when the value doesn't fit the stack buffer,
+/// calls (`"region"` on the FunctionCall) pass it to the callee.
+///
+/// With `fuse_concats`, a chain of concatenations like `a + b + c` is a
+/// single site (the outermost one), since code gen builds it in one buffer.
+std::vector<AllocationSite> analyze_escapes(nlohmann::json &module, bool use_regions, bool fuse_concats);
+
+/// `-fescape-report`: every allocation site, and why it wasn't put on the stack
+void print_escape_report(std::vector<AllocationSite> const& sites, llvm::raw_ostream &os);
+
+#endif
@@ -25,6 +25,7 @@ std::string Token::token_type_to_string() const {
         case TokenType::ArithmeticOperator: return "ArithmeticOperator";
         case TokenType::AssignmentOperator: return "AssignmentOperator";
         case TokenType::ComparisonOperator: return "ComparisonOperator";
+        case TokenType::LogicalOperator: return "LogicalOperator";
         case TokenType::IntegerLiteral: return "IntegerLiteral";
         case TokenType::FloatLiteral: return "FloatLiteral";
         case TokenType::StringLiteral: return "StringLiteral";
@@ -44,6 +45,7 @@ std::string Token::token_type_to_string() const {
         case TokenType::RangeDescriptor: return "RangeDescriptor";
         case TokenType::SemiColon: return "SemiColon";
         case TokenType::NewLine: return "NewLine";
+        case TokenType::Attribute: return "Attribute";
         default: return "Invalid";
     }
 }
@@ -75,7 +77,13 @@ bool Token::equals(TokenType tok_type, std::string val) const {
 
 const std::vector<std::string> Lexer::DATA_TYPES = {
     "int",
+    "uint",
     "float",
+    "i8",
+    "i16",
+    "i32",
+    "u32",
+    "f32",
     "bool",
     "char",
     "byte",
@@ -87,13 +95,23 @@ const std::vector<std::string> Lexer::KEYWORDS = {
     "if",
     "else",
     "for",
+    "parallel",
     "while",
     "return",
     "in",
 };
 
 Lexer::Lexer(const std::string& s)
-    : source(s), pos(0) {
+    : source(s), pos(0), line(1), line_start(0), line_pos(0) {
+}
+
+void Lexer::advance_line(size_t to) {
+    for (; line_pos < to; line_pos++) {
+        if (source[line_pos] == '\n') {
+            line++;
+            line_start = line_pos + 1;
+        }
+    }
 }
 
 std::optional<Token> Lexer::next() {
@@ -108,45 +126,49 @@ std::optional<Token> Lexer::next() {
         char curr_char = source[counter];
 
         if (token_type == TokenType::Unknown) {
-            auto lit_res = starts_with_literal(source.substr(pos));
+            // No token spans lines, so only the rest of the line has to be matched against
+            size_t line_end = source.find('\n', pos);
+            std::string rest = source.substr(pos, line_end == std::string::npos ? std::string::npos : line_end - pos + 1);
+
+            auto lit_res = starts_with_literal(rest);
             if (lit_res.has_value()) {
                 size_t literal_len = lit_res->first;
                 token_type = lit_res->second;
                 counter += literal_len;
                 break;
             } else {
-                auto dot_res = starts_with_dots(source.substr(pos));
+                auto dot_res = starts_with_dots(rest);
                 if (dot_res.has_value()) {
                     size_t dot_len = dot_res->first;
                     token_type = dot_res->second;
                     counter += dot_len;
                     break;
                 } else {
-                    auto kw_len_opt = starts_with_kw(source.substr(pos));
+                    auto kw_len_opt = starts_with_kw(rest);
                     if (kw_len_opt.has_value()) {
                         token_type = TokenType::Keyword;
                         counter += kw_len_opt.value();
                         break;
                     } else {
-                        auto dt_len_opt = starts_with_dt(source.substr(pos));
+                        auto dt_len_opt = starts_with_dt(rest);
                         if (dt_len_opt.has_value()) {
                             token_type = TokenType::DataType;
                             counter += dt_len_opt.value();
                             break;
                         } else {
-                            auto cmp_op_len_opt = starts_with_cmp_op(source.substr(pos));
+                            auto cmp_op_len_opt = starts_with_cmp_op(rest);
                             if (cmp_op_len_opt.has_value()) {
                                 token_type = TokenType::ComparisonOperator;
                                 counter += cmp_op_len_opt.value();
                                 break;
                             } else {
-                                auto assign_op_len_opt = starts_with_assign_op(source.substr(pos));
+                                auto assign_op_len_opt = starts_with_assign_op(rest);
                                 if (assign_op_len_opt.has_value()) {
                                     token_type = TokenType::AssignmentOperator;
                                     counter += assign_op_len_opt.value();
                                     break;
                                 } else {
-                                    auto obj_name_len_opt = starts_with_object_name(source.substr(pos));
+                                    auto obj_name_len_opt = starts_with_object_name(rest);
                                     if (obj_name_len_opt.has_value()) {
                                         counter += obj_name_len_opt.value();
                                         std::string object_name = source.substr(pos, counter - pos);
@@ -227,6 +249,14 @@ std::optional<Token> Lexer::next() {
                                                 throw std::runtime_error("This should never run");
                                         }
                                         break;
+                                    } else if (starts_with_logical_op(rest).has_value()) {
+                                        counter += starts_with_logical_op(rest).value();
+                                        token_type = TokenType::LogicalOperator;
+                                        break;
+                                    } else if (starts_with_attribute(rest).has_value()) {
+                                        counter += starts_with_attribute(rest).value();
+                                        token_type = TokenType::Attribute;
+                                        break;
                                     } else if (std::string("+-*/%").find(curr_char) != std::string::npos) {
                                         counter += 1;
                                         token_type = TokenType::ArithmeticOperator;
@@ -250,8 +280,14 @@ std::optional<Token> Lexer::next() {
     }
 
     std::string res = source.substr(pos, counter - pos);
+
+    advance_line(pos);
+    unsigned int token_line = line;
+    unsigned int token_col = pos - line_start + 1;
+    advance_line(counter);
+
     pos = counter;
-    Token token = {token_type, res};
+    Token token = {token_type, res, token_line, token_col};
     tokens.push_back(token);
     return token;
 }
@@ -262,7 +298,8 @@ std::optional<size_t> Lexer::starts_with_dt(const std::string& s) {
             size_t dt_len = dt.size();
             if (dt_len >= s.size()) continue;
             char next_char = s[dt_len];
-            if (!(std::isspace(next_char) || next_char == '[' || next_char == '>')) {
+            // `(` for conversions like `f32(x)` and lengths like `int[](n)`
+            if (!(std::isspace(next_char) || next_char == '[' || next_char == '>' || next_char == '(')) {
                 continue;
             }
 
@@ -272,6 +309,13 @@ std::optional<size_t> Lexer::starts_with_dt(const std::string& s) {
             return dt_len;
         }
     }
+
+    // SIMD vectors, `<element>x<lanes>` like `f32x8`
+    static const std::regex re_vector(R"(^(i8|i16|i32|i64|u8|u32|u64|f32|f64|bool)x(2|4|8|16|32|64)(?=[\s\[>(]))");
+    std::smatch match_vector;
+    if (std::regex_search(s, match_vector, re_vector)) {
+        return match_vector.str().size();
+    }
     return std::nullopt;
 }
 
@@ -296,8 +340,9 @@ std::optional<std::pair<size_t, TokenType>> Lexer::starts_with_literal(const std
     std::smatch match_int;
     if (std::regex_search(s, match_int, re_int) && match_int.position() == 0) {
         size_t l = match_int.str().size();
-        // Ensure that the next character is not a decimal point (to prevent matching floats)
-        if (l >= s.size() || s[l] != '.') {
+        // Ensure that the next character is not a decimal point (to prevent matching floats),
+        // unless it starts a range like `0..n`
+        if (l >= s.size() || s[l] != '.' || s.compare(l, 2, "..") == 0) {
             return std::make_pair(l, TokenType::IntegerLiteral);
         }
     }
@@ -312,7 +357,7 @@ std::optional<std::pair<size_t, TokenType>> Lexer::starts_with_literal(const std
     }
 
     // String literal
-    static const std::regex re_str(R"(^"[^\n]*")");
+    static const std::regex re_str(R"(^"([^"\\\n]|\\.)*")");
     std::smatch match_str;
     if (std::regex_search(s, match_str, re_str) && match_str.position() == 0) {
         return std::make_pair(match_str.str().size(), TokenType::StringLiteral);
@@ -346,6 +391,16 @@ std::optional<size_t> Lexer::starts_with_cmp_op(const std::string& s) {
     return std::nullopt;
 }
 
+std::optional<size_t> Lexer::starts_with_logical_op(const std::string& s) {
+    std::vector<std::string> operators = {"&&", "||"};
+    for (const auto& op : operators) {
+        if (s.substr(0, op.size()) == op) {
+            return op.size();
+        }
+    }
+    return std::nullopt;
+}
+
 std::optional<size_t> Lexer::starts_with_assign_op(const std::string& s) {
     std::vector<std::string> assign_ops = {":=", "="};
     for (const auto& op : assign_ops) {
@@ -386,6 +441,16 @@ std::optional<size_t> Lexer::starts_with_object_name(const std::string& s) {
     return std::nullopt;
 }
 
+std::optional<size_t> Lexer::starts_with_attribute(const std::string& s) {
+    static const std::regex re(R"(^@[a-zA-Z_]\w*)");
+
+    std::smatch match;
+    if (std::regex_search(s, match, re)) {
+        return match.str().size();
+    }
+    return std::nullopt;
+}
+
 std::vector<std::string> Lexer::validate_syntax() {
     std::vector<std::string> errors;
 
@@ -433,8 +498,10 @@ std::vector<std::string> Lexer::validate_syntax() {
                     errors.push_back("[Token " + std::to_string(i) + "] Error: Invalid range descriptor");
                     continue;
                 }
-                if (!(tokens[i - 1].token_type == TokenType::IntegerLiteral || tokens[i - 1].token_type == TokenType::Object) ||
-                    !(tokens[i + 1].token_type == TokenType::IntegerLiteral || tokens[i + 1].token_type == TokenType::Object)) {
+                if (!(tokens[i - 1].token_type == TokenType::IntegerLiteral || tokens[i - 1].token_type == TokenType::Object ||
+                      tokens[i - 1].token_type == TokenType::CloseParen || tokens[i - 1].token_type == TokenType::CloseSquareBracket) ||
+                    !(tokens[i + 1].token_type == TokenType::IntegerLiteral || tokens[i + 1].token_type == TokenType::Object ||
+                      tokens[i + 1].token_type == TokenType::OpenParen)) {
                     errors.push_back("[Token " + std::to_string(i) + "] Error: Invalid range descriptor");
                 }
                 break;
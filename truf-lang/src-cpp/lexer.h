@@ -16,6 +16,7 @@ enum class TokenType {
     ArithmeticOperator,
     AssignmentOperator,
     ComparisonOperator,
+    LogicalOperator,
     IntegerLiteral,
     FloatLiteral,
     StringLiteral,
@@ -35,6 +36,8 @@ enum class TokenType {
     RangeDescriptor,
     SemiColon,
     NewLine,
+    // `@name`, in front of a declaration
+    Attribute,
 };
 
 bool is_literal(TokenType tok);
@@ -44,6 +47,10 @@ struct Token {
     TokenType token_type;
     std::string value;
 
+    // Position of the first character of the token in the source (1 based)
+    unsigned int line = 0;
+    unsigned int col = 0;
+
     // Function to convert TokenType to a string
     std::string token_type_to_string() const;
 
@@ -70,11 +77,18 @@ public:
     // Data members
     const std::string& source;
     size_t pos;
+    unsigned int line;
     std::vector<Token> tokens;
     std::unordered_set<std::string> variables;
     std::unordered_set<std::string> functions;
 
 private:
+    // Start of the current line and how far `line` has been computed
+    size_t line_start;
+    size_t line_pos;
+
+    void advance_line(size_t to);
+
     // Constants for data types and keywords
     static const std::vector<std::string> DATA_TYPES;
     static const std::vector<std::string> KEYWORDS;
@@ -84,9 +98,11 @@ private:
     std::optional<size_t> starts_with_kw(const std::string& s);
     std::optional<std::pair<size_t, TokenType>> starts_with_literal(const std::string& s);
     std::optional<size_t> starts_with_cmp_op(const std::string& s);
+    std::optional<size_t> starts_with_logical_op(const std::string& s);
     std::optional<size_t> starts_with_assign_op(const std::string& s);
     std::optional<std::pair<size_t, TokenType>> starts_with_dots(const std::string& s);
     std::optional<size_t> starts_with_object_name(const std::string& s);
+    std::optional<size_t> starts_with_attribute(const std::string& s);
 };
 
 #endif  // LEXER_H
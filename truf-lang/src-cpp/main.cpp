@@ -16,6 +16,9 @@
 #include <iomanip>
 #include <fstream>
 
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
 std::string f_read_to_string(std::string filepath) {
     // Open the file in input mode
     std::ifstream file(filepath);
@@ -57,11 +60,11 @@ void write_to_file(const std::string& path, const std::string& data) {
 }
 
 
-void generate_ast() {
+nlohmann::json generate_ast(std::string filepath) {
     time_t start = clock();
     
     
-    std::string source = f_read_to_string("truffle/main.tr");
+    std::string source = f_read_to_string(filepath);
 
     Lexer lexer = Lexer(source);
 
@@ -73,6 +76,14 @@ void generate_ast() {
         }
     }
 
+    std::vector<std::string> errors = lexer.validate_syntax();
+    if (!errors.empty()) {
+        for (const auto& err : errors) {
+            std::cerr << err << "\n";
+        }
+        throw std::runtime_error("Lexer found " + std::to_string(errors.size()) + " syntax errors");
+    }
+
     VarLst var_lst = VarLst();
     FuncLst fn_lst = FuncLst();
 
@@ -82,6 +93,48 @@ void generate_ast() {
         .ret_type = BeDataType::Null,
     });
 
+    fn_lst.push_back(FunctionTr {
+        .name = "flush",
+        .param_type = {},
+        .ret_type = BeDataType::Null,
+    });
+
+    fn_lst.push_back(FunctionTr {
+        .name = "len",
+        .param_type = {},
+        .ret_type = BeDataType::I64,
+    });
+
+    fn_lst.push_back(FunctionTr {
+        .name = "slice",
+        .param_type = {},
+        .ret_type = BeDataType::String,
+    });
+
+    // Branch hints, `if likely(x > 0) {`
+    for (std::string name : {"likely", "unlikely"}) {
+        fn_lst.push_back(FunctionTr {
+            .name = name,
+            .param_type = { BeDataType::Bool },
+            .ret_type = BeDataType::Bool,
+        });
+    }
+
+    fn_lst.push_back(FunctionTr {
+        .name = "prefetch",
+        .param_type = {},
+        .ret_type = BeDataType::Null,
+    });
+
+    // The vector builtins, see `check_vector_builtin`
+    for (std::string name : {"store", "select", "shuffle", "reduce_add", "reduce_mul", "reduce_min", "reduce_max", "any", "all"}) {
+        fn_lst.push_back(FunctionTr {
+            .name = name,
+            .param_type = {},
+            .ret_type = BeDataType::Null,
+        });
+    }
+
     fn_lst.push_back(FunctionTr {
         .name = "__some_c_func",
         .param_type = {},
@@ -95,23 +148,168 @@ void generate_ast() {
     write_to_file("ast.json", ast_str);
 
     time_t end = clock();
-    printf("Time Elapsed: %f", ((double) end - (double) start) / (double) CLOCKS_PER_SEC);
+    printf("Time Elapsed: %f\n", ((double) end - (double) start) / (double) CLOCKS_PER_SEC);
+
+    return ast;
 }
 
 
 
-int main() {
-    std::cout << "Starting LLVM code gen...\n";
+/// The runtime bitcode library that `make runtime/truffle_rt.bc` puts next to
+/// the compiler, or "" if it hasn't been built
+std::string default_runtime_path(const char* argv0) {
+    std::string executable = llvm::sys::fs::getMainExecutable(argv0, (void*) &default_runtime_path);
+    llvm::SmallString<128> path(llvm::sys::path::parent_path(executable));
+    llvm::sys::path::append(path, "runtime", "truffle_rt.bc");
+    if (!llvm::sys::fs::exists(path)) {
+        return "";
+    }
+    return std::string(path.str());
+}
 
-    // TEMP
-    generate_ast();
-    return 0;
+/// Usage: ./main [-O<n>] [-mcpu=<cpu> | -mcpu=native] [-g | -gline-tables-only] [-fno-print-fusion] [-fno-concat-fusion] [-fno-escape-analysis] [-fescape-report] [-fauto-parallel [-fparallel-report]] [-fno-alias-info] [-ffast-math] [-Rpass=<regex>] [-Rpass-missed=<regex>] [-Rpass-analysis=<regex>] [-fno-bounds-check-elimination] [-fno-regions] [-fno-autofree | -frefcount] [-fcheck-memory] [--runtime=<file> | -fno-link-runtime] [--profile-generate[=<file>] | --profile-use=<file> | --profile-sample-use=<file>] [source.tr] [output.ll | output.o]
+int main(int argc, char** argv) {
+    std::vector<std::string> positional = {};
+    CodeGenOptions options;
+    bool link_runtime = true;
 
-    std::string ast_str = f_read_to_string("ast.json");
-    
-    nlohmann::json ast = nlohmann::json::parse(ast_str);
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-g") {
+            options.debug_info = DebugInfoLevel::Full;
+        }
+        else if (arg == "-gline-tables-only") {
+            options.debug_info = DebugInfoLevel::LineTablesOnly;
+        }
+        else if (arg == "-g0") {
+            options.debug_info = DebugInfoLevel::None;
+        }
+        else if (arg == "--profile-generate") {
+            options.profile_generate = true;
+        }
+        else if (arg.rfind("--profile-generate=", 0) == 0) {
+            options.profile_generate = true;
+            options.profile_generate_path = arg.substr(std::string("--profile-generate=").size());
+        }
+        else if (arg.rfind("--profile-use=", 0) == 0) {
+            options.profile_use_path = arg.substr(std::string("--profile-use=").size());
+        }
+        else if (arg.rfind("--profile-sample-use=", 0) == 0) {
+            options.profile_sample_use_path = arg.substr(std::string("--profile-sample-use=").size());
+        }
+        else if (arg == "-fno-print-fusion") {
+            options.fuse_prints = false;
+        }
+        else if (arg == "-fno-concat-fusion") {
+            options.fuse_concats = false;
+        }
+        else if (arg == "-fno-escape-analysis") {
+            options.escape_analysis = false;
+        }
+        else if (arg == "-fescape-report") {
+            options.escape_report = true;
+        }
+        else if (arg == "-fauto-parallel") {
+            options.auto_parallel = true;
+        }
+        else if (arg == "-fparallel-report") {
+            options.parallel_report = true;
+        }
+        else if (arg == "-fno-alias-info") {
+            options.alias_info = false;
+        }
+        else if (arg == "-ffast-math") {
+            options.fast_math = true;
+        }
+        else if (arg.rfind("-Rpass=", 0) == 0) {
+            options.remarks_passed = arg.substr(std::string("-Rpass=").size());
+        }
+        else if (arg.rfind("-Rpass-missed=", 0) == 0) {
+            options.remarks_missed = arg.substr(std::string("-Rpass-missed=").size());
+        }
+        else if (arg.rfind("-Rpass-analysis=", 0) == 0) {
+            options.remarks_analysis = arg.substr(std::string("-Rpass-analysis=").size());
+        }
+        else if (arg == "-fno-bounds-check-elimination") {
+            options.bounds_check_elimination = false;
+        }
+        else if (arg == "-fno-regions") {
+            options.regions = false;
+        }
+        else if (arg == "-fno-autofree") {
+            options.memory_model = MemoryModel::Leak;
+        }
+        else if (arg == "-frefcount") {
+            options.memory_model = MemoryModel::RefCount;
+        }
+        else if (arg == "-fcheck-memory") {
+            options.check_memory = true;
+        }
+        else if (arg.rfind("--runtime=", 0) == 0) {
+            options.runtime_path = arg.substr(std::string("--runtime=").size());
+        }
+        else if (arg == "-fno-link-runtime") {
+            link_runtime = false;
+        }
+        else if (arg.rfind("-mcpu=", 0) == 0) {
+            options.cpu = arg.substr(std::string("-mcpu=").size());
+        }
+        else if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && arg[2] >= '0' && arg[2] <= '3') {
+            options.opt_level = arg[2] - '0';
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+        else {
+            positional.push_back(arg);
+        }
+    }
+
+    std::string src_path = positional.size() > 0 ? positional[0] : "truffle/main.tr";
+    std::string out_path = positional.size() > 1 ? positional[1] : "truffle-main.ll";
+    options.source_path = src_path;
+    options.emit_object = out_path.size() > 2 && out_path.substr(out_path.size() - 2) == ".o";
+
+    int num_profile_modes = options.profile_generate + !options.profile_use_path.empty() + !options.profile_sample_use_path.empty();
+    if (num_profile_modes > 1) {
+        std::cerr << "Only one of --profile-generate, --profile-use and --profile-sample-use can be used\n";
+        return 1;
+    }
+
+    if (options.parallel_report && !options.auto_parallel) {
+        std::cerr << "-fparallel-report needs -fauto-parallel\n";
+        return 1;
+    }
+
+    if (options.check_memory && options.memory_model == MemoryModel::RefCount) {
+        std::cerr << "-fcheck-memory can't be combined with -frefcount\n";
+        return 1;
+    }
 
-    gen_llvm_ir("truffle-main.ll", ast);
+    if (!link_runtime) {
+        options.runtime_path = "";
+    } else if (options.runtime_path.empty()) {
+        options.runtime_path = default_runtime_path(argv[0]);
+    }
+
+    // Samples are mapped back to the code through the line table
+    if (!options.profile_sample_use_path.empty() && options.debug_info == DebugInfoLevel::None) {
+        options.debug_info = DebugInfoLevel::LineTablesOnly;
+    }
+
+    // So that remarks can point at a line
+    bool remarks = !options.remarks_passed.empty() || !options.remarks_missed.empty() || !options.remarks_analysis.empty();
+    if (remarks && options.debug_info == DebugInfoLevel::None) {
+        options.debug_info = DebugInfoLevel::LineTablesOnly;
+    }
+
+    nlohmann::json ast = generate_ast(src_path);
+
+    std::cout << "Starting LLVM code gen...\n";
+    if (!gen_llvm_ir(out_path, ast, options)) {
+        return 1;
+    }
 
     return 0;
 }
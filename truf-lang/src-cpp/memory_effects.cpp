@@ -0,0 +1,243 @@
+#include "memory_effects.h"
+#include "dtype_utils.h"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/// How much of memory a function touches, from least to most
+enum class Effects {
+    None,
+    Read,
+    Any,
+};
+
+struct FunctionFacts {
+    Effects effects = Effects::None;
+    bool has_while_loop = false;
+    std::set<std::string> callees;
+};
+
+/// Whether a value of type `dtype` can be passed to or returned from a
+/// function that doesn't touch memory
+bool is_plain_value(std::string const& dtype) {
+    BeDataType type = dtype_from_str(dtype);
+    return type == BeDataType::Null || dtype_is_numeric(type) || type == BeDataType::Bool || dtype_is_vector(type);
+}
+
+/// What `node` does by itself, not counting the functions it calls (which
+/// are added to `facts.callees`)
+void collect_function_facts(
+    const nlohmann::json &node,
+    std::map<std::string, nlohmann::json*> const& functions,
+    FunctionFacts &facts
+) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            collect_function_facts(child, functions, facts);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    static const std::set<std::string> freeing = { "drop", "drop-on-entry", "drop-on-exit", "else-drop", "drop-old", "alloc", "region" };
+    for (const std::string& key : freeing) {
+        if (node.contains(key)) {
+            facts.effects = Effects::Any;
+            return;
+        }
+    }
+
+    std::string type = node.value("type", "");
+    if (node.contains("dtype") && node["dtype"].is_string() && node["dtype"] == "String") {
+        facts.effects = Effects::Any;
+        return;
+    }
+    if (type == "FunctionCall") {
+        std::string name = node["function-name"];
+        if (functions.count(name)) {
+            facts.callees.insert(name);
+        }
+        else if (name == "print" || name == "flush" || name == "slice" || name == "store" || name == "prefetch" || name == "__some_c_func") {
+            facts.effects = Effects::Any;
+            return;
+        }
+    }
+    else if (type == "Index") {
+        if (!node.value("in-bounds", false)) {
+            facts.effects = Effects::Any;
+            return;
+        }
+        if (dtype_is_array(dtype_from_str(node["array"]["dtype"])) && facts.effects == Effects::None) {
+            facts.effects = Effects::Read;
+        }
+    }
+    else if (type == "VectorLoad") {
+        // Only lanes that are out of bounds fail, and a mask turns those off
+        if (!node.contains("mask")) {
+            facts.effects = Effects::Any;
+            return;
+        }
+        if (facts.effects == Effects::None) {
+            facts.effects = Effects::Read;
+        }
+    }
+    else if (type == "ForLoop") {
+        if (node.value("parallel", false)) {
+            facts.effects = Effects::Any;
+            return;
+        }
+        if (node.contains("array") && facts.effects == Effects::None) {
+            facts.effects = Effects::Read;
+        }
+    }
+    else if (type == "Loop") {
+        facts.has_while_loop = true;
+    }
+    else if (type == "NewArray" || type == "ElementAssignmentStatement") {
+        facts.effects = Effects::Any;
+        return;
+    }
+    else if ((type == "DeclarationStatement" || type == "AssignmentStatement") && dtype_is_array(dtype_from_str(node["src"]["dtype"]))) {
+        // Arrays are copied, unless moved
+        facts.effects = Effects::Any;
+        return;
+    }
+
+    for (const auto& [key, child] : node.items()) {
+        collect_function_facts(child, functions, facts);
+        if (facts.effects == Effects::Any) {
+            return;
+        }
+    }
+}
+
+/// Adds the effects of the functions each function calls to its own, until
+/// nothing changes. Calls of the functions in `pure` count as reading memory
+/// at most, since `@pure` promises that they don't change it.
+void propagate_effects(std::map<std::string, FunctionFacts> &facts, std::set<std::string> const& pure) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& [name, own] : facts) {
+            for (const std::string& callee : own.callees) {
+                Effects effects = facts[callee].effects;
+                if (pure.count(callee) && effects == Effects::Any) {
+                    effects = Effects::Read;
+                }
+                if (effects > own.effects) {
+                    own.effects = effects;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/// `parse_function` only checks the body of a `@pure` function itself, so
+/// the attribute is dropped (with a warning) from functions that call one
+/// that may print or write memory. The callee may only allocate buffers of
+/// its own, but that can't be told apart here.
+void check_pure_callees(
+    std::map<std::string, nlohmann::json*> const& functions,
+    std::map<std::string, FunctionFacts> const& own_facts
+) {
+    std::set<std::string> pure;
+    for (const auto& [name, func] : functions) {
+        if (func->contains("attributes") && (*func)["attributes"].contains("pure")) {
+            pure.insert(name);
+        }
+    }
+
+    // Dropping `@pure` from one function can make its callers impure too
+    bool dropped = true;
+    while (dropped) {
+        dropped = false;
+        std::map<std::string, FunctionFacts> facts = own_facts;
+        propagate_effects(facts, pure);
+
+        for (const std::string& name : pure) {
+            for (const std::string& callee : facts[name].callees) {
+                if (callee == name || pure.count(callee) || facts[callee].effects != Effects::Any) {
+                    continue;
+                }
+                std::cerr << "Warning: `@pure` is ignored on `" << name << "`, which calls `" << callee << "`, which may print or write memory\n";
+                (*functions.at(name))["attributes"].erase("pure");
+                pure.erase(name);
+                dropped = true;
+                break;
+            }
+            if (dropped) {
+                break;
+            }
+        }
+    }
+}
+
+void annotate_memory_effects(nlohmann::json &module) {
+    std::map<std::string, nlohmann::json*> functions;
+    if (module["type"] == "Module") {
+        for (auto& stmt : module["statements"]) {
+            if (stmt["type"] == "Function") {
+                functions[stmt["name"]] = &stmt;
+            }
+        }
+    } else if (module["type"] == "Function") {
+        functions[module["name"]] = &module;
+    }
+
+    std::map<std::string, FunctionFacts> facts;
+    for (const auto& [name, func] : functions) {
+        FunctionFacts& own = facts[name];
+        bool plain = name != "main" && is_plain_value((*func)["ret-type"]);
+        for (const auto& param : (*func)["parameters"]) {
+            BeDataType dtype = dtype_from_str(param["dtype"]);
+            plain = plain && (is_plain_value(param["dtype"]) || dtype_is_array(dtype));
+        }
+        if (!plain) {
+            own.effects = Effects::Any;
+            continue;
+        }
+        collect_function_facts((*func)["code-block"], functions, own);
+    }
+
+    check_pure_callees(functions, facts);
+
+    // A function touches what the functions it calls touch
+    propagate_effects(facts, {});
+
+    // Starts out false for every function, so recursion never returns for sure
+    std::set<std::string> will_return;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& [name, own] : facts) {
+            if (will_return.count(name) || own.effects == Effects::Any || own.has_while_loop) {
+                continue;
+            }
+            bool callees_return = true;
+            for (const std::string& callee : own.callees) {
+                callees_return = callees_return && will_return.count(callee);
+            }
+            if (callees_return) {
+                will_return.insert(name);
+                changed = true;
+            }
+        }
+    }
+
+    for (const auto& [name, func] : functions) {
+        Effects effects = facts[name].effects;
+        if (effects == Effects::Any) {
+            continue;
+        }
+        (*func)["memory"] = effects == Effects::None ? "none" : "read";
+        if (will_return.count(name)) {
+            (*func)["will-return"] = true;
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MEMORY_EFFECTS_H
+#define MEMORY_EFFECTS_H
+
+#include "json.hpp"
+
+/// Marks the functions whose calls can be moved around like arithmetic, so
+/// code gen can tell LLVM (`readnone`/`readonly`, `nofree`, `nosync`):
+///
+/// - `"memory": "none"` on a Function that doesn't touch memory at all: it
+///   takes and returns numbers, bools, vectors and arrays (only to take their
+///   length), and only calls functions that are marked too
+/// - `"memory": "read"` on one that reads elements of arrays as well
+///
+/// Neither may print, build a string or an array, write an element, free
+/// anything (see `annotate_drops`), run a `parallel for` or index without
+/// range analysis proving the index in bounds, since a failing bounds check
+/// prints an error.
+///
+/// Marked functions without `while` loops that only call functions like
+/// that, and not themselves, also get `"will-return": true`: `for` loops
+/// always end.
+///
+/// It also drops `@pure` from functions that call a function that may print
+/// or write memory (see `check_pure_callees`), so code gen only trusts the
+/// attribute where the callees keep its promise.
+///
+/// This looks at the final AST, so it has to run after all of the other passes.
+void annotate_memory_effects(nlohmann::json &module);
+
+#endif
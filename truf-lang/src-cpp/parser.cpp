@@ -19,6 +19,9 @@ OperationType get_op(std::string op) {
     if (op == "==") return OperationType::Eq;
     if (op == "!=") return OperationType::NotEq;
 
+    if (op == "&&") return OperationType::And;
+    if (op == "||") return OperationType::Or;
+
     throw std::runtime_error("Unknown operation [fn get_op]: " + op);
 }
 
@@ -36,6 +39,9 @@ TokenType get_op_type(OperationType op) {
     if (op == OperationType::Eq) return TokenType::ComparisonOperator;
     if (op == OperationType::NotEq) return TokenType::ComparisonOperator;
 
+    if (op == OperationType::And) return TokenType::LogicalOperator;
+    if (op == OperationType::Or) return TokenType::LogicalOperator;
+
     throw std::runtime_error("Unknown operation [fn get_op_type]: " + op);
 }
 
@@ -54,22 +60,431 @@ unsigned int get_op_priority(OperationType op) {
     if (op == OperationType::Eq) return 9;
     if (op == OperationType::NotEq) return 9;
 
+    if (op == OperationType::And) return 5;
+    if (op == OperationType::Or) return 4;
+
     throw std::runtime_error("Unknown operation [fn get_op_priority]: " + op);
 }
 
-void consume_whitespace(std::vector<Token> tokens, unsigned int &idx) {
-    while (tokens[idx].token_type == TokenType::NewLine) {
+void consume_whitespace(std::vector<Token> const& tokens, unsigned int &idx) {
+    while (idx < tokens.size() && tokens[idx].token_type == TokenType::NewLine) {
         idx++;
     }
 }
+
+bool is_open_group(Token const& token) {
+    return token.token_type == TokenType::OpenParen || token.token_type == TokenType::OpenSquareBracket;
+}
+
+bool is_close_group(Token const& token) {
+    return token.token_type == TokenType::CloseParen || token.token_type == TokenType::CloseSquareBracket;
+}
+
+/// Returns the index of the parenthesis (or square bracket) that closes the
+/// one at `open_idx`, or `end + 1` if it isn't closed before `end`.
+unsigned int find_matching_paren(std::vector<Token> const& tokens, unsigned int open_idx, unsigned int end) {
+    unsigned int depth = 0;
+    for (unsigned int i = open_idx; i <= end; i++) {
+        if (is_open_group(tokens[i])) {
+            depth++;
+        }
+        else if (is_close_group(tokens[i])) {
+            depth--;
+            if (depth == 0) return i;
+        }
+    }
+    return end + 1;
+}
+
+/// Finds the operator an expression should be split at: the one with the lowest
+/// priority outside of any parenthesis (or index). Ties go to the rightmost
+/// operator so that operators are left associative (`a - b - c` -> `(a - b) - c`).
+/// Returns `end + 1` if the range contains no such operator.
+unsigned int find_split_operator(std::vector<Token> const& tokens, unsigned int start, unsigned int end) {
+    unsigned int op_idx = end + 1;
+    unsigned int op_priority = 256;
+    unsigned int depth = 0;
+
+    for (unsigned int i = start; i <= end; i++) {
+        if (is_open_group(tokens[i])) {
+            depth++;
+            continue;
+        }
+        else if (is_close_group(tokens[i])) {
+            depth--;
+            continue;
+        }
+
+        if (
+            depth != 0 ||
+            (
+                tokens[i].token_type != TokenType::ArithmeticOperator && 
+                tokens[i].token_type != TokenType::ComparisonOperator &&
+                tokens[i].token_type != TokenType::LogicalOperator
+            )
+        ) {
+            continue;
+        }
+
+        unsigned int curr_priority = get_op_priority(get_op(tokens[i].value));
+        if (curr_priority <= op_priority) {
+            op_priority = curr_priority;
+            op_idx = i;
+        }
+    }
+
+    return op_idx;
+}
 // -------------------
 
 
 // Forward Declarations
 BeDataType inference_type(BeDataType left, BeDataType right, std::string op);
+
+/// Records where in the source a statement starts (used for debug info)
+void set_location(nlohmann::json &node, Token const& token) {
+    node["line"] = token.line;
+    node["col"] = token.col;
+}
+
+/// Whether the integer literal `value` is a value of the number type `dtype`
+bool literal_fits(std::string const& value, BeDataType dtype) {
+    if (dtype_is_float(dtype)) {
+        return true;
+    }
+    unsigned int bits = dtype_bits(dtype);
+    if (dtype_is_unsigned(dtype)) {
+        if (value[0] == '-') {
+            return false;
+        }
+        return bits == 64 || std::stoull(value) < (1ULL << bits);
+    }
+    long long v = std::stoll(value);
+    return bits == 64 || (v >= -(1LL << (bits - 1)) && v < (1LL << (bits - 1)));
+}
+
+/// Wraps `value` in a `Cast` to `dtype` (see `parse_conversion`)
+nlohmann::json make_cast(nlohmann::json value, BeDataType dtype) {
+    nlohmann::json cast;
+    cast["type"] = "Cast";
+    cast["value"] = value;
+    cast["dtype"] = dtype_to_str(dtype);
+    return cast;
+}
+
+/// Converts `expr` to `dtype` where no value can change: a literal just takes
+/// the type (if its value fits), anything that widens to `dtype` is wrapped in
+/// a `Cast`. Integers of the same size are left as they are, like before there
+/// were narrow types. Narrowing throws, it has to be written out as `T(x)`.
+nlohmann::json coerce_to(nlohmann::json expr, BeDataType dtype, std::string const& fn_name) {
+    BeDataType from = dtype_from_str(expr["dtype"]);
+    if (from == dtype) {
+        return expr;
+    }
+
+    // A scalar used as a vector is copied to every lane
+    if (dtype_is_vector(dtype) && !dtype_is_vector(from) && (dtype_is_numeric(from) || from == BeDataType::Bool)) {
+        return make_cast(coerce_to(expr, dtype_element(dtype), fn_name), dtype);
+    }
+    if (dtype_is_vector(dtype) || dtype_is_vector(from)) {
+        throw std::runtime_error(
+            "[fn " + fn_name + "] " + dtype_to_str(from) + " doesn't implicitly convert to " + dtype_to_str(dtype)
+        );
+    }
+
+    if (!dtype_is_numeric(from) || !dtype_is_numeric(dtype)) {
+        return expr;
+    }
+
+    if (expr["type"] == "Literal" && (dtype_is_integer(from) || dtype_is_float(dtype)) && literal_fits(expr["value"], dtype)) {
+        expr["dtype"] = dtype_to_str(dtype);
+        return expr;
+    }
+    if (expr["type"] == "Literal" && dtype_is_integer(from)) {
+        throw std::runtime_error("[fn " + fn_name + "] `" + expr["value"].get<std::string>() + "` doesn't fit in " + dtype_to_str(dtype));
+    }
+    if (dtype_widens_to(from, dtype)) {
+        return make_cast(expr, dtype);
+    }
+    if (dtype_is_integer(from) && dtype_is_integer(dtype) && dtype_bits(from) == dtype_bits(dtype)) {
+        return expr;
+    }
+
+    throw std::runtime_error(
+        "[fn " + fn_name + "] " + dtype_to_str(from) + " doesn't implicitly convert to " + dtype_to_str(dtype) +
+        ", narrowing has to be explicit (`T(x)`)"
+    );
+}
 // ---------------
 
 
+/// Collects the name of every variable that is the target of an assignment
+/// inside of `node`. Nested functions have their own variables and are skipped.
+void collect_assigned_names(nlohmann::json const& node, std::unordered_set<std::string> &names) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            collect_assigned_names(child, names);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    if (node.value("type", "") == "AssignmentStatement") {
+        names.insert(node["dst"].get<std::string>());
+    }
+    for (const auto& [key, child] : node.items()) {
+        collect_assigned_names(child, names);
+    }
+}
+
+/// Names of the variables declared inside of `node` (loop variables included)
+void collect_declared_names(nlohmann::json const& node, std::unordered_set<std::string> &names) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            collect_declared_names(child, names);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    if (node.value("type", "") == "DeclarationStatement") {
+        names.insert(node["dst"].get<std::string>());
+    }
+    else if (node.value("type", "") == "ForLoop") {
+        names.insert(node["variable"].get<std::string>());
+    }
+    for (const auto& [key, child] : node.items()) {
+        collect_declared_names(child, names);
+    }
+}
+
+/// How often `node` reads the variable `name`
+size_t count_reads(nlohmann::json const& node, std::string const& name) {
+    if (node.is_array()) {
+        size_t reads = 0;
+        for (const auto& child : node) {
+            reads += count_reads(child, name);
+        }
+        return reads;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return 0;
+    }
+
+    size_t reads = node.value("type", "") == "Variable" && node["name"] == name;
+    for (const auto& [key, child] : node.items()) {
+        reads += count_reads(child, name);
+    }
+    return reads;
+}
+
+/// Every assignment to `name` inside of `node`
+void collect_assignments(nlohmann::json const& node, std::string const& name, std::vector<nlohmann::json const*> &assignments) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            collect_assignments(child, name, assignments);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    if (node.value("type", "") == "AssignmentStatement" && node["dst"] == name) {
+        assignments.push_back(&node);
+    }
+    for (const auto& [key, child] : node.items()) {
+        collect_assignments(child, name, assignments);
+    }
+}
+
+bool contains_return(nlohmann::json const& node) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            if (contains_return(child)) return true;
+        }
+        return false;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return false;
+    }
+
+    if (node.value("type", "") == "ReturnStatement") {
+        return true;
+    }
+    for (const auto& [key, child] : node.items()) {
+        if (contains_return(child)) return true;
+    }
+    return false;
+}
+
+/// What `node` does that a `@pure` function can't (see `parse_function`),
+/// like "prints", or "" if nothing
+std::string find_side_effect(nlohmann::json const& node, std::unordered_set<std::string> const& params) {
+    if (node.is_array()) {
+        for (const auto& child : node) {
+            std::string effect = find_side_effect(child, params);
+            if (!effect.empty()) return effect;
+        }
+        return "";
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return "";
+    }
+
+    std::string type = node.value("type", "");
+    if (type == "FunctionCall") {
+        std::string name = node["function-name"];
+        if (name == "print" || name == "flush" || name == "__some_c_func") {
+            return "calls `" + name + "`";
+        }
+    }
+    else if (type == "ElementAssignmentStatement" && params.count(node["dst"].get<std::string>())) {
+        return "writes elements of its parameter `" + node["dst"].get<std::string>() + "`";
+    }
+    else if (type == "ForLoop" && node.value("parallel", false)) {
+        return "runs a `parallel for`";
+    }
+    for (const auto& [key, child] : node.items()) {
+        std::string effect = find_side_effect(child, params);
+        if (!effect.empty()) return effect;
+    }
+    return "";
+}
+
+/// Finds the reduction variables of the for loop `loop` (see
+/// `parse_parallel_for`) and adds them to `reductions`. Returns why the loop
+/// can't run in parallel if it assigns to any other variable from outside
+/// of it (like "assigns to `x` ..."), or "" if it doesn't.
+std::string find_reductions(nlohmann::json const& loop, nlohmann::json &reductions) {
+    std::unordered_set<std::string> assigned = {};
+    std::unordered_set<std::string> declared = {};
+    collect_assigned_names(loop["code-block"], assigned);
+    collect_declared_names(loop["code-block"], declared);
+
+    std::vector<std::string> names(assigned.begin(), assigned.end());
+    std::sort(names.begin(), names.end());
+
+    for (std::string const& name : names) {
+        if (name == loop["variable"] || declared.count(name)) {
+            continue;
+        }
+
+        std::vector<nlohmann::json const*> assignments = {};
+        collect_assignments(loop["code-block"], name, assignments);
+        std::string combine = "";
+        std::string dtype = "";
+        for (nlohmann::json const* assignment : assignments) {
+            nlohmann::json const& src = (*assignment)["src"];
+            std::string op = src.value("operator", "");
+            bool commutative = op == "+" || op == "*" || op == "&&" || op == "||";
+            bool updates = false;
+            if (src["type"] == "Expression" && (commutative || op == "-")) {
+                nlohmann::json const& left = src["left-operand"];
+                nlohmann::json const& right = src["right-operand"];
+                if (left["type"] == "Variable" && left["name"] == name && count_reads(right, name) == 0) {
+                    updates = true;
+                    dtype = left["dtype"];
+                } else if (commutative && right["type"] == "Variable" && right["name"] == name && count_reads(left, name) == 0) {
+                    updates = true;
+                    dtype = right["dtype"];
+                }
+            }
+            if (!updates) {
+                return "assigns to `" + name + "` other than like a reduction (`" + name + " = " + name + " + ...`)";
+            }
+
+            BeDataType reduction_dtype = dtype_from_str(dtype);
+            if (!dtype_is_numeric(reduction_dtype) && reduction_dtype != BeDataType::Bool) {
+                return "assigns to `" + name + "`, and only numbers and bools can be reduction variables";
+            }
+
+            if (op == "-") {
+                op = "+";
+            }
+            if (!combine.empty() && combine != op) {
+                return "updates the reduction variable `" + name + "` with different operators";
+            }
+            combine = op;
+        }
+        if (count_reads(loop["code-block"], name) != assignments.size()) {
+            return "reads the reduction variable `" + name + "` other than to update it";
+        }
+
+        nlohmann::json reduction;
+        reduction["name"] = name;
+        reduction["operator"] = combine;
+        reduction["dtype"] = dtype;
+        reductions.push_back(reduction);
+    }
+    return "";
+}
+
+/// Converts the value of every `return` inside of `node` to `ret_type`
+void coerce_returns(nlohmann::json &node, BeDataType ret_type) {
+    if (node.is_array()) {
+        for (auto& child : node) {
+            coerce_returns(child, ret_type);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    if (node.value("type", "") == "ReturnStatement") {
+        node["value"] = coerce_to(node["value"], ret_type, "parse_return");
+        node["dtype"] = node["value"]["dtype"];
+        return;
+    }
+    for (auto& [key, child] : node.items()) {
+        coerce_returns(child, ret_type);
+    }
+}
+
+void mark_mutable_bindings_h(nlohmann::json &node, std::unordered_set<std::string> const& assigned) {
+    if (node.is_array()) {
+        for (auto& child : node) {
+            mark_mutable_bindings_h(child, assigned);
+        }
+        return;
+    }
+    if (!node.is_object() || node.value("type", "") == "Function") {
+        return;
+    }
+
+    if (node.value("type", "") == "DeclarationStatement") {
+        node["mutable"] = assigned.count(node["dst"].get<std::string>()) > 0;
+    }
+    else if (node.value("type", "") == "ForLoop") {
+        node["mutable"] = assigned.count(node["variable"].get<std::string>()) > 0;
+    }
+    for (auto& [key, child] : node.items()) {
+        mark_mutable_bindings_h(child, assigned);
+    }
+}
+
+/// Truffle variables are immutable unless they are assigned to after being
+/// declared. Sets `"mutable"` on the parameters and declarations of `func` so
+/// that code gen can keep immutable bindings in SSA registers.
+///
+/// This is done by name for the whole function, so assigning to one variable
+/// makes every variable of the same name in the function mutable.
+void mark_mutable_bindings(nlohmann::json &func) {
+    std::unordered_set<std::string> assigned = {};
+    collect_assigned_names(func["code-block"], assigned);
+
+    for (auto& param : func["parameters"]) {
+        param["mutable"] = assigned.count(param["name"].get<std::string>()) > 0;
+    }
+    mark_mutable_bindings_h(func["code-block"], assigned);
+}
+
+
 /// ## Module
 /// ```json
 /// {
@@ -78,7 +493,7 @@ BeDataType inference_type(BeDataType left, BeDataType right, std::string op);
 /// }
 /// ```
 nlohmann::json parse_module(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst* var_lst,
     FuncLst* fn_list
@@ -93,8 +508,21 @@ nlohmann::json parse_module(
 
     while (idx < tokens.size()) {
         consume_whitespace(tokens, idx);
-
-        if (tokens[idx].token_type == TokenType::Keyword) {
+        if (idx >= tokens.size()) {
+            break;
+        }
+        unsigned int start_idx = idx;
+        size_t num_statements = statements.size();
+
+        if (tokens[idx].token_type == TokenType::Attribute) {
+            // A function starts at `fn`, after its attributes
+            start_idx = skip_attributes(tokens, idx);
+            if (!tokens[start_idx].equals(TokenType::Keyword, "fn")) {
+                throw std::runtime_error("[fn parse_module] Only functions can have attributes.");
+            }
+            statements.push_back(parse_function(tokens, idx, var_lst, fn_list));
+        }
+        else if (tokens[idx].token_type == TokenType::Keyword) {
             if (tokens[idx].value == "fn") {
                 statements.push_back(parse_function(tokens, idx, var_lst, fn_list));
             }
@@ -111,6 +539,10 @@ nlohmann::json parse_module(
         else {
             throw std::runtime_error("[fn parse_module] Invalid start token -> " + tokens[idx].value);
         }
+
+        if (statements.size() > num_statements) {
+            set_location(statements.back(), tokens[start_idx]);
+        }
     }
 
     module_node["statements"] = statements;
@@ -125,11 +557,14 @@ nlohmann::json parse_module(
 /// ```json
 /// {
 ///     "type": "CodeBlock",
-///     "statements": [] // These can be any node specified below
+///     "statements": [], // These can be any node specified below
+///     "end-line": 0     // line of the closing `}`
 /// }
+///
+/// Every statement node also carries the `"line"` and `"col"` of its first token.
 /// ```
 nlohmann::json parse_code_block(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst* var_lst,
     FuncLst* fn_list
@@ -158,11 +593,35 @@ nlohmann::json parse_code_block(
             continue;
         }
         else if (tokens[idx].token_type == TokenType::CloseCurlyBrace) {
+            node["end-line"] = tokens[idx].line;
             idx++;
             break;
         }
+        unsigned int start_idx = idx;
 
-        if (tokens[idx].equals(TokenType::Keyword)) {
+        if (tokens[idx].token_type == TokenType::Attribute) {
+            start_idx = skip_attributes(tokens, idx);
+            Token const& next = tokens[start_idx];
+            if (next.equals(TokenType::Keyword, "fn")) {
+                code_block.push_back(parse_function(tokens, idx, var_lst, fn_list));
+            }
+            else if (next.equals(TokenType::Keyword, "while") || next.equals(TokenType::Keyword, "for") || next.equals(TokenType::Keyword, "parallel")) {
+                nlohmann::json attributes = parse_attributes(tokens, idx);
+                check_loop_attributes(attributes);
+                if (next.equals("while")) {
+                    code_block.push_back(parse_loop(tokens, idx, var_lst, fn_list));
+                } else if (next.equals("for")) {
+                    code_block.push_back(parse_for_loop(tokens, idx, var_lst, fn_list));
+                } else {
+                    code_block.push_back(parse_parallel_for(tokens, idx, var_lst, fn_list));
+                }
+                code_block.back()["attributes"] = attributes;
+            }
+            else {
+                throw std::runtime_error("[fn parse_code_block] Only functions and loops can have attributes.");
+            }
+        }
+        else if (tokens[idx].equals(TokenType::Keyword)) {
             if (tokens[idx].value == "fn") {
                 fn_list->push_back(FunctionTr {
                     .name = tokens[idx+1].value,
@@ -181,6 +640,14 @@ nlohmann::json parse_code_block(
                 nlohmann::json loop_block = parse_loop(tokens, idx, var_lst, fn_list);
                 code_block.push_back(loop_block);
             }
+            else if (tokens[idx].equals("for"))  {
+                nlohmann::json loop_block = parse_for_loop(tokens, idx, var_lst, fn_list);
+                code_block.push_back(loop_block);
+            }
+            else if (tokens[idx].equals("parallel"))  {
+                nlohmann::json loop_block = parse_parallel_for(tokens, idx, var_lst, fn_list);
+                code_block.push_back(loop_block);
+            }
             else if (tokens[idx].equals("return")) {
                 nlohmann::json ret_statement = parse_return(tokens, idx, var_lst, fn_list);
                 code_block.push_back(ret_statement);
@@ -200,7 +667,9 @@ nlohmann::json parse_code_block(
             code_block.push_back(parse_declaration(tokens, idx, var_lst, fn_list));
         }
         else if (tokens[idx].token_type == TokenType::Object) {
-            if (fn_list->contains(tokens[idx].value)) {
+            // Builtins like `any` or `store` are only called when `(` follows,
+            // so they can still be used as variable names
+            if (fn_list->contains(tokens[idx].value) && tokens[idx+1].token_type == TokenType::OpenParen) {
                 code_block.push_back(parse_function_call(tokens, idx, var_lst, fn_list));
             }
             else if (var_lst->contains(tokens[idx].value)) {
@@ -213,6 +682,8 @@ nlohmann::json parse_code_block(
         else {
             throw std::runtime_error("no valid parsing strategy in [fn parse_code_block] for " + tokens[idx].to_string());
         }
+
+        set_location(code_block.back(), tokens[start_idx]);
     }
 
     node["statements"] = code_block;
@@ -222,17 +693,123 @@ nlohmann::json parse_code_block(
     return node;
 }
 
+/// ## Attributes
+/// `@name` or `@name(argument)` in front of a declaration, one after another
+/// on the same line or on lines of their own, like `@hot @target("avx2")`.
+/// The argument is a string or an integer literal, or a list of names like
+/// `@fastmath(reassoc, contract)`. An attribute without one is `true`.
+/// ```json
+/// {"hot": true, "target": "avx2", "fastmath": ["reassoc", "contract"]}
+/// ```
+nlohmann::json parse_attributes(std::vector<Token> const& tokens, unsigned int &idx) {
+    nlohmann::json attributes = nlohmann::json::object();
+    while (idx < tokens.size() && tokens[idx].token_type == TokenType::Attribute) {
+        std::string name = tokens[idx].value.substr(1);
+        if (attributes.contains(name)) {
+            throw std::runtime_error("[fn parse_attributes] `@" + name + "` is given twice.");
+        }
+        idx++;
+
+        nlohmann::json value = true;
+        if (idx < tokens.size() && tokens[idx].token_type == TokenType::OpenParen) {
+            idx++;
+            if (tokens[idx].token_type == TokenType::StringLiteral) {
+                value = tokens[idx].value.substr(1, tokens[idx].value.size() - 2);
+            }
+            else if (tokens[idx].token_type == TokenType::IntegerLiteral) {
+                value = std::stoll(tokens[idx].value);
+            }
+            else if (tokens[idx].token_type == TokenType::Object) {
+                value = nlohmann::json::array({ tokens[idx].value });
+                while (tokens[idx + 1].token_type == TokenType::Comma && tokens[idx + 2].token_type == TokenType::Object) {
+                    idx += 2;
+                    value.push_back(tokens[idx].value);
+                }
+            }
+            else {
+                throw std::runtime_error("[fn parse_attributes] The argument of `@" + name + "` has to be a string or an integer literal, or a list of names.");
+            }
+            idx++;
+            if (!tokens[idx].equals(TokenType::CloseParen)) {
+                throw std::runtime_error("[fn parse_attributes] Expected ')' after the argument of `@" + name + "`.");
+            }
+            idx++;
+        }
+        attributes[name] = value;
+        consume_whitespace(tokens, idx);
+    }
+    return attributes;
+}
+
+/// Checks the attributes of a `while`, `for` or `parallel for` loop, which
+/// are hints for how LLVM optimizes it:
+///
+/// - `@unroll` unrolls it if possible, `@unroll(n)` by `n`, `@unroll(1)` not
+/// - `@vectorize` vectorizes it even where LLVM's cost model is against it,
+///   `@vectorize(n)` with vectors of `n` lanes, `@vectorize(1)` not at all
+/// - `@interleave(n)` runs `n` (vector) iterations at a time, interleaved
+///
+/// Asking for vectors or interleaving lets LLVM reorder float additions and
+/// multiplications across iterations (like `#pragma clang loop`), which can
+/// change the last bits of a sum.
+void check_loop_attributes(nlohmann::json const& attributes) {
+    for (const auto& [name, value] : attributes.items()) {
+        if (name != "unroll" && name != "vectorize" && name != "interleave") {
+            throw std::runtime_error("[fn check_loop_attributes] Unknown loop attribute `@" + name + "`.");
+        }
+        if (value.is_string() || (value.is_boolean() && name == "interleave")) {
+            throw std::runtime_error("[fn check_loop_attributes] `@" + name + "` takes a count, like `@" + name + "(4)`.");
+        }
+        if (value.is_number() && (value.get<int64_t>() < 1 || value.get<int64_t>() > 1024)) {
+            throw std::runtime_error("[fn check_loop_attributes] The count of `@" + name + "` has to be between 1 and 1024.");
+        }
+        if (name == "vectorize" && value.is_number() && (value.get<int64_t>() & (value.get<int64_t>() - 1)) != 0) {
+            throw std::runtime_error("[fn check_loop_attributes] The vector width of `@vectorize` has to be a power of 2.");
+        }
+    }
+}
+
+/// Index of the first token after the attributes at `idx`, if there are any
+unsigned int skip_attributes(std::vector<Token> const& tokens, unsigned int idx) {
+    parse_attributes(tokens, idx);
+    return idx;
+}
+
 /// ## Function
 /// ```json
 /// {
 ///     "type": "Function",
-///     "parameters": ["DataType", "DataType", ...],
+///     "parameters": [{"name": "...", "dtype": "DataType"}, ...],
 ///     "ret-type": "DataType",
+///     "attributes": {"inline": true, "target": "avx2"}, // only if it has any
 ///     "code-block": {"type": "CodeBlock", ...}
 /// }
 /// ```
+///
+/// Attributes steer how the function is optimized:
+///
+/// - `@inline` inlines it into every caller, `@noinline` never
+/// - `@flatten` inlines the functions it calls into it (not their callees)
+/// - `@hot` puts it with the other hot code (`.text.hot`)
+/// - `@cold` optimizes it for size, makes branches to calls of it unlikely,
+///   and puts it out of the way (`.text.unlikely`)
+/// - `@pure` promises that its result only depends on its arguments (and the
+///   elements of array arguments), so calls can be merged and dropped. It
+///   can't print, write elements of its parameters, run a `parallel for`, or
+///   take or return strings or return arrays. If a function it calls may
+///   print or write memory, code gen ignores the attribute with a warning
+///   (see `annotate_memory_effects`).
+/// - `@target("avx2,no-fma")` compiles it for CPUs with (`no-`: without) the
+///   given features, on top of `-mcpu`. It's only inlined into functions
+///   with those features too.
+/// - `@fastmath(reassoc, contract, ...)` lets LLVM take shortcuts with the
+///   float math of the function that can change its results: `reassoc`
+///   reorders sums and products (so reductions vectorize), `contract` fuses
+///   `a * b + c` into one FMA, `nnan`/`ninf` assume no NaNs/infinities, `nsz`
+///   ignores the sign of zero and `arcp` multiplies by reciprocals instead
+///   of dividing. `@fastmath` alone allows all of it, like `-ffast-math` does for every function without the attribute.
 nlohmann::json parse_function(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst* var_lst,
     FuncLst* fn_list
@@ -240,6 +817,8 @@ nlohmann::json parse_function(
     var_lst->push_stack();
     fn_list->push_stack();
 
+    nlohmann::json attributes = parse_attributes(tokens, idx);
+
     // Check for 'fn' keyword
     if (tokens[idx].token_type != TokenType::Keyword || tokens[idx].value != "fn") {
         throw std::runtime_error("[fn parse_function] Expected 'fn' keyword at the beginning of function definition.");
@@ -257,12 +836,6 @@ nlohmann::json parse_function(
     func["name"] = function_name;
     idx++;  // Move to '('
 
-    fn_list->funcs[fn_list->funcs.size()-2].push_back(FunctionTr {
-        .name = function_name,
-        .param_type = {},
-        .ret_type = BeDataType::Null,
-    });
-
     // Expect '('
     if (tokens[idx].token_type != TokenType::OpenParen) {
         throw std::runtime_error("[fn parse_function] Expected '(' after function name.");
@@ -271,6 +844,7 @@ nlohmann::json parse_function(
 
     // Parse parameters
     std::vector<nlohmann::json> params = {};
+    std::vector<BeDataType> param_types = {};
     while (tokens[idx].token_type != TokenType::CloseParen) {
         // Skip commas
         if (tokens[idx].token_type == TokenType::Comma) {
@@ -299,6 +873,12 @@ nlohmann::json parse_function(
         param_obj["name"] = param_name;
         param_obj["dtype"] = param_dtype_json;
         params.push_back(param_obj);
+        param_types.push_back(param_dtype);
+
+        var_lst->push_back(VariableTr {
+            .name = param_name,
+            .dtype = param_dtype,
+        });
     }
 
     func["parameters"] = params;
@@ -310,32 +890,106 @@ nlohmann::json parse_function(
     idx++;  // Move past ')'
 
     // Check for return type
+    BeDataType ret_type = BeDataType::Null;
     if (tokens[idx].token_type == TokenType::DataType) {
         std::string ret_type_str = tokens[idx].value;
-        BeDataType ret_type = dtype_from_str(ret_type_str);
-        func["ret-type"] = dtype_to_str(ret_type);
+        ret_type = dtype_from_str(ret_type_str);
         idx++;  // Move to '{'
-    } else {
-        // Default return type is 'Null' if not specified
-        func["ret-type"] = "Null";
     }
+    // Default return type is 'Null' if not specified
+    func["ret-type"] = dtype_to_str(ret_type);
+
+    static const std::unordered_set<std::string> flags = { "inline", "noinline", "flatten", "hot", "cold", "pure" };
+    static const std::unordered_set<std::string> fast_math_flags = { "reassoc", "contract", "nnan", "ninf", "nsz", "arcp" };
+    for (const auto& [name, value] : attributes.items()) {
+        if (flags.count(name) && !value.is_boolean()) {
+            throw std::runtime_error("[fn parse_function] `@" + name + "` doesn't take an argument.");
+        }
+        if (name == "target" && !value.is_string()) {
+            throw std::runtime_error("[fn parse_function] `@target` takes the target features as a string, like `@target(\"avx2,fma\")`.");
+        }
+        if (name == "fastmath" && !value.is_boolean()) {
+            if (!value.is_array()) {
+                throw std::runtime_error("[fn parse_function] `@fastmath` takes the names of what it allows, like `@fastmath(reassoc, contract)`.");
+            }
+            for (const auto& flag : value) {
+                if (!fast_math_flags.count(flag.get<std::string>())) {
+                    throw std::runtime_error("[fn parse_function] Unknown `@fastmath` flag `" + flag.get<std::string>() + "`.");
+                }
+            }
+        }
+        if (!flags.count(name) && name != "target" && name != "fastmath") {
+            throw std::runtime_error("[fn parse_function] Unknown function attribute `@" + name + "`.");
+        }
+    }
+    if (attributes.contains("inline") && attributes.contains("noinline")) {
+        throw std::runtime_error("[fn parse_function] `" + function_name + "` can't be both `@inline` and `@noinline`.");
+    }
+    if (attributes.contains("hot") && attributes.contains("cold")) {
+        throw std::runtime_error("[fn parse_function] `" + function_name + "` can't be both `@hot` and `@cold`.");
+    }
+    if (attributes.contains("pure")) {
+        bool string_param = std::find(param_types.begin(), param_types.end(), BeDataType::String) != param_types.end();
+        if (dtype_has_buffer(ret_type) || string_param) {
+            throw std::runtime_error("[fn parse_function] `@pure` function `" + function_name + "` can't take or return strings, or return an array.");
+        }
+    }
+    if (!attributes.empty()) {
+        func["attributes"] = attributes;
+    }
+
+    // Register the signature in the enclosing scope before parsing the body so
+    // that the function can call itself.
+    fn_list->funcs[fn_list->funcs.size()-2].push_back(FunctionTr {
+        .name = function_name,
+        .param_type = param_types,
+        .ret_type = ret_type,
+    });
 
     // Parse the function body using parse_code_block
     nlohmann::json code_block = parse_code_block(tokens, idx, var_lst, fn_list);
+    if (ret_type != BeDataType::Null) {
+        coerce_returns(code_block, ret_type);
+    }
     func["code-block"] = code_block;
 
+    if (attributes.contains("pure")) {
+        std::unordered_set<std::string> param_names;
+        for (const auto& param : params) {
+            param_names.insert(param["name"].get<std::string>());
+        }
+        std::string effect = find_side_effect(code_block, param_names);
+        if (!effect.empty()) {
+            throw std::runtime_error("[fn parse_function] `@pure` function `" + function_name + "` " + effect + ".");
+        }
+    }
+
+    mark_mutable_bindings(func);
+
     var_lst->pop_stack();
     fn_list->pop_stack();
     return func;
 }
 
 
+/// Conditions are bools or numbers, which are true when they aren't zero
+void check_condition(nlohmann::json const& condition, std::string const& fn_name) {
+    if (!condition.contains("dtype")) {
+        return;
+    }
+    BeDataType dtype = dtype_from_str(condition["dtype"]);
+    if (dtype != BeDataType::Bool && !dtype_is_numeric(dtype)) {
+        throw std::runtime_error("[fn " + fn_name + "] A condition has to be a bool or a number, not " + condition["dtype"].get<std::string>() + ".");
+    }
+}
+
 /// ## IfBlock
 /// ```json
 /// {
 ///     "type": "IfBlock",
 ///     "statements": [
 ///         {
+///             "line": 0, "col": 0,
 ///             "condition": "...",
 ///             "code-block": {"type": "CodeBlock", ...},
 ///         }
@@ -344,7 +998,7 @@ nlohmann::json parse_function(
 /// }
 /// ```
 nlohmann::json parse_if_block(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst* var_lst,
     FuncLst* fn_list
@@ -358,19 +1012,15 @@ nlohmann::json parse_if_block(
     std::vector<nlohmann::json> statements = {};
 
     while (true) {
-        if (
-            tokens[idx].token_type != TokenType::Keyword ||
-            tokens[idx].value != "if"
-        ) {
-            if (tokens[idx].value == "else") {
-                break;
-            }
+        if (!tokens[idx].equals(TokenType::Keyword, "if")) {
             throw std::runtime_error("[fn parse_if_block] invalid start token: " + tokens[idx].value);
         }
         idx++;
 
         nlohmann::json statement;
+        set_location(statement, tokens[idx-1]);
         statement["condition"] = parse_expression(tokens, idx, var_lst, fn_list);
+        check_condition(statement["condition"], "parse_if_block");
 
         if (tokens[idx].token_type != TokenType::OpenCurlyBrace) {
             throw std::runtime_error("[fn parse_if_block] invalid token after conditional expression: " + tokens[idx].value);
@@ -379,16 +1029,26 @@ nlohmann::json parse_if_block(
         statement["code-block"] = parse_code_block(tokens, idx, var_lst, fn_list);
 
         statements.push_back(statement);
-    }
 
-    if_block["statements"] = statements;
+        // Only look past newlines if the chain actually continues with an `else`
+        unsigned int next_idx = idx;
+        while (next_idx < tokens.size() && tokens[next_idx].token_type == TokenType::NewLine) {
+            next_idx++;
+        }
+        if (next_idx >= tokens.size() || !tokens[next_idx].equals(TokenType::Keyword, "else")) {
+            break;
+        }
+        idx = next_idx + 1;
 
-    consume_whitespace(tokens, idx);
-    if (tokens[idx].token_type == TokenType::Keyword && tokens[idx].value == "else") {
-        idx++;
+        if (tokens[idx].equals(TokenType::Keyword, "if")) {
+            continue;
+        }
         if_block["default"] = parse_code_block(tokens, idx, var_lst, fn_list);
+        break;
     }
 
+    if_block["statements"] = statements;
+
     var_lst->pop_stack();
     fn_list->pop_stack();
     return if_block;
@@ -403,7 +1063,7 @@ nlohmann::json parse_if_block(
 /// }
 /// ```
 nlohmann::json parse_loop(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst* var_lst,
     FuncLst* fn_list
@@ -419,6 +1079,7 @@ nlohmann::json parse_loop(
     nlohmann::json loop_block;
     loop_block["type"] = "Loop";
     loop_block["condition"] = parse_expression(tokens, idx, var_lst, fn_list);
+    check_condition(loop_block["condition"], "parse_loop");
 
     if (tokens[idx].token_type != TokenType::OpenCurlyBrace) {
         throw std::runtime_error("[fn parse_loop] error parsing, conditional expression not followed by `{`");
@@ -431,26 +1092,260 @@ nlohmann::json parse_loop(
     return loop_block;
 }
 
-/// ## FunctionCall
+/// ## ForLoop
 /// ```json
 /// {
-///     "type": "FunctionCall",
-///     "function-name": "...",
-///     "parameters": ["..."],
-///     "dtype": "DataType"
+///     "type": "ForLoop",
+///     "variable": "...",
+///     "dtype": "DataType",
+///     "start": "...",         // `for x in start..end` (or `start..=end`)
+///     "end": "...",
+///     "inclusive": false,     // true for `..=`
+///     "array": "...",         // or `for x in array` instead of a range
+///     "mutable": false,       // Set by `mark_mutable_bindings` once the function is parsed
+///     "code-block": {"type": "CodeBlock", ...}
 /// }
 /// ```
-nlohmann::json parse_function_call(
-    std::vector<Token> tokens, 
+///
+/// The bounds of a range (and the array) are evaluated once, before the
+/// first iteration, so the number of iterations is known up front. Assigning
+/// to the loop variable only changes it for the rest of the iteration.
+nlohmann::json parse_for_loop(
+    std::vector<Token> const& tokens,
     unsigned int &idx,
-    VarLst const* var_lst,
-    FuncLst const* fn_list
+    VarLst* var_lst,
+    FuncLst* fn_list
 ) {
-    if (tokens[idx].token_type != TokenType::Object) {
-        throw std::runtime_error("[fn parse_function_call] error parsing, tokens do not start TokenType::Object");
+    var_lst->push_stack();
+    fn_list->push_stack();
+
+    if (tokens[idx].token_type != TokenType::Keyword || tokens[idx].value != "for") {
+        throw std::runtime_error("[fn parse_for_loop] error parsing, tokens does not start with `for`.");
     }
+    idx++;
 
-    nlohmann::json func;
+    if (tokens[idx].token_type != TokenType::Object) {
+        throw std::runtime_error("[fn parse_for_loop] expected a variable name after `for`");
+    }
+    std::string variable = tokens[idx].value;
+    idx++;
+
+    if (!tokens[idx].equals(TokenType::Keyword, "in")) {
+        throw std::runtime_error("[fn parse_for_loop] expected `in` after `for " + variable + "`");
+    }
+    idx++;
+
+    nlohmann::json loop_block;
+    loop_block["type"] = "ForLoop";
+    loop_block["variable"] = variable;
+
+    nlohmann::json first = parse_expression(tokens, idx, var_lst, fn_list);
+    if (tokens[idx].token_type == TokenType::RangeDescriptor) {
+        loop_block["inclusive"] = tokens[idx].value == "..=";
+        idx++;
+        nlohmann::json last = parse_expression(tokens, idx, var_lst, fn_list);
+
+        // Integer literals take the integer type of the other end, like in an `Expression`
+        if (first["type"] == "Literal" && first["dtype"] == "I64" && dtype_is_integer(dtype_from_str(last["dtype"]))) {
+            first["dtype"] = last["dtype"];
+        }
+        if (last["type"] == "Literal" && last["dtype"] == "I64" && dtype_is_integer(dtype_from_str(first["dtype"]))) {
+            last["dtype"] = first["dtype"];
+        }
+        if (!dtype_is_integer(dtype_from_str(first["dtype"])) || first["dtype"] != last["dtype"]) {
+            throw std::runtime_error("[fn parse_for_loop] both ends of a range have to be integers of the same type");
+        }
+
+        loop_block["dtype"] = first["dtype"];
+        loop_block["start"] = first;
+        loop_block["end"] = last;
+    }
+    else {
+        BeDataType dtype = dtype_from_str(first["dtype"]);
+        if (first["type"] != "Variable" || !dtype_is_array(dtype)) {
+            throw std::runtime_error("[fn parse_for_loop] `for " + variable + " in ...` needs a range or an array variable");
+        }
+        loop_block["dtype"] = dtype_to_str(dtype_element(dtype));
+        loop_block["array"] = first;
+    }
+
+    if (tokens[idx].token_type != TokenType::OpenCurlyBrace) {
+        throw std::runtime_error("[fn parse_for_loop] error parsing, `for` not followed by `{`");
+    }
+
+    var_lst->push_back(VariableTr{
+        .name = variable,
+        .dtype = dtype_from_str(loop_block["dtype"])
+    });
+    loop_block["code-block"] = parse_code_block(tokens, idx, var_lst, fn_list);
+
+    // The loop keeps the array's buffer and length from before the first iteration
+    if (loop_block.contains("array")) {
+        std::unordered_set<std::string> assigned = {};
+        collect_assigned_names(loop_block["code-block"], assigned);
+        if (assigned.count(loop_block["array"]["name"].get<std::string>())) {
+            throw std::runtime_error("[fn parse_for_loop] `" + loop_block["array"]["name"].get<std::string>() + "` can't be assigned to inside of a loop over it");
+        }
+    }
+
+    var_lst->pop_stack();
+    fn_list->pop_stack();
+    return loop_block;
+}
+
+/// ## ForLoop (parallel)
+/// ```json
+/// {
+///     "type": "ForLoop",
+///     "parallel": true,
+///     "reductions": [
+///         {"name": "...", "operator": "+", "dtype": "DataType"}
+///     ],
+///     ...                     // the rest of a `ForLoop` over a range
+/// }
+/// ```
+///
+/// `parallel for x in start..end { ... }` runs its iterations in any order,
+/// and any number of them at once. The iterations may write to different
+/// elements of an array, but not to a variable from outside of the loop,
+/// unless it is a reduction variable: one that is only ever updated like
+/// `x = x + e`, `x = x - e`, `x = x * e`, `x = x && e` or `x = x || e` (with
+/// one operator, or `+` and `-`) and not read otherwise. Every worker thread
+/// then accumulates into a copy of it, and the copies are combined with the
+/// operator (`+` for `-`) after the loop. A `parallel for` can't `return`.
+nlohmann::json parse_parallel_for(
+    std::vector<Token> const& tokens,
+    unsigned int &idx,
+    VarLst* var_lst,
+    FuncLst* fn_list
+) {
+    if (!tokens[idx].equals(TokenType::Keyword, "parallel") || !tokens[idx + 1].equals(TokenType::Keyword, "for")) {
+        throw std::runtime_error("[fn parse_parallel_for] expected `parallel for`");
+    }
+    idx++;
+
+    nlohmann::json loop_block = parse_for_loop(tokens, idx, var_lst, fn_list);
+    std::string variable = loop_block["variable"];
+    if (loop_block.contains("array")) {
+        throw std::runtime_error("[fn parse_parallel_for] `parallel for " + variable + " in ...` needs a range");
+    }
+    if (contains_return(loop_block["code-block"])) {
+        throw std::runtime_error("[fn parse_parallel_for] can't `return` from inside of a `parallel for`");
+    }
+
+    nlohmann::json reductions = nlohmann::json::array();
+    std::string error = find_reductions(loop_block, reductions);
+    if (!error.empty()) {
+        throw std::runtime_error("[fn parse_parallel_for] a `parallel for` " + error);
+    }
+
+    loop_block["parallel"] = true;
+    loop_block["reductions"] = reductions;
+    return loop_block;
+}
+
+/// The vector builtins, which are only used as such if their first argument
+/// is a vector (so functions of the same name can still be called):
+///
+/// - `store(v, a, i)` stores the lanes of `v` to `a[i]`, `a[i+1]`, ..., which
+///   all have to be in bounds. `store(v, a, i, mask)` only stores the lanes
+///   where `mask` is true and that are in bounds.
+/// - `select(mask, a, b)` takes each lane from `a` where `mask` is true and
+///   from `b` where it isn't.
+/// - `shuffle(v, i0, i1, ...)` picks lanes of `v` (and `shuffle(a, b, ...)`
+///   of `a` followed by `b`) by constant index, into a vector of as many lanes.
+/// - `reduce_add(v)`, `reduce_mul(v)`, `reduce_min(v)` and `reduce_max(v)`
+///   combine the lanes of `v`, in no particular order.
+/// - `any(mask)` and `all(mask)` tell whether any or all lanes are true.
+///
+/// Checks the arguments of `call` and sets its `"dtype"`. Returns false if
+/// `call` isn't a call to a vector builtin.
+bool check_vector_builtin(nlohmann::json &call) {
+    std::string name = call["function-name"];
+    nlohmann::json &args = call["parameters"];
+    if (args.empty() || !dtype_is_vector(dtype_from_str(args[0]["dtype"]))) {
+        return false;
+    }
+
+    BeDataType dtype = dtype_from_str(args[0]["dtype"]);
+    BeDataType element = dtype_element(dtype);
+    BeDataType mask_dtype = dtype_vector_of(BeDataType::Bool, dtype_lanes(dtype));
+    auto expect = [&](bool ok, std::string const& message) {
+        if (!ok) {
+            throw std::runtime_error("[fn check_vector_builtin] " + message);
+        }
+    };
+
+    if (name == "store") {
+        expect(args.size() == 3 || args.size() == 4, "expected `store(vector, array, index[, mask])`");
+        expect(
+            args[1]["dtype"] == dtype_to_str(dtype_array_of(element)) && element != BeDataType::Bool,
+            "`store` needs a number array of the element type of the vector"
+        );
+        expect(dtype_is_integer(dtype_from_str(args[2]["dtype"])), "the index of `store` has to be an integer");
+        args[2] = coerce_to(args[2], BeDataType::I64, "check_vector_builtin");
+        if (args.size() == 4) {
+            expect(args[3]["dtype"] == dtype_to_str(mask_dtype), "the mask of `store` has to be a " + dtype_to_str(mask_dtype));
+        }
+        call["dtype"] = "Null";
+    }
+    else if (name == "select") {
+        expect(args.size() == 3 && element == BeDataType::Bool, "expected `select(mask, a, b)`");
+        BeDataType value_dtype = dtype_from_str(args[1]["dtype"]);
+        if (!dtype_is_vector(value_dtype)) {
+            value_dtype = dtype_from_str(args[2]["dtype"]);
+        }
+        expect(dtype_is_vector(value_dtype) && dtype_lanes(value_dtype) == dtype_lanes(dtype), "`select` needs a vector with as many lanes as the mask");
+        args[1] = coerce_to(args[1], value_dtype, "check_vector_builtin");
+        args[2] = coerce_to(args[2], value_dtype, "check_vector_builtin");
+        call["dtype"] = dtype_to_str(value_dtype);
+    }
+    else if (name == "shuffle") {
+        size_t first_index = args.size() > 1 && args[1]["dtype"] == args[0]["dtype"] ? 2 : 1;
+        unsigned int num_lanes = dtype_lanes(dtype) * first_index;
+        for (size_t i = first_index; i < args.size(); i++) {
+            expect(
+                args[i]["type"] == "Literal" && dtype_is_integer(dtype_from_str(args[i]["dtype"])) &&
+                args[i]["value"].get<std::string>()[0] != '-' && std::stoull(args[i]["value"].get<std::string>()) < num_lanes,
+                "the lanes of `shuffle` have to be integer literals below " + std::to_string(num_lanes)
+            );
+        }
+        call["dtype"] = dtype_to_str(dtype_vector_of(element, args.size() - first_index));
+    }
+    else if (name == "reduce_add" || name == "reduce_mul" || name == "reduce_min" || name == "reduce_max") {
+        expect(args.size() == 1 && dtype_is_numeric(element), "`" + name + "` needs a vector of numbers");
+        call["dtype"] = dtype_to_str(element);
+    }
+    else if (name == "any" || name == "all") {
+        expect(args.size() == 1 && element == BeDataType::Bool, "`" + name + "` needs a vector of bools");
+        call["dtype"] = "Bool";
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/// ## FunctionCall
+/// ```json
+/// {
+///     "type": "FunctionCall",
+///     "function-name": "...",
+///     "parameters": ["..."],
+///     "dtype": "DataType"
+/// }
+/// ```
+nlohmann::json parse_function_call(
+    std::vector<Token> const& tokens, 
+    unsigned int &idx,
+    VarLst const* var_lst,
+    FuncLst const* fn_list
+) {
+    if (tokens[idx].token_type != TokenType::Object) {
+        throw std::runtime_error("[fn parse_function_call] error parsing, tokens do not start TokenType::Object");
+    }
+
+    nlohmann::json func;
     func["type"] = "FunctionCall";
     func["function-name"] = tokens[idx].value;
     
@@ -462,7 +1357,7 @@ nlohmann::json parse_function_call(
 
     std::vector<nlohmann::json> arguments = {};
     while (tokens[idx].token_type != TokenType::CloseParen) {
-        if (tokens[idx].token_type == TokenType::NewLine) {
+        if (tokens[idx].token_type == TokenType::NewLine || tokens[idx].token_type == TokenType::Comma) {
             idx++;
             continue;
         }
@@ -472,10 +1367,49 @@ nlohmann::json parse_function_call(
 
     idx++;
 
-    std::optional<FunctionTr> f = fn_list->get(tokens[idx].value);
+    std::optional<FunctionTr> f = fn_list->get(func["function-name"]);
+
+    if (f.has_value() && f.value().param_type.size() == arguments.size()) {
+        for (size_t i = 0; i < arguments.size(); i++) {
+            arguments[i] = coerce_to(arguments[i], f.value().param_type[i], "parse_function_call");
+        }
+    }
+    else if (func["function-name"] == "slice") {
+        for (size_t i = 1; i < arguments.size(); i++) {
+            arguments[i] = coerce_to(arguments[i], BeDataType::I64, "parse_function_call");
+        }
+    }
+    else if (func["function-name"] == "prefetch") {
+        // `prefetch(a, i[, locality])`, see `processFunctionCall`
+        if (arguments.size() < 2 || arguments.size() > 3 || !dtype_is_array(dtype_from_str(arguments[0]["dtype"]))) {
+            throw std::runtime_error("[fn parse_function_call] expected `prefetch(array, index[, locality])`");
+        }
+        arguments[1] = coerce_to(arguments[1], BeDataType::I64, "parse_function_call");
+        if (arguments.size() == 3) {
+            nlohmann::json const& locality = arguments[2];
+            if (locality["type"] != "Literal" || locality["dtype"] != "I64" || locality["value"].get<std::string>().size() != 1
+                || locality["value"].get<std::string>()[0] < '0' || locality["value"].get<std::string>()[0] > '3') {
+                throw std::runtime_error("[fn parse_function_call] the locality of `prefetch` has to be a literal from 0 (none) to 3 (keep in all caches)");
+            }
+        }
+    }
+    else if (func["function-name"] == "print" && arguments.size() == 1) {
+        // The runtime prints 64 bit numbers
+        BeDataType dtype = dtype_from_str(arguments[0]["dtype"]);
+        if (dtype_is_vector(dtype)) {
+            throw std::runtime_error("[fn parse_function_call] vectors can't be printed, only their lanes (`v[i]`)");
+        }
+        if (dtype_is_numeric(dtype) && dtype_bits(dtype) < 64) {
+            BeDataType wide = dtype_is_float(dtype) ? BeDataType::F64 : dtype_is_unsigned(dtype) ? BeDataType::U64 : BeDataType::I64;
+            arguments[0] = coerce_to(arguments[0], wide, "parse_function_call");
+        }
+    }
 
     func["parameters"] = arguments;
 
+    if (check_vector_builtin(func)) {
+        return func;
+    }
     if (f.has_value()) {
         func["dtype"] = dtype_to_str(f.value().ret_type);
     }
@@ -497,102 +1431,162 @@ nlohmann::json parse_function_call(
 /// }
 /// ```
 nlohmann::json parse_expression(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst const* var_lst,
     FuncLst const* fn_list
 ) {
     unsigned int num_paren = 0;
-    bool num_paren_on = false;
+    unsigned int num_brack = 0;
 
-    unsigned int expr_end_idx = idx;
+    unsigned int expr_end_idx = tokens.size();
 
     for (unsigned int i = idx; i < tokens.size(); i++) {
         if (
             tokens[i].token_type == TokenType::CloseCurlyBrace ||
-            tokens[i].token_type == TokenType::CloseSquareBracket ||
             tokens[i].token_type == TokenType::OpenCurlyBrace ||
             tokens[i].token_type == TokenType::SemiColon ||
-            tokens[i].token_type == TokenType::Comma || 
             tokens[i].token_type == TokenType::NewLine
         ) {
             expr_end_idx = i;
             break;
         }
+        else if (
+            (tokens[i].token_type == TokenType::Comma || tokens[i].token_type == TokenType::RangeDescriptor) &&
+            num_paren == 0 && num_brack == 0
+        ) {
+            expr_end_idx = i;
+            break;
+        }
         else if (tokens[i].token_type == TokenType::OpenParen) {
             num_paren++;
-            num_paren_on = true;
         }
         else if (tokens[i].token_type == TokenType::CloseParen) {
-            if (num_paren_on) {
-                if (num_paren == 0) {
-                    expr_end_idx = i;
-                    break;
-                }
-                else {
-                    num_paren--;
-                }
+            if (num_paren == 0) {
+                // Closes a parenthesis opened by the caller (ex. a function call)
+                expr_end_idx = i;
+                break;
             }
-            else {
+            num_paren--;
+        }
+        else if (tokens[i].token_type == TokenType::OpenSquareBracket) {
+            num_brack++;
+        }
+        else if (tokens[i].token_type == TokenType::CloseSquareBracket) {
+            if (num_brack == 0) {
+                // Closes a bracket opened by the caller (ex. the index of `a[i] = ...`)
                 expr_end_idx = i;
                 break;
             }
+            num_brack--;
         }
     }
 
     if (idx == expr_end_idx) {
         throw std::runtime_error("idx is equal expr_end_idx");
     }
-    else if (idx == expr_end_idx + 1) {
-        if (tokens[idx].token_type == TokenType::Object) {
-            return parse_variable(tokens, idx, var_lst, fn_list);
+
+    nlohmann::json expr = parse_expression_h(tokens, idx, expr_end_idx-1, var_lst, fn_list);
+    idx = expr_end_idx;
+    return expr;
+}
+
+nlohmann::json parse_expression_h(
+    std::vector<Token> const& tokens, 
+    unsigned int start, 
+    unsigned int end,
+    VarLst const* var_lst,
+    FuncLst const* fn_list
+) {
+    if (end < start) {
+        throw std::runtime_error("[fn parse_expression_h] end is less than start.");
+    }
+    else if (end == start) {
+        if (is_literal(tokens[start].token_type)) {
+            return parse_literal(tokens, start);
         }
-        else if (is_literal(tokens[idx].token_type)) {
-            return parse_literal(tokens, idx);
+        else if (tokens[start].token_type == TokenType::Object) {
+            return parse_variable(tokens, start, var_lst, fn_list);
         }
     }
 
-    
+    unsigned int op_idx = find_split_operator(tokens, start, end);
+
+    if (op_idx > end) {
+        // No operator outside of parenthesis, so this is either `( ... )` or `f( ... )`
+        if (
+            tokens[start].token_type == TokenType::OpenParen &&
+            find_matching_paren(tokens, start, end) == end
+        ) {
+            return parse_expression_h(tokens, start+1, end-1, var_lst, fn_list);
+        }
+        else if (
+            tokens[start].token_type == TokenType::Object &&
+            tokens[start+1].token_type == TokenType::OpenParen &&
+            find_matching_paren(tokens, start+1, end) == end &&
+            fn_list->get(tokens[start].value).has_value()
+        ) {
+            return parse_function_call(tokens, start, var_lst, fn_list);
+        }
+        else if (
+            tokens[start].token_type == TokenType::DataType &&
+            tokens[start+1].token_type == TokenType::OpenParen &&
+            find_matching_paren(tokens, start+1, end) == end
+        ) {
+            if (dtype_is_array(dtype_from_str(tokens[start].value))) {
+                return parse_new_array(tokens, start, end, var_lst, fn_list);
+            }
+            return parse_conversion(tokens, start, end, var_lst, fn_list);
+        }
+        else if (tokens[end].token_type == TokenType::CloseSquareBracket) {
+            return parse_index(tokens, start, end, var_lst, fn_list);
+        }
+
+        std::cout << "Num Tokens: " << (end-start) << "\n";
+        throw std::runtime_error("[fn parse_expression] No operation found. Curr token: " + tokens[start].to_string());
+    }
+
     nlohmann::json op;
     op["type"] = "Expression";
+    op["operator"] = tokens[op_idx].value;
 
-    unsigned int op_idx = 0;
-    unsigned int op_priority = 0;
+    op["left-operand"] = parse_expression_h(tokens, start, op_idx-1, var_lst, fn_list);
+    op["right-operand"] = parse_expression_h(tokens, op_idx+1, end, var_lst, fn_list);
 
-    for (unsigned int i = idx; i < expr_end_idx; i++) {
+    // Number literals take the type of the other operand, so `x / 2` stays
+    // unsigned for a `uint x` and `x * 0.5` stays single precision for an `f32 x`
+    for (auto [lit, other] : {std::pair{"left-operand", "right-operand"}, std::pair{"right-operand", "left-operand"}}) {
+        BeDataType lit_dtype = dtype_from_str(op[lit]["dtype"]);
+        BeDataType other_dtype = dtype_element(dtype_from_str(op[other]["dtype"]));
         if (
-            tokens[i].token_type != TokenType::ArithmeticOperator && 
-            tokens[i].token_type != TokenType::ComparisonOperator
+            op[lit]["type"] == "Literal" &&
+            (lit_dtype == BeDataType::I64 || lit_dtype == BeDataType::F64) &&
+            (dtype_is_float(other_dtype) || (dtype_is_integer(lit_dtype) && dtype_is_integer(other_dtype)))
         ) {
-            continue;
+            op[lit]["dtype"] = dtype_to_str(other_dtype);
         }
+    }
 
-        unsigned int curr_priority = get_op_priority(get_op(tokens[i].value));
-        if (curr_priority > op_priority) {
-            op_priority = curr_priority;
-            op_idx = i;
+    // A scalar operand of a vector operation is copied to every lane (`v * 2.0`)
+    for (auto [scalar, vector] : {std::pair{"left-operand", "right-operand"}, std::pair{"right-operand", "left-operand"}}) {
+        BeDataType vector_dtype = dtype_from_str(op[vector]["dtype"]);
+        if (dtype_is_vector(vector_dtype) && !dtype_is_vector(dtype_from_str(op[scalar]["dtype"]))) {
+            op[scalar] = coerce_to(op[scalar], vector_dtype, "parse_expression");
         }
     }
 
-    if (op_priority == 0) {
-        // No operator found in the expression
-        // Check if the expression is just a literal or variable
-        if (expr_end_idx - idx == 1) {
-            if (tokens[idx].token_type == TokenType::Object) {
-                return parse_variable(tokens, idx, var_lst, fn_list);
-            }
-            else if (is_literal(tokens[idx].token_type)) {
-                return parse_literal(tokens, idx);
-            }
+    // The operation is done in the type that both operands widen to
+    BeDataType left_dtype = dtype_from_str(op["left-operand"]["dtype"]);
+    BeDataType right_dtype = dtype_from_str(op["right-operand"]["dtype"]);
+    if (left_dtype != right_dtype && dtype_is_numeric(left_dtype) && dtype_is_numeric(right_dtype)) {
+        if (dtype_widens_to(left_dtype, right_dtype)) {
+            op["left-operand"] = make_cast(op["left-operand"], right_dtype);
+        }
+        else if (dtype_widens_to(right_dtype, left_dtype)) {
+            op["right-operand"] = make_cast(op["right-operand"], left_dtype);
         }
-        throw std::runtime_error("[fn parse_expression] No operation found. Curr token: " + tokens[idx].to_string());
     }
 
-
-    op["operator"] = tokens[op_idx].value;
-
-    op["left-operand"] = parse_expression_h(tokens, idx, op_idx-1, var_lst, fn_list);
-    op["right-operand"] = parse_expression_h(tokens, op_idx+1, expr_end_idx-1, var_lst, fn_list);
     auto dtype_res = inference_type(
         dtype_from_str(op["left-operand"]["dtype"]),
         dtype_from_str(op["right-operand"]["dtype"]),
@@ -600,71 +1594,250 @@ nlohmann::json parse_expression(
     );
     op["dtype"] = dtype_to_str(dtype_res);
 
-    idx = expr_end_idx;
     return op;
 }
 
-nlohmann::json parse_expression_h(
-    std::vector<Token> tokens, 
-    unsigned int start, 
+/// ## Index
+/// ```json
+/// {
+///     "type": "Index",
+///     "array": "...",
+///     "index": "...",
+///     "dtype": "DataType" // the element type of the array
+/// }
+/// ```
+nlohmann::json parse_index(
+    std::vector<Token> const& tokens,
+    unsigned int start,
     unsigned int end,
     VarLst const* var_lst,
     FuncLst const* fn_list
 ) {
-    if (end == start) {
-        if (is_literal(tokens[start].token_type)) {
-            return parse_literal(tokens, start);
+    // The last bracket at the top level is the one `end` closes
+    unsigned int open_idx = end + 1;
+    unsigned int depth = 0;
+    for (unsigned int i = start; i <= end; i++) {
+        if (is_open_group(tokens[i])) {
+            if (depth == 0 && tokens[i].token_type == TokenType::OpenSquareBracket) {
+                open_idx = i;
+            }
+            depth++;
         }
-        else if (tokens[start].token_type == TokenType::Object) {
-            return parse_variable(tokens, start, var_lst, fn_list);
+        else if (is_close_group(tokens[i])) {
+            depth--;
         }
-        else if (tokens[start].token_type == TokenType::Object) {
-            // Parse expression needs to be fixed
-            return parse_function_call(tokens, start, var_lst, fn_list);
+    }
+    if (open_idx <= start || open_idx > end || find_matching_paren(tokens, open_idx, end) != end || open_idx + 1 == end) {
+        throw std::runtime_error("[fn parse_index] invalid index expression at line " + std::to_string(tokens[start].line));
+    }
+
+    nlohmann::json index;
+    index["type"] = "Index";
+    index["array"] = parse_expression_h(tokens, start, open_idx-1, var_lst, fn_list);
+    index["index"] = parse_expression_h(tokens, open_idx+1, end-1, var_lst, fn_list);
+
+    BeDataType array_dtype = dtype_from_str(index["array"]["dtype"]);
+    if (!dtype_is_array(array_dtype) && !dtype_is_vector(array_dtype)) {
+        throw std::runtime_error("[fn parse_index] only arrays and vectors can be indexed, not " + dtype_to_str(array_dtype));
+    }
+    if (!dtype_is_integer(dtype_from_str(index["index"]["dtype"]))) {
+        throw std::runtime_error("[fn parse_index] an array index has to be an integer");
+    }
+    index["index"] = coerce_to(index["index"], BeDataType::I64, "parse_index");
+    if (dtype_is_vector(array_dtype) && index["index"]["type"] == "Literal") {
+        std::string lane = index["index"]["value"];
+        if (lane[0] == '-' || std::stoull(lane) >= dtype_lanes(array_dtype)) {
+            throw std::runtime_error("[fn parse_index] a " + dtype_to_str(array_dtype) + " has no lane " + lane);
         }
     }
-    else if (end < start) {
-        throw std::runtime_error("[fn parse_expression_h] end is less than start.");
+    index["dtype"] = dtype_to_str(dtype_element(array_dtype));
+    return index;
+}
+
+/// ## NewArray
+/// `T[](length)`, a new array of `length` zeros (or `false`s)
+/// ```json
+/// {
+///     "type": "NewArray",
+///     "length": "...",
+///     "dtype": "DataType"
+/// }
+/// ```
+nlohmann::json parse_new_array(
+    std::vector<Token> const& tokens,
+    unsigned int start,
+    unsigned int end,
+    VarLst const* var_lst,
+    FuncLst const* fn_list
+) {
+    BeDataType dtype = dtype_from_str(tokens[start].value);
+    if (!dtype_is_array(dtype)) {
+        throw std::runtime_error("[fn parse_new_array] `" + tokens[start].value + "(...)` is not an array type");
+    }
+    if (start + 2 == end) {
+        throw std::runtime_error("[fn parse_new_array] `" + tokens[start].value + "()` needs a length");
     }
 
-    nlohmann::json op;
-    op["type"] = "Expression";
+    nlohmann::json array;
+    array["type"] = "NewArray";
+    array["length"] = parse_expression_h(tokens, start+2, end-1, var_lst, fn_list);
+    if (!dtype_is_integer(dtype_from_str(array["length"]["dtype"]))) {
+        throw std::runtime_error("[fn parse_new_array] the length of an array has to be an integer");
+    }
+    array["length"] = coerce_to(array["length"], BeDataType::I64, "parse_new_array");
+    array["dtype"] = dtype_to_str(dtype);
+    return array;
+}
 
-    unsigned int op_idx = 0;
-    unsigned int op_priority = 0;
+/// ## Cast
+/// `T(x)`, the number `x` converted to the number type `T`
+/// ```json
+/// {
+///     "type": "Cast",
+///     "value": "...",
+///     "dtype": "DataType"
+/// }
+/// ```
+///
+/// Widening conversions (`i32` to `int`, `f32` to `float`, integers to
+/// floats) are also made explicit as a `Cast` by the parser wherever a value
+/// is used as a wider type. Narrowing ones only happen through `T(x)`:
+/// integers wrap around, floats are rounded, and floats converted to integers
+/// are truncated and saturate at the limits of `T`.
+nlohmann::json parse_conversion(
+    std::vector<Token> const& tokens,
+    unsigned int start,
+    unsigned int end,
+    VarLst const* var_lst,
+    FuncLst const* fn_list
+) {
+    BeDataType dtype = dtype_from_str(tokens[start].value);
+    if (start + 2 == end) {
+        throw std::runtime_error("[fn parse_conversion] `" + tokens[start].value + "()` needs a value to convert");
+    }
 
-    for (unsigned int i = start; i <=end; i++) {
-        if (
-            tokens[i].token_type != TokenType::ArithmeticOperator && 
-            tokens[i].token_type != TokenType::ComparisonOperator
-        ) {
-            continue;
+    // The arguments are split at the commas outside of any brackets
+    std::vector<nlohmann::json> args = {};
+    unsigned int arg_start = start + 2;
+    unsigned int depth = 0;
+    for (unsigned int i = start + 2; i < end; i++) {
+        if (is_open_group(tokens[i])) {
+            depth++;
         }
-
-        unsigned int curr_priority = get_op_priority(get_op(tokens[i].value));
-        if (curr_priority > op_priority) {
-            op_priority = curr_priority;
-            op_idx = i;
+        else if (is_close_group(tokens[i])) {
+            depth--;
+        }
+        else if (tokens[i].token_type == TokenType::Comma && depth == 0) {
+            args.push_back(parse_expression_h(tokens, arg_start, i-1, var_lst, fn_list));
+            arg_start = i + 1;
         }
     }
+    args.push_back(parse_expression_h(tokens, arg_start, end-1, var_lst, fn_list));
 
-    if (op_priority == 0) {
-        std::cout << "Num Tokens: " << (end-start) << "\n";
-        throw std::runtime_error("[fn parse_expression] No operation found. Curr token: " + tokens[start].to_string());
+    if (dtype_is_vector(dtype)) {
+        return parse_vector(dtype, args);
+    }
+    if (args.size() != 1) {
+        throw std::runtime_error("[fn parse_conversion] `" + tokens[start].value + "(...)` converts a single value");
     }
 
-    op["operator"] = tokens[op_idx].value;
+    nlohmann::json value = args[0];
+    BeDataType value_dtype = dtype_from_str(value["dtype"]);
+    if (value_dtype == dtype) {
+        return value;
+    }
+    if (!dtype_is_numeric(dtype) || !dtype_is_numeric(value_dtype)) {
+        throw std::runtime_error("[fn parse_conversion] can't convert " + dtype_to_str(value_dtype) + " to " + dtype_to_str(dtype));
+    }
 
-    op["left-operand"] = parse_expression_h(tokens, start, op_idx-1, var_lst, fn_list);
-    op["right-operand"] = parse_expression_h(tokens, op_idx+1, end, var_lst, fn_list);
-    auto dtype_res = inference_type(
-        dtype_from_str(op["left-operand"]["dtype"]),
-        dtype_from_str(op["right-operand"]["dtype"]),
-        tokens[op_idx].value
-    );
-    op["dtype"] = dtype_to_str(dtype_res);
+    if (value["type"] == "Literal" && dtype_is_integer(value_dtype) && literal_fits(value["value"], dtype)) {
+        value["dtype"] = dtype_to_str(dtype);
+        return value;
+    }
+    return make_cast(value, dtype);
+}
 
-    return op;
+/// ## Vector
+/// `T(a, b, ...)` with a value for every lane of the vector type `T`
+/// ```json
+/// {
+///     "type": "Vector",
+///     "elements": ["..."],
+///     "dtype": "DataType" // e.g. "F32x4"
+/// }
+/// ```
+///
+/// ## VectorLoad
+/// `T(a, i)` loads the lanes of `T` from `a[i]`, `a[i+1]`, ... of an array,
+/// which all have to be in bounds. `T(a, i, mask)` only loads the lanes
+/// where `mask` is true and that are in bounds, the others are zero.
+/// ```json
+/// {
+///     "type": "VectorLoad",
+///     "array": "...",
+///     "index": "...",
+///     "mask": "...", // optional
+///     "dtype": "DataType"
+/// }
+/// ```
+///
+/// `T(x)` with a single scalar copies it to every lane and `T(v)` converts
+/// every lane of a vector with as many lanes, both are a `Cast`.
+nlohmann::json parse_vector(BeDataType dtype, std::vector<nlohmann::json> const& args) {
+    BeDataType element = dtype_element(dtype);
+    unsigned int lanes = dtype_lanes(dtype);
+    BeDataType first_dtype = dtype_from_str(args[0]["dtype"]);
+
+    if (dtype_is_array(first_dtype)) {
+        if (dtype_element(first_dtype) != element || element == BeDataType::Bool) {
+            throw std::runtime_error("[fn parse_vector] " + dtype_to_str(dtype) + " can only be loaded from a number array of its element type");
+        }
+        if (args.size() != 2 && args.size() != 3) {
+            throw std::runtime_error("[fn parse_vector] a vector is loaded with `T(array, index)` or `T(array, index, mask)`");
+        }
+
+        nlohmann::json load;
+        load["type"] = "VectorLoad";
+        load["array"] = args[0];
+        if (!dtype_is_integer(dtype_from_str(args[1]["dtype"]))) {
+            throw std::runtime_error("[fn parse_vector] an array index has to be an integer");
+        }
+        load["index"] = coerce_to(args[1], BeDataType::I64, "parse_vector");
+        if (args.size() == 3) {
+            if (args[2]["dtype"] != dtype_to_str(dtype_vector_of(BeDataType::Bool, lanes))) {
+                throw std::runtime_error("[fn parse_vector] the mask of a " + dtype_to_str(dtype) + " load has to be a boolx" + std::to_string(lanes));
+            }
+            load["mask"] = args[2];
+        }
+        load["dtype"] = dtype_to_str(dtype);
+        return load;
+    }
+
+    if (args.size() == 1) {
+        if (dtype_is_vector(first_dtype)) {
+            if (dtype_lanes(first_dtype) != lanes || !dtype_is_numeric(element) || !dtype_is_numeric(dtype_element(first_dtype))) {
+                throw std::runtime_error("[fn parse_vector] can't convert " + dtype_to_str(first_dtype) + " to " + dtype_to_str(dtype));
+            }
+            return first_dtype == dtype ? args[0] : make_cast(args[0], dtype);
+        }
+        return coerce_to(args[0], dtype, "parse_vector");
+    }
+
+    if (args.size() != lanes) {
+        throw std::runtime_error(
+            "[fn parse_vector] " + dtype_to_str(dtype) + " needs one value or " + std::to_string(lanes) +
+            ", not " + std::to_string(args.size())
+        );
+    }
+
+    nlohmann::json vector;
+    vector["type"] = "Vector";
+    vector["elements"] = nlohmann::json::array();
+    for (auto const& arg : args) {
+        vector["elements"].push_back(coerce_to(arg, element, "parse_vector"));
+    }
+    vector["dtype"] = dtype_to_str(dtype);
+    return vector;
 }
 
 /// ## DeclarationStatement
@@ -672,11 +1845,12 @@ nlohmann::json parse_expression_h(
 /// {
 ///     "type": "DeclarationStatement",
 ///     "dst": "some variable",
-///     "src": "..."
+///     "src": "...",
+///     "mutable": false // Set by `mark_mutable_bindings` once the function is parsed
 /// }
 /// ```
 nlohmann::json parse_declaration(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst const* var_lst,
     FuncLst const* fn_list
@@ -722,6 +1896,7 @@ nlohmann::json parse_declaration(
         if (!dtypes_check_valid(dtype, expr_dtype)) {
             throw std::runtime_error("error constructing declaration statement: mismatched types.");
         }
+        expr = coerce_to(expr, dtype, "parse_declaration");
     }
 
     nlohmann::json decl_statement;
@@ -742,7 +1917,7 @@ nlohmann::json parse_declaration(
 /// }
 /// ```
 nlohmann::json parse_assignment(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst const* var_lst,
     FuncLst const* fn_list
@@ -751,6 +1926,10 @@ nlohmann::json parse_assignment(
         throw std::runtime_error("[fn parse_assignment] tokens does not start with object");
     }
 
+    if (tokens[idx+1].token_type == TokenType::OpenSquareBracket) {
+        return parse_element_assignment(tokens, idx, var_lst, fn_list);
+    }
+
     nlohmann::json assignment_s;
     assignment_s["type"] = "AssignmentStatement";
     assignment_s["dst"] = tokens[idx].value;
@@ -761,6 +1940,56 @@ nlohmann::json parse_assignment(
     idx += 2;
     assignment_s["src"] = parse_expression(tokens, idx, var_lst, fn_list);
 
+    std::optional<VariableTr> v = var_lst->get(assignment_s["dst"]);
+    if (v.has_value()) {
+        assignment_s["src"] = coerce_to(assignment_s["src"], v.value().dtype, "parse_assignment");
+    }
+    return assignment_s;
+}
+
+/// ## ElementAssignmentStatement
+/// `a[i] = ...`
+/// ```json
+/// {
+///     "type": "ElementAssignmentStatement",
+///     "dst": "some array variable",
+///     "index": "...",
+///     "src": "..."
+/// }
+/// ```
+nlohmann::json parse_element_assignment(
+    std::vector<Token> const& tokens, 
+    unsigned int &idx,
+    VarLst const* var_lst,
+    FuncLst const* fn_list
+) {
+    std::optional<VariableTr> v = var_lst->get(tokens[idx].value);
+    if (!v.has_value() || !dtype_is_array(v.value().dtype)) {
+        throw std::runtime_error("[fn parse_element_assignment] `" + tokens[idx].value + "` is not an array");
+    }
+
+    nlohmann::json assignment_s;
+    assignment_s["type"] = "ElementAssignmentStatement";
+    assignment_s["dst"] = tokens[idx].value;
+
+    idx += 2;
+    assignment_s["index"] = parse_expression(tokens, idx, var_lst, fn_list);
+    if (!tokens[idx].equals(TokenType::CloseSquareBracket)) {
+        throw std::runtime_error("[fn parse_element_assignment] expected `]` after the index");
+    }
+    if (!dtype_is_integer(dtype_from_str(assignment_s["index"]["dtype"]))) {
+        throw std::runtime_error("[fn parse_element_assignment] an array index has to be an integer");
+    }
+    assignment_s["index"] = coerce_to(assignment_s["index"], BeDataType::I64, "parse_element_assignment");
+    idx++;
+
+    if (!tokens[idx].equals(TokenType::AssignmentOperator, "=")) {
+        throw std::runtime_error("[fn parse_element_assignment] no assignment operator after `]`");
+    }
+    idx++;
+    assignment_s["src"] = parse_expression(tokens, idx, var_lst, fn_list);
+    assignment_s["src"] = coerce_to(assignment_s["src"], dtype_element(v.value().dtype), "parse_element_assignment");
+
     return assignment_s;
 }
 
@@ -773,7 +2002,7 @@ nlohmann::json parse_assignment(
 /// }
 /// ```
 nlohmann::json parse_return(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst const* var_lst,
     FuncLst const* fn_list
@@ -801,7 +2030,7 @@ nlohmann::json parse_return(
 ///     "dtype": "DataType"
 /// }
 /// ```
-nlohmann::json parse_literal(std::vector<Token> tokens, unsigned int &idx) {
+nlohmann::json parse_literal(std::vector<Token> const& tokens, unsigned int &idx) {
     BeDataType dtype = BeDataType::Null;
     if (tokens[idx].token_type == TokenType::IntegerLiteral) {
         dtype = BeDataType::I64;
@@ -836,7 +2065,7 @@ nlohmann::json parse_literal(std::vector<Token> tokens, unsigned int &idx) {
 /// }
 /// ```
 nlohmann::json parse_variable(
-    std::vector<Token> tokens, 
+    std::vector<Token> const& tokens, 
     unsigned int &idx,
     VarLst const* var_lst,
     FuncLst const* fn_list
@@ -860,81 +2089,38 @@ nlohmann::json parse_variable(
 }
 
 
+/// The type of `left <op> right`. Numbers of different types have a type
+/// in common if one of them widens to the other (`dtype_widens_to`).
 BeDataType inference_type(BeDataType left, BeDataType right, std::string op) {
-    if (op == "+") {
-        if (left == BeDataType::I64 && right == BeDataType::I64) {
-            return BeDataType::I64;
-        }
-        else if (left == BeDataType::I64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::I64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::String && right == BeDataType::String) {
-            return BeDataType::String;
-        }
-        else {
-            throw std::runtime_error("[fn inference_type] invalid operations");
-        }
-    }
-    else if (op == "-") {
-        if (left == BeDataType::I64 && right == BeDataType::I64) {
-            return BeDataType::I64;
-        }
-        else if (left == BeDataType::I64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::I64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else {
-            throw std::runtime_error("[fn inference_type] invalid operations");
-        }
+    if (dtype_is_array(left) || dtype_is_array(right)) {
+        throw std::runtime_error("[fn inference_type] arrays can't be used with `" + op + "`");
     }
-    else if (op == "*") {
-        if (left == BeDataType::I64 && right == BeDataType::I64) {
-            return BeDataType::I64;
-        }
-        else if (left == BeDataType::I64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::I64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else {
-            throw std::runtime_error("[fn inference_type] invalid operations");
+
+    // Vector operations work lane by lane, `&&` and `||` included
+    if (dtype_is_vector(left) || dtype_is_vector(right)) {
+        if (left != right) {
+            throw std::runtime_error("[fn inference_type] the operands of a vector `" + op + "` have to be the same type");
         }
+        return dtype_vector_of(inference_type(dtype_element(left), dtype_element(right), op), dtype_lanes(left));
     }
-    else if (op == "/") {
-        if (left == BeDataType::I64 && right == BeDataType::I64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::I64 && right == BeDataType::F64) {
-            return BeDataType::F64;
-        }
-        else if (left == BeDataType::F64 && right == BeDataType::I64) {
-            return BeDataType::F64;
+
+    bool numeric = dtype_is_numeric(left) && dtype_is_numeric(right);
+    bool have_common = numeric && (dtype_widens_to(left, right) || dtype_widens_to(right, left));
+
+    if (op == "+" || op == "-" || op == "*" || op == "/") {
+        if (have_common) {
+            return dtype_common(left, right);
         }
-        else if (left == BeDataType::F64 && right == BeDataType::F64) {
-            return BeDataType::F64;
+        else if (op == "+" && left == BeDataType::String && right == BeDataType::String) {
+            return BeDataType::String;
         }
         else {
             throw std::runtime_error("[fn inference_type] invalid operations");
         }
     }
     else if (op == "%") {
-        if (left == BeDataType::I64 && right == BeDataType::I64) {
-            return BeDataType::I64;
+        if (dtype_is_integer(left) && left == right) {
+            return left;
         }
         else {
             throw std::runtime_error("[fn inference_type] invalid operations");
@@ -948,17 +2134,17 @@ BeDataType inference_type(BeDataType left, BeDataType right, std::string op) {
         op == "==" ||
         op == "!=" 
     ) {
-        if (left == right) {
-            return BeDataType::Bool;
-        }
-        else if (left == BeDataType::I64 && right == BeDataType::F64) {
+        if (left == right || have_common) {
             return BeDataType::Bool;
         }
-        else if (left == BeDataType::F64 && right == BeDataType::I64) {
+        throw std::runtime_error("[fn inference_type] invalid comparison");
+    }
+    else if (op == "&&" || op == "||") {
+        if (left == BeDataType::Bool && right == BeDataType::Bool) {
             return BeDataType::Bool;
         }
-        throw std::runtime_error("[fn inference_type] invalid comparison");
+        throw std::runtime_error("[fn inference_type] logical operators require Bool operands");
     }
 
     throw std::runtime_error("[fn inference_type] invalid operations");
-}
\ No newline at end of file
+}
@@ -7,23 +7,40 @@
 #include "scope_tr.h"
 
 #include <string>
+#include <unordered_set>
 #include <vector>
 
-nlohmann::json parse_module(std::vector<Token> tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
-nlohmann::json parse_code_block(std::vector<Token> tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
-nlohmann::json parse_if_block(std::vector<Token> tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
-nlohmann::json parse_loop(std::vector<Token> tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
-nlohmann::json parse_function(std::vector<Token> tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
-nlohmann::json parse_expression(std::vector<Token> tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
-nlohmann::json parse_expression_h(std::vector<Token> tokens, unsigned int start, unsigned int end, VarLst const* var_lst, FuncLst const* fn_list);
-nlohmann::json parse_function_call(std::vector<Token> tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
-nlohmann::json parse_literal(std::vector<Token> tokens, unsigned int &idx);
-nlohmann::json parse_variable(std::vector<Token> tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
-nlohmann::json parse_declaration(std::vector<Token> tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
-nlohmann::json parse_assignment(std::vector<Token> tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
-nlohmann::json parse_return(std::vector<Token> tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
-
-void consume_whitespace(std::vector<Token> tokens, unsigned int &idx);
+nlohmann::json parse_module(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_code_block(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_if_block(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_loop(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_for_loop(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_parallel_for(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_function(std::vector<Token> const& tokens, unsigned int &idx, VarLst* var_lst, FuncLst* fn_list);
+nlohmann::json parse_attributes(std::vector<Token> const& tokens, unsigned int &idx);
+unsigned int skip_attributes(std::vector<Token> const& tokens, unsigned int idx);
+void check_loop_attributes(nlohmann::json const& attributes);
+nlohmann::json parse_expression(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_expression_h(std::vector<Token> const& tokens, unsigned int start, unsigned int end, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_function_call(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_literal(std::vector<Token> const& tokens, unsigned int &idx);
+nlohmann::json parse_variable(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_index(std::vector<Token> const& tokens, unsigned int start, unsigned int end, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_new_array(std::vector<Token> const& tokens, unsigned int start, unsigned int end, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_conversion(std::vector<Token> const& tokens, unsigned int start, unsigned int end, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_vector(BeDataType dtype, std::vector<nlohmann::json> const& args);
+nlohmann::json parse_declaration(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_assignment(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_element_assignment(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+nlohmann::json parse_return(std::vector<Token> const& tokens, unsigned int &idx, VarLst const* var_lst, FuncLst const* fn_list);
+
+void consume_whitespace(std::vector<Token> const& tokens, unsigned int &idx);
+void mark_mutable_bindings(nlohmann::json &func);
+
+void collect_declared_names(nlohmann::json const& node, std::unordered_set<std::string> &names);
+size_t count_reads(nlohmann::json const& node, std::string const& name);
+bool contains_return(nlohmann::json const& node);
+std::string find_reductions(nlohmann::json const& loop, nlohmann::json &reductions);
 
 enum OperationType {
     Add,
@@ -37,6 +54,8 @@ enum OperationType {
     LessThanEq,
     Eq,
     NotEq,
+    And,
+    Or,
 };
 
 TokenType get_op_type(OperationType op);
@@ -0,0 +1,410 @@
+#include "range_analysis.h"
+#include "dtype_utils.h"
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using Names = std::set<std::string>;
+using NamePairs = std::set<std::pair<std::string, std::string>>;
+
+/// What is known to hold at some point of a function
+struct Facts {
+    /// `(i, a)` for every `i < len(a)`
+    NamePairs in_bounds;
+
+    /// `(a, n)` for every `len(a) == n`, from `a = T[](n)`
+    NamePairs lengths;
+};
+
+struct RangeAnalysis {
+    /// Variables that are never negative
+    Names nonnegative;
+};
+
+/// Every declaration and assignment in `code_block`, as `(name, value)`
+void collect_assignments(
+    const nlohmann::json &code_block,
+    std::vector<std::pair<std::string, const nlohmann::json*>> &assignments,
+    Names &declared
+) {
+    for (auto const& stmt : code_block["statements"]) {
+        std::string type = stmt["type"];
+
+        if (type == "DeclarationStatement" || type == "AssignmentStatement") {
+            assignments.emplace_back(stmt["dst"], &stmt["src"]);
+            if (type == "DeclarationStatement") {
+                declared.insert(stmt["dst"].get<std::string>());
+            }
+        }
+        else if (type == "IfBlock") {
+            for (auto const& branch : stmt["statements"]) {
+                collect_assignments(branch["code-block"], assignments, declared);
+            }
+            if (stmt.contains("default")) {
+                collect_assignments(stmt["default"], assignments, declared);
+            }
+        }
+        else if (type == "Loop") {
+            collect_assignments(stmt["code-block"], assignments, declared);
+        }
+        else if (type == "ForLoop") {
+            // A range never goes below its start. Elements can be anything.
+            assignments.emplace_back(stmt["variable"], stmt.contains("start") ? &stmt["start"] : &stmt["array"]);
+            declared.insert(stmt["variable"].get<std::string>());
+            collect_assignments(stmt["code-block"], assignments, declared);
+        }
+    }
+}
+
+/// `expr` without the `Cast`s that widen an integer to a wider integer, which
+/// keep its value
+const nlohmann::json& strip_widening(const nlohmann::json &expr) {
+    if (expr["type"] != "Cast") {
+        return expr;
+    }
+    BeDataType from = dtype_from_str(expr["value"]["dtype"]);
+    BeDataType to = dtype_from_str(expr["dtype"]);
+    if (!dtype_is_integer(from) || !dtype_is_integer(to) || !dtype_widens_to(from, to)) {
+        return expr;
+    }
+    return strip_widening(expr["value"]);
+}
+
+bool is_nonnegative(const nlohmann::json &expr, Names const& nonnegative) {
+    BeDataType dtype = dtype_from_str(expr.value("dtype", "Null"));
+    if (dtype_is_unsigned(dtype)) {
+        return true;
+    }
+    if (!dtype_is_integer(dtype)) {
+        return false;
+    }
+
+    std::string type = expr["type"];
+    if (type == "Literal") {
+        return expr["value"].get<std::string>().rfind("-", 0) != 0;
+    }
+    else if (type == "Variable") {
+        return nonnegative.count(expr["name"].get<std::string>()) > 0;
+    }
+    else if (type == "FunctionCall") {
+        return expr["function-name"] == "len";
+    }
+    else if (type == "Cast") {
+        const nlohmann::json &value = strip_widening(expr);
+        return &value != &expr && is_nonnegative(value, nonnegative);
+    }
+    else if (type == "Expression") {
+        std::string op = expr["operator"];
+
+        // The remainder takes the sign of the dividend
+        if (op == "%") {
+            return is_nonnegative(expr["left-operand"], nonnegative);
+        }
+        if (op == "+" || op == "*" || op == "/") {
+            return is_nonnegative(expr["left-operand"], nonnegative) && is_nonnegative(expr["right-operand"], nonnegative);
+        }
+    }
+    return false;
+}
+
+/// The variables of a function that are never negative: the largest set of
+/// names whose values are all non-negative given that the names in the set are
+void find_nonnegative_variables(const nlohmann::json &func, RangeAnalysis &analysis) {
+    std::vector<std::pair<std::string, const nlohmann::json*>> assignments;
+    Names declared;
+    collect_assignments(func["code-block"], assignments, declared);
+
+    analysis.nonnegative = declared;
+    for (auto const& param : func["parameters"]) {
+        if (!dtype_is_unsigned(dtype_from_str(param["dtype"]))) {
+            analysis.nonnegative.erase(param["name"].get<std::string>());
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto const& [name, value] : assignments) {
+            if (analysis.nonnegative.count(name) && !is_nonnegative(*value, analysis.nonnegative)) {
+                analysis.nonnegative.erase(name);
+                changed = true;
+            }
+        }
+    }
+}
+
+/// Adds what holds whenever `cond` is true
+void collect_facts(const nlohmann::json &cond, RangeAnalysis const& analysis, Facts &facts) {
+    // Branch hints don't change the condition
+    if (cond["type"] == "FunctionCall" && (cond["function-name"] == "likely" || cond["function-name"] == "unlikely")
+        && cond["parameters"].size() == 1) {
+        collect_facts(cond["parameters"][0], analysis, facts);
+        return;
+    }
+    if (cond["type"] != "Expression") {
+        return;
+    }
+
+    std::string op = cond["operator"];
+    if (op == "&&") {
+        collect_facts(cond["left-operand"], analysis, facts);
+        collect_facts(cond["right-operand"], analysis, facts);
+        return;
+    }
+
+    const nlohmann::json* index = nullptr;
+    const nlohmann::json* length = nullptr;
+    if (op == "<") {
+        index = &strip_widening(cond["left-operand"]);
+        length = &strip_widening(cond["right-operand"]);
+    } else if (op == ">") {
+        index = &strip_widening(cond["right-operand"]);
+        length = &strip_widening(cond["left-operand"]);
+    } else {
+        return;
+    }
+
+    if ((*index)["type"] != "Variable" || !is_nonnegative(*index, analysis.nonnegative)) {
+        return;
+    }
+    std::string index_name = (*index)["name"];
+
+    // `i < n` where `n` is the length some arrays were made with
+    if ((*length)["type"] == "Variable") {
+        NamePairs in_bounds;
+        for (auto const& [array, length_name] : facts.lengths) {
+            if (length_name == (*length)["name"]) {
+                in_bounds.emplace(index_name, array);
+            }
+        }
+        facts.in_bounds.insert(in_bounds.begin(), in_bounds.end());
+        return;
+    }
+
+    if ((*length)["type"] != "FunctionCall" || (*length)["function-name"] != "len" || (*length)["parameters"].size() != 1) {
+        return;
+    }
+    const nlohmann::json &array = (*length)["parameters"][0];
+    if (array["type"] != "Variable" || !dtype_is_array(dtype_from_str(array["dtype"]))) {
+        return;
+    }
+    facts.in_bounds.emplace(index_name, array["name"]);
+}
+
+bool is_known_in_bounds(const nlohmann::json &index, const std::string& array, Facts const& facts) {
+    const nlohmann::json &value = strip_widening(index);
+    return value["type"] == "Variable" && facts.in_bounds.count({ value["name"].get<std::string>(), array });
+}
+
+void mark_indexes(nlohmann::json &expr, Facts const& facts, RangeAnalysis const& analysis) {
+    std::string type = expr["type"];
+
+    if (type == "Index") {
+        mark_indexes(expr["array"], facts, analysis);
+        mark_indexes(expr["index"], facts, analysis);
+        if (expr["array"]["type"] == "Variable" && is_known_in_bounds(expr["index"], expr["array"]["name"], facts)) {
+            expr["in-bounds"] = true;
+        }
+    }
+    else if (type == "Expression") {
+        mark_indexes(expr["left-operand"], facts, analysis);
+
+        // The right hand side of `&&` is only evaluated if the left hand side holds
+        if (expr["operator"] == "&&") {
+            Facts right_facts = facts;
+            collect_facts(expr["left-operand"], analysis, right_facts);
+            mark_indexes(expr["right-operand"], right_facts, analysis);
+        } else {
+            mark_indexes(expr["right-operand"], facts, analysis);
+        }
+    }
+    else if (type == "FunctionCall") {
+        for (auto& param : expr["parameters"]) {
+            mark_indexes(param, facts, analysis);
+        }
+    }
+    else if (type == "NewArray") {
+        mark_indexes(expr["length"], facts, analysis);
+    }
+    else if (type == "Cast") {
+        mark_indexes(expr["value"], facts, analysis);
+    }
+    else if (type == "Vector") {
+        for (auto& element : expr["elements"]) {
+            mark_indexes(element, facts, analysis);
+        }
+    }
+    else if (type == "VectorLoad") {
+        mark_indexes(expr["array"], facts, analysis);
+        mark_indexes(expr["index"], facts, analysis);
+        if (expr.contains("mask")) {
+            mark_indexes(expr["mask"], facts, analysis);
+        }
+    }
+}
+
+/// Every variable that `stmt` (or a statement nested in it) assigns or declares
+void collect_assigned(const nlohmann::json &stmt, Names &assigned) {
+    std::string type = stmt["type"];
+
+    if (type == "DeclarationStatement" || type == "AssignmentStatement") {
+        assigned.insert(stmt["dst"].get<std::string>());
+    }
+    else if (type == "IfBlock") {
+        for (auto const& branch : stmt["statements"]) {
+            for (auto const& inner : branch["code-block"]["statements"]) {
+                collect_assigned(inner, assigned);
+            }
+        }
+        if (stmt.contains("default")) {
+            for (auto const& inner : stmt["default"]["statements"]) {
+                collect_assigned(inner, assigned);
+            }
+        }
+    }
+    else if (type == "Loop" || type == "ForLoop") {
+        if (type == "ForLoop") {
+            assigned.insert(stmt["variable"].get<std::string>());
+        }
+        for (auto const& inner : stmt["code-block"]["statements"]) {
+            collect_assigned(inner, assigned);
+        }
+    }
+}
+
+NamePairs without(NamePairs const& pairs, Names const& assigned) {
+    NamePairs result;
+    for (auto const& pair : pairs) {
+        if (!assigned.count(pair.first) && !assigned.count(pair.second)) {
+            result.insert(pair);
+        }
+    }
+    return result;
+}
+
+Facts without(Facts const& facts, Names const& assigned) {
+    return Facts{ without(facts.in_bounds, assigned), without(facts.lengths, assigned) };
+}
+
+void annotate_block(nlohmann::json &code_block, Facts const& facts, RangeAnalysis const& analysis);
+
+/// Marks the indexes in `stmt` given what holds before it runs
+void annotate_statement(nlohmann::json &stmt, Facts const& facts, RangeAnalysis const& analysis) {
+    std::string type = stmt["type"];
+
+    if (type == "DeclarationStatement" || type == "AssignmentStatement") {
+        mark_indexes(stmt["src"], facts, analysis);
+    }
+    else if (type == "ElementAssignmentStatement") {
+        mark_indexes(stmt["index"], facts, analysis);
+        mark_indexes(stmt["src"], facts, analysis);
+        if (is_known_in_bounds(stmt["index"], stmt["dst"], facts)) {
+            stmt["in-bounds"] = true;
+        }
+    }
+    else if (type == "FunctionCall") {
+        mark_indexes(stmt, facts, analysis);
+    }
+    else if (type == "ReturnStatement") {
+        if (stmt.contains("value")) {
+            mark_indexes(stmt["value"], facts, analysis);
+        }
+    }
+    else if (type == "IfBlock") {
+        for (auto& branch : stmt["statements"]) {
+            mark_indexes(branch["condition"], facts, analysis);
+            Facts branch_facts = facts;
+            collect_facts(branch["condition"], analysis, branch_facts);
+            annotate_block(branch["code-block"], branch_facts, analysis);
+        }
+        if (stmt.contains("default")) {
+            annotate_block(stmt["default"], facts, analysis);
+        }
+    }
+    else if (type == "Loop") {
+        // Only what no iteration changes holds every time the condition is checked
+        Names assigned;
+        collect_assigned(stmt, assigned);
+        Facts header_facts = without(facts, assigned);
+
+        mark_indexes(stmt["condition"], header_facts, analysis);
+        Facts body_facts = header_facts;
+        collect_facts(stmt["condition"], analysis, body_facts);
+        annotate_block(stmt["code-block"], body_facts, analysis);
+    }
+    else if (type == "ForLoop") {
+        // The bounds are evaluated once, before the loop
+        for (auto key : {"start", "end", "array"}) {
+            if (stmt.contains(key)) {
+                mark_indexes(stmt[key], facts, analysis);
+            }
+        }
+
+        Names assigned;
+        collect_assigned(stmt, assigned);
+        Facts body_facts = without(facts, assigned);
+
+        // `for i in start..end` is `i < end` at the start of every iteration,
+        // as long as neither the body nor the loop assigns `i` or what `end` names
+        if (stmt.contains("start") && !stmt.value("inclusive", false)) {
+            nlohmann::json cond = {
+                {"type", "Expression"},
+                {"operator", "<"},
+                {"left-operand", {{"type", "Variable"}, {"name", stmt["variable"]}, {"dtype", stmt["dtype"]}}},
+                {"right-operand", stmt["end"]},
+            };
+            Facts range_facts = body_facts;
+            collect_facts(cond, analysis, range_facts);
+
+            Names body_assigned;
+            for (auto const& inner : stmt["code-block"]["statements"]) {
+                collect_assigned(inner, body_assigned);
+            }
+            body_facts.in_bounds = without(range_facts.in_bounds, body_assigned);
+        }
+        annotate_block(stmt["code-block"], body_facts, analysis);
+    }
+}
+
+void annotate_block(nlohmann::json &code_block, Facts const& facts, RangeAnalysis const& analysis) {
+    Facts live = facts;
+    for (auto& stmt : code_block["statements"]) {
+        annotate_statement(stmt, live, analysis);
+
+        Names assigned;
+        collect_assigned(stmt, assigned);
+        live = without(live, assigned);
+
+        // `a = T[](n)`
+        std::string type = stmt["type"];
+        if (type == "DeclarationStatement" || type == "AssignmentStatement") {
+            const nlohmann::json &src = stmt["src"];
+            if (src["type"] == "NewArray") {
+                const nlohmann::json &length = strip_widening(src["length"]);
+                if (length["type"] == "Variable" && length["name"] != stmt["dst"]) {
+                    live.lengths.emplace(stmt["dst"], length["name"]);
+                }
+            }
+        }
+    }
+}
+
+void annotate_function_bounds(nlohmann::json &func) {
+    RangeAnalysis analysis;
+    find_nonnegative_variables(func, analysis);
+    annotate_block(func["code-block"], {}, analysis);
+}
+
+void annotate_bounds_checks(nlohmann::json &module) {
+    if (module["type"] == "Function") {
+        annotate_function_bounds(module);
+        return;
+    }
+    for (auto& stmt : module["statements"]) {
+        if (stmt["type"] == "Function") {
+            annotate_function_bounds(stmt);
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef RANGE_ANALYSIS_H
+#define RANGE_ANALYSIS_H
+
+#include "json.hpp"
+
+/// Bounds-check elimination: marks every `a[i]` (an Index, or the element an
+/// ElementAssignmentStatement writes) whose index is known to be in bounds
+/// with `"in-bounds": true`, so code gen leaves out its check.
+///
+/// `a[i]` is known to be in bounds where `i < len(a)` (or `len(a) > i`, or
+/// `i < n` after `a = T[](n)`) holds and `i` can't be negative:
+///
+/// - the condition is the one of a loop or if branch around the statement (or
+///   one of the operands of a `&&` chain that is), the range of a
+///   `for i in start..end` around it, or the left hand side of a `&&` whose
+///   right hand side contains the index
+/// - neither `i` nor `a` (nor `n`) has been assigned (or redeclared) since the
+///   condition was evaluated, which a later iteration of a loop counts as too
+/// - every value ever assigned to a variable named `i` in the function is
+///   non-negative: literals, lengths, unsigned values, and sums, products and
+///   quotients of non-negative values (signed overflow is undefined). Integer
+///   parameters are only non-negative if they are `uint`.
+///
+/// Like `mark_mutable_bindings`, variables are told apart by name only.
+void annotate_bounds_checks(nlohmann::json &module);
+
+#endif
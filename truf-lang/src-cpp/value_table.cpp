@@ -0,0 +1,45 @@
+#include "value_table.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+ValueTable::ValueTable() {
+    scopes.push_back({});
+}
+
+SymbolId ValueTable::intern(const std::string& name) {
+    auto it = symbol_ids.find(name);
+    if (it != symbol_ids.end()) {
+        return it->second;
+    }
+
+    SymbolId id = bindings.size();
+    symbol_ids.emplace(name, id);
+    bindings.push_back(std::nullopt);
+    return id;
+}
+
+void ValueTable::push_scope() {
+    scopes.push_back({});
+}
+
+void ValueTable::pop_scope() {
+    auto& shadowed = scopes.back();
+    for (auto it = shadowed.rbegin(); it != shadowed.rend(); it++) {
+        bindings[it->first] = it->second;
+    }
+    scopes.pop_back();
+}
+
+void ValueTable::bind(SymbolId id, ValueBinding binding) {
+    scopes.back().push_back({id, bindings[id]});
+    bindings[id] = binding;
+}
+
+std::optional<ValueBinding> ValueTable::get(SymbolId id) const {
+    if (id >= bindings.size()) {
+        return std::nullopt;
+    }
+    return bindings[id];
+}
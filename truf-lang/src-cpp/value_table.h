@@ -0,0 +1,52 @@
+#ifndef VALUE_TABLE_H
+#define VALUE_TABLE_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <llvm/IR/Value.h>
+
+typedef uint32_t SymbolId;
+
+struct ValueBinding {
+    /// The `alloca` holding a mutable variable, or the SSA value of an immutable one
+    llvm::Value* value;
+    bool is_mutable;
+};
+
+/// Symbol table used by code gen. Names are interned to dense ids once, before
+/// code gen starts (see `internSymbols`), and kept on the AST, so a lookup is
+/// a vector index instead of hashing the name per tree node.
+///
+/// Scopes are pushed and popped with code blocks. Popping a scope restores
+/// whatever its bindings shadowed, so nothing declared in a block (or a
+/// function) is visible after it ends.
+struct ValueTable {
+    ValueTable();
+
+    SymbolId intern(const std::string& name);
+
+    void push_scope();
+
+    void pop_scope();
+
+    /// Binds `id` in the innermost scope, shadowing any outer binding
+    void bind(SymbolId id, ValueBinding binding);
+
+    std::optional<ValueBinding> get(SymbolId id) const;
+
+private:
+    std::unordered_map<std::string, SymbolId> symbol_ids;
+
+    /// Innermost binding of every symbol, indexed by its id
+    std::vector<std::optional<ValueBinding>> bindings;
+
+    /// For every open scope, the bindings it shadowed (in order)
+    std::vector<std::vector<std::pair<SymbolId, std::optional<ValueBinding>>>> scopes;
+};
+
+#endif